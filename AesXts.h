@@ -0,0 +1,266 @@
+/**
+ * @file AesXts.h
+ * @brief Заголовочный файл шифрования образов AES-256-XTS на инструкциях AES-NI.
+ */
+
+#ifndef AESXTS_H_INCLUDED
+#define AESXTS_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include "BlockFile.h"
+#include "SectorPolicy.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <cpuid.h>
+#endif // __linux__
+
+#if defined(__GNUC__)
+#define AES_TARGET __attribute__((target("aes,sse2")))
+#else
+#define AES_TARGET
+#endif
+
+constexpr uint64_t XTS_UNIT = SECTOR_SIZE;   ///< Размер единицы данных XTS (номер сектора файла — tweak).
+constexpr size_t XTS_KEY_BYTES = 64;         ///< Размер ключевого файла: два ключа AES-256.
+
+/**
+ * @class AesXts
+ * @brief Шифрование AES-256-XTS (IEEE 1619) секторов по 512 байт.
+ *
+ * Tweak — номер сектора в выходном файле (как plain64 в dm-crypt), поэтому любой
+ * сектор расшифровывается независимо и образ доступен для чтения с произвольного
+ * смещения. Блоки обрабатываются по четыре за раз, чтобы загрузить конвейер AES-NI.
+ * Объект после SetKey только читается и может использоваться из нескольких потоков.
+ */
+class AesXts
+{
+public:
+    AesXts() {};
+
+    /**
+     * @brief Проверяет поддержку AES-NI процессором.
+     */
+    static bool Supported();
+
+    /**
+     * @brief Устанавливает ключ.
+     * @param key 64 байта: ключ данных и ключ tweak (должны различаться).
+     * @return false, если ключи совпадают или процессор не поддерживает AES-NI.
+     */
+    AES_TARGET bool SetKey(const unsigned char* key);
+
+    /**
+     * @brief Читает ключ из ключевого файла (ровно 64 байта).
+     * @return false, если файл не прочитан или ключ некорректен.
+     */
+    bool LoadKeyFile(const PathString& path);
+
+    /**
+     * @brief Шифрует данные на месте.
+     * @param data Данные.
+     * @param len Длина, кратная XTS_UNIT.
+     * @param offset Смещение данных в выходном файле, кратное XTS_UNIT.
+     * @return false, если длина или смещение не кратны XTS_UNIT (данные не изменяются).
+     */
+    bool Encrypt(unsigned char* data, uint64_t len, uint64_t offset) const { return Process(data, len, offset, true); };
+
+    /**
+     * @brief Расшифровывает данные на месте. Параметры и результат совпадают с Encrypt.
+     */
+    bool Decrypt(unsigned char* data, uint64_t len, uint64_t offset) const { return Process(data, len, offset, false); };
+
+private:
+    __m128i encKeys[15];     ///< Раунды ключа данных (шифрование).
+    __m128i decKeys[15];     ///< Раунды ключа данных (расшифрование).
+    __m128i tweakKeys[15];   ///< Раунды ключа tweak.
+
+    AES_TARGET static void ExpandKey(const unsigned char* key, __m128i* rounds);
+    AES_TARGET bool Process(unsigned char* data, uint64_t len, uint64_t offset, bool encrypt) const;
+};
+
+/**
+ * @class DecryptingSource
+ * @brief Источник, расшифровывающий зашифрованный DD-образ при чтении с любого смещения.
+ */
+class DecryptingSource : public BlockSource
+{
+public:
+    DecryptingSource(BlockSource& s, const AesXts& c) : source(s), cipher(c) {};
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override
+    {
+        // Чтение расширяется до целых единиц XTS
+        uint64_t begin = offset / XTS_UNIT * XTS_UNIT;
+        uint64_t end = (offset + len + XTS_UNIT - 1) / XTS_UNIT * XTS_UNIT;
+        if (begin == offset && end == offset + len) {
+            if (!source.ReadAt(buf, len, offset))
+                return false;
+            return cipher.Decrypt(buf, len, offset);
+        }
+        std::vector<unsigned char> units(end - begin);
+        if (!source.ReadAt(units.data(), units.size(), begin) || !cipher.Decrypt(units.data(), units.size(), begin))
+            return false;
+        memcpy(buf, units.data() + (offset - begin), len);
+        return true;
+    }
+
+    uint64_t Size() override { return source.Size(); };
+
+private:
+    BlockSource& source;     ///< Зашифрованный образ.
+    const AesXts& cipher;    ///< Ключ.
+};
+
+inline bool AesXts::Supported()
+{
+    #ifdef _WIN32
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 25)) != 0;
+    #endif // _WIN32
+
+    #ifdef __linux__
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    return (c & bit_AES) != 0;
+    #endif // __linux__
+}
+
+AES_TARGET inline bool AesXts::SetKey(const unsigned char* key)
+{
+    if (!Supported() || memcmp(key, key + 32, 32) == 0)
+        return false;
+    ExpandKey(key, encKeys);
+    ExpandKey(key + 32, tweakKeys);
+    decKeys[0] = encKeys[14];
+    for (int i = 1; i != 14; i++)
+        decKeys[i] = _mm_aesimc_si128(encKeys[14 - i]);
+    decKeys[14] = encKeys[0];
+    return true;
+}
+
+inline bool AesXts::LoadKeyFile(const PathString& path)
+{
+    BlockFile file;
+    unsigned char key[XTS_KEY_BYTES];
+    if (!file.Open(path, BlockFileMode::Read) || file.Size() != XTS_KEY_BYTES ||
+        !file.ReadAt(key, XTS_KEY_BYTES, 0))
+        return false;
+    bool ok = SetKey(key);
+    memset(key, 0, sizeof(key));
+    return ok;
+}
+
+/**
+ * @brief Шаг расширения ключа AES-256 (четные раунды: rcon, нечетные: подстановка без сдвига).
+ */
+AES_TARGET inline __m128i AesExpandStep(__m128i key, __m128i assist)
+{
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+AES_TARGET inline void AesXts::ExpandKey(const unsigned char* key, __m128i* rk)
+{
+    rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    rk[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+    // aeskeygenassist требует rcon в виде константы, поэтому шаги развернуты
+    rk[2] = AesExpandStep(rk[0], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[1], 0x01), 0xFF));
+    rk[3] = AesExpandStep(rk[1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[2], 0x00), 0xAA));
+    rk[4] = AesExpandStep(rk[2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[3], 0x02), 0xFF));
+    rk[5] = AesExpandStep(rk[3], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[4], 0x00), 0xAA));
+    rk[6] = AesExpandStep(rk[4], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[5], 0x04), 0xFF));
+    rk[7] = AesExpandStep(rk[5], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[6], 0x00), 0xAA));
+    rk[8] = AesExpandStep(rk[6], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[7], 0x08), 0xFF));
+    rk[9] = AesExpandStep(rk[7], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[8], 0x00), 0xAA));
+    rk[10] = AesExpandStep(rk[8], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[9], 0x10), 0xFF));
+    rk[11] = AesExpandStep(rk[9], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[10], 0x00), 0xAA));
+    rk[12] = AesExpandStep(rk[10], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[11], 0x20), 0xFF));
+    rk[13] = AesExpandStep(rk[11], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[12], 0x00), 0xAA));
+    rk[14] = AesExpandStep(rk[12], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[13], 0x40), 0xFF));
+}
+
+/**
+ * @brief Умножает tweak на x в GF(2^128) (порядок байт little-endian, как в IEEE 1619).
+ */
+AES_TARGET inline __m128i XtsNextTweak(__m128i t)
+{
+    __m128i carry = _mm_and_si128(_mm_srai_epi32(t, 31), _mm_set_epi32(0x87, 1, 1, 1));
+    return _mm_xor_si128(_mm_slli_epi32(t, 1), _mm_shuffle_epi32(carry, 0x93));
+}
+
+AES_TARGET inline bool AesXts::Process(unsigned char* data, uint64_t len, uint64_t offset, bool encrypt) const
+{
+    // Неполная единица не может быть зашифрована XTS без кражи шифротекста: оставлять ее открытой нельзя
+    if (len % XTS_UNIT != 0 || offset % XTS_UNIT != 0) {
+        std::cout << "Encryption error: data is not aligned to " << XTS_UNIT << " bytes" << std::endl;
+        return false;
+    }
+    const __m128i* keys = encrypt ? encKeys : decKeys;
+    for (uint64_t unit = 0; unit < len / XTS_UNIT; unit++) {
+        // Начальный tweak: номер сектора, зашифрованный ключом tweak
+        __m128i t = _mm_set_epi64x(0, static_cast<long long>(offset / XTS_UNIT + unit));
+        t = _mm_xor_si128(t, tweakKeys[0]);
+        for (int r = 1; r != 14; r++)
+            t = _mm_aesenc_si128(t, tweakKeys[r]);
+        t = _mm_aesenclast_si128(t, tweakKeys[14]);
+
+        __m128i* p = reinterpret_cast<__m128i*>(data + unit * XTS_UNIT);
+        for (uint64_t b = 0; b < XTS_UNIT / 16; b += 4) {
+            __m128i t0 = t;
+            __m128i t1 = XtsNextTweak(t0);
+            __m128i t2 = XtsNextTweak(t1);
+            __m128i t3 = XtsNextTweak(t2);
+            t = XtsNextTweak(t3);
+
+            __m128i x0 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p + b), t0), keys[0]);
+            __m128i x1 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p + b + 1), t1), keys[0]);
+            __m128i x2 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p + b + 2), t2), keys[0]);
+            __m128i x3 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p + b + 3), t3), keys[0]);
+            if (encrypt) {
+                for (int r = 1; r != 14; r++) {
+                    x0 = _mm_aesenc_si128(x0, keys[r]);
+                    x1 = _mm_aesenc_si128(x1, keys[r]);
+                    x2 = _mm_aesenc_si128(x2, keys[r]);
+                    x3 = _mm_aesenc_si128(x3, keys[r]);
+                }
+                x0 = _mm_aesenclast_si128(x0, keys[14]);
+                x1 = _mm_aesenclast_si128(x1, keys[14]);
+                x2 = _mm_aesenclast_si128(x2, keys[14]);
+                x3 = _mm_aesenclast_si128(x3, keys[14]);
+            }
+            else {
+                for (int r = 1; r != 14; r++) {
+                    x0 = _mm_aesdec_si128(x0, keys[r]);
+                    x1 = _mm_aesdec_si128(x1, keys[r]);
+                    x2 = _mm_aesdec_si128(x2, keys[r]);
+                    x3 = _mm_aesdec_si128(x3, keys[r]);
+                }
+                x0 = _mm_aesdeclast_si128(x0, keys[14]);
+                x1 = _mm_aesdeclast_si128(x1, keys[14]);
+                x2 = _mm_aesdeclast_si128(x2, keys[14]);
+                x3 = _mm_aesdeclast_si128(x3, keys[14]);
+            }
+            _mm_storeu_si128(p + b, _mm_xor_si128(x0, t0));
+            _mm_storeu_si128(p + b + 1, _mm_xor_si128(x1, t1));
+            _mm_storeu_si128(p + b + 2, _mm_xor_si128(x2, t2));
+            _mm_storeu_si128(p + b + 3, _mm_xor_si128(x3, t3));
+        }
+    }
+    return true;
+}
+
+#endif // AESXTS_H_INCLUDED
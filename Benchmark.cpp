@@ -0,0 +1,259 @@
+/**
+ * @file Benchmark.cpp
+ * @brief Микробенчмарки базовых операций: поиск нулевых зерен, хэширование зерен,
+ * позиционный ввод-вывод BlockFile и вызов логгера.
+ *
+ * Результаты выводятся в stdout в формате JSON, ход выполнения — в stderr.
+ * Запуск: `Benchmark [--dir <каталог>]... [--min-time <секунды>] [--filter <подстрока>]`.
+ * Каталогов может быть несколько (например, tmpfs и обычный диск); по умолчанию
+ * в Linux это /dev/shm и текущий каталог. Страничный кэш между проходами не сбрасывается.
+ * Сборка: `g++ -std=c++17 -O2 -pthread Benchmark.cpp -o Benchmark`.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include "BlockFile.h"
+#include "BufferPool.h"
+#include "GrainHash.h"
+#include "logger.h"
+
+/**
+ * @brief Результат одного бенчмарка.
+ */
+struct BenchResult
+{
+    std::string name;            ///< Имя вида `группа/вариант`.
+    std::string params;          ///< Параметры в виде JSON-объекта.
+    uint64_t iterations = 0;     ///< Количество выполненных операций.
+    double nsPerOp = 0;          ///< Среднее время операции, нс.
+    uint64_t bytesPerOp = 0;     ///< Объем данных одной операции (0 — не имеет смысла).
+};
+
+/**
+ * @brief Настройки запуска.
+ */
+struct BenchConfig
+{
+    std::vector<std::filesystem::path> dirs;  ///< Каталоги для файловых бенчмарков.
+    double minSeconds = 0.5;                  ///< Минимальное время измерения одного варианта.
+    std::string filter;                       ///< Запускаются только имена, содержащие подстроку.
+};
+
+static volatile uint64_t benchSink = 0;   ///< Не дает компилятору выбросить измеряемый код.
+
+/**
+ * @brief Измеряет операцию.
+ *
+ * Количество повторов удваивается, пока серия не займет не меньше `minSeconds`,
+ * поэтому часы опрашиваются один раз на серию и не влияют на короткие операции.
+ *
+ * @param config Настройки запуска.
+ * @param results Список, в который добавляется результат.
+ * @param name Имя бенчмарка.
+ * @param params Параметры в виде JSON-объекта.
+ * @param bytesPerOp Объем данных одной операции.
+ * @param body Операция; возвращает значение, которое учитывается в benchSink.
+ */
+template<class Body>
+void Measure(const BenchConfig& config, std::vector<BenchResult>& results, const std::string& name,
+             const std::string& params, uint64_t bytesPerOp, Body&& body)
+{
+    if (!config.filter.empty() && name.find(config.filter) == std::string::npos)
+        return;
+    std::cerr << name << " " << params << std::endl;
+
+    benchSink = benchSink + body();   // Прогрев
+    uint64_t count = 1;
+    double elapsed = 0;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i != count; i++)
+            benchSink = benchSink + body();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= config.minSeconds)
+            break;
+        count *= 2;
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.params = params;
+    r.iterations = count;
+    r.nsPerOp = elapsed * 1e9 / count;
+    r.bytesPerOp = bytesPerOp;
+    results.push_back(r);
+}
+
+/**
+ * @brief Поиск нулевых зерен: сравнение буфера с самим собой со сдвигом
+ * (ThreadedGrains, DedupGrains) и с нулевым буфером.
+ * Буфер нулевой, поэтому просматривается целиком — худший случай.
+ */
+void BenchZeroDetect(const BenchConfig& config, std::vector<BenchResult>& results)
+{
+    for (uint64_t bytes : { 4096ull, 65536ull, 1048576ull, 16777216ull }) {
+        PooledBuffer grain = BufferPool::Shared().Acquire(bytes);
+        memset(grain.Data(), 0, bytes);
+        std::vector<unsigned char> zeros(bytes, 0);
+        std::string params = "{\"bytes\":" + std::to_string(bytes) + "}";
+
+        Measure(config, results, "zero_detect/memcmp_self", params, bytes, [&] {
+            unsigned char* g = grain.Data();
+            return static_cast<uint64_t>(g[0] == 0 && memcmp(g, g + 1, bytes - 1) == 0);
+        });
+        Measure(config, results, "zero_detect/memcmp_zeros", params, bytes, [&] {
+            return static_cast<uint64_t>(memcmp(grain.Data(), zeros.data(), bytes) == 0);
+        });
+    }
+}
+
+/**
+ * @brief Хэширование зерен (GrainHash64 — дедупликация и манифест, GrainHashStream — хэш потока).
+ */
+void BenchGrainHash(const BenchConfig& config, std::vector<BenchResult>& results)
+{
+    for (uint64_t bytes : { 4096ull, 65536ull, 1048576ull }) {
+        PooledBuffer grain = BufferPool::Shared().Acquire(bytes);
+        for (uint64_t i = 0; i != bytes; i++)
+            grain.Data()[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+        std::string params = "{\"bytes\":" + std::to_string(bytes) + "}";
+
+        Measure(config, results, "hash/grain_hash64", params, bytes, [&] {
+            return GrainHash64(grain.Data(), bytes);
+        });
+        Measure(config, results, "hash/grain_hash_stream", params, bytes, [&] {
+            GrainHashStream stream;
+            for (uint64_t pos = 0; pos < bytes; pos += 4096)
+                stream.Update(grain.Data() + pos, 4096);
+            return stream.Digest();
+        });
+    }
+}
+
+/**
+ * @brief Пропускная способность BlockFile при разных размерах буфера.
+ *
+ * Одна операция — запись или чтение файла размером 64 МиБ целиком.
+ */
+void BenchFileIO(const BenchConfig& config, std::vector<BenchResult>& results)
+{
+    const uint64_t fileBytes = 64ull * 1024 * 1024;
+    for (const std::filesystem::path& dir : config.dirs) {
+        std::filesystem::path path = dir / "benchmark_io.bin";
+        #ifdef _WIN32
+        PathString blockPath = path.wstring();
+        #endif // _WIN32
+        #ifdef __linux__
+        PathString blockPath = path.string();
+        #endif // __linux__
+
+        for (uint64_t bufBytes : { 4096ull, 65536ull, 1048576ull, 4194304ull, 16777216ull }) {
+            PooledBuffer buffer = BufferPool::Shared().Acquire(bufBytes);
+            memset(buffer.Data(), 0x5A, bufBytes);
+            std::string params = "{\"dir\":\"" + dir.generic_string() + "\",\"buffer\":" + std::to_string(bufBytes) + "}";
+
+            Measure(config, results, "io/blockfile_write", params, fileBytes, [&] {
+                BlockFile file;
+                if (!file.Open(blockPath, BlockFileMode::Write))
+                    return uint64_t(0);
+                uint64_t done = 0;
+                for (uint64_t pos = 0; pos < fileBytes; pos += bufBytes)
+                    done += file.WriteAt(buffer.Data(), bufBytes, pos) ? bufBytes : 0;
+                return done;
+            });
+            Measure(config, results, "io/blockfile_read", params, fileBytes, [&] {
+                BlockFile file;
+                if (!file.Open(blockPath, BlockFileMode::Read))
+                    return uint64_t(0);
+                uint64_t done = 0;
+                for (uint64_t pos = 0; pos < fileBytes; pos += bufBytes)
+                    done += file.ReadAt(buffer.Data(), bufBytes, pos) ? bufBytes : 0;
+                return done;
+            });
+        }
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+/**
+ * @brief Стоимость одного вызова log_message (открытие, запись и закрытие файла лога).
+ */
+void BenchLogger(const BenchConfig& config, std::vector<BenchResult>& results)
+{
+    Measure(config, results, "logger/log_message", "{}", 0, [] {
+        log_message("INFO", "benchmark message");
+        return uint64_t(1);
+    });
+}
+
+/**
+ * @brief Выводит результаты в формате JSON.
+ */
+void PrintJson(std::ostream& out, const BenchConfig& config, const std::vector<BenchResult>& results)
+{
+    out << "{\n  \"context\": {\"threads\": " << std::thread::hardware_concurrency()
+        << ", \"min_seconds\": " << config.minSeconds << ", \"dirs\": [";
+    for (size_t i = 0; i != config.dirs.size(); i++)
+        out << (i ? ", " : "") << "\"" << config.dirs[i].generic_string() << "\"";
+    out << "]},\n  \"benchmarks\": [";
+    for (size_t i = 0; i != results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"params\": " << r.params
+            << ", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.nsPerOp;
+        if (r.bytesPerOp != 0)
+            out << ", \"bytes_per_second\": " << static_cast<uint64_t>(r.bytesPerOp * 1e9 / r.nsPerOp);
+        out << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dir" && i + 1 < argc)
+            config.dirs.push_back(argv[++i]);
+        else if (arg == "--min-time" && i + 1 < argc)
+            config.minSeconds = std::stod(argv[++i]);
+        else if (arg == "--filter" && i + 1 < argc)
+            config.filter = argv[++i];
+        else {
+            std::cerr << "Usage: Benchmark [--dir <path>]... [--min-time <seconds>] [--filter <substring>]" << std::endl;
+            return 1;
+        }
+    }
+    if (config.dirs.empty()) {
+        #ifdef __linux__
+        if (std::filesystem::is_directory("/dev/shm"))
+            config.dirs.push_back("/dev/shm");
+        #endif // __linux__
+        config.dirs.push_back(std::filesystem::current_path());
+    }
+
+    std::vector<BenchResult> results;
+    BenchZeroDetect(config, results);
+    BenchGrainHash(config, results);
+    BenchFileIO(config, results);
+
+    // Лог пишется в текущий каталог: работаем во временном
+    std::filesystem::path home = std::filesystem::current_path();
+    std::filesystem::path scratch = config.dirs.back() / "benchmark_logs";
+    std::filesystem::create_directories(scratch);
+    std::filesystem::current_path(scratch);
+    BenchLogger(config, results);
+    std::filesystem::current_path(home);
+    std::error_code ec;
+    std::filesystem::remove_all(scratch, ec);
+
+    PrintJson(std::cout, config, results);
+    return 0;
+}
@@ -0,0 +1,797 @@
+/**
+ * @file BlockFile.h
+ * @brief Заголовочный файл для позиционного чтения и записи файлов и дисков.
+ */
+
+#ifndef BLOCKFILE_H_INCLUDED
+#define BLOCKFILE_H_INCLUDED
+
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <locale>
+#include <codecvt>
+#include <vector>
+#include <utility>
+#include "IoStats.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <winioctl.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/uio.h>
+#include <climits>
+#endif // __linux__
+
+constexpr uint64_t CACHE_WINDOW = 16ull * 1024 * 1024;   ///< Окно упреждающей записи и сброса кэша по умолчанию.
+
+#ifdef _WIN32
+typedef std::wstring PathString;  ///< Тип строки пути к файлу (Windows).
+#endif // _WIN32
+
+#ifdef __linux__
+typedef std::string PathString;   ///< Тип строки пути к файлу (Linux).
+#endif // __linux__
+
+/**
+ * @brief Проверяет, что имя файла из метаданных образа не выводит за пределы его директории.
+ *
+ * Допускаются только простые имена: без разделителей каталогов, буквы диска и без `.`/`..`.
+ *
+ * @param name Имя из дескриптора (UTF-8).
+ */
+inline bool IsPlainFileName(const std::string& name)
+{
+    return !name.empty() && name != "." && name != ".." &&
+           name.find_first_of("/\\:") == std::string::npos && name.find('\0') == std::string::npos;
+}
+
+/**
+ * @brief Режим открытия файла.
+ */
+enum class BlockFileMode : int
+{
+    Read = 0,      ///< Только чтение.
+    Write,         ///< Запись с созданием и усечением файла.
+    ReadWrite,     ///< Чтение и запись существующего файла (создаётся при отсутствии).
+};
+
+/**
+ * @class BlockSource
+ * @brief Интерфейс источника данных с произвольным доступом.
+ *
+ * Реализуется файлами, дисками и образами, чтобы движки копирования
+ * могли читать данные по смещению независимо от их происхождения.
+ */
+class BlockSource
+{
+public:
+    virtual ~BlockSource() {};
+
+    /**
+     * @brief Читает ровно `len` байт начиная со смещения `offset`.
+     * @param buf Буфер для данных.
+     * @param len Количество байт для чтения.
+     * @param offset Смещение в байтах от начала источника.
+     * @return true, если прочитано ровно `len` байт.
+     * @return false, если возникла ошибка или достигнут конец источника.
+     */
+    virtual bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) = 0;
+
+    /**
+     * @brief Возвращает размер источника в байтах.
+     */
+    virtual uint64_t Size() = 0;
+
+    /**
+     * @brief Возвращает данные источника без копирования, если они отображены в память.
+     *
+     * Указатель действителен, пока источник открыт. Движки копирования используют его
+     * вместо ReadAt, чтобы не копировать данные в промежуточный буфер. Вызов может ждать
+     * подгрузки страниц, поэтому выполняется внутри TaskScheduler::BlockingScope;
+     * при nullptr участок читается через ReadAt.
+     *
+     * @return Указатель на `len` байт со смещения `offset` или nullptr, если отображения нет
+     *         или его страницы не удалось прочитать.
+     */
+    virtual const unsigned char* View(uint64_t offset, uint64_t len) { (void)offset; (void)len; return nullptr; };
+};
+
+/**
+ * @class BlockFile
+ * @brief Класс для позиционного ввода-вывода.
+ *
+ * В отличие от Reader и Writer не хранит текущую позицию: каждая операция
+ * выполняется по явному смещению (pread/pwrite в Linux, OVERLAPPED в Windows),
+ * поэтому один объект можно безопасно использовать из нескольких потоков.
+ */
+class BlockFile : public BlockSource
+{
+private:
+    #ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE; ///< Хэндл файла или диска.
+    #endif // _WIN32
+
+    #ifdef __linux__
+    int fd = -1;                              ///< Файловый дескриптор.
+    #endif // __linux__
+
+    /**
+     * @brief Диапазон файла, затронутый операциями с момента последнего сброса.
+     */
+    struct CacheRange
+    {
+        uint64_t begin = UINT64_MAX;          ///< Начало диапазона.
+        uint64_t end = 0;                     ///< Конец диапазона.
+        uint64_t bytes = 0;                   ///< Объем операций в диапазоне.
+
+        void Add(uint64_t offset, uint64_t len) {
+            begin = offset < begin ? offset : begin;
+            end = offset + len > end ? offset + len : end;
+            bytes += len;
+        }
+    };
+
+    uint64_t cacheWindow = 0;                 ///< Окно управления кэшем (0 — выключено).
+    std::mutex cacheMtx;                      ///< Защищает диапазоны.
+    CacheRange readRange;                     ///< Прочитано с последнего сброса.
+    CacheRange writeRange;                    ///< Записано с последнего запуска записи.
+    CacheRange flushingRange;                 ///< Диапазон, запись которого уже запущена.
+
+    IoStats* stats = nullptr;                 ///< Статистика задержек (nullptr — не измеряется).
+    uint64_t preallocEnd = 0;                 ///< Конец зарезервированного места (см. Preallocate).
+
+    /**
+     * @brief Учитывает операцию и при заполнении окна сбрасывает кэш (см. SetCacheHygiene).
+     */
+    void TrackCache(uint64_t offset, uint64_t len, bool write);
+
+public:
+
+    BlockFile() {};
+
+    ~BlockFile() { Close(); };
+
+    BlockFile(const BlockFile&) = delete;
+    BlockFile& operator=(const BlockFile&) = delete;
+
+    /**
+     * @brief Открывает файл или диск.
+     * @param path Путь к файлу или имя устройства.
+     * @param mode Режим открытия.
+     * @return true, если файл успешно открыт.
+     * @return false, если возникла ошибка.
+     */
+    bool Open(const PathString& path, BlockFileMode mode);
+
+    #ifdef __linux__
+    /**
+     * @brief Открывает файл, путь к которому задан широкой строкой (Linux).
+     */
+    bool Open(const std::wstring& path, BlockFileMode mode) { return Open(WCharToString(path), mode); };
+    #endif // __linux__
+
+    /**
+     * @brief Закрывает файл, если он был открыт.
+     */
+    void Close();
+
+    /**
+     * @brief Проверяет, открыт ли файл.
+     */
+    bool IsOpen() const;
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    /**
+     * @brief Записывает ровно `len` байт по смещению `offset`.
+     * @param buf Буфер с данными.
+     * @param len Количество байт для записи.
+     * @param offset Смещение в байтах от начала файла.
+     * @return true, если все данные записаны.
+     * @return false, если возникла ошибка.
+     */
+    bool WriteAt(const unsigned char* buf, uint64_t len, uint64_t offset);
+
+    /**
+     * @brief Записывает несколько буферов в файл подряд, начиная со смещения `offset`.
+     *
+     * Буферы, соседние в памяти, склеиваются. В Linux данные уходят сборной записью
+     * pwritev (пачками по IOV_MAX буферов), в Windows — одним WriteAt на каждый
+     * непрерывный в памяти участок.
+     *
+     * @param parts Пары (данные, длина) в порядке записи.
+     * @param offset Смещение первого буфера в байтах.
+     * @return true, если все данные записаны.
+     */
+    bool WriteGatherAt(const std::vector<std::pair<const unsigned char*, uint64_t>>& parts, uint64_t offset);
+
+    /**
+     * @brief Возвращает размер файла или блочного устройства в байтах.
+     */
+    uint64_t Size() override;
+
+    /**
+     * @brief Устанавливает размер файла. Новая область не занимает места на диске.
+     * @param size Новый размер в байтах.
+     */
+    bool Truncate(uint64_t size);
+
+    /**
+     * @brief Сбрасывает данные файла на носитель (fdatasync / FlushFileBuffers).
+     */
+    bool Sync();
+
+    /**
+     * @brief Возвращает участки файла, содержащие данные (без дыр sparse-файла).
+     *
+     * В Linux участки находятся через lseek(SEEK_DATA / SEEK_HOLE), в Windows —
+     * через FSCTL_QUERY_ALLOCATED_RANGES. Если файловая система не сообщает о дырах
+     * или открыт диск, весь файл считается одним участком данных.
+     *
+     * @param[out] ranges Пары (смещение, длина) в порядке возрастания смещения.
+     * @return true, если дыры определены файловой системой; false, если возвращен весь файл.
+     */
+    bool DataRanges(std::vector<std::pair<uint64_t, uint64_t>>& ranges);
+
+    /**
+     * @brief Помечает файл как sparse (FSCTL_SET_SPARSE в Windows).
+     *
+     * В Linux файлы разрежены изначально, метод ничего не делает.
+     */
+    bool SetSparse();
+
+    /**
+     * @brief Освобождает место под участком файла; участок читается как нули.
+     *
+     * Используется fallocate(FALLOC_FL_PUNCH_HOLE) в Linux (для диска — обнуление
+     * средствами устройства) и FSCTL_SET_ZERO_DATA в Windows. Размер файла не меняется.
+     *
+     * @param offset Начало участка в байтах.
+     * @param len Длина участка в байтах.
+     */
+    bool PunchHole(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Резервирует место под участком файла, не меняя его размер.
+     *
+     * Зарезервированный участок размещается файловой системой одним куском, поэтому
+     * образ, записанный параллельными задачами, не фрагментируется. Используется
+     * fallocate(FALLOC_FL_KEEP_SIZE) в Linux и FileAllocationInfo в Windows.
+     *
+     * @param offset Начало участка в байтах.
+     * @param len Длина участка в байтах.
+     * @return false для дисков и файловых систем без поддержки резервирования.
+     */
+    bool Preallocate(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Освобождает зарезервированное Preallocate место за текущим концом файла.
+     */
+    bool TrimPreallocated();
+
+    /**
+     * @brief Включает управление страничным кэшем при потоковом копировании.
+     *
+     * Используется, когда данные читаются или пишутся один раз и не нужны в кэше.
+     * Для чтения источник помечается как последовательный (POSIX_FADV_SEQUENTIAL),
+     * а каждые `window` прочитанных байт уже прочитанный диапазон удаляется из кэша (POSIX_FADV_DONTNEED).
+     * Для записи каждые `window` записанных байт запускается запись диапазона на диск
+     * (sync_file_range), при следующем окне дожидается его завершения и удаляет из кэша.
+     * Так объем грязных страниц не превышает двух окон и сброс идет равномерно.
+     * В Windows не действует.
+     *
+     * @param window Размер окна в байтах (0 — выключить).
+     */
+    void SetCacheHygiene(uint64_t window = CACHE_WINDOW);
+
+    /**
+     * @brief Возвращает физический размер сектора устройства.
+     *
+     * Для обычных файлов возвращается 512.
+     */
+    uint32_t SectorSize();
+
+    /**
+     * @brief Включает измерение задержек ReadAt, WriteAt и Sync (см. IoStats).
+     * @param s Статистика задания или nullptr. Объект должен жить, пока открыт файл.
+     */
+    void SetStats(IoStats* s) { stats = s; };
+
+    /**
+     * @brief Возвращает статистику, заданную SetStats.
+     */
+    IoStats* GetStats() const { return stats; };
+
+    #ifdef __linux__
+    /**
+     * @brief Возвращает файловый дескриптор (Linux).
+     */
+    int Fd() const { return fd; };
+    #endif // __linux__
+
+    #ifdef _WIN32
+    /**
+     * @brief Возвращает хэндл файла (Windows).
+     */
+    HANDLE Handle() const { return fileHandle; };
+    #endif // _WIN32
+
+    /**
+     * @brief Преобразует строку типа `std::wstring` в строку типа `std::string` (UTF-8).
+     */
+    static std::string WCharToString(const std::wstring& wstr) {
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        return converter.to_bytes(wstr);
+    }
+};
+
+#ifdef __linux__
+
+inline bool BlockFile::Open(const PathString& path, BlockFileMode mode)
+{
+    Close();
+    int flags = O_RDONLY;
+    if (mode == BlockFileMode::Write)
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (mode == BlockFileMode::ReadWrite)
+        flags = O_RDWR | O_CREAT;
+
+    fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+    return fd >= 0;
+}
+
+inline void BlockFile::Close()
+{
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    cacheWindow = 0;
+    preallocEnd = 0;
+    readRange = writeRange = flushingRange = CacheRange();
+}
+
+inline bool BlockFile::IsOpen() const { return fd >= 0; }
+
+inline bool BlockFile::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    IoTimer timer(stats, IoOp::Read, len, offset);
+    const uint64_t start = offset;
+    const uint64_t total = len;
+    while (len > 0) {
+        ssize_t res = pread(fd, buf, len, static_cast<off_t>(offset));
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        buf += res;
+        len -= res;
+        offset += res;
+    }
+    if (cacheWindow != 0)
+        TrackCache(start, total, false);
+    return true;
+}
+
+inline bool BlockFile::WriteAt(const unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    IoTimer timer(stats, IoOp::Write, len, offset);
+    const uint64_t start = offset;
+    const uint64_t total = len;
+    while (len > 0) {
+        ssize_t res = pwrite(fd, buf, len, static_cast<off_t>(offset));
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        buf += res;
+        len -= res;
+        offset += res;
+    }
+    if (cacheWindow != 0)
+        TrackCache(start, total, true);
+    return true;
+}
+
+inline bool BlockFile::WriteGatherAt(const std::vector<std::pair<const unsigned char*, uint64_t>>& parts, uint64_t offset)
+{
+    std::vector<struct iovec> iov;
+    uint64_t total = 0;
+    for (const auto& part : parts) {
+        if (part.second == 0)
+            continue;
+        if (!iov.empty() && static_cast<unsigned char*>(iov.back().iov_base) + iov.back().iov_len == part.first)
+            iov.back().iov_len += part.second;
+        else
+            iov.push_back({ const_cast<unsigned char*>(part.first), part.second });
+        total += part.second;
+    }
+    if (iov.size() == 1)
+        return WriteAt(static_cast<const unsigned char*>(iov[0].iov_base), total, offset);
+
+    IoTimer timer(stats, IoOp::Write, total, offset);
+    const uint64_t start = offset;
+    size_t next = 0;
+    while (next != iov.size()) {
+        int count = iov.size() - next < IOV_MAX ? static_cast<int>(iov.size() - next) : IOV_MAX;
+        ssize_t res = pwritev(fd, &iov[next], count, static_cast<off_t>(offset));
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        offset += res;
+        // Частичная запись: пропускаем записанные буферы и сдвигаем начало недописанного
+        while (res > 0 && static_cast<uint64_t>(res) >= iov[next].iov_len) {
+            res -= iov[next].iov_len;
+            next++;
+        }
+        if (res > 0) {
+            iov[next].iov_base = static_cast<unsigned char*>(iov[next].iov_base) + res;
+            iov[next].iov_len -= res;
+        }
+    }
+    if (cacheWindow != 0)
+        TrackCache(start, total, true);
+    return true;
+}
+
+inline void BlockFile::SetCacheHygiene(uint64_t window)
+{
+    cacheWindow = window;
+    if (window != 0)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+inline void BlockFile::TrackCache(uint64_t offset, uint64_t len, bool write)
+{
+    CacheRange start;   // Диапазон, запись которого нужно запустить
+    CacheRange drop;    // Диапазон, который нужно дождаться и убрать из кэша
+    {
+        std::lock_guard<std::mutex> lock(cacheMtx);
+        CacheRange& range = write ? writeRange : readRange;
+        range.Add(offset, len);
+        if (range.bytes < cacheWindow)
+            return;
+        if (write) {
+            drop = flushingRange;
+            flushingRange = range;
+            start = range;
+        }
+        else {
+            drop = range;
+        }
+        range = CacheRange();
+    }
+
+    // Системные вызовы выполняются без блокировки: ожидание записи тормозит только этот поток
+    if (start.bytes != 0)
+        sync_file_range(fd, start.begin, start.end - start.begin, SYNC_FILE_RANGE_WRITE);
+    if (drop.bytes != 0) {
+        if (write)
+            sync_file_range(fd, drop.begin, drop.end - drop.begin,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, drop.begin, drop.end - drop.begin, POSIX_FADV_DONTNEED);
+    }
+}
+
+inline uint64_t BlockFile::Size()
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return 0;
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t bytes = 0;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0)
+            return 0;
+        return bytes;
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+inline bool BlockFile::Truncate(uint64_t size)
+{
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+inline bool BlockFile::Sync()
+{
+    IoTimer timer(stats, IoOp::Sync);
+    return fdatasync(fd) == 0;
+}
+
+inline bool BlockFile::DataRanges(std::vector<std::pair<uint64_t, uint64_t>>& ranges)
+{
+    ranges.clear();
+    const uint64_t size = Size();
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        uint64_t pos = 0;
+        while (pos < size) {
+            off_t data = lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+            if (data < 0 && errno == ENXIO)
+                return true;   // До конца файла только дыра
+            if (data < 0)
+                break;
+            off_t hole = lseek(fd, data, SEEK_HOLE);
+            if (hole < 0)
+                break;
+            ranges.emplace_back(static_cast<uint64_t>(data), static_cast<uint64_t>(hole - data));
+            pos = static_cast<uint64_t>(hole);
+        }
+        if (pos >= size)
+            return true;
+    }
+
+    // SEEK_DATA не поддерживается (или это диск): данные везде
+    ranges.clear();
+    if (size != 0)
+        ranges.emplace_back(0, size);
+    return false;
+}
+
+inline bool BlockFile::SetSparse()
+{
+    return true;
+}
+
+inline bool BlockFile::PunchHole(uint64_t offset, uint64_t len)
+{
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                     static_cast<off_t>(offset), static_cast<off_t>(len)) == 0;
+}
+
+inline bool BlockFile::Preallocate(uint64_t offset, uint64_t len)
+{
+    struct stat st;
+    if (len == 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(len)) != 0)
+        return false;
+    if (offset + len > preallocEnd)
+        preallocEnd = offset + len;
+    return true;
+}
+
+inline bool BlockFile::TrimPreallocated()
+{
+    uint64_t end = Size();
+    if (preallocEnd <= end)
+        return true;
+    // Место за концом файла с FALLOC_FL_KEEP_SIZE само не освобождается, а дыры за концом
+    // файла ext4 не пробивает: освобождает только усечение (в том числе до того же размера)
+    preallocEnd = 0;
+    return ftruncate(fd, static_cast<off_t>(end)) == 0;
+}
+
+inline uint32_t BlockFile::SectorSize()
+{
+    struct stat st;
+    unsigned int physical = 0;
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode) && ioctl(fd, BLKPBSZGET, &physical) == 0 && physical >= 512)
+        return physical;
+    return 512;
+}
+
+#endif // __linux__
+
+#ifdef _WIN32
+
+inline bool BlockFile::Open(const PathString& path, BlockFileMode mode)
+{
+    Close();
+    DWORD access = GENERIC_READ;
+    DWORD disposition = OPEN_EXISTING;
+    if (mode == BlockFileMode::Write) {
+        access = GENERIC_WRITE;
+        disposition = CREATE_ALWAYS;
+    }
+    else if (mode == BlockFileMode::ReadWrite) {
+        access = GENERIC_READ | GENERIC_WRITE;
+        disposition = OPEN_ALWAYS;
+    }
+
+    fileHandle = CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+    return fileHandle != INVALID_HANDLE_VALUE;
+}
+
+inline void BlockFile::Close()
+{
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+    preallocEnd = 0;
+}
+
+inline bool BlockFile::IsOpen() const { return fileHandle != INVALID_HANDLE_VALUE; }
+
+inline bool BlockFile::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    IoTimer timer(stats, IoOp::Read, len, offset);
+    while (len > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD done = 0;
+        if (!ReadFile(fileHandle, buf, chunk, &done, &ov) || done == 0)
+            return false;
+        buf += done;
+        len -= done;
+        offset += done;
+    }
+    return true;
+}
+
+inline bool BlockFile::WriteAt(const unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    IoTimer timer(stats, IoOp::Write, len, offset);
+    while (len > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD done = 0;
+        if (!WriteFile(fileHandle, buf, chunk, &done, &ov) || done == 0)
+            return false;
+        buf += done;
+        len -= done;
+        offset += done;
+    }
+    return true;
+}
+
+inline uint64_t BlockFile::Size()
+{
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(fileHandle, &size))
+        return static_cast<uint64_t>(size.QuadPart);
+
+    // Для дисков размер берётся через IOCTL
+    GET_LENGTH_INFORMATION info;
+    DWORD ret = 0;
+    if (DeviceIoControl(fileHandle, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &info, sizeof(info), &ret, NULL))
+        return static_cast<uint64_t>(info.Length.QuadPart);
+    return 0;
+}
+
+inline bool BlockFile::Truncate(uint64_t size)
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = static_cast<LONGLONG>(size);
+    return SetFilePointerEx(fileHandle, pos, NULL, FILE_BEGIN) && SetEndOfFile(fileHandle);
+}
+
+inline bool BlockFile::Sync()
+{
+    IoTimer timer(stats, IoOp::Sync);
+    return FlushFileBuffers(fileHandle) != 0;
+}
+
+inline bool BlockFile::DataRanges(std::vector<std::pair<uint64_t, uint64_t>>& ranges)
+{
+    ranges.clear();
+    const uint64_t size = Size();
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = 0;
+    query.Length.QuadPart = static_cast<LONGLONG>(size);
+    std::vector<FILE_ALLOCATED_RANGE_BUFFER> found(256);
+
+    while (size != 0) {
+        DWORD ret = 0;
+        BOOL done = DeviceIoControl(fileHandle, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+                                    found.data(), static_cast<DWORD>(found.size() * sizeof(found[0])), &ret, NULL);
+        if (!done && GetLastError() != ERROR_MORE_DATA)
+            break;
+        size_t count = ret / sizeof(found[0]);
+        for (size_t i = 0; i != count; i++)
+            ranges.emplace_back(static_cast<uint64_t>(found[i].FileOffset.QuadPart),
+                                static_cast<uint64_t>(found[i].Length.QuadPart));
+        if (done)
+            return true;
+        if (count == 0)
+            break;
+        // Продолжаем с конца последнего полученного участка
+        LONGLONG next = found[count - 1].FileOffset.QuadPart + found[count - 1].Length.QuadPart;
+        query.FileOffset.QuadPart = next;
+        query.Length.QuadPart = static_cast<LONGLONG>(size) - next;
+    }
+
+    // Файловая система не поддерживает запрос (или это диск): данные везде
+    ranges.clear();
+    if (size != 0)
+        ranges.emplace_back(0, size);
+    return false;
+}
+
+inline bool BlockFile::SetSparse()
+{
+    DWORD ret = 0;
+    return DeviceIoControl(fileHandle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret, NULL) != 0;
+}
+
+inline bool BlockFile::PunchHole(uint64_t offset, uint64_t len)
+{
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + len);
+    DWORD ret = 0;
+    return DeviceIoControl(fileHandle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &ret, NULL) != 0;
+}
+
+inline bool BlockFile::Preallocate(uint64_t offset, uint64_t len)
+{
+    if (len == 0 || GetFileType(fileHandle) != FILE_TYPE_DISK)
+        return false;
+    if (offset + len <= preallocEnd)
+        return true;
+    // Размер выделенного места задается целиком: уменьшать его нельзя
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(offset + len);
+    if (!SetFileInformationByHandle(fileHandle, FileAllocationInfo, &info, sizeof(info)))
+        return false;
+    preallocEnd = offset + len;
+    return true;
+}
+
+inline bool BlockFile::TrimPreallocated()
+{
+    if (preallocEnd == 0)
+        return true;
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(Size());
+    preallocEnd = 0;
+    return SetFileInformationByHandle(fileHandle, FileAllocationInfo, &info, sizeof(info)) != 0;
+}
+
+inline bool BlockFile::WriteGatherAt(const std::vector<std::pair<const unsigned char*, uint64_t>>& parts, uint64_t offset)
+{
+    size_t i = 0;
+    while (i != parts.size()) {
+        // Соседние в памяти буферы записываются одной операцией
+        const unsigned char* buf = parts[i].first;
+        uint64_t len = parts[i].second;
+        for (i++; i != parts.size() && buf + len == parts[i].first; i++)
+            len += parts[i].second;
+        if (len != 0 && !WriteAt(buf, len, offset))
+            return false;
+        offset += len;
+    }
+    return true;
+}
+
+inline void BlockFile::SetCacheHygiene(uint64_t)
+{
+    // Аналогов posix_fadvise и sync_file_range для открытого хэндла нет
+}
+
+inline void BlockFile::TrackCache(uint64_t, uint64_t, bool)
+{
+}
+
+inline uint32_t BlockFile::SectorSize()
+{
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageAccessAlignmentProperty;
+    query.QueryType = PropertyStandardQuery;
+    STORAGE_ACCESS_ALIGNMENT_DESCRIPTOR alignment = {};
+    DWORD ret = 0;
+    if (DeviceIoControl(fileHandle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                        &alignment, sizeof(alignment), &ret, NULL) && alignment.BytesPerPhysicalSector >= 512)
+        return alignment.BytesPerPhysicalSector;
+    return 512;
+}
+
+#endif // _WIN32
+
+#endif // BLOCKFILE_H_INCLUDED
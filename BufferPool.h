@@ -0,0 +1,344 @@
+/**
+ * @file BufferPool.h
+ * @brief Заголовочный файл пула буферов ввода-вывода, переиспользуемых между этапами и заданиями.
+ */
+
+#ifndef BUFFERPOOL_H_INCLUDED
+#define BUFFERPOOL_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif // __linux__
+
+class BufferPool;
+
+/**
+ * @class PooledBuffer
+ * @brief Буфер, взятый из пула. При уничтожении возвращается в пул.
+ */
+class PooledBuffer
+{
+public:
+    PooledBuffer() {};
+
+    PooledBuffer(PooledBuffer&& other) noexcept { *this = std::move(other); };
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    ~PooledBuffer() { Release(); };
+
+    /**
+     * @brief Возвращает указатель на данные (выровнен по странице).
+     */
+    unsigned char* Data() const { return data; };
+
+    /**
+     * @brief Возвращает запрошенный размер буфера в байтах.
+     */
+    uint64_t Size() const { return size; };
+
+    /**
+     * @brief Возвращает буфер в пул досрочно.
+     */
+    void Release();
+
+private:
+    friend class BufferPool;
+
+    BufferPool* pool = nullptr;   ///< Пул-владелец.
+    unsigned char* data = nullptr;///< Данные.
+    uint64_t size = 0;            ///< Запрошенный размер.
+    unsigned sizeClass = 0;       ///< Класс размера (log2 размера блока).
+    unsigned node = 0;            ///< Узел NUMA, на котором размещен блок.
+};
+
+/**
+ * @class BufferPool
+ * @brief Пул выровненных блоков фиксированных размеров.
+ *
+ * Размер блока — степень двойки от 4 КиБ, запрос округляется вверх до ближайшего класса.
+ * Блоки выделяются у ОС (mmap / VirtualAlloc) и после использования не освобождаются,
+ * а возвращаются в список свободных, поэтому в установившемся режиме копирование
+ * не обращается к куче. Блоки от 2 МиБ выравниваются по 2 МиБ и размещаются на больших
+ * страницах (MAP_HUGETLB или прозрачные huge pages, MEM_LARGE_PAGES в Windows), что
+ * уменьшает промахи TLB. Списки свободных блоков ведутся отдельно для каждого узла NUMA;
+ * новый блок заполняется нулями потоком, который его запросил, и поэтому размещается
+ * в памяти его узла.
+ */
+class BufferPool
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param useHugePages Использовать большие страницы для блоков от 2 МиБ.
+     * @param maxCached Максимальный объем свободных блоков в пуле, сверх него блоки возвращаются ОС.
+     */
+    explicit BufferPool(bool useHugePages = true, uint64_t maxCached = 1ull << 30)
+        : hugePages(useHugePages), cacheLimit(maxCached)
+    {
+        nodes = NodeCount();
+        lists.resize(nodes * CLASS_COUNT);
+        for (auto& l : lists)
+            l.reset(new FreeList());
+    }
+
+    ~BufferPool()
+    {
+        for (size_t i = 0; i != lists.size(); i++)
+            for (unsigned char* slab : lists[i]->slabs)
+                Unmap(slab, 1ull << (i % CLASS_COUNT + MIN_SHIFT));
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /**
+     * @brief Берет из пула буфер не меньше `bytes` байт.
+     *
+     * Содержимое переиспользованного буфера не очищается.
+     * @return Пустой буфер (Data() == nullptr), если память выделить не удалось.
+     */
+    PooledBuffer Acquire(uint64_t bytes);
+
+    /**
+     * @brief Количество блоков, выделенных у ОС за все время.
+     */
+    uint64_t GetMappedSlabs() const { return mappedSlabs; };
+
+    /**
+     * @brief Общий пул процесса, которым пользуются все движки копирования.
+     */
+    static BufferPool& Shared()
+    {
+        static BufferPool shared;
+        return shared;
+    }
+
+private:
+    friend class PooledBuffer;
+
+    static constexpr unsigned MIN_SHIFT = 12;                   ///< Минимальный блок 4 КиБ.
+    static constexpr unsigned CLASS_COUNT = 40 - MIN_SHIFT;     ///< Классы до 1 ТиБ.
+    static constexpr uint64_t HUGE_PAGE = 2ull * 1024 * 1024;   ///< Размер большой страницы.
+
+    /**
+     * @brief Список свободных блоков одного класса на одном узле.
+     */
+    struct FreeList
+    {
+        std::mutex mtx;                       ///< Защищает список.
+        std::vector<unsigned char*> slabs;    ///< Свободные блоки.
+    };
+
+    bool hugePages;                                 ///< Использовать большие страницы.
+    uint64_t cacheLimit;                            ///< Предел объема свободных блоков.
+    unsigned nodes = 1;                             ///< Количество узлов NUMA.
+    std::vector<std::unique_ptr<FreeList>> lists;   ///< Списки [узел * CLASS_COUNT + класс].
+    std::atomic<uint64_t> cachedBytes{0};           ///< Объем свободных блоков.
+    std::atomic<uint64_t> mappedSlabs{0};           ///< Блоков выделено у ОС.
+
+    void Return(PooledBuffer& buf);
+
+    /**
+     * @brief Выделяет блок у ОС на заданном узле.
+     * @param bytes Размер блока (степень двойки).
+     * @param node Узел NUMA.
+     */
+    unsigned char* Map(uint64_t bytes, unsigned node);
+
+    void Unmap(unsigned char* p, uint64_t bytes);
+
+    static unsigned NodeCount();
+
+    static unsigned CurrentNode();
+};
+
+inline PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+    if (this != &other) {
+        Release();
+        pool = other.pool;
+        data = other.data;
+        size = other.size;
+        sizeClass = other.sizeClass;
+        node = other.node;
+        other.pool = nullptr;
+        other.data = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+inline void PooledBuffer::Release()
+{
+    if (pool != nullptr && data != nullptr)
+        pool->Return(*this);
+    pool = nullptr;
+    data = nullptr;
+    size = 0;
+}
+
+inline PooledBuffer BufferPool::Acquire(uint64_t bytes)
+{
+    PooledBuffer buf;
+    unsigned cls = MIN_SHIFT;
+    while ((1ull << cls) < bytes && cls + 1 < MIN_SHIFT + CLASS_COUNT)
+        cls++;
+    if ((1ull << cls) < bytes)
+        return buf;
+
+    unsigned node = CurrentNode() % nodes;
+    FreeList& list = *lists[node * CLASS_COUNT + (cls - MIN_SHIFT)];
+    {
+        std::lock_guard<std::mutex> lock(list.mtx);
+        if (!list.slabs.empty()) {
+            buf.data = list.slabs.back();
+            list.slabs.pop_back();
+            cachedBytes -= 1ull << cls;
+        }
+    }
+
+    if (buf.data == nullptr) {
+        buf.data = Map(1ull << cls, node);
+        if (buf.data == nullptr)
+            return buf;
+        mappedSlabs++;
+        // Первое касание из запросившего потока размещает страницы на его узле
+        memset(buf.data, 0, 1ull << cls);
+    }
+
+    buf.pool = this;
+    buf.size = bytes;
+    buf.sizeClass = cls;
+    buf.node = node;
+    return buf;
+}
+
+inline void BufferPool::Return(PooledBuffer& buf)
+{
+    uint64_t bytes = 1ull << buf.sizeClass;
+    if (cachedBytes + bytes > cacheLimit) {
+        Unmap(buf.data, bytes);
+        return;
+    }
+
+    FreeList& list = *lists[buf.node * CLASS_COUNT + (buf.sizeClass - MIN_SHIFT)];
+    std::lock_guard<std::mutex> lock(list.mtx);
+    list.slabs.push_back(buf.data);
+    cachedBytes += bytes;
+}
+
+#ifdef __linux__
+
+inline unsigned char* BufferPool::Map(uint64_t bytes, unsigned)
+{
+    if (hugePages && bytes >= HUGE_PAGE) {
+        // Явные большие страницы, если администратор их зарезервировал
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return static_cast<unsigned char*>(p);
+
+        // Иначе прозрачные huge pages: область выравнивается по 2 МиБ
+        void* raw = mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return nullptr;
+        uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (start + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        if (aligned != start)
+            munmap(raw, aligned - start);
+        if (start + HUGE_PAGE != aligned)
+            munmap(reinterpret_cast<void*>(aligned + bytes), start + HUGE_PAGE - aligned);
+        madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+        return reinterpret_cast<unsigned char*>(aligned);
+    }
+
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : static_cast<unsigned char*>(p);
+}
+
+inline void BufferPool::Unmap(unsigned char* p, uint64_t bytes)
+{
+    munmap(p, bytes);
+}
+
+inline unsigned BufferPool::NodeCount()
+{
+    unsigned count = 0;
+    struct stat st;
+    while (stat(("/sys/devices/system/node/node" + std::to_string(count)).c_str(), &st) == 0)
+        count++;
+    return count == 0 ? 1 : count;
+}
+
+inline unsigned BufferPool::CurrentNode()
+{
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+    return node;
+}
+
+#endif // __linux__
+
+#ifdef _WIN32
+
+inline unsigned char* BufferPool::Map(uint64_t bytes, unsigned node)
+{
+    SIZE_T large = GetLargePageMinimum();
+    if (hugePages && large != 0 && bytes >= large && bytes % large == 0) {
+        // Требует привилегии SeLockMemoryPrivilege, иначе используются обычные страницы
+        void* p = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+        if (p != NULL)
+            return static_cast<unsigned char*>(p);
+    }
+    void* p = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    return static_cast<unsigned char*>(p);
+}
+
+inline void BufferPool::Unmap(unsigned char* p, uint64_t)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+inline unsigned BufferPool::NodeCount()
+{
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest))
+        return 1;
+    return static_cast<unsigned>(highest) + 1;
+}
+
+inline unsigned BufferPool::CurrentNode()
+{
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    USHORT node = 0;
+    if (!GetNumaProcessorNodeEx(&processor, &node))
+        return 0;
+    return node;
+}
+
+#endif // _WIN32
+
+#endif // BUFFERPOOL_H_INCLUDED
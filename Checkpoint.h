@@ -0,0 +1,306 @@
+/**
+ * @file Checkpoint.h
+ * @brief Заголовочный файл для надежных контрольных точек копирования, согласованных со сбросом данных на диск.
+ */
+
+#ifndef CHECKPOINT_H_INCLUDED
+#define CHECKPOINT_H_INCLUDED
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <locale>
+#include <codecvt>
+#include <cstdio>
+#include <iostream>
+#include "BlockFile.h"
+#include "SectorPolicy.h"
+#include "LogsReadWrite.h"
+
+constexpr uint64_t CHECKPOINT_BYTES = 256ull * 1024 * 1024;   ///< Объем данных между контрольными точками по умолчанию.
+constexpr unsigned CHECKPOINT_SECONDS = 10;                   ///< Интервал между контрольными точками по умолчанию.
+
+/**
+ * @struct CheckpointFields
+ * @brief Поля контрольной точки посекторного копирования.
+ *
+ * Те же поля, что у LogFile для DD, но в обычной (не упакованной) структуре:
+ * строки в упакованной LogFile не выровнены, и обращение к ним — неопределенное поведение.
+ */
+struct CheckpointFields
+{
+    ImageType type = ImageType::DD;   ///< Тип образа.
+    std::wstring disk;                ///< Имя диска.
+    std::wstring serialNum;           ///< Серийный номер диска.
+    std::wstring outFileDir;          ///< Директория выходного файла.
+    std::wstring outFileName;         ///< Имя выходного файла.
+    time_t endTime = 0;               ///< Время фиксации.
+    uint64_t numOfSectorsWriten = 0;  ///< Количество записанных секторов.
+    uint64_t totalSectors = 0;        ///< Общее количество секторов.
+};
+
+/**
+ * @class DurableCheckpoint
+ * @brief Контрольная точка посекторного копирования, которой можно доверять после сбоя питания.
+ *
+ * Копирующие потоки сообщают о каждом записанном участке (Completed), участки могут
+ * завершаться в любом порядке. Контрольная точка хранит только непрерывно записанную
+ * от начала часть. При фиксации сначала выполняется барьер записи (fdatasync выходного
+ * файла), и только потом файл контрольной точки атомарно заменяется новым
+ * (запись во временный файл, fsync, rename). Поэтому записанное в контрольной точке
+ * количество секторов всегда уже лежит на носителе. Фиксация выполняется не чаще,
+ * чем раз в заданный объем данных или интервал времени. После фиксации всего диска
+ * файл удаляется (Remove): контрольная точка есть только у незавершенной копии.
+ *
+ * Формат файла совпадает с логом LogsReadWrite::CreateRawCopyLog (по одному полю в строке).
+ */
+class DurableCheckpoint
+{
+public:
+    /**
+     * @brief Конструктор.
+     *
+     * @param out Выходной файл копирования.
+     * @param path Путь к файлу контрольной точки.
+     * @param base Поля лога (диск, серийный номер, директория, имя, общее количество секторов).
+     * @param startBytes Уже записанная при предыдущих запусках часть в байтах.
+     * @param everyBytes Объем данных между фиксациями.
+     * @param everySeconds Интервал между фиксациями в секундах.
+     */
+    DurableCheckpoint(BlockFile& out, const PathString& path, const CheckpointFields& base, uint64_t startBytes,
+                      uint64_t everyBytes = CHECKPOINT_BYTES, unsigned everySeconds = CHECKPOINT_SECONDS)
+        : writer(out), checkpointPath(path), log(base), watermark(startBytes), committed(startBytes),
+          cadenceBytes(everyBytes), cadence(std::chrono::seconds(everySeconds)),
+          lastCommit(std::chrono::steady_clock::now()) {};
+
+    DurableCheckpoint(const DurableCheckpoint&) = delete;
+    DurableCheckpoint& operator=(const DurableCheckpoint&) = delete;
+
+    /**
+     * @brief Отмечает участок как записанный и при необходимости фиксирует контрольную точку.
+     *
+     * @param offset Смещение участка в байтах.
+     * @param len Длина участка в байтах.
+     * @return false, если фиксация не удалась.
+     */
+    bool Completed(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Немедленно фиксирует контрольную точку.
+     * @return false, если не удалось сбросить данные или записать файл.
+     */
+    bool Commit();
+
+    /**
+     * @brief Удаляет файл контрольной точки завершенной копии.
+     *
+     * Вызывается после Commit, зафиксировавшего весь диск. Удаление переживает сбой
+     * (каталог сбрасывается), поэтому оставшаяся контрольная точка всегда означает
+     * незавершенную копию.
+     * @return false, если файл не удалось удалить.
+     */
+    bool Remove();
+
+    /**
+     * @brief Возвращает количество секторов, гарантированно лежащих на носителе.
+     */
+    uint64_t GetDurableSectors()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return committed / SECTOR_SIZE;
+    }
+
+    /**
+     * @brief Читает файл контрольной точки.
+     *
+     * @param[in] path Путь к файлу.
+     * @param[out] log Прочитанные поля (тип, диск, серийный номер, директория, имя, время, записано, всего).
+     * @return false, если файл отсутствует или поврежден.
+     */
+    static bool Read(const PathString& path, CheckpointFields& log);
+
+private:
+    BlockFile& writer;                ///< Выходной файл.
+    PathString checkpointPath;        ///< Файл контрольной точки.
+    CheckpointFields log;             ///< Поля лога.
+
+    std::mutex mtx;                   ///< Защищает watermark, pending и committed.
+    std::mutex commitMtx;             ///< Одна фиксация одновременно.
+    uint64_t watermark;               ///< Конец непрерывно записанной части.
+    uint64_t committed;               ///< Конец части, зафиксированной в контрольной точке.
+    std::map<uint64_t, uint64_t> pending; ///< Записанные участки за пределами watermark (начало -> конец).
+
+    uint64_t cadenceBytes;            ///< Объем между фиксациями.
+    std::chrono::steady_clock::duration cadence; ///< Интервал между фиксациями.
+    std::chrono::steady_clock::time_point lastCommit; ///< Время последней фиксации.
+
+    /**
+     * @brief Атомарно заменяет файл контрольной точки.
+     */
+    bool WriteAtomic(const std::string& content);
+
+    #ifdef __linux__
+    /**
+     * @brief Сбрасывает каталог файла контрольной точки, чтобы замена или удаление пережили сбой.
+     */
+    bool SyncDirectory();
+    #endif // __linux__
+};
+
+inline bool DurableCheckpoint::Completed(uint64_t offset, uint64_t len)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (offset <= watermark) {
+            watermark = offset + len > watermark ? offset + len : watermark;
+            // Подтягиваем участки, завершившиеся раньше предыдущих
+            auto it = pending.begin();
+            while (it != pending.end() && it->first <= watermark) {
+                watermark = it->second > watermark ? it->second : watermark;
+                it = pending.erase(it);
+            }
+        }
+        else {
+            pending[offset] = offset + len;
+        }
+
+        bool due = watermark - committed >= cadenceBytes ||
+                   (watermark != committed && std::chrono::steady_clock::now() - lastCommit >= cadence);
+        if (!due)
+            return true;
+    }
+    return Commit();
+}
+
+inline bool DurableCheckpoint::Commit()
+{
+    std::unique_lock<std::mutex> commitLock(commitMtx, std::try_to_lock);
+    if (!commitLock.owns_lock())
+        return true;    // Фиксацию уже выполняет другой поток
+
+    // Граница берется до барьера: все участки до нее уже записаны и будут сброшены
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        target = watermark;
+    }
+    IoTimer timer(writer.GetStats(), IoOp::Checkpoint, 0, target);
+
+    if (!writer.Sync()) {
+        std::cout << "Flush error" << std::endl;
+        return false;
+    }
+
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    std::ostringstream content;
+    content << static_cast<int>(log.type) << "\n"
+            << converter.to_bytes(log.disk) << "\n"
+            << converter.to_bytes(log.serialNum) << "\n"
+            << converter.to_bytes(log.outFileDir) << "\n"
+            << converter.to_bytes(log.outFileName) << "\n"
+            << time(nullptr) << "\n"
+            << target / SECTOR_SIZE << "\n"
+            << log.totalSectors << "\n";
+    if (!WriteAtomic(content.str())) {
+        std::cout << "Checkpoint write error" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    committed = target;
+    lastCommit = std::chrono::steady_clock::now();
+    return true;
+}
+
+inline bool DurableCheckpoint::WriteAtomic(const std::string& content)
+{
+    #ifdef _WIN32
+    PathString tmp = checkpointPath + L".tmp";
+    #endif // _WIN32
+    #ifdef __linux__
+    PathString tmp = checkpointPath + ".tmp";
+    #endif // __linux__
+
+    BlockFile file;
+    if (!file.Open(tmp, BlockFileMode::Write) ||
+        !file.WriteAt((const unsigned char*)content.data(), content.size(), 0) ||
+        !file.Sync())
+        return false;
+    file.Close();
+
+    #ifdef _WIN32
+    return MoveFileExW(tmp.c_str(), checkpointPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    #endif // _WIN32
+
+    #ifdef __linux__
+    if (rename(tmp.c_str(), checkpointPath.c_str()) != 0)
+        return false;
+    // Сама замена должна пережить сбой: сбрасываем каталог
+    return SyncDirectory();
+    #endif // __linux__
+}
+
+inline bool DurableCheckpoint::Remove()
+{
+    #ifdef _WIN32
+    return DeleteFileW(checkpointPath.c_str()) != 0 || GetLastError() == ERROR_FILE_NOT_FOUND;
+    #endif // _WIN32
+
+    #ifdef __linux__
+    if (unlink(checkpointPath.c_str()) != 0 && errno != ENOENT)
+        return false;
+    return SyncDirectory();
+    #endif // __linux__
+}
+
+#ifdef __linux__
+inline bool DurableCheckpoint::SyncDirectory()
+{
+    size_t slash = checkpointPath.find_last_of('/');
+    PathString dir = slash == PathString::npos ? "." : (slash == 0 ? "/" : checkpointPath.substr(0, slash));
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+        return false;
+    bool synced = fsync(dirFd) == 0;
+    close(dirFd);
+    return synced;
+}
+#endif // __linux__
+
+inline bool DurableCheckpoint::Read(const PathString& path, CheckpointFields& log)
+{
+    BlockFile file;
+    if (!file.Open(path, BlockFileMode::Read))
+        return false;
+    std::string content(file.Size(), '\0');
+    if (!file.ReadAt((unsigned char*)&content[0], content.size(), 0))
+        return false;
+
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    std::istringstream lines(content);
+    std::string type, disk, serial, dir, name, endTime, written, total;
+    if (!std::getline(lines, type) || !std::getline(lines, disk) || !std::getline(lines, serial) ||
+        !std::getline(lines, dir) || !std::getline(lines, name) || !std::getline(lines, endTime) ||
+        !std::getline(lines, written) || !std::getline(lines, total))
+        return false;
+
+    try {
+        log.type = static_cast<ImageType>(std::stoi(type));
+        log.disk = converter.from_bytes(disk);
+        log.serialNum = converter.from_bytes(serial);
+        log.outFileDir = converter.from_bytes(dir);
+        log.outFileName = converter.from_bytes(name);
+        log.endTime = static_cast<time_t>(std::stoll(endTime));
+        log.numOfSectorsWriten = std::stoull(written);
+        log.totalSectors = std::stoull(total);
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+#endif // CHECKPOINT_H_INCLUDED
@@ -6,7 +6,10 @@
 #ifndef DISKINFO_H
 #define DISKINFO_H
 
+#ifdef _WIN32
 #include <windows.h>
+#endif // _WIN32
+
 #include <vector>
 #include <map>
 #include <iostream>
@@ -35,9 +38,12 @@ typedef struct
     wstring fileSystemType;     ///< Тип файловой системы
     int16_t numOfLogicalDisk;   ///< Число логических дисков. Эта часть задается только если тип диска физический,если логический, то -1.                
     float totalSize;            ///< Общий объем (в Гб)
-    int64_t total_sectors;      ///< Общее количество секторов
+    int64_t total_sectors;      ///< Общее количество секторов по 512 байт (в этих единицах емкость принимают движки копирования)
     int64_t total_bytes;        ///< Общий объем в байтах
     float freeSpace;            ///< Свободный объем (в Гб)
+    uint32_t logicalSectorSize; ///< Размер логического сектора в байтах
+    uint32_t physicalSectorSize;///< Размер физического сектора в байтах
+    int64_t logicalSectors;     ///< Количество логических секторов (размером logicalSectorSize)
 } DiskInfoStruct;
 
 /// Указатель на структуру DiskInfoStruct.
@@ -55,6 +61,34 @@ private:
     int physical_disk_amount;
     map<wstring, vector<wstring>> connected_drives;
 
+    #ifdef __linux__
+    /**
+     * @struct DiskDetails
+     * @brief Дорогие в получении сведения о диске, которые загружаются по запросу.
+     */
+    struct DiskDetails
+    {
+        wstring fileSystemType;  ///< Тип файловой системы (пусто, если не смонтирован)
+        float freeSpace;         ///< Свободный объем (в Гб), -1 если неизвестен
+    };
+
+    map<wstring, bool> partitions_listed;   ///< Отмечает диски, разделы которых уже перечислены.
+    map<wstring, DiskDetails> details_cache; ///< Кэш сведений о файловой системе.
+
+    /**
+     * @brief Перечисляет разделы физического диска в /sys/block/<disk>.
+     * @param disk Имя физического диска (например, L"sda").
+     * @return Список имен разделов.
+     */
+    vector<wstring>& ListPartitions(const wstring& disk);
+
+    /**
+     * @brief Находит имя устройства по индексам дисков.
+     * @return Пустая строка, если индексы некорректны.
+     */
+    wstring ResolveDevice(int IdPhDisk, int IdLogicDisk);
+    #endif // __linux__
+
 public:
     /**
      * @brief Конструктор класса DiskInfo.
@@ -86,6 +120,25 @@ public:
      * Выводит информацию о всех обнаруженных дисках.
      */
     void DisplayAllDrives();
+
+    #ifdef __linux__
+    /**
+     * @brief Получение типа файловой системы и свободного объема (Linux).
+     *
+     * Эти сведения требуют обращения к таблице монтирования и файловой системе,
+     * поэтому загружаются только по запросу и кэшируются.
+     *
+     * @param[in] IdPhDisk Индекс физического диска.
+     * @param[in] IdLogicDisk Индекс логического диска.
+     * @param[out] diskInfo Структура, в которой заполняются поля fileSystemType и freeSpace.
+     * @return True, если индексы корректны, иначе False.
+     */
+    bool GetDiskDetails(int IdPhDisk, int IdLogicDisk, PDiskInfoStruct diskInfo);
+    #endif // __linux__
 };
 
+#ifdef __linux__
+#include "DiskInfoLinux.h"
+#endif // __linux__
+
 #endif // DISKINFO_H
@@ -0,0 +1,233 @@
+/**
+ * @file DiskInfoLinux.h
+ * @brief Реализация класса DiskInfo для Linux на основе sysfs и ioctl блочных устройств.
+ *
+ * Подключается из DiskInfo.h. Конструктор только перечисляет имена в /sys/block,
+ * разделы перечисляются при первом обращении к диску, а тип файловой системы
+ * и свободный объем загружаются отдельно (GetDiskDetails) и кэшируются.
+ */
+
+#ifndef DISKINFOLINUX_H_INCLUDED
+#define DISKINFOLINUX_H_INCLUDED
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <linux/fs.h>
+
+/**
+ * @brief Читает первое число из файла sysfs.
+ * @param path Путь к файлу.
+ * @param value Прочитанное значение.
+ * @return true, если значение прочитано.
+ */
+inline bool ReadSysfsNumber(const string& path, uint64_t& value)
+{
+    ifstream f(path);
+    return static_cast<bool>(f >> value);
+}
+
+/**
+ * @brief Перечисляет записи каталога.
+ * @param path Путь к каталогу.
+ * @return Отсортированный список имен (без "." и "..").
+ */
+inline vector<string> ListDirectory(const string& path)
+{
+    vector<string> names;
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL)
+        return names;
+    while (struct dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..")
+            names.push_back(name);
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    return names;
+}
+
+/**
+ * @brief Раскрывает восьмеричные последовательности (`\040`) в путях из /proc/self/mounts.
+ */
+inline string UnescapeMountPath(const string& path)
+{
+    string res;
+    for (size_t i = 0; i < path.size(); i++) {
+        if (path[i] == '\\' && i + 3 < path.size()) {
+            res += static_cast<char>(((path[i + 1] - '0') << 6) | ((path[i + 2] - '0') << 3) | (path[i + 3] - '0'));
+            i += 3;
+        }
+        else {
+            res += path[i];
+        }
+    }
+    return res;
+}
+
+inline DiskInfo::DiskInfo()
+{
+    // Только имена устройств: никаких обращений к самим дискам
+    for (const string& name : ListDirectory("/sys/block")) {
+        uint64_t sectors = 0;
+        bool isVirtual = name.compare(0, 3, "ram") == 0 || name.compare(0, 4, "loop") == 0;
+        if (isVirtual && (!ReadSysfsNumber("/sys/block/" + name + "/size", sectors) || sectors == 0))
+            continue;
+        connected_drives[wstring(name.begin(), name.end())] = vector<wstring>();
+    }
+    physical_disk_amount = static_cast<int>(connected_drives.size());
+}
+
+inline vector<wstring>& DiskInfo::ListPartitions(const wstring& disk)
+{
+    vector<wstring>& parts = connected_drives[disk];
+    if (partitions_listed[disk])
+        return parts;
+
+    string diskS(disk.begin(), disk.end());
+    string base = "/sys/block/" + diskS + "/";
+    for (const string& name : ListDirectory(base)) {
+        struct stat st;
+        if (name.compare(0, diskS.size(), diskS) == 0 && stat((base + name + "/partition").c_str(), &st) == 0)
+            parts.push_back(wstring(name.begin(), name.end()));
+    }
+    partitions_listed[disk] = true;
+    return parts;
+}
+
+inline wstring DiskInfo::ResolveDevice(int IdPhDisk, int IdLogicDisk)
+{
+    if (IdPhDisk < 0 || IdPhDisk >= GetNumOfPhysicalDisk() || IdLogicDisk < 0)
+        return L"";
+
+    auto it = connected_drives.begin();
+    advance(it, IdPhDisk);
+    if (IdLogicDisk == 0)
+        return it->first;
+
+    vector<wstring>& parts = ListPartitions(it->first);
+    if (IdLogicDisk > static_cast<int>(parts.size()))
+        return L"";
+    return parts[IdLogicDisk - 1];
+}
+
+inline bool DiskInfo::GetDiskInfo(int IdPhDisk, int IdLogicDisk, PDiskInfoStruct diskInfo)
+{
+    wstring name = ResolveDevice(IdPhDisk, IdLogicDisk);
+    if (name.empty() || diskInfo == NULL)
+        return false;
+
+    auto phys = connected_drives.begin();
+    advance(phys, IdPhDisk);
+    string nameS(name.begin(), name.end());
+    string physS(phys->first.begin(), phys->first.end());
+
+    diskInfo->type = IdLogicDisk == 0 ? DiskType::Physical : DiskType::Logical;
+    diskInfo->diskName = L"/dev/" + name;
+    diskInfo->numOfLogicalDisk = IdLogicDisk == 0 ? static_cast<int16_t>(ListPartitions(phys->first).size()) : -1;
+    diskInfo->fileSystemType = L"";
+    diskInfo->freeSpace = -1;
+
+    uint64_t bytes = 0;
+    int logical = 0;
+    unsigned int physical = 0;
+
+    // Точные значения берутся у самого устройства, при нехватке прав — из sysfs
+    int fd = open(("/dev/" + nameS).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) {
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0)
+            bytes = 0;
+        if (ioctl(fd, BLKSSZGET, &logical) != 0)
+            logical = 0;
+        if (ioctl(fd, BLKPBSZGET, &physical) != 0)
+            physical = 0;
+        close(fd);
+    }
+
+    string sysBase = IdLogicDisk == 0 ? "/sys/block/" + nameS : "/sys/block/" + physS + "/" + nameS;
+    uint64_t value = 0;
+    if (bytes == 0 && ReadSysfsNumber(sysBase + "/size", value))
+        bytes = value * 512;    // sysfs всегда считает в 512-байтных секторах
+    if (logical == 0 && ReadSysfsNumber("/sys/block/" + physS + "/queue/logical_block_size", value))
+        logical = static_cast<int>(value);
+    if (physical == 0 && ReadSysfsNumber("/sys/block/" + physS + "/queue/physical_block_size", value))
+        physical = static_cast<unsigned int>(value);
+    if (logical == 0)
+        logical = 512;
+    if (physical == 0)
+        physical = logical;
+
+    diskInfo->logicalSectorSize = static_cast<uint32_t>(logical);
+    diskInfo->physicalSectorSize = physical;
+    diskInfo->total_bytes = static_cast<int64_t>(bytes);
+    diskInfo->total_sectors = static_cast<int64_t>(bytes / 512);   // На дисках 4Kn тоже в 512-байтных единицах
+    diskInfo->logicalSectors = static_cast<int64_t>(bytes / logical);
+    diskInfo->totalSize = static_cast<float>(bytes) / (1024.0f * 1024.0f * 1024.0f);
+    return true;
+}
+
+inline bool DiskInfo::GetDiskDetails(int IdPhDisk, int IdLogicDisk, PDiskInfoStruct diskInfo)
+{
+    wstring name = ResolveDevice(IdPhDisk, IdLogicDisk);
+    if (name.empty() || diskInfo == NULL)
+        return false;
+
+    auto cached = details_cache.find(name);
+    if (cached == details_cache.end()) {
+        DiskDetails details;
+        details.freeSpace = -1;
+
+        string device = "/dev/" + string(name.begin(), name.end());
+        ifstream mounts("/proc/self/mounts");
+        string line;
+        while (getline(mounts, line)) {
+            istringstream fields(line);
+            string source, target, fsType;
+            if (!(fields >> source >> target >> fsType) || source != device)
+                continue;
+            details.fileSystemType = wstring(fsType.begin(), fsType.end());
+            struct statvfs vfs;
+            if (statvfs(UnescapeMountPath(target).c_str(), &vfs) == 0)
+                details.freeSpace = static_cast<float>(vfs.f_bavail) * vfs.f_frsize / (1024.0f * 1024.0f * 1024.0f);
+            break;
+        }
+        cached = details_cache.emplace(name, details).first;
+    }
+
+    diskInfo->fileSystemType = cached->second.fileSystemType;
+    diskInfo->freeSpace = cached->second.freeSpace;
+    return true;
+}
+
+inline void DiskInfo::DisplayAllDrives()
+{
+    for (int i = 0; i < GetNumOfPhysicalDisk(); i++) {
+        DiskInfoStruct info;
+        if (!GetDiskInfo(i, 0, &info))
+            continue;
+        string diskName(info.diskName.begin(), info.diskName.end());
+        cout << i << ". " << diskName << "  " << info.totalSize << " Гб"
+             << "  сектор " << info.logicalSectorSize << "/" << info.physicalSectorSize << endl;
+
+        for (int j = 1; j <= info.numOfLogicalDisk; j++) {
+            DiskInfoStruct part;
+            if (!GetDiskInfo(i, j, &part) || !GetDiskDetails(i, j, &part))
+                continue;
+            string partName(part.diskName.begin(), part.diskName.end());
+            string fsType(part.fileSystemType.begin(), part.fileSystemType.end());
+            cout << "    " << j << ". " << partName << "  " << part.totalSize << " Гб";
+            if (!fsType.empty())
+                cout << "  " << fsType << "  свободно " << part.freeSpace << " Гб";
+            cout << endl;
+        }
+    }
+}
+
+#endif // DISKINFOLINUX_H_INCLUDED
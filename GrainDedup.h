@@ -0,0 +1,96 @@
+/**
+ * @file GrainDedup.h
+ * @brief Заголовочный файл для поиска одинаковых зерен (дедупликации) при создании sparse VMDK.
+ */
+
+#ifndef GRAINDEDUP_H_INCLUDED
+#define GRAINDEDUP_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * @class GrainDedupIndex
+ * @brief Потокобезопасный индекс уже записанных зерен по их хэшу.
+ *
+ * Индекс разбит на сегменты с отдельными мьютексами, поэтому потоки,
+ * обрабатывающие разные зерна, почти не блокируют друг друга.
+ * Совпадение хэша не считается совпадением зерна: вызывающая сторона
+ * подтверждает его полным побайтовым сравнением через функцию `sameContent`.
+ * Сравнение читает диск, поэтому выполняется без блокировки сегмента.
+ */
+class GrainDedupIndex
+{
+public:
+    /**
+     * @brief Конструктор индекса.
+     * @param shards Количество сегментов.
+     */
+    explicit GrainDedupIndex(size_t shards = 64) : segments(shards) {};
+
+    /**
+     * @brief Ищет записанное зерно с тем же содержимым, а при отсутствии добавляет новое.
+     *
+     * @param hash Хэш зерна.
+     * @param newGTE GTE, которое получит зерно, если совпадение не найдено.
+     * @param sameContent Функция полного сравнения с зерном по заданному GTE
+     *                    (вызывается без блокировки, возможно параллельно).
+     * @return GTE найденного совпадающего зерна или 0, если зерно добавлено как новое.
+     */
+    uint32_t FindOrInsert(uint64_t hash, uint32_t newGTE, const std::function<bool(uint32_t)>& sameContent)
+    {
+        Segment& seg = segments[hash % segments.size()];
+        size_t checked = 0;
+        std::vector<uint32_t> candidates;
+        for (;;) {
+            // Под блокировкой только берем еще не проверенных кандидатов
+            {
+                std::lock_guard<std::mutex> lock(seg.mtx);
+                std::vector<uint32_t>& known = seg.grains[hash];
+                if (checked == known.size()) {
+                    known.push_back(newGTE);
+                    return 0;
+                }
+                candidates.assign(known.begin() + checked, known.end());
+                checked = known.size();
+            }
+            for (uint32_t gte : candidates) {
+                if (sameContent(gte))
+                    return gte;
+            }
+            // За время сравнения могли добавиться новые зерна с тем же хэшем: проверяем и их
+        }
+    }
+
+    /**
+     * @brief Возвращает количество уникальных зерен в индексе.
+     */
+    uint64_t Count()
+    {
+        uint64_t n = 0;
+        for (Segment& seg : segments) {
+            std::lock_guard<std::mutex> lock(seg.mtx);
+            for (const auto& entry : seg.grains)
+                n += entry.second.size();
+        }
+        return n;
+    }
+
+private:
+    /**
+     * @struct Segment
+     * @brief Сегмент индекса со своим мьютексом.
+     */
+    struct Segment
+    {
+        std::mutex mtx;                                        ///< Мьютекс сегмента.
+        std::unordered_map<uint64_t, std::vector<uint32_t>> grains; ///< Хэш зерна -> GTE в порядке добавления.
+    };
+
+    std::vector<Segment> segments;   ///< Сегменты индекса.
+};
+
+#endif // GRAINDEDUP_H_INCLUDED
@@ -0,0 +1,285 @@
+/**
+ * @file GrainHash.h
+ * @brief Заголовочный файл для хэширования зерен (grains) и работы с манифестом хэшей образа.
+ */
+
+#ifndef GRAINHASH_H_INCLUDED
+#define GRAINHASH_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "BlockFile.h"
+
+#define GRAIN_MANIFEST_MAGIC 0x464D4847   ///< 'GHMF' в hex (магическое число манифеста)
+#define GRAIN_MANIFEST_VERSION 1          ///< Версия формата манифеста
+
+/**
+ * @struct Xxh64
+ * @brief Константы и шаги алгоритма XXH64, общие для GrainHash64 и GrainHashStream.
+ */
+struct Xxh64
+{
+    static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    static uint64_t Read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; };
+    static uint64_t Round(uint64_t acc, uint64_t input) { return Rotl(acc + input * P2, 31) * P1; };
+    static uint64_t Merge(uint64_t acc, uint64_t val) { return (acc ^ Round(0, val)) * P1 + P4; };
+
+    /**
+     * @brief Заполняет четыре аккумулятора начальными значениями.
+     */
+    static void Init(uint64_t acc[4], uint64_t seed)
+    {
+        acc[0] = seed + P1 + P2;
+        acc[1] = seed + P2;
+        acc[2] = seed;
+        acc[3] = seed - P1;
+    }
+
+    /**
+     * @brief Обрабатывает целые 32-байтные блоки четырьмя независимыми потоками.
+     */
+    static void Stripes(uint64_t acc[4], const unsigned char* p, size_t blocks)
+    {
+        // Аккумуляторы в локальных переменных: чтение данных через unsigned char* не заставляет их перечитывать
+        uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+        for (size_t i = 0; i != blocks; i++, p += 32) {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+        }
+        acc[0] = v1;
+        acc[1] = v2;
+        acc[2] = v3;
+        acc[3] = v4;
+    }
+
+    /**
+     * @brief Сводит аккумуляторы в одно значение (если данных не меньше 32 байт).
+     */
+    static uint64_t Converge(const uint64_t acc[4])
+    {
+        uint64_t h = Rotl(acc[0], 1) + Rotl(acc[1], 7) + Rotl(acc[2], 12) + Rotl(acc[3], 18);
+        for (int i = 0; i != 4; i++)
+            h = Merge(h, acc[i]);
+        return h;
+    }
+
+    /**
+     * @brief Добавляет хвост короче 32 байт и выполняет финальное перемешивание.
+     * @param h Значение после Converge (или seed + P5), к которому прибавлена длина данных.
+     */
+    static uint64_t Finish(uint64_t h, const unsigned char* p, const unsigned char* end)
+    {
+        while (p + 8 <= end) {
+            h ^= Round(0, Read64(p));
+            h = Rotl(h, 27) * P1 + P4;
+            p += 8;
+        }
+        if (p + 4 <= end) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            h ^= static_cast<uint64_t>(v) * P1;
+            h = Rotl(h, 23) * P2 + P3;
+            p += 4;
+        }
+        while (p < end) {
+            h ^= (*p) * P5;
+            h = Rotl(h, 11) * P1;
+            p++;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+/**
+ * @brief Вычисляет 64-битный хэш блока данных (алгоритм XXH64).
+ *
+ * Хэш обрабатывает по 32 байта за итерацию в четыре независимых потока,
+ * поэтому его скорость близка к скорости чтения памяти.
+ *
+ * @param data Указатель на данные.
+ * @param len Длина данных в байтах.
+ * @param seed Начальное значение.
+ * @return 64-битный хэш.
+ */
+inline uint64_t GrainHash64(const unsigned char* data, size_t len, uint64_t seed = 0)
+{
+    const size_t blocks = len / 32;
+    uint64_t h = seed + Xxh64::P5;
+    if (blocks != 0) {
+        uint64_t acc[4];
+        Xxh64::Init(acc, seed);
+        Xxh64::Stripes(acc, data, blocks);
+        h = Xxh64::Converge(acc);
+    }
+    return Xxh64::Finish(h + static_cast<uint64_t>(len), data + blocks * 32, data + len);
+}
+
+/**
+ * @class GrainHashStream
+ * @brief Потоковое вычисление XXH64 для данных, поступающих частями.
+ *
+ * Результат Digest() совпадает с GrainHash64 от всех переданных данных подряд,
+ * поэтому хэш потока можно сверить с хэшем готового файла.
+ */
+class GrainHashStream
+{
+public:
+    explicit GrainHashStream(uint64_t s = 0) { Reset(s); };
+
+    /**
+     * @brief Начинает вычисление заново.
+     * @param s Начальное значение.
+     */
+    void Reset(uint64_t s = 0) {
+        seed = s;
+        Xxh64::Init(acc, seed);
+        total = 0;
+        buffered = 0;
+    }
+
+    /**
+     * @brief Добавляет очередную часть данных.
+     */
+    void Update(const unsigned char* data, size_t len);
+
+    /**
+     * @brief Возвращает хэш переданных данных (вычисление можно продолжать).
+     */
+    uint64_t Digest() const;
+
+private:
+    uint64_t seed;                  ///< Начальное значение.
+    uint64_t acc[4];                ///< Четыре независимых аккумулятора.
+    uint64_t total;                 ///< Всего передано байт.
+    unsigned char tail[32];         ///< Неполный 32-байтный блок.
+    size_t buffered;                ///< Байт в tail.
+};
+
+inline void GrainHashStream::Update(const unsigned char* data, size_t len)
+{
+    total += len;
+    if (buffered != 0) {
+        size_t take = 32 - buffered < len ? 32 - buffered : len;
+        memcpy(tail + buffered, data, take);
+        buffered += take;
+        data += take;
+        len -= take;
+        if (buffered != 32)
+            return;
+        Xxh64::Stripes(acc, tail, 1);
+        buffered = 0;
+    }
+    Xxh64::Stripes(acc, data, len / 32);
+    memcpy(tail, data + len / 32 * 32, len % 32);
+    buffered = len % 32;
+}
+
+inline uint64_t GrainHashStream::Digest() const
+{
+    uint64_t h = total >= 32 ? Xxh64::Converge(acc) : seed + Xxh64::P5;
+    return Xxh64::Finish(h + total, tail, tail + buffered);
+}
+
+#pragma pack(push, 1)
+
+/**
+ * @struct GrainManifestHeader
+ * @brief Заголовок файла манифеста хэшей зерен.
+ */
+typedef struct
+{
+    uint32_t magicNumber;   ///< Магическое число ('GHMF')
+    uint32_t version;       ///< Версия формата
+    uint64_t grainSize;     ///< Размер зерна в секторах
+    uint64_t capacity;      ///< Емкость образа в секторах
+    uint64_t grainCount;    ///< Количество хэшей в манифесте
+} GrainManifestHeader;
+
+#pragma pack(pop)
+
+/**
+ * @class GrainHashManifest
+ * @brief Класс для хранения хэшей всех зерен образа.
+ *
+ * Манифест сохраняется рядом с sparse-образом (файл с расширением `.ghm`) и
+ * позволяет при следующем копировании определить изменившиеся зерна,
+ * не читая предыдущий образ.
+ */
+class GrainHashManifest
+{
+public:
+    uint64_t grainSize = 0;          ///< Размер зерна в секторах.
+    uint64_t capacity = 0;           ///< Емкость образа в секторах.
+    std::vector<uint64_t> hashes;    ///< Хэши зерен по порядку.
+
+    GrainHashManifest() {};
+
+    /**
+     * @brief Инициализирует пустой манифест.
+     * @param grainSectors Размер зерна в секторах.
+     * @param capacitySectors Емкость в секторах.
+     * @param grains Количество зерен.
+     */
+    void Reset(uint64_t grainSectors, uint64_t capacitySectors, uint64_t grains) {
+        grainSize = grainSectors;
+        capacity = capacitySectors;
+        hashes.assign(grains, 0);
+    }
+
+    /**
+     * @brief Сохраняет манифест в файл.
+     * @param path Путь к файлу манифеста.
+     * @return true, если манифест сохранён.
+     */
+    bool Save(const PathString& path) const {
+        BlockFile file;
+        if (!file.Open(path, BlockFileMode::Write))
+            return false;
+        GrainManifestHeader h;
+        h.magicNumber = GRAIN_MANIFEST_MAGIC;
+        h.version = GRAIN_MANIFEST_VERSION;
+        h.grainSize = grainSize;
+        h.capacity = capacity;
+        h.grainCount = hashes.size();
+        return file.WriteAt((const unsigned char*)&h, sizeof(h), 0) &&
+               file.WriteAt((const unsigned char*)hashes.data(), hashes.size() * sizeof(uint64_t), sizeof(h));
+    }
+
+    /**
+     * @brief Загружает манифест из файла.
+     * @param path Путь к файлу манифеста.
+     * @return true, если манифест прочитан и корректен.
+     */
+    bool Load(const PathString& path) {
+        BlockFile file;
+        GrainManifestHeader h;
+        if (!file.Open(path, BlockFileMode::Read) ||
+            !file.ReadAt((unsigned char*)&h, sizeof(h), 0) ||
+            h.magicNumber != GRAIN_MANIFEST_MAGIC ||
+            h.version != GRAIN_MANIFEST_VERSION ||
+            file.Size() != sizeof(h) + h.grainCount * sizeof(uint64_t))
+            return false;
+        grainSize = h.grainSize;
+        capacity = h.capacity;
+        hashes.assign(h.grainCount, 0);
+        return file.ReadAt((unsigned char*)hashes.data(), hashes.size() * sizeof(uint64_t), sizeof(h));
+    }
+};
+
+#endif // GRAINHASH_H_INCLUDED
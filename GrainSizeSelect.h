@@ -0,0 +1,161 @@
+/**
+ * @file GrainSizeSelect.h
+ * @brief Заголовочный файл для подбора размера зерна sparse VMDK по выборке с диска.
+ */
+
+#ifndef GRAINSIZESELECT_H_INCLUDED
+#define GRAINSIZESELECT_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "BlockFile.h"
+
+/**
+ * @class GrainSizeSampler
+ * @brief Оценивает размер образа и количество операций записи для разных размеров зерна.
+ *
+ * С диска читаются случайные окна размером с максимальное зерно. Для каждого окна
+ * строится карта ненулевых блоков минимального размера зерна, по которой без
+ * повторного чтения считается количество ненулевых зерен для всех кандидатов.
+ * Стоимость кандидата — ожидаемый размер образа (данные + GT) плюс количество
+ * записей, умноженное на условную стоимость одной операции ввода-вывода в байтах.
+ * Мелкое зерно экономит место на разреженных дисках, крупное — уменьшает
+ * число операций и размер таблиц на плотных.
+ */
+class GrainSizeSampler
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param minSectors Минимальный размер зерна в секторах (степень двойки).
+     * @param maxSectors Максимальный размер зерна в секторах (степень двойки), он же размер окна выборки.
+     * @param opCost Стоимость одной операции записи в байтах.
+     */
+    GrainSizeSampler(uint64_t minSectors = 8, uint64_t maxSectors = 4096, uint64_t opCost = 64 * 1024)
+        : minGrain(minSectors), maxGrain(maxSectors), ioCost(opCost) {};
+
+    /**
+     * @brief Читает выборку с источника.
+     *
+     * Смещения окон выбираются генератором с фиксированным зерном, поэтому
+     * повторный запуск на том же диске даёт тот же результат.
+     *
+     * @param source Источник данных (диск или файл).
+     * @param capacitySectors Размер диска в секторах по 512 байт.
+     * @param samples Количество окон.
+     * @param seed Зерно генератора смещений.
+     * @return false, если источник не удалось прочитать.
+     */
+    bool Sample(BlockSource& source, uint64_t capacitySectors, uint32_t samples, uint64_t seed = 1)
+    {
+        const uint64_t windowBytes = maxGrain * 512;
+        const uint64_t blockBytes = minGrain * 512;
+        const uint64_t blocksPerWindow = maxGrain / minGrain;
+        const uint64_t diskBytes = capacitySectors * 512;
+        const uint64_t windows = (diskBytes + windowBytes - 1) / windowBytes;
+
+        capacity = capacitySectors;
+        sampledWindows = 0;
+        counts.clear();
+        for (uint64_t g = minGrain; g <= maxGrain; g *= 2)
+            counts.push_back(0);
+        if (windows == 0)
+            return false;
+
+        // Окна выбираются без повторов, если диск меньше выборки — читается целиком
+        std::vector<uint64_t> order;
+        if (windows <= samples) {
+            for (uint64_t i = 0; i != windows; i++)
+                order.push_back(i);
+        }
+        else {
+            std::mt19937_64 gen(seed);
+            std::uniform_int_distribution<uint64_t> dist(0, windows - 1);
+            while (order.size() != samples)
+                order.push_back(dist(gen));
+            std::sort(order.begin(), order.end());
+            order.erase(std::unique(order.begin(), order.end()), order.end());
+        }
+
+        std::vector<unsigned char> window(windowBytes);
+        std::vector<bool> blockUsed(blocksPerWindow);
+        for (uint64_t w : order) {
+            uint64_t offset = w * windowBytes;
+            uint64_t len = std::min(windowBytes, diskBytes - offset);
+            std::fill(window.begin() + len, window.end(), 0);
+            if (!source.ReadAt(window.data(), len, offset))
+                return false;
+
+            for (uint64_t b = 0; b != blocksPerWindow; b++) {
+                const unsigned char* p = window.data() + b * blockBytes;
+                blockUsed[b] = std::any_of(p, p + blockBytes, [](unsigned char c) { return c != 0; });
+            }
+
+            // Зерно размера g ненулевое, если ненулевой хотя бы один из его блоков
+            size_t k = 0;
+            for (uint64_t g = minGrain; g <= maxGrain; g *= 2, k++) {
+                uint64_t per = g / minGrain;
+                for (uint64_t b = 0; b < blocksPerWindow; b += per)
+                    if (std::find(blockUsed.begin() + b, blockUsed.begin() + b + per, true) != blockUsed.begin() + b + per)
+                        counts[k]++;
+            }
+            sampledWindows++;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Оценивает стоимость размера зерна по последней выборке.
+     * @param grainSectors Размер зерна в секторах.
+     * @param gtesPerGT Количество записей в одной GT.
+     * @return Стоимость в байтах (размер образа + стоимость операций записи).
+     */
+    uint64_t Cost(uint64_t grainSectors, uint32_t gtesPerGT = 512) const
+    {
+        size_t k = 0;
+        for (uint64_t g = minGrain; g < grainSectors && k + 1 < counts.size(); g *= 2)
+            k++;
+        if (sampledWindows == 0)
+            return 0;
+
+        const uint64_t grainBytes = grainSectors * 512;
+        const uint64_t totalGrains = (capacity + grainSectors - 1) / grainSectors;
+        const uint64_t sampledGrains = sampledWindows * (maxGrain / grainSectors);
+        const uint64_t dataGrains = static_cast<uint64_t>(
+            static_cast<double>(counts[k]) / sampledGrains * totalGrains + 0.5);
+        const uint64_t numGT = (totalGrains + gtesPerGT - 1) / gtesPerGT;
+        const uint64_t metadata = numGT * gtesPerGT * 4 + numGT * 4;
+        return dataGrains * grainBytes + metadata + dataGrains * ioCost;
+    }
+
+    /**
+     * @brief Возвращает размер зерна с минимальной стоимостью.
+     * @param gtesPerGT Количество записей в одной GT.
+     * @return Размер зерна в секторах (при равной стоимости выбирается более крупное зерно).
+     */
+    uint64_t Best(uint32_t gtesPerGT = 512) const
+    {
+        uint64_t best = maxGrain;
+        uint64_t bestCost = Cost(maxGrain, gtesPerGT);
+        for (uint64_t g = maxGrain / 2; g >= minGrain; g /= 2) {
+            uint64_t cost = Cost(g, gtesPerGT);
+            if (cost < bestCost) {
+                best = g;
+                bestCost = cost;
+            }
+        }
+        return best;
+    }
+
+private:
+    uint64_t minGrain;                        ///< Минимальный размер зерна в секторах.
+    uint64_t maxGrain;                        ///< Максимальный размер зерна в секторах.
+    uint64_t ioCost;                          ///< Стоимость операции записи в байтах.
+    uint64_t capacity = 0;                    ///< Размер диска в секторах.
+    uint64_t sampledWindows = 0;              ///< Количество прочитанных окон.
+    std::vector<uint64_t> counts;             ///< Ненулевые зерна в выборке для каждого кандидата.
+};
+
+#endif // GRAINSIZESELECT_H_INCLUDED
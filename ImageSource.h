@@ -0,0 +1,399 @@
+/**
+ * @file ImageSource.h
+ * @brief Заголовочный файл для открытия созданных образов (DD, flat VMDK, sparse VMDK, zstd) как источника данных.
+ */
+
+#ifndef IMAGESOURCE_H_INCLUDED
+#define IMAGESOURCE_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include "BlockFile.h"
+#include "MappedFile.h"
+#include "SectorPolicy.h"
+#include "VMDKSparseReader.h"
+#include "ZstdSeekable.h"
+#include "Checkpoint.h"
+
+constexpr uint64_t IMAGE_CACHE_BLOCK = 64 * 1024;              ///< Размер блока кэша по умолчанию.
+constexpr uint64_t IMAGE_CACHE_BYTES = 64ull * 1024 * 1024;    ///< Объем кэша по умолчанию.
+
+/**
+ * @class FlatVMDKSource
+ * @brief Чтение flat VMDK по дескриптору: экстенты FLAT склеиваются последовательно.
+ *
+ * Экстенты ищутся только в каталоге дескриптора: имя с путем или `..` отклоняется.
+ */
+class FlatVMDKSource : public BlockSource
+{
+public:
+    FlatVMDKSource() {};
+
+    /**
+     * @brief Открывает дескриптор и все его экстенты.
+     * @param path Путь к .vmdk дескриптору (файлы экстентов ищутся рядом с ним).
+     * @return false, если дескриптор не описывает flat-образ или экстент не открывается.
+     */
+    bool Open(const PathString& path);
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return total; };
+
+private:
+    /**
+     * @brief Экстент flat-образа.
+     */
+    struct Extent
+    {
+        std::unique_ptr<BlockFile> file;   ///< Файл экстента.
+        uint64_t start;                    ///< Начало экстента на виртуальном диске в байтах.
+        uint64_t bytes;                    ///< Размер экстента в байтах.
+        uint64_t fileOffset;               ///< Смещение данных в файле в байтах.
+    };
+
+    std::vector<Extent> extents;           ///< Экстенты по порядку.
+    uint64_t total = 0;                    ///< Размер виртуального диска.
+};
+
+/**
+ * @class CheckpointedSource
+ * @brief Незавершенный DD-образ, читаемый до последней контрольной точки.
+ *
+ * Размер источника равен размеру диска из контрольной точки, данные за пределами
+ * зафиксированной части читаются как нули. Контрольная точка перечитывается не чаще
+ * раза в секунду, поэтому доступная часть растет вместе с копированием; после
+ * завершения копии контрольная точка удаляется, и доступен весь образ.
+ */
+class CheckpointedSource : public BlockSource
+{
+public:
+    CheckpointedSource() {};
+
+    /**
+     * @brief Открывает образ и его контрольную точку.
+     * @return false, если образ или контрольная точка не читаются.
+     */
+    bool Open(const PathString& image, const PathString& checkpoint);
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return total; };
+
+    /**
+     * @brief Возвращает размер зафиксированной части в байтах.
+     */
+    uint64_t GetDurableBytes();
+
+private:
+    BlockFile file;                        ///< Файл образа.
+    PathString checkpointPath;             ///< Файл контрольной точки.
+    uint64_t total = 0;                    ///< Размер диска.
+    uint64_t durable = 0;                  ///< Зафиксированная часть.
+    std::mutex mtx;                        ///< Защищает durable и lastRefresh.
+    std::chrono::steady_clock::time_point lastRefresh; ///< Время последнего чтения контрольной точки.
+};
+
+/**
+ * @class BlockCache
+ * @brief Кэш блоков источника с вытеснением давно не использованных (LRU).
+ *
+ * Промах читает блок целиком вне блокировки, поэтому несколько клиентов читают
+ * разные блоки параллельно. Полезен для sparse VMDK и zstd, где чтение блока
+ * требует поиска в таблицах или распаковки кадра.
+ */
+class BlockCache : public BlockSource
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param s Источник.
+     * @param blockBytes Размер блока.
+     * @param capacityBytes Объем кэша.
+     */
+    BlockCache(std::shared_ptr<BlockSource> s, uint64_t blockBytes = IMAGE_CACHE_BLOCK,
+               uint64_t capacityBytes = IMAGE_CACHE_BYTES)
+        : source(s), block(blockBytes), capacity(capacityBytes / blockBytes == 0 ? 1 : capacityBytes / blockBytes) {};
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return source->Size(); };
+
+    /**
+     * @brief Возвращает количество попаданий и промахов.
+     */
+    uint64_t GetHits() const { return hits; };
+    uint64_t GetMisses() const { return misses; };
+
+private:
+    typedef std::shared_ptr<std::vector<unsigned char>> Block;
+
+    std::shared_ptr<BlockSource> source;   ///< Источник.
+    uint64_t block;                        ///< Размер блока.
+    size_t capacity;                       ///< Максимум блоков в кэше.
+    std::mutex mtx;                        ///< Защищает lru и index.
+    std::list<std::pair<uint64_t, Block>> lru;  ///< Блоки, начиная с последнего использованного.
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Block>>::iterator> index; ///< Номер блока -> элемент lru.
+    uint64_t hits = 0;                     ///< Попадания.
+    uint64_t misses = 0;                   ///< Промахи.
+
+    Block Get(uint64_t number);
+};
+
+/**
+ * @brief Открывает образ, определяя формат по содержимому.
+ *
+ * Sparse VMDK распознается по магическому числу, flat VMDK — по тексту дескриптора,
+ * zstd seekable — по магическому числу кадра zstd, остальное читается как DD.
+ * Если рядом с DD-образом лежит контрольная точка (`<образ>.ckpt`), образ считается
+ * незавершенным и читается до нее (см. CheckpointedSource). Готовые sparse и
+ * zstd-образы оборачиваются в BlockCache, готовый DD-образ отображается в память (MappedFile).
+ *
+ * @param path Путь к образу.
+ * @param cacheBytes Объем кэша блоков (0 — без кэша).
+ * @return Источник или nullptr, если образ не открывается.
+ */
+inline std::shared_ptr<BlockSource> OpenImageSource(const PathString& path, uint64_t cacheBytes = IMAGE_CACHE_BYTES);
+
+inline bool FlatVMDKSource::Open(const PathString& path)
+{
+    extents.clear();
+    total = 0;
+
+    BlockFile desc;
+    if (!desc.Open(path, BlockFileMode::Read) || desc.Size() > 1024 * 1024)
+        return false;
+    std::string text(desc.Size(), '\0');
+    if (!desc.ReadAt((unsigned char*)&text[0], text.size(), 0) || text.find("# Disk DescriptorFile") != 0)
+        return false;
+
+    #ifdef _WIN32
+    size_t slash = path.find_last_of(L"\\/");
+    #endif // _WIN32
+    #ifdef __linux__
+    size_t slash = path.find_last_of('/');
+    #endif // __linux__
+    PathString dir = slash == PathString::npos ? PathString() : path.substr(0, slash + 1);
+
+    // Строки экстентов: RW <секторов> FLAT "<файл>" <смещение>
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string access, type, name;
+        uint64_t sectors = 0, offset = 0;
+        if (!(fields >> access >> sectors >> type) || (access != "RW" && access != "RDONLY"))
+            continue;
+        if (type != "FLAT")
+            return false;
+        size_t first = line.find('"');
+        size_t last = line.rfind('"');
+        if (first == std::string::npos || last <= first)
+            return false;
+        name = line.substr(first + 1, last - first - 1);
+        std::istringstream(line.substr(last + 1)) >> offset;
+        if (!IsPlainFileName(name))   // Экстент не может ссылаться за пределы каталога дескриптора
+            return false;
+
+        Extent e;
+        e.file.reset(new BlockFile());
+        #ifdef _WIN32
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        if (!e.file->Open(dir + converter.from_bytes(name), BlockFileMode::Read))
+            return false;
+        #endif // _WIN32
+        #ifdef __linux__
+        if (!e.file->Open(dir + name, BlockFileMode::Read))
+            return false;
+        #endif // __linux__
+        e.start = total;
+        e.bytes = sectors * SECTOR_SIZE;
+        e.fileOffset = offset * SECTOR_SIZE;
+        total += e.bytes;
+        extents.push_back(std::move(e));
+    }
+    return !extents.empty();
+}
+
+inline bool FlatVMDKSource::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > total)
+        return false;
+    for (Extent& e : extents) {
+        if (len == 0)
+            break;
+        if (offset >= e.start + e.bytes)
+            continue;
+        uint64_t part = e.start + e.bytes - offset < len ? e.start + e.bytes - offset : len;
+        if (!e.file->ReadAt(buf, part, e.fileOffset + offset - e.start))
+            return false;
+        buf += part;
+        offset += part;
+        len -= part;
+    }
+    return len == 0;
+}
+
+inline bool CheckpointedSource::Open(const PathString& image, const PathString& checkpoint)
+{
+    CheckpointFields log;
+    if (!file.Open(image, BlockFileMode::Read) || !DurableCheckpoint::Read(checkpoint, log))
+        return false;
+    checkpointPath = checkpoint;
+    total = log.totalSectors * SECTOR_SIZE;
+    durable = log.numOfSectorsWriten * SECTOR_SIZE;
+    lastRefresh = std::chrono::steady_clock::now();
+    return true;
+}
+
+inline uint64_t CheckpointedSource::GetDurableBytes()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (std::chrono::steady_clock::now() - lastRefresh >= std::chrono::seconds(1)) {
+        CheckpointFields log;
+        BlockFile ckpt;
+        if (DurableCheckpoint::Read(checkpointPath, log)) {
+            if (log.numOfSectorsWriten * SECTOR_SIZE > durable)
+                durable = log.numOfSectorsWriten * SECTOR_SIZE;
+        }
+        else if (!ckpt.Open(checkpointPath, BlockFileMode::Read)) {
+            durable = total;   // Контрольная точка удалена: копия завершена
+        }
+        lastRefresh = std::chrono::steady_clock::now();
+    }
+    return durable < total ? durable : total;
+}
+
+inline bool CheckpointedSource::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > total)
+        return false;
+    uint64_t limit = GetDurableBytes();
+    uint64_t part = offset >= limit ? 0 : (limit - offset < len ? limit - offset : len);
+    if (part != 0 && !file.ReadAt(buf, part, offset))
+        return false;
+    memset(buf + part, 0, len - part);
+    return true;
+}
+
+inline BlockCache::Block BlockCache::Get(uint64_t number)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(number);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            hits++;
+            return it->second->second;
+        }
+        misses++;
+    }
+
+    uint64_t offset = number * block;
+    uint64_t size = source->Size();
+    uint64_t len = size - offset < block ? size - offset : block;
+    Block data = std::make_shared<std::vector<unsigned char>>(len);
+    if (!source->ReadAt(data->data(), len, offset))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (index.find(number) == index.end()) {
+        lru.emplace_front(number, data);
+        index[number] = lru.begin();
+        if (lru.size() > capacity) {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+    return data;
+}
+
+inline bool BlockCache::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > Size())
+        return false;
+    while (len != 0) {
+        Block data = Get(offset / block);
+        if (!data)
+            return false;
+        uint64_t inBlock = offset % block;
+        uint64_t part = data->size() - inBlock < len ? data->size() - inBlock : len;
+        memcpy(buf, data->data() + inBlock, part);
+        buf += part;
+        offset += part;
+        len -= part;
+    }
+    return true;
+}
+
+inline std::shared_ptr<BlockSource> OpenImageSource(const PathString& path, uint64_t cacheBytes)
+{
+    BlockFile probe;
+    uint32_t magic = 0;
+    if (!probe.Open(path, BlockFileMode::Read))
+        return nullptr;
+    uint64_t size = probe.Size();
+    if (size >= 4 && !probe.ReadAt((unsigned char*)&magic, 4, 0))
+        return nullptr;
+    probe.Close();
+
+    std::shared_ptr<BlockSource> source;
+    uint64_t block = IMAGE_CACHE_BLOCK;
+    if (magic == VMDK_MAGICNUMBER) {
+        auto sparse = std::make_shared<SparseVMDKReader>();
+        if (!sparse->Open(path))
+            return nullptr;
+        block = sparse->GetGrainBytes();
+        source = sparse;
+    }
+    else if (magic == 0xFD2FB528) {
+        auto zstd = std::make_shared<SeekableZstdReader>();
+        if (!zstd->Open(path))
+            return nullptr;
+        source = zstd;
+    }
+    else if (memcmp(&magic, "# Di", 4) == 0) {
+        auto flat = std::make_shared<FlatVMDKSource>();
+        if (!flat->Open(path))
+            return nullptr;
+        return flat;     // Данные экстентов и так в страничном кэше ОС
+    }
+    else {
+        #ifdef _WIN32
+        PathString checkpoint = path + L".ckpt";
+        #endif // _WIN32
+        #ifdef __linux__
+        PathString checkpoint = path + ".ckpt";
+        #endif // __linux__
+        BlockFile ckpt;
+        if (ckpt.Open(checkpoint, BlockFileMode::Read)) {
+            ckpt.Close();
+            auto partial = std::make_shared<CheckpointedSource>();
+            if (!partial->Open(path, checkpoint))
+                return nullptr;
+            return partial;
+        }
+        // Готовый DD-образ читается из отображения без системного вызова на запрос
+        auto mapped = std::make_shared<MappedFile>();
+        if (mapped->Open(path, false))
+            return mapped;
+        auto raw = std::make_shared<BlockFile>();
+        if (!raw->Open(path, BlockFileMode::Read))
+            return nullptr;
+        return raw;
+    }
+
+    if (cacheBytes == 0)
+        return source;
+    return std::make_shared<BlockCache>(source, block, cacheBytes);
+}
+
+#endif // IMAGESOURCE_H_INCLUDED
@@ -0,0 +1,246 @@
+/**
+ * @file ImageVerify.h
+ * @brief Заголовочный файл для полной проверки готового образа по источнику.
+ */
+
+#ifndef IMAGEVERIFY_H_INCLUDED
+#define IMAGEVERIFY_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include "BlockFile.h"
+#include "ImageSource.h"
+#include "AesXts.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+
+constexpr uint64_t VERIFY_CHUNK_BYTES = 4 * 1024 * 1024;   ///< Размер участка, сравниваемого одной задачей.
+
+/**
+ * @class ImageVerifier
+ * @brief Побайтно сравнивает готовый образ с источником.
+ *
+ * Образ открывается через OpenImageSource: DD, flat VMDK и sparse VMDK (через
+ * таблицы зерен, невыделенные зерна читаются как нули). Участки сравниваются
+ * задачами общего планировщика; в работе одновременно несколько участков, поэтому
+ * чтение обеих сторон идет с опережением и проверка упирается в более медленное
+ * устройство. Отображенные в память образы сравниваются без копирования (BlockSource::View).
+ * Несовпадения собираются с точностью до сектора и склеиваются в диапазоны.
+ */
+class ImageVerifier
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param chunkBytes Размер участка одной задачи (кратен сектору).
+     * @param readAheadChunks Участков в работе одновременно (0 — удвоенное число потоков планировщика).
+     */
+    ImageVerifier(uint64_t chunkBytes = VERIFY_CHUNK_BYTES, size_t readAheadChunks = 0)
+        : chunk(chunkBytes < SECTOR_SIZE ? SECTOR_SIZE : chunkBytes / SECTOR_SIZE * SECTOR_SIZE),
+          readAhead(readAheadChunks) {};
+
+    /**
+     * @brief Сравнивает первые `bytes` байт источника и образа.
+     *
+     * @param source Источник (диск).
+     * @param image Образ (расшифрованный, если он зашифрован).
+     * @param bytes Объем сравнения в байтах.
+     * @return false, если источник или образ не удалось прочитать.
+     */
+    bool Verify(BlockSource& source, BlockSource& image, uint64_t bytes);
+
+    /**
+     * @brief Открывает диск и образ и сравнивает их.
+     *
+     * Если размеры различаются, сравнивается общая часть, а остаток считается несовпадением.
+     *
+     * @param sourcePath Исходный диск или файл.
+     * @param imagePath Образ (.dd, .vmdk).
+     * @param cipher Ключ зашифрованного образа или nullptr.
+     * @param bytes Объем образа в байтах, если копировалась только часть диска (0 — весь диск).
+     * @return false, если диск или образ не открываются или не читаются.
+     */
+    bool VerifyImage(const PathString& sourcePath, const PathString& imagePath,
+                     std::shared_ptr<const AesXts> cipher = nullptr, uint64_t bytes = 0);
+
+    /**
+     * @brief Выводит итог последней проверки и несовпавшие диапазоны.
+     */
+    void Report(std::ostream& out) const;
+
+    /**
+     * @brief Возвращает несовпавшие диапазоны (смещение, длина) в порядке возрастания.
+     */
+    const std::vector<std::pair<uint64_t, uint64_t>>& GetMismatches() const { return mismatches; };
+
+    /**
+     * @brief Возвращает объем сравненных данных в байтах.
+     */
+    uint64_t GetComparedBytes() const { return compared; };
+
+    /**
+     * @brief Проверяет, совпал ли образ с источником при последней проверке.
+     */
+    bool IsIdentical() const { return mismatches.empty(); };
+
+private:
+    uint64_t chunk;                                          ///< Размер участка.
+    size_t readAhead;                                        ///< Участков в работе.
+    uint64_t compared = 0;                                   ///< Сравнено байт.
+    std::vector<std::pair<uint64_t, uint64_t>> mismatches;   ///< Несовпавшие диапазоны.
+
+    /**
+     * @brief Сортирует диапазоны и склеивает соседние.
+     */
+    void MergeMismatches();
+};
+
+inline bool ImageVerifier::Verify(BlockSource& source, BlockSource& image, uint64_t bytes)
+{
+    compared = 0;
+    mismatches.clear();
+
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    TaskGroup group(scheduler);
+    const size_t depth = readAhead != 0 ? readAhead : 2 * scheduler.GetConcurrency();
+    std::mutex mtx;
+    std::atomic<bool> failed(false);
+    std::atomic<uint64_t> done(0);
+
+    for (uint64_t pos = 0; pos < bytes && !failed; pos += chunk) {
+        const uint64_t len = bytes - pos < chunk ? bytes - pos : chunk;
+        group.WaitBelow(depth);
+        group.Run([&, pos, len] {
+            PooledBuffer srcBuffer, imgBuffer;
+            const unsigned char* src = nullptr;
+            const unsigned char* img = nullptr;
+            {
+                // Подгрузка страниц отображения ждет устройство; при ее ошибке участок читается через ReadAt
+                TaskScheduler::BlockingScope blocking;
+                src = source.View(pos, len);
+                img = image.View(pos, len);
+                if (src == nullptr) {
+                    srcBuffer = BufferPool::Shared().Acquire(len);
+                    if (!source.ReadAt(srcBuffer.Data(), len, pos)) {
+                        std::cout << "READ error" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    src = srcBuffer.Data();
+                }
+                if (img == nullptr) {
+                    imgBuffer = BufferPool::Shared().Acquire(len);
+                    if (!image.ReadAt(imgBuffer.Data(), len, pos)) {
+                        std::cout << "Image read error" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    img = imgBuffer.Data();
+                }
+            }
+            done += len;
+            if (memcmp(src, img, len) == 0)
+                return;
+
+            // Участок различается: уточняем до сектора
+            std::vector<std::pair<uint64_t, uint64_t>> local;
+            for (uint64_t off = 0; off < len; off += SECTOR_SIZE) {
+                uint64_t part = len - off < SECTOR_SIZE ? len - off : SECTOR_SIZE;
+                if (memcmp(src + off, img + off, part) == 0)
+                    continue;
+                if (!local.empty() && local.back().first + local.back().second == pos + off)
+                    local.back().second += part;
+                else
+                    local.emplace_back(pos + off, part);
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            mismatches.insert(mismatches.end(), local.begin(), local.end());
+        });
+    }
+    group.Wait();
+
+    compared = done;
+    MergeMismatches();
+    return !failed;
+}
+
+inline bool ImageVerifier::VerifyImage(const PathString& sourcePath, const PathString& imagePath,
+                                       std::shared_ptr<const AesXts> cipher, uint64_t bytes)
+{
+    compared = 0;
+    mismatches.clear();
+
+    BlockFile source;
+    if (!source.Open(sourcePath, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    source.SetCacheHygiene();
+
+    // Без кэша блоков: образ читается один раз и по порядку
+    std::shared_ptr<BlockSource> image = OpenImageSource(imagePath, 0);
+    if (!image) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    std::unique_ptr<DecryptingSource> plain;
+    BlockSource* imageData = image.get();
+    if (cipher) {
+        auto sparse = std::dynamic_pointer_cast<SparseVMDKReader>(image);
+        if (sparse) {
+            sparse->SetCipher(cipher);
+        }
+        else {
+            plain.reset(new DecryptingSource(*image, *cipher));
+            imageData = plain.get();
+        }
+    }
+
+    const uint64_t sourceBytes = bytes != 0 && bytes < source.Size() ? bytes : source.Size();
+    const uint64_t imageBytes = imageData->Size();
+    const uint64_t common = sourceBytes < imageBytes ? sourceBytes : imageBytes;
+    bool ok = Verify(source, *imageData, common);
+
+    // Лишнее или недостающее в конце образа — тоже расхождение
+    uint64_t longer = sourceBytes > imageBytes ? sourceBytes : imageBytes;
+    if (longer > common) {
+        mismatches.emplace_back(common, longer - common);
+        MergeMismatches();
+    }
+    return ok;
+}
+
+inline void ImageVerifier::MergeMismatches()
+{
+    std::sort(mismatches.begin(), mismatches.end());
+    std::vector<std::pair<uint64_t, uint64_t>> merged;
+    for (const auto& range : mismatches) {
+        if (!merged.empty() && merged.back().first + merged.back().second >= range.first) {
+            uint64_t end = std::max(merged.back().first + merged.back().second, range.first + range.second);
+            merged.back().second = end - merged.back().first;
+        }
+        else {
+            merged.push_back(range);
+        }
+    }
+    mismatches.swap(merged);
+}
+
+inline void ImageVerifier::Report(std::ostream& out) const
+{
+    uint64_t bad = 0;
+    for (const auto& range : mismatches)
+        bad += range.second;
+    out << "Verify: " << compared << " bytes compared, " << mismatches.size() << " mismatched ranges, "
+        << bad << " bytes differ" << std::endl;
+    for (const auto& range : mismatches)
+        out << "  mismatch at " << range.first << " length " << range.second << std::endl;
+}
+
+#endif // IMAGEVERIFY_H_INCLUDED
@@ -0,0 +1,748 @@
+/**
+ * @file ImagingDaemon.h
+ * @brief Заголовочный файл службы создания образов: приём заданий через спул-каталог или Unix-сокет
+ * и их выполнение постоянным пулом потоков.
+ */
+
+#ifndef IMAGINGDAEMON_H_INCLUDED
+#define IMAGINGDAEMON_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <condition_variable>
+#include "BlockFile.h"
+#include "RawCopy.h"
+#include "VMDKSparce.h"
+#include "VMDKDelta.h"
+#include "ImageVerify.h"
+#include "UnixSocket.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif // __linux__
+
+/**
+ * @brief Формат образа, создаваемого заданием.
+ */
+enum class JobFormat : int
+{
+    DD = 1,           ///< Посекторная копия.
+    SparseVMDK,       ///< monolithicSparse VMDK.
+    SparseDedup,      ///< monolithicSparse VMDK с дедупликацией зерен.
+    DeltaVMDK,        ///< Дочерний sparse VMDK относительно родителя.
+};
+
+/**
+ * @brief Состояние задания.
+ */
+enum class JobState : int
+{
+    Unknown = 0,      ///< Задание с таким ID не поступало.
+    Queued,           ///< Ожидает свободного потока или памяти.
+    Running,          ///< Выполняется.
+    Done,             ///< Успешно завершено.
+    Failed,           ///< Завершено с ошибкой.
+};
+
+/**
+ * @brief Описание задания на создание образа.
+ *
+ * Текстовая форма задания — строки `ключ=значение` (как в дескрипторе VMDK):
+ * `id`, `source`, `format` (dd, sparse, dedup, delta), `dir`, `name`, `parent`,
+ * `buffer` (байт), `grain` (секторов или auto), `gtes`, `capacity` (секторов),
+ * `key` (ключевой файл AES-XTS, 64 байта — образ шифруется),
+ * `trace` (файл трассировки ввода-вывода в формате Chrome JSON),
+ * `verify` (yes — после создания сравнить образ с источником, кроме delta),
+ * `verifyChunk` (байт на задачу проверки, по умолчанию VERIFY_CHUNK_BYTES).
+ */
+struct JobSpec
+{
+    std::string id;                   ///< Идентификатор задания.
+    PathString source;                ///< Исходный диск или файл.
+    PathString outDir;                ///< Каталог для образа.
+    PathString outName;               ///< Имя образа без расширения.
+    PathString parent;                ///< Родительский образ (только для delta).
+    JobFormat format = JobFormat::DD; ///< Формат образа.
+    unsigned long bufSize = 4194304;  ///< Размер буфера чтения в байтах.
+    uint64_t grainSectors = 0;        ///< Размер зерна (0 — по умолчанию).
+    bool autoGrain = false;           ///< Подобрать размер зерна по выборке.
+    uint32_t gtesPerGT = 0;           ///< Записей в GT (0 — по умолчанию).
+    uint64_t capacitySectors = 0;     ///< Емкость в секторах (0 — по размеру источника).
+    PathString keyFile;               ///< Ключевой файл шифрования (пусто — без шифрования).
+    PathString traceFile;             ///< Файл трассировки (пусто — только гистограммы).
+    bool verify = false;              ///< Сравнить готовый образ с источником.
+    uint64_t verifyChunk = VERIFY_CHUNK_BYTES; ///< Размер участка одной задачи проверки в байтах.
+};
+
+/**
+ * @brief Преобразует строку UTF-8 из задания в путь платформы.
+ */
+inline PathString Utf8ToPath(const std::string& str)
+{
+    #ifdef _WIN32
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    return converter.from_bytes(str);
+    #endif // _WIN32
+
+    #ifdef __linux__
+    return str;
+    #endif // __linux__
+}
+
+/**
+ * @brief Разбирает текстовое описание задания.
+ *
+ * @param[in] text Строки `ключ=значение`, пустые строки и строки с `#` пропускаются.
+ * @param[out] spec Заполняемое задание.
+ * @param[out] error Описание ошибки.
+ * @return true, если задание корректно.
+ */
+inline bool ParseJobSpec(const std::string& text, JobSpec& spec, std::string& error)
+{
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            error = "bad line: " + line;
+            return false;
+        }
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+
+        try {
+            if (key == "id")
+                spec.id = value;
+            else if (key == "source")
+                spec.source = Utf8ToPath(value);
+            else if (key == "dir")
+                spec.outDir = Utf8ToPath(value);
+            else if (key == "name")
+                spec.outName = Utf8ToPath(value);
+            else if (key == "parent")
+                spec.parent = Utf8ToPath(value);
+            else if (key == "format") {
+                if (value == "dd")
+                    spec.format = JobFormat::DD;
+                else if (value == "sparse")
+                    spec.format = JobFormat::SparseVMDK;
+                else if (value == "dedup")
+                    spec.format = JobFormat::SparseDedup;
+                else if (value == "delta")
+                    spec.format = JobFormat::DeltaVMDK;
+                else {
+                    error = "unknown format: " + value;
+                    return false;
+                }
+            }
+            else if (key == "buffer")
+                spec.bufSize = std::stoul(value);
+            else if (key == "grain") {
+                spec.autoGrain = value == "auto";
+                spec.grainSectors = spec.autoGrain ? 0 : std::stoull(value);
+            }
+            else if (key == "gtes")
+                spec.gtesPerGT = static_cast<uint32_t>(std::stoul(value));
+            else if (key == "capacity")
+                spec.capacitySectors = std::stoull(value);
+            else if (key == "key")
+                spec.keyFile = Utf8ToPath(value);
+            else if (key == "trace")
+                spec.traceFile = Utf8ToPath(value);
+            else if (key == "verify")
+                spec.verify = value == "yes" || value == "1";
+            else if (key == "verifyChunk")
+                spec.verifyChunk = std::stoull(value);
+            else {
+                error = "unknown key: " + key;
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            error = "bad value: " + line;
+            return false;
+        }
+    }
+
+    if (spec.source.empty() || spec.outDir.empty() || spec.outName.empty()) {
+        error = "source, dir and name are required";
+        return false;
+    }
+    if (spec.format == JobFormat::DeltaVMDK && spec.parent.empty()) {
+        error = "delta job requires parent";
+        return false;
+    }
+    if (spec.format == JobFormat::DeltaVMDK && spec.verify) {
+        error = "verify is not supported for delta jobs";
+        return false;
+    }
+    if (spec.bufSize < SECTOR_SIZE || spec.bufSize % SECTOR_SIZE != 0) {
+        error = "buffer must be a multiple of 512";
+        return false;
+    }
+    if (spec.verifyChunk < SECTOR_SIZE || spec.verifyChunk % SECTOR_SIZE != 0) {
+        error = "verifyChunk must be a multiple of 512";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Ограничения службы.
+ */
+struct DaemonLimits
+{
+    unsigned workers = 4;                          ///< Количество постоянных потоков.
+    size_t maxQueued = 64;                         ///< Максимум заданий в очереди, остальные отклоняются.
+    uint64_t memoryBudget = 256ull * 1024 * 1024;  ///< Суммарный размер буферов выполняющихся заданий.
+};
+
+/**
+ * @class ImagingDaemon
+ * @brief Долгоживущая служба создания образов.
+ *
+ * Задания принимаются из спул-каталога (файлы `*.job`) и, в Linux, через Unix-сокет.
+ * Все задания выполняются одним постоянным пулом потоков, поэтому на каждое задание
+ * не создаются новые потоки. Допуск к выполнению ограничен длиной очереди
+ * и суммарным размером буферов одновременно выполняющихся заданий.
+ * DD-образы создаются движком RawCopy (многопоточно, с контрольными точками и
+ * возобновлением), sparse — CreateSparseThread.
+ */
+class ImagingDaemon
+{
+public:
+    explicit ImagingDaemon(const DaemonLimits& l = DaemonLimits()) : limits(l) {};
+
+    ~ImagingDaemon() { Stop(); };
+
+    ImagingDaemon(const ImagingDaemon&) = delete;
+    ImagingDaemon& operator=(const ImagingDaemon&) = delete;
+
+    /**
+     * @brief Запускает пул потоков.
+     */
+    void Start();
+
+    /**
+     * @brief Останавливает приём заданий и дожидается завершения выполняющихся.
+     *
+     * Задания, оставшиеся в очереди, не выполняются.
+     */
+    void Stop();
+
+    /**
+     * @brief Ставит задание в очередь.
+     *
+     * @param[in] spec Задание. Если ID не задан, он назначается службой.
+     * @param[out] id Назначенный ID.
+     * @param[out] error Причина отказа.
+     * @return false, если очередь заполнена, ID занят или задание не помещается в бюджет памяти.
+     */
+    bool Submit(JobSpec spec, std::string& id, std::string& error) { return Enqueue(spec, id, error, PathString()); };
+
+    /**
+     * @brief Возвращает состояние задания.
+     */
+    JobState GetState(const std::string& id);
+
+    /**
+     * @brief Ждет, пока очередь опустеет и все задания завершатся.
+     */
+    void WaitIdle();
+
+    /**
+     * @brief Запускает поток, принимающий задания из спул-каталога.
+     *
+     * Файл `<id>.job` после приема переименовывается в `<id>.accepted` (или `<id>.rejected`),
+     * по завершении задания рядом создается `<id>.done` или `<id>.failed`.
+     *
+     * @param dir Каталог спула.
+     * @param pollMs Период опроса каталога в миллисекундах.
+     */
+    void ServeSpool(const PathString& dir, unsigned pollMs = 1000);
+
+    #ifdef __linux__
+    /**
+     * @brief Запускает поток, принимающий задания через Unix-сокет (Linux).
+     *
+     * Клиент передает текст задания и закрывает запись, в ответ получает
+     * `accepted <id>` или `rejected <причина>`. Запрос `status <id>` возвращает состояние задания.
+     * Сокет доступен только владельцу службы (0600) или ее группе (0660), клиенты других
+     * пользователей отключаются без ответа (см. OpenUnixListener, UnixPeerAllowed).
+     * Каждый клиент обслуживается своим потоком, поэтому медленный клиент не задерживает прием.
+     *
+     * @param path Путь к сокету.
+     * @param groupAccess Разрешить подключение участникам группы службы.
+     * @return false, если сокет не удалось создать или путь занят.
+     */
+    bool ServeSocket(const std::string& path, bool groupAccess = false);
+    #endif // __linux__
+
+    /**
+     * @brief Выполняет одно задание в текущем потоке.
+     *
+     * По завершении выводится отчет о задержках операций ввода-вывода задания (см. IoStats),
+     * а если задан `trace`, трассировка сохраняется в этот файл. Если задан `verify`,
+     * готовый образ сравнивается с источником (см. ImageVerifier).
+     *
+     * @return true при успешном создании образа (и совпадении с источником, если задан `verify`).
+     */
+    static bool RunJob(const JobSpec& spec);
+
+private:
+    DaemonLimits limits;                       ///< Ограничения службы.
+    std::vector<std::thread> workers;          ///< Постоянные потоки пула.
+    std::vector<std::thread> listeners;        ///< Потоки приема заданий.
+    std::set<int> clientFds;                   ///< Открытые соединения сокета (по одному потоку на каждое).
+    std::deque<JobSpec> queue;                 ///< Очередь заданий.
+    std::map<std::string, JobState> states;    ///< Состояния всех принятых заданий.
+    std::map<std::string, PathString> spoolJobs; ///< Задания из спула и их файлы (без расширения).
+    std::mutex mtx;                            ///< Защищает очередь и состояния.
+    std::condition_variable cv;                ///< Оповещение о новых заданиях и освобождении памяти.
+    std::atomic<bool> stopping{false};         ///< Признак остановки.
+    uint64_t runningBytes = 0;                 ///< Память буферов выполняющихся заданий.
+    unsigned running = 0;                      ///< Количество выполняющихся заданий.
+    uint64_t nextId = 1;                       ///< Счетчик для автоматических ID.
+
+    /**
+     * @brief Ставит задание в очередь (см. Submit).
+     * @param spoolBase Путь к файлу задания из спула без расширения (пустой для остальных заданий).
+     */
+    bool Enqueue(JobSpec spec, std::string& id, std::string& error, const PathString& spoolBase);
+
+    /**
+     * @brief Основной цикл потока пула.
+     */
+    void WorkerLoop();
+
+    #ifdef __linux__
+    /**
+     * @brief Читает запрос клиента сокета, отвечает и закрывает соединение.
+     */
+    void ServeClient(int client);
+    #endif // __linux__
+
+    /**
+     * @brief Память, которую задание занимает во время выполнения.
+     */
+    static uint64_t JobMemory(const JobSpec& spec) { return spec.bufSize; };
+
+    /**
+     * @brief Создает образ формата задания (основная часть RunJob).
+     */
+    static bool RunFormat(const JobSpec& spec, uint64_t capacity, std::shared_ptr<AesXts> cipher,
+                          std::shared_ptr<IoStats> stats);
+
+    /**
+     * @brief Создает файл-маркер результата задания из спула.
+     */
+    void FinishSpoolJob(const std::string& id, bool ok);
+};
+
+inline void ImagingDaemon::Start()
+{
+    stopping = false;
+    unsigned count = limits.workers == 0 ? 1 : limits.workers;
+    for (unsigned i = 0; i != count; i++)
+        workers.emplace_back(&ImagingDaemon::WorkerLoop, this);
+}
+
+inline void ImagingDaemon::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread& t : listeners)
+        t.join();
+
+    // Прерываем чтение запросов и ждем завершения потоков клиентов
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        #ifdef __linux__
+        for (int fd : clientFds)
+            shutdown(fd, SHUT_RDWR);
+        #endif // __linux__
+        cv.wait(lock, [this] { return clientFds.empty(); });
+    }
+    for (std::thread& t : workers)
+        t.join();
+    listeners.clear();
+    workers.clear();
+}
+
+inline bool ImagingDaemon::Enqueue(JobSpec spec, std::string& id, std::string& error, const PathString& spoolBase)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (stopping) {
+        error = "stopping";
+        return false;
+    }
+    if (queue.size() >= limits.maxQueued) {
+        error = "queue full";
+        return false;
+    }
+    if (JobMemory(spec) > limits.memoryBudget) {
+        error = "buffer exceeds memory budget";
+        return false;
+    }
+    if (spec.id.empty())
+        spec.id = "job-" + std::to_string(nextId++);
+    if (states.count(spec.id) != 0) {
+        error = "duplicate id";
+        return false;
+    }
+
+    id = spec.id;
+    states[id] = JobState::Queued;
+    if (!spoolBase.empty())
+        spoolJobs[id] = spoolBase;
+    queue.push_back(spec);
+    cv.notify_all();
+    return true;
+}
+
+inline JobState ImagingDaemon::GetState(const std::string& id)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = states.find(id);
+    return it == states.end() ? JobState::Unknown : it->second;
+}
+
+inline void ImagingDaemon::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return (queue.empty() && running == 0) || stopping; });
+}
+
+inline void ImagingDaemon::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        // Задание допускается, если его буфер помещается в бюджет (или пул простаивает)
+        cv.wait(lock, [this] {
+            return stopping || (!queue.empty() &&
+                   (running == 0 || runningBytes + JobMemory(queue.front()) <= limits.memoryBudget));
+        });
+        if (stopping)
+            return;
+
+        JobSpec spec = queue.front();
+        queue.pop_front();
+        states[spec.id] = JobState::Running;
+        runningBytes += JobMemory(spec);
+        running++;
+
+        lock.unlock();
+        bool ok = RunJob(spec);
+        lock.lock();
+
+        runningBytes -= JobMemory(spec);
+        running--;
+        states[spec.id] = ok ? JobState::Done : JobState::Failed;
+        FinishSpoolJob(spec.id, ok);
+        cv.notify_all();
+    }
+}
+
+inline bool ImagingDaemon::RunJob(const JobSpec& spec)
+{
+    uint64_t capacity = spec.capacitySectors;
+    if (capacity == 0) {
+        BlockFile src;
+        if (!src.Open(spec.source, BlockFileMode::Read)) {
+            std::cout << "Open disk error" << std::endl;
+            return false;
+        }
+        capacity = src.Size() / SECTOR_SIZE;
+    }
+
+    std::shared_ptr<AesXts> cipher;
+    if (!spec.keyFile.empty()) {
+        cipher = std::make_shared<AesXts>();
+        if (!cipher->LoadKeyFile(spec.keyFile)) {
+            std::cout << "Key file error" << std::endl;
+            return false;
+        }
+    }
+
+    std::shared_ptr<IoStats> stats = std::make_shared<IoStats>();
+    if (!spec.traceFile.empty())
+        stats->EnableTrace();
+
+    bool ok = RunFormat(spec, capacity, cipher, stats);
+    if (ok && spec.verify) {
+        #ifdef _WIN32
+        PathString image = spec.outDir + L"\\" + spec.outName + (spec.format == JobFormat::DD ? L".dd" : L".vmdk");
+        #endif // _WIN32
+        #ifdef __linux__
+        PathString image = spec.outDir + "/" + spec.outName + (spec.format == JobFormat::DD ? ".dd" : ".vmdk");
+        #endif // __linux__
+        // Размер участка проверки не связан с буфером копирования: крупные участки
+        // держат оба устройства загруженными, а размер буфера подбирается под движок
+        ImageVerifier verifier(spec.verifyChunk);
+        ok = verifier.VerifyImage(spec.source, image, cipher, capacity * SECTOR_SIZE);
+        std::cout << "Job " << spec.id << " ";
+        verifier.Report(std::cout);
+        ok = ok && verifier.IsIdentical();
+    }
+
+    std::cout << "Job " << spec.id << " I/O latency:" << std::endl;
+    stats->Report(std::cout);
+    if (!spec.traceFile.empty()) {
+        std::ofstream trace(spec.traceFile);
+        if (!stats->SaveTrace(trace))
+            std::cout << "Trace write error" << std::endl;
+    }
+    return ok;
+}
+
+inline bool ImagingDaemon::RunFormat(const JobSpec& spec, uint64_t capacity, std::shared_ptr<AesXts> cipher,
+                                     std::shared_ptr<IoStats> stats)
+{
+    switch (spec.format) {
+    case JobFormat::DD: {
+        #ifdef _WIN32
+        PathString outFile = spec.outDir + L"\\" + spec.outName + L".dd";
+        std::wstring source = spec.source;
+        std::wstring out = outFile;
+        #endif // _WIN32
+        #ifdef __linux__
+        PathString outFile = spec.outDir + "/" + spec.outName + ".dd";
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        std::wstring source = converter.from_bytes(spec.source);
+        std::wstring out = converter.from_bytes(outFile);
+        #endif // __linux__
+
+        RawCopy copy(source, L"", out, spec.bufSize, capacity);
+        copy.SetCipher(cipher);
+        copy.SetStats(stats);
+
+        // Прерванное задание с тем же выходом продолжается с проверенной контрольной точки.
+        // Контрольная точка всего диска (сбой между фиксацией и ее удалением) означает
+        // завершенную копию: повтор задания копирует диск заново, источник мог измениться
+        #ifdef _WIN32
+        PathString checkpointPath = copy.GetCheckpointFile();
+        #endif // _WIN32
+        #ifdef __linux__
+        PathString checkpointPath = BlockFile::WCharToString(copy.GetCheckpointFile());
+        #endif // __linux__
+        CheckpointFields checkpoint;
+        unsigned long long resumeFrom = 0;
+        if (!DurableCheckpoint::Read(checkpointPath, checkpoint) || checkpoint.disk != source ||
+            checkpoint.totalSectors != capacity || checkpoint.numOfSectorsWriten >= checkpoint.totalSectors ||
+            !copy.VerifyResume(checkpoint.numOfSectorsWriten, resumeFrom) || resumeFrom == 0) {
+            resumeFrom = 0;   // Копия с нуля усекает прежний файл (см. RawCopy::TruncateStale)
+        }
+        else {
+            std::cout << "Job " << spec.id << " resumes at sector " << resumeFrom << std::endl;
+        }
+        return copy.CreateRawCopyThreads(resumeFrom);
+    }
+    case JobFormat::SparseVMDK:
+    case JobFormat::SparseDedup: {
+        SparseVMDK sparse(spec.outDir, spec.outName, spec.source);
+        if (spec.grainSectors != 0 && !sparse.SetGrainSize(spec.grainSectors))
+            return false;
+        if (spec.gtesPerGT != 0 && !sparse.SetGTECount(spec.gtesPerGT))
+            return false;
+        if (spec.autoGrain && sparse.SelectGrainSize(capacity) == 0)
+            return false;
+        sparse.SetCipher(cipher);
+        sparse.SetStats(stats);
+        if (spec.format == JobFormat::SparseDedup)
+            return sparse.CreateSparseDedup(spec.bufSize, capacity);
+        return sparse.CreateSparseThread(spec.bufSize, capacity);
+    }
+    case JobFormat::DeltaVMDK: {
+        DeltaSparseVMDK delta(spec.outDir, spec.outName, spec.source, spec.parent);
+        delta.SetCipher(cipher);
+        delta.SetStats(stats);
+        return delta.CreateDelta(spec.bufSize, capacity);
+    }
+    }
+    return false;
+}
+
+inline void ImagingDaemon::FinishSpoolJob(const std::string& id, bool ok)
+{
+    auto it = spoolJobs.find(id);
+    if (it == spoolJobs.end())
+        return;
+
+    #ifdef _WIN32
+    std::ofstream marker(it->second + (ok ? L".done" : L".failed"));
+    #endif // _WIN32
+    #ifdef __linux__
+    std::ofstream marker(it->second + (ok ? ".done" : ".failed"));
+    #endif // __linux__
+    marker << id << "\n";
+    spoolJobs.erase(it);
+}
+
+inline void ImagingDaemon::ServeSpool(const PathString& dir, unsigned pollMs)
+{
+    listeners.emplace_back([this, dir, pollMs] {
+        while (!stopping) {
+            // Имена *.job в каталоге (без расширения)
+            std::vector<PathString> names;
+
+            #ifdef _WIN32
+            WIN32_FIND_DATAW data;
+            HANDLE find = FindFirstFileW((dir + L"\\*.job").c_str(), &data);
+            if (find != INVALID_HANDLE_VALUE) {
+                do {
+                    std::wstring name = data.cFileName;
+                    names.push_back(dir + L"\\" + name.substr(0, name.size() - 4));
+                } while (FindNextFileW(find, &data));
+                FindClose(find);
+            }
+            #endif // _WIN32
+
+            #ifdef __linux__
+            if (DIR* d = opendir(dir.c_str())) {
+                while (struct dirent* entry = readdir(d)) {
+                    std::string name = entry->d_name;
+                    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".job") == 0)
+                        names.push_back(dir + "/" + name.substr(0, name.size() - 4));
+                }
+                closedir(d);
+            }
+            #endif // __linux__
+
+            for (const PathString& base : names) {
+                #ifdef _WIN32
+                PathString jobFile = base + L".job";
+                PathString accepted = base + L".accepted";
+                PathString rejected = base + L".rejected";
+                std::string stem = BlockFile::WCharToString(base.substr(dir.size() + 1));
+                #endif // _WIN32
+                #ifdef __linux__
+                PathString jobFile = base + ".job";
+                PathString accepted = base + ".accepted";
+                PathString rejected = base + ".rejected";
+                std::string stem = base.substr(dir.size() + 1);
+                #endif // __linux__
+
+                std::ifstream in(jobFile);
+                std::stringstream text;
+                text << in.rdbuf();
+                in.close();
+
+                JobSpec spec;
+                std::string id, error;
+                bool parsed = ParseJobSpec(text.str(), spec, error);
+                if (parsed && spec.id.empty())
+                    spec.id = stem;
+                bool ok = parsed && Enqueue(spec, id, error, base);
+                if (!ok && error == "queue full")
+                    break;  // Файл остается в спуле до следующего опроса
+
+                #ifdef _WIN32
+                MoveFileExW(jobFile.c_str(), (ok ? accepted : rejected).c_str(), MOVEFILE_REPLACE_EXISTING);
+                #endif // _WIN32
+                #ifdef __linux__
+                rename(jobFile.c_str(), (ok ? accepted : rejected).c_str());
+                #endif // __linux__
+                if (!ok)
+                    std::cout << "Job " << stem << " rejected: " << error << std::endl;
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait_for(lock, std::chrono::milliseconds(pollMs), [this] { return stopping.load(); });
+        }
+    });
+}
+
+#ifdef __linux__
+inline bool ImagingDaemon::ServeSocket(const std::string& path, bool groupAccess)
+{
+    int listenFd = OpenUnixListener(path, groupAccess);
+    if (listenFd < 0)
+        return false;
+
+    listeners.emplace_back([this, listenFd, path, groupAccess] {
+        while (!stopping) {
+            pollfd pfd = { listenFd, POLLIN, 0 };
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            int client = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0)
+                continue;
+            if (!UnixPeerAllowed(client, groupAccess)) {
+                std::cout << "Socket client rejected" << std::endl;
+                close(client);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                clientFds.insert(client);
+            }
+            std::thread(&ImagingDaemon::ServeClient, this, client).detach();
+        }
+        close(listenFd);
+        unlink(path.c_str());
+    });
+    return true;
+}
+
+inline void ImagingDaemon::ServeClient(int client)
+{
+    timeval timeout = { 5, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Запрос читается до закрытия записи клиентом
+    std::string request;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(client, buf, sizeof(buf))) > 0)
+        request.append(buf, n);
+
+    // Соединение без запроса (проверка занятости сокета, см. OpenUnixListener) закрывается молча
+    std::string reply;
+    if (request.empty()) {
+    }
+    else if (request.compare(0, 7, "status ") == 0) {
+        std::string id = request.substr(7);
+        while (!id.empty() && (id.back() == '\n' || id.back() == '\r'))
+            id.pop_back();
+        static const char* names[] = { "unknown", "queued", "running", "done", "failed" };
+        reply = std::string(names[static_cast<int>(GetState(id))]) + "\n";
+    }
+    else {
+        JobSpec spec;
+        std::string id, error;
+        if (ParseJobSpec(request, spec, error) && Submit(spec, id, error))
+            reply = "accepted " + id + "\n";
+        else
+            reply = "rejected " + error + "\n";
+    }
+    if (!reply.empty() && send(client, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)   // Клиент мог уже отключиться
+        std::cout << "Socket write error" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    clientFds.erase(client);
+    close(client);
+    cv.notify_all();
+}
+#endif // __linux__
+
+#endif // IMAGINGDAEMON_H_INCLUDED
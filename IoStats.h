@@ -0,0 +1,360 @@
+/**
+ * @file IoStats.h
+ * @brief Заголовочный файл для гистограмм задержек операций ввода-вывода и трассировки в формате Chrome.
+ */
+
+#ifndef IOSTATS_H_INCLUDED
+#define IOSTATS_H_INCLUDED
+
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif // _WIN32
+
+constexpr unsigned LATENCY_SUB_BITS = 5;                        ///< Бит мантиссы: 32 корзины на каждую степень двойки.
+constexpr unsigned LATENCY_SUB = 1u << LATENCY_SUB_BITS;        ///< Корзин на степень двойки.
+constexpr unsigned LATENCY_BUCKETS = (64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB; ///< Всего корзин (весь диапазон uint64_t).
+constexpr size_t TRACE_MAX_SPANS = 1u << 20;                    ///< Предел записей трассировки по умолчанию.
+
+/**
+ * @brief Вид измеряемой операции.
+ */
+enum class IoOp : int
+{
+    Read = 0,     ///< Чтение (Reader::Read, BlockFile::ReadAt).
+    Write,        ///< Запись (Writer::Write, BlockFile::WriteAt).
+    Seek,         ///< Перемещение указателя (Reader/Writer::SetFilePointer).
+    Sync,         ///< Сброс на носитель (BlockFile::Sync).
+    Checkpoint,   ///< Фиксация контрольной точки целиком (DurableCheckpoint::Commit).
+    Count,        ///< Количество видов операций.
+};
+
+/**
+ * @brief Возвращает имя операции для отчета и трассировки.
+ */
+inline const char* IoOpName(IoOp op)
+{
+    switch (op) {
+    case IoOp::Read: return "read";
+    case IoOp::Write: return "write";
+    case IoOp::Seek: return "seek";
+    case IoOp::Sync: return "sync";
+    case IoOp::Checkpoint: return "checkpoint";
+    default: return "unknown";
+    }
+}
+
+/**
+ * @class LatencyHistogram
+ * @brief Гистограмма задержек в духе HdrHistogram.
+ *
+ * Значения в наносекундах раскладываются по корзинам: каждая степень двойки
+ * делится на LATENCY_SUB равных частей, поэтому относительная погрешность
+ * не превышает 1/32 во всем диапазоне. Запись — одно атомарное сложение без блокировок,
+ * гистограмму можно пополнять из любого числа потоков.
+ */
+class LatencyHistogram
+{
+public:
+    /**
+     * @brief Учитывает одно значение.
+     * @param ns Задержка в наносекундах.
+     */
+    void Record(uint64_t ns);
+
+    /**
+     * @brief Возвращает количество учтенных значений.
+     */
+    uint64_t GetCount() const { return count.load(std::memory_order_relaxed); };
+
+    /**
+     * @brief Возвращает максимальное значение в наносекундах.
+     */
+    uint64_t GetMax() const { return maximum.load(std::memory_order_relaxed); };
+
+    /**
+     * @brief Возвращает среднее значение в наносекундах.
+     */
+    double GetMean() const {
+        uint64_t n = GetCount();
+        return n == 0 ? 0.0 : static_cast<double>(total.load(std::memory_order_relaxed)) / n;
+    }
+
+    /**
+     * @brief Возвращает перцентиль (верхнюю границу корзины, но не больше максимума).
+     * @param q Доля от 0 до 1 (например, 0.99).
+     */
+    uint64_t Percentile(double q) const;
+
+    /**
+     * @brief Возвращает номер корзины для значения.
+     */
+    static size_t Bucket(uint64_t ns);
+
+    /**
+     * @brief Возвращает наименьшее значение, попадающее в корзину.
+     */
+    static uint64_t BucketLow(size_t bucket);
+
+private:
+    std::atomic<uint64_t> counts[LATENCY_BUCKETS] = {};  ///< Счетчики корзин.
+    std::atomic<uint64_t> count{0};                      ///< Всего значений.
+    std::atomic<uint64_t> total{0};                      ///< Сумма значений.
+    std::atomic<uint64_t> maximum{0};                    ///< Максимум.
+};
+
+inline size_t LatencyHistogram::Bucket(uint64_t ns)
+{
+    if (ns < LATENCY_SUB)
+        return static_cast<size_t>(ns);
+    #ifdef _WIN32
+    unsigned long index;
+    _BitScanReverse64(&index, ns);   // ns != 0: значения меньше LATENCY_SUB отсечены выше
+    unsigned msb = static_cast<unsigned>(index);
+    #endif // _WIN32
+    #ifdef __linux__
+    unsigned msb = 63 - __builtin_clzll(ns);
+    #endif // __linux__
+    unsigned shift = msb - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB + static_cast<size_t>(ns >> shift) - LATENCY_SUB;
+}
+
+inline uint64_t LatencyHistogram::BucketLow(size_t bucket)
+{
+    if (bucket < LATENCY_SUB)
+        return bucket;
+    size_t shift = bucket / LATENCY_SUB - 1;
+    return static_cast<uint64_t>(LATENCY_SUB + bucket % LATENCY_SUB) << shift;
+}
+
+inline void LatencyHistogram::Record(uint64_t ns)
+{
+    counts[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t seen = maximum.load(std::memory_order_relaxed);
+    while (ns > seen && !maximum.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+}
+
+inline uint64_t LatencyHistogram::Percentile(double q) const
+{
+    const uint64_t n = GetCount();
+    if (n == 0)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * n));
+    rank = rank == 0 ? 1 : (rank > n ? n : rank);
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b != LATENCY_BUCKETS; b++) {
+        seen += counts[b].load(std::memory_order_relaxed);
+        if (seen < rank)
+            continue;
+        uint64_t high = b + 1 == LATENCY_BUCKETS ? UINT64_MAX : BucketLow(b + 1) - 1;
+        return high < GetMax() ? high : GetMax();
+    }
+    return GetMax();
+}
+
+/**
+ * @brief Запись трассировки: одна операция одного потока.
+ */
+struct TraceSpan
+{
+    IoOp op;            ///< Операция.
+    uint32_t thread;    ///< Номер потока в трассировке.
+    uint64_t start;     ///< Начало от создания IoStats, нс.
+    uint64_t duration;  ///< Длительность, нс.
+    uint64_t bytes;     ///< Объем данных.
+    uint64_t offset;    ///< Смещение.
+};
+
+/**
+ * @class IoStats
+ * @brief Статистика задержек операций ввода-вывода одного задания.
+ *
+ * Для каждого вида операции ведется LatencyHistogram. В режиме трассировки
+ * каждая операция дополнительно сохраняется как интервал своего потока и может
+ * быть выгружена в JSON формата Chrome Trace Event (chrome://tracing, ui.perfetto.dev),
+ * где видны простои конвейера и зависания устройства.
+ */
+class IoStats
+{
+public:
+    IoStats() : origin(std::chrono::steady_clock::now()) {};
+
+    IoStats(const IoStats&) = delete;
+    IoStats& operator=(const IoStats&) = delete;
+
+    /**
+     * @brief Учитывает завершенную операцию.
+     * @param op Операция.
+     * @param start Время начала.
+     * @param end Время окончания.
+     * @param bytes Объем данных.
+     * @param offset Смещение.
+     */
+    void Record(IoOp op, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+                uint64_t bytes, uint64_t offset);
+
+    /**
+     * @brief Возвращает гистограмму операции.
+     */
+    const LatencyHistogram& Get(IoOp op) const { return histograms[static_cast<int>(op)]; };
+
+    /**
+     * @brief Включает запись интервалов для трассировки.
+     * @param maxSpans Предел количества записей; последующие операции только учитываются в гистограммах.
+     */
+    void EnableTrace(size_t maxSpans = TRACE_MAX_SPANS);
+
+    /**
+     * @brief Возвращает количество операций, не попавших в трассировку из-за предела.
+     */
+    uint64_t GetDroppedSpans() const { return dropped; };
+
+    /**
+     * @brief Выводит по строке на каждую выполнявшуюся операцию:
+     * количество, среднее, p50, p99, p99.9 и максимум в микросекундах.
+     */
+    void Report(std::ostream& out) const;
+
+    /**
+     * @brief Выгружает трассировку в формате Chrome Trace Event (JSON).
+     * @return false, если трассировка не включалась.
+     */
+    bool SaveTrace(std::ostream& out) const;
+
+private:
+    LatencyHistogram histograms[static_cast<int>(IoOp::Count)]; ///< Гистограммы по операциям.
+    std::chrono::steady_clock::time_point origin;  ///< Начало отсчета трассировки.
+    std::atomic<bool> tracing{false};              ///< Включена ли трассировка.
+    size_t traceLimit = 0;                         ///< Предел записей.
+    std::atomic<uint64_t> dropped{0};              ///< Отброшено записей.
+    mutable std::mutex traceMtx;                   ///< Защищает spans.
+    std::vector<TraceSpan> spans;                  ///< Записи трассировки.
+
+    /**
+     * @brief Возвращает номер текущего потока (1, 2, ... в порядке первого обращения).
+     */
+    static uint32_t ThreadIndex();
+};
+
+inline uint32_t IoStats::ThreadIndex()
+{
+    static std::atomic<uint32_t> next{0};
+    thread_local uint32_t index = ++next;
+    return index;
+}
+
+inline void IoStats::Record(IoOp op, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+                            uint64_t bytes, uint64_t offset)
+{
+    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    histograms[static_cast<int>(op)].Record(ns);
+    if (!tracing.load(std::memory_order_relaxed))
+        return;
+
+    TraceSpan span{op, ThreadIndex(),
+                   static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count()),
+                   ns, bytes, offset};
+    std::lock_guard<std::mutex> lock(traceMtx);
+    if (spans.size() < traceLimit)
+        spans.push_back(span);
+    else
+        dropped++;
+}
+
+inline void IoStats::EnableTrace(size_t maxSpans)
+{
+    std::lock_guard<std::mutex> lock(traceMtx);
+    traceLimit = maxSpans;
+    spans.reserve(maxSpans < 65536 ? maxSpans : 65536);
+    tracing = true;
+}
+
+inline void IoStats::Report(std::ostream& out) const
+{
+    for (int i = 0; i != static_cast<int>(IoOp::Count); i++) {
+        const LatencyHistogram& h = histograms[i];
+        if (h.GetCount() == 0)
+            continue;
+        out << IoOpName(static_cast<IoOp>(i))
+            << ": n=" << h.GetCount()
+            << " mean=" << static_cast<uint64_t>(h.GetMean() / 1000)
+            << " p50=" << h.Percentile(0.5) / 1000
+            << " p99=" << h.Percentile(0.99) / 1000
+            << " p99.9=" << h.Percentile(0.999) / 1000
+            << " max=" << h.GetMax() / 1000 << " us" << std::endl;
+    }
+}
+
+inline bool IoStats::SaveTrace(std::ostream& out) const
+{
+    if (!tracing)
+        return false;
+    std::lock_guard<std::mutex> lock(traceMtx);
+    std::ios_base::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+
+    // Полные события ("ph":"X"), время в микросекундах; tid — номер потока
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    uint32_t threads = 0;
+    bool first = true;
+    for (const TraceSpan& s : spans) {
+        threads = s.thread > threads ? s.thread : threads;
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"" << IoOpName(s.op) << "\",\"cat\":\"io\",\"ph\":\"X\",\"pid\":1,\"tid\":" << s.thread
+            << ",\"ts\":" << s.start / 1000.0 << ",\"dur\":" << s.duration / 1000.0
+            << ",\"args\":{\"bytes\":" << s.bytes << ",\"offset\":" << s.offset << "}}";
+        first = false;
+    }
+    for (uint32_t t = 1; t <= threads; t++) {
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+            << ",\"args\":{\"name\":\"io " << t << "\"}}";
+        first = false;
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+    return out.good();
+}
+
+/**
+ * @class IoTimer
+ * @brief Измеряет время операции от создания до разрушения и учитывает его в IoStats.
+ *
+ * Если статистика не задана (nullptr), часы не опрашиваются и накладных расходов нет.
+ */
+class IoTimer
+{
+public:
+    IoTimer(IoStats* s, IoOp o, uint64_t b = 0, uint64_t off = 0) : stats(s), op(o), bytes(b), offset(off) {
+        if (stats)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~IoTimer() {
+        if (stats)
+            stats->Record(op, start, std::chrono::steady_clock::now(), bytes, offset);
+    }
+
+    IoTimer(const IoTimer&) = delete;
+    IoTimer& operator=(const IoTimer&) = delete;
+
+private:
+    IoStats* stats;                                  ///< Статистика или nullptr.
+    IoOp op;                                         ///< Операция.
+    uint64_t bytes;                                  ///< Объем данных.
+    uint64_t offset;                                 ///< Смещение.
+    std::chrono::steady_clock::time_point start;     ///< Время начала.
+};
+
+#endif // IOSTATS_H_INCLUDED
@@ -0,0 +1,306 @@
+/**
+ * @file MappedFile.h
+ * @brief Заголовочный файл для чтения файлов образов через отображение в память.
+ */
+
+#ifndef MAPPEDFILE_H_INCLUDED
+#define MAPPEDFILE_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include "BlockFile.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
+#endif // __linux__
+
+/**
+ * @class MappedFile
+ * @brief Обычный файл (DD-образ, файл диска ВМ, loop-образ), отображенный в память только для чтения.
+ *
+ * View отдает данные прямо из страничного кэша: проверка нулевых зерен, хэширование
+ * и запись работают с отображением без промежуточного буфера и без системного
+ * вызова на каждый блок. Диски, тома и каналы не отображаются — для них Open возвращает
+ * false, и вызывающий использует BlockFile.
+ *
+ * View заранее подгружает страницы участка и может ждать устройство, поэтому
+ * вызывается внутри TaskScheduler::BlockingScope. Если страницу прочитать нельзя
+ * (ошибка ввода-вывода, файл усечен), View возвращает nullptr вместо SIGBUS,
+ * а ReadAt читает файл обычным позиционным чтением и сообщает об ошибке.
+ * Файл по-прежнему не должен усекаться, пока вызывающий работает с уже полученным участком.
+ */
+class MappedFile : public BlockSource
+{
+public:
+    MappedFile() {};
+
+    ~MappedFile() { Close(); };
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Отображает файл.
+     * @param path Путь к файлу.
+     * @param sequential Подсказка о последовательном чтении (упреждающее чтение и
+     *                   освобождение прочитанных страниц); false — для произвольного доступа.
+     * @return false, если это не обычный файл, он пуст или отображение не удалось.
+     */
+    bool Open(const PathString& path, bool sequential = true);
+
+    /**
+     * @brief Снимает отображение и закрывает файл.
+     */
+    void Close();
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return size; };
+
+    const unsigned char* View(uint64_t offset, uint64_t len) override
+    {
+        if (offset + len > size || offset + len < offset || !Prefault(data + offset, len))
+            return nullptr;
+        return data + offset;
+    };
+
+private:
+    /**
+     * @brief Подгружает страницы участка отображения.
+     * @return false, если страницу не удалось прочитать.
+     */
+    static bool Prefault(const unsigned char* p, uint64_t len);
+
+    #ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE; ///< Хэндл файла.
+    HANDLE mapping = NULL;                    ///< Объект отображения.
+    #endif // _WIN32
+
+    #ifdef __linux__
+    int fd = -1;                              ///< Файловый дескриптор.
+    #endif // __linux__
+
+    const unsigned char* data = nullptr;      ///< Начало отображения.
+    uint64_t size = 0;                        ///< Размер файла.
+};
+
+#ifdef __linux__
+
+namespace MappedFileGuard {
+
+inline thread_local sigjmp_buf* jump = nullptr;   ///< Точка возврата потока, подгружающего страницы.
+inline struct sigaction previous;                 ///< Обработчик SIGBUS до установки защиты.
+
+/**
+ * @brief Возвращает из подгрузки страниц при SIGBUS; вне ее передает сигнал прежнему обработчику.
+ */
+inline void OnSigbus(int sig, siginfo_t* info, void* context)
+{
+    if (jump != nullptr)
+        siglongjmp(*jump, 1);
+    if ((previous.sa_flags & SA_SIGINFO) != 0 && previous.sa_sigaction != nullptr)
+        previous.sa_sigaction(sig, info, context);
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        previous.sa_handler(sig);
+    else
+        sigaction(sig, &previous, nullptr);   // Повторный сбой завершит процесс как обычно
+}
+
+/**
+ * @brief Читает по байту с каждой страницы [begin, end) (отдельно от sigsetjmp, чтобы не терять регистры).
+ */
+__attribute__((noinline)) inline void Touch(uintptr_t begin, uintptr_t end, uintptr_t page)
+{
+    for (uintptr_t addr = begin; addr < end; addr += page)
+        (void)*reinterpret_cast<const volatile unsigned char*>(addr);
+}
+
+inline bool Install()
+{
+    struct sigaction action = {};
+    action.sa_sigaction = OnSigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGBUS, &action, &previous) == 0;
+}
+
+} // namespace MappedFileGuard
+
+inline bool MappedFile::Prefault(const unsigned char* p, uint64_t len)
+{
+    if (len == 0)
+        return true;
+    const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(p) + len;
+
+    #ifdef MADV_POPULATE_READ
+    // Ядро 5.14+: недоступная страница дает ошибку, а не SIGBUS
+    if (madvise(reinterpret_cast<void*>(begin), end - begin, MADV_POPULATE_READ) == 0)
+        return true;
+    if (errno != EINVAL)
+        return false;
+    #endif // MADV_POPULATE_READ
+
+    // Старое ядро: страницы трогаются под защитой обработчика SIGBUS
+    static const bool installed = MappedFileGuard::Install();
+    if (!installed)
+        return false;
+    sigjmp_buf env;
+    if (sigsetjmp(env, 1) != 0) {
+        MappedFileGuard::jump = nullptr;
+        return false;
+    }
+    MappedFileGuard::jump = &env;
+    MappedFileGuard::Touch(begin, end, page);
+    MappedFileGuard::jump = nullptr;
+    return true;
+}
+
+inline bool MappedFile::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > size || offset + len < offset)
+        return false;
+    while (len != 0) {
+        ssize_t n = pread(fd, buf, len, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool MappedFile::Open(const PathString& path, bool sequential)
+{
+    Close();
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        Close();
+        return false;
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    data = static_cast<const unsigned char*>(addr);
+    size = static_cast<uint64_t>(st.st_size);
+
+    // Подсказки необязательны: ошибки madvise не мешают чтению
+    madvise(addr, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    #ifdef MADV_HUGEPAGE
+    madvise(addr, size, MADV_HUGEPAGE);   // Действует для файлов на tmpfs и ФС с большими страницами кэша
+    #endif // MADV_HUGEPAGE
+    return true;
+}
+
+inline void MappedFile::Close()
+{
+    if (data != nullptr)
+        munmap(const_cast<unsigned char*>(data), size);
+    if (fd >= 0)
+        close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+}
+
+#endif // __linux__
+
+#ifdef _WIN32
+
+inline bool MappedFile::Prefault(const unsigned char* p, uint64_t len)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const uint64_t page = info.dwPageSize;
+    #ifdef _MSC_VER
+    // Ошибка чтения страницы приходит исключением EXCEPTION_IN_PAGE_ERROR
+    __try {
+    #endif // _MSC_VER
+        for (uint64_t off = 0; off < len; off += page)
+            (void)*reinterpret_cast<const volatile unsigned char*>(p + off);
+        if (len != 0)
+            (void)*reinterpret_cast<const volatile unsigned char*>(p + len - 1);
+    #ifdef _MSC_VER
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+    #endif // _MSC_VER
+    return true;
+}
+
+inline bool MappedFile::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > size || offset + len < offset)
+        return false;
+    while (len != 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD part = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD n = 0;
+        if (!ReadFile(fileHandle, buf, part, &n, &ov) || n == 0)
+            return false;
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool MappedFile::Open(const PathString& path, bool sequential)
+{
+    Close();
+    if (path.compare(0, 4, L"\\\\.\\") == 0)
+        return false;   // Тома и физические диски (\\.\X:, \\.\PhysicalDriveN) не отображаются
+    fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                             sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (GetFileType(fileHandle) != FILE_TYPE_DISK || !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    mapping = CreateFileMappingW(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        Close();   // Тома и физические диски не отображаются
+        return false;
+    }
+    data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+        Close();
+        return false;
+    }
+    size = static_cast<uint64_t>(fileSize.QuadPart);
+    return true;
+}
+
+inline void MappedFile::Close()
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    if (fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+    data = nullptr;
+    size = 0;
+    mapping = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#endif // _WIN32
+
+#endif // MAPPEDFILE_H_INCLUDED
@@ -0,0 +1,558 @@
+/**
+ * @file NbdServer.h
+ * @brief Заголовочный файл NBD-сервера, публикующего созданные образы только для чтения.
+ *
+ * Реализована часть протокола NBD (fixed newstyle), нужная ядерному клиенту:
+ * NBD_OPT_EXPORT_NAME, NBD_OPT_LIST, NBD_OPT_INFO, NBD_OPT_GO, NBD_OPT_ABORT
+ * и команды READ, FLUSH, DISC. Запись и TRIM отклоняются с EPERM.
+ * Пример подключения: `nbd-client -unix /run/image.sock /dev/nbd0 -N disk -readonly`.
+ */
+
+#ifndef NBDSERVER_H_INCLUDED
+#define NBDSERVER_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <condition_variable>
+#include "BlockFile.h"
+#include "BufferPool.h"
+#include "ImageSource.h"
+#include "UnixSocket.h"
+
+#ifdef __linux__
+#include <endian.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif // __linux__
+
+constexpr uint64_t NBD_MAGIC = 0x4e42444d41474943ull;          ///< "NBDMAGIC".
+constexpr uint64_t NBD_IHAVEOPT = 0x49484156454F5054ull;       ///< "IHAVEOPT".
+constexpr uint64_t NBD_REPLY_MAGIC = 0x3e889045565a9ull;       ///< Магическое число ответа на опцию.
+constexpr uint32_t NBD_REQUEST_MAGIC = 0x25609513;             ///< Магическое число запроса.
+constexpr uint32_t NBD_SIMPLE_REPLY_MAGIC = 0x67446698;        ///< Магическое число простого ответа.
+constexpr uint32_t NBD_MAX_REQUEST = 32 * 1024 * 1024;         ///< Максимальная длина запроса чтения.
+
+/**
+ * @brief Опции и ответы согласования NBD.
+ */
+enum NbdOption : uint32_t
+{
+    NBD_OPT_EXPORT_NAME = 1,
+    NBD_OPT_ABORT = 2,
+    NBD_OPT_LIST = 3,
+    NBD_OPT_INFO = 6,
+    NBD_OPT_GO = 7,
+
+    NBD_REP_ACK = 1,
+    NBD_REP_SERVER = 2,
+    NBD_REP_INFO = 3,
+    NBD_REP_ERR_UNSUP = 0x80000001,
+    NBD_REP_ERR_INVALID = 0x80000003,
+    NBD_REP_ERR_UNKNOWN = 0x80000006
+};
+
+/**
+ * @brief Команды фазы передачи NBD.
+ */
+enum NbdCommand : uint16_t
+{
+    NBD_CMD_READ = 0,
+    NBD_CMD_WRITE = 1,
+    NBD_CMD_DISC = 2,
+    NBD_CMD_FLUSH = 3,
+    NBD_CMD_TRIM = 4,
+    NBD_CMD_WRITE_ZEROES = 6
+};
+
+constexpr uint16_t NBD_FLAG_FIXED_NEWSTYLE = 1;    ///< Флаг сервера: fixed newstyle.
+constexpr uint16_t NBD_FLAG_NO_ZEROES = 2;         ///< Флаг сервера: без 124 нулевых байт.
+constexpr uint16_t NBD_EXPORT_FLAGS = 1 | 2 | 4 | 256;  ///< HAS_FLAGS | READ_ONLY | SEND_FLUSH | CAN_MULTI_CONN.
+
+#pragma pack(push, 1)
+
+/**
+ * @struct NbdHello
+ * @brief Приветствие сервера (все поля в сетевом порядке байт).
+ */
+typedef struct
+{
+    uint64_t magic;       ///< NBD_MAGIC.
+    uint64_t opt;         ///< NBD_IHAVEOPT.
+    uint16_t flags;       ///< Флаги сервера.
+} NbdHello;
+
+/**
+ * @struct NbdOptionHeader
+ * @brief Заголовок опции клиента.
+ */
+typedef struct
+{
+    uint64_t magic;       ///< NBD_IHAVEOPT.
+    uint32_t option;      ///< Опция.
+    uint32_t length;      ///< Длина данных опции.
+} NbdOptionHeader;
+
+/**
+ * @struct NbdOptionReply
+ * @brief Заголовок ответа на опцию.
+ */
+typedef struct
+{
+    uint64_t magic;       ///< NBD_REPLY_MAGIC.
+    uint32_t option;      ///< Опция, на которую дан ответ.
+    uint32_t type;        ///< Тип ответа.
+    uint32_t length;      ///< Длина данных ответа.
+} NbdOptionReply;
+
+/**
+ * @struct NbdRequest
+ * @brief Запрос фазы передачи.
+ */
+typedef struct
+{
+    uint32_t magic;       ///< NBD_REQUEST_MAGIC.
+    uint16_t flags;       ///< Флаги команды.
+    uint16_t type;        ///< Команда.
+    uint64_t handle;      ///< Идентификатор запроса клиента.
+    uint64_t offset;      ///< Смещение.
+    uint32_t length;      ///< Длина.
+} NbdRequest;
+
+/**
+ * @struct NbdSimpleReply
+ * @brief Простой ответ фазы передачи (за ним следуют данные чтения).
+ */
+typedef struct
+{
+    uint32_t magic;       ///< NBD_SIMPLE_REPLY_MAGIC.
+    uint32_t error;       ///< Код ошибки errno (0 — успех).
+    uint64_t handle;      ///< Идентификатор запроса.
+} NbdSimpleReply;
+
+#pragma pack(pop)
+
+#ifdef __linux__
+
+/**
+ * @class NbdServer
+ * @brief NBD-сервер на Unix-сокете или localhost.
+ *
+ * Каждый клиент обслуживается своим потоком, запросы читаются из общих источников
+ * (см. OpenImageSource), поэтому несколько клиентов и несколько соединений одного
+ * клиента (nbd-client -C) работают параллельно и делят кэш блоков.
+ */
+class NbdServer
+{
+public:
+    NbdServer() {};
+
+    ~NbdServer() { Stop(); };
+
+    NbdServer(const NbdServer&) = delete;
+    NbdServer& operator=(const NbdServer&) = delete;
+
+    /**
+     * @brief Публикует источник под именем.
+     * @return false, если имя уже занято.
+     */
+    bool AddExport(const std::string& name, std::shared_ptr<BlockSource> source);
+
+    /**
+     * @brief Открывает образ (см. OpenImageSource) и публикует его под именем.
+     * @return false, если образ не открывается или имя уже занято.
+     */
+    bool AddImage(const std::string& name, const PathString& path, uint64_t cacheBytes = IMAGE_CACHE_BYTES);
+
+    /**
+     * @brief Начинает прием соединений на Unix-сокете (в отдельном потоке).
+     *
+     * Сокет создается с правами 0600 (0660 при доступе для группы), клиенты других
+     * пользователей отключаются (см. OpenUnixListener, UnixPeerAllowed).
+     *
+     * @param path Путь к сокету.
+     * @param groupAccess Разрешить подключение участникам группы сервера.
+     * @return false, если сокет не удалось создать или путь занят.
+     */
+    bool ServeUnix(const std::string& path, bool groupAccess = false);
+
+    /**
+     * @brief Начинает прием соединений на 127.0.0.1:port (в отдельном потоке).
+     */
+    bool ServeTcp(uint16_t port);
+
+    /**
+     * @brief Закрывает все соединения и останавливает прием.
+     */
+    void Stop();
+
+    /**
+     * @brief Возвращает количество открытых соединений.
+     */
+    size_t GetClientCount()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return clientFds.size();
+    }
+
+private:
+    std::map<std::string, std::shared_ptr<BlockSource>> exports;  ///< Опубликованные образы.
+    std::vector<std::thread> listeners;     ///< Потоки приема соединений.
+    std::set<int> clientFds;                ///< Открытые соединения (по одному потоку на каждое).
+    std::mutex mtx;                         ///< Защищает exports и clientFds.
+    std::condition_variable cv;             ///< Оповещение о закрытии соединений.
+    std::atomic<bool> stopping{false};      ///< Признак остановки.
+
+    /**
+     * @brief Цикл приема соединений.
+     * @param unixPath Путь Unix-сокета (пусто для TCP): клиенты проверяются по SO_PEERCRED, сокет удаляется при остановке.
+     */
+    void Listen(int listenFd, std::string unixPath, bool groupAccess);
+
+    void ServeClient(int fd);
+
+    /**
+     * @brief Согласование опций. Возвращает выбранный источник или nullptr.
+     */
+    std::shared_ptr<BlockSource> Negotiate(int fd);
+
+    /**
+     * @brief Фаза передачи: обработка запросов до отключения клиента.
+     */
+    void Transmission(int fd, BlockSource& source);
+
+    std::shared_ptr<BlockSource> FindExport(const std::string& name);
+
+    static bool SendAll(int fd, const void* data, size_t len);
+
+    static bool RecvAll(int fd, void* data, size_t len);
+
+    static bool SendOptionReply(int fd, uint32_t option, uint32_t type, const void* data = nullptr, uint32_t len = 0);
+};
+
+inline bool NbdServer::AddExport(const std::string& name, std::shared_ptr<BlockSource> source)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return source && exports.emplace(name, source).second;
+}
+
+inline bool NbdServer::AddImage(const std::string& name, const PathString& path, uint64_t cacheBytes)
+{
+    std::shared_ptr<BlockSource> source = OpenImageSource(path, cacheBytes);
+    if (!source) {
+        std::cout << "Open image error" << std::endl;
+        return false;
+    }
+    return AddExport(name, source);
+}
+
+inline bool NbdServer::ServeUnix(const std::string& path, bool groupAccess)
+{
+    int listenFd = OpenUnixListener(path, groupAccess);
+    if (listenFd < 0)
+        return false;
+    listeners.emplace_back(&NbdServer::Listen, this, listenFd, path, groupAccess);
+    return true;
+}
+
+inline bool NbdServer::ServeTcp(uint16_t port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+        return false;
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+        close(listenFd);
+        return false;
+    }
+    listeners.emplace_back(&NbdServer::Listen, this, listenFd, std::string(), false);
+    return true;
+}
+
+inline void NbdServer::Stop()
+{
+    stopping = true;
+    for (std::thread& t : listeners)
+        t.join();
+    listeners.clear();
+
+    // Прерываем ожидание запросов во всех соединениях и ждем завершения их потоков
+    std::unique_lock<std::mutex> lock(mtx);
+    for (int fd : clientFds)
+        shutdown(fd, SHUT_RDWR);
+    cv.wait(lock, [this] { return clientFds.empty(); });
+}
+
+inline void NbdServer::Listen(int listenFd, std::string unixPath, bool groupAccess)
+{
+    while (!stopping) {
+        pollfd pfd = { listenFd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        if (unixPath.empty()) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        else if (!UnixPeerAllowed(fd, groupAccess)) {
+            std::cout << "NBD client rejected" << std::endl;
+            close(fd);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping) {
+            close(fd);
+            break;
+        }
+        clientFds.insert(fd);
+        std::thread(&NbdServer::ServeClient, this, fd).detach();
+    }
+    close(listenFd);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+inline void NbdServer::ServeClient(int fd)
+{
+    std::shared_ptr<BlockSource> source = Negotiate(fd);
+    if (source)
+        Transmission(fd, *source);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    clientFds.erase(fd);
+    close(fd);
+    cv.notify_all();
+}
+
+inline std::shared_ptr<BlockSource> NbdServer::FindExport(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    // Пустое имя — экспорт по умолчанию (первый по алфавиту)
+    auto it = name.empty() ? exports.begin() : exports.find(name);
+    return it == exports.end() ? nullptr : it->second;
+}
+
+inline std::shared_ptr<BlockSource> NbdServer::Negotiate(int fd)
+{
+    NbdHello hello = { htobe64(NBD_MAGIC), htobe64(NBD_IHAVEOPT), htobe16(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES) };
+    uint32_t clientFlags;
+    if (!SendAll(fd, &hello, sizeof(hello)) || !RecvAll(fd, &clientFlags, 4))
+        return nullptr;
+    const bool noZeroes = (be32toh(clientFlags) & NBD_FLAG_NO_ZEROES) != 0;
+
+    while (!stopping) {
+        NbdOptionHeader request;
+        if (!RecvAll(fd, &request, sizeof(request)) || be64toh(request.magic) != NBD_IHAVEOPT)
+            return nullptr;
+        const uint32_t option = be32toh(request.option);
+        const uint32_t length = be32toh(request.length);
+        if (length > 64 * 1024)
+            return nullptr;
+        std::vector<unsigned char> data(length);
+        if (length != 0 && !RecvAll(fd, data.data(), length))
+            return nullptr;
+
+        switch (option) {
+        case NBD_OPT_EXPORT_NAME: {
+            std::shared_ptr<BlockSource> source = FindExport(std::string(data.begin(), data.end()));
+            if (!source)
+                return nullptr;   // По протоколу сервер просто закрывает соединение
+            unsigned char reply[10 + 124] = {};
+            uint64_t size = htobe64(source->Size());
+            uint16_t flags = htobe16(NBD_EXPORT_FLAGS);
+            memcpy(reply, &size, 8);
+            memcpy(reply + 8, &flags, 2);
+            if (!SendAll(fd, reply, noZeroes ? 10 : sizeof(reply)))
+                return nullptr;
+            return source;
+        }
+        case NBD_OPT_ABORT:
+            SendOptionReply(fd, option, NBD_REP_ACK);
+            return nullptr;
+        case NBD_OPT_LIST: {
+            std::vector<std::string> names;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                for (auto& e : exports)
+                    names.push_back(e.first);
+            }
+            for (const std::string& name : names) {
+                std::vector<unsigned char> entry(4 + name.size());
+                uint32_t nameLen = htobe32(static_cast<uint32_t>(name.size()));
+                memcpy(entry.data(), &nameLen, 4);
+                memcpy(entry.data() + 4, name.data(), name.size());
+                if (!SendOptionReply(fd, option, NBD_REP_SERVER, entry.data(), static_cast<uint32_t>(entry.size())))
+                    return nullptr;
+            }
+            if (!SendOptionReply(fd, option, NBD_REP_ACK))
+                return nullptr;
+            break;
+        }
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO: {
+            uint32_t nameLen = 0;
+            if (length >= 4)
+                memcpy(&nameLen, data.data(), 4);
+            nameLen = be32toh(nameLen);
+            if (length < 6 || nameLen > length - 6) {
+                if (!SendOptionReply(fd, option, NBD_REP_ERR_INVALID))
+                    return nullptr;
+                break;
+            }
+            std::shared_ptr<BlockSource> source = FindExport(std::string(data.begin() + 4, data.begin() + 4 + nameLen));
+            if (!source) {
+                if (!SendOptionReply(fd, option, NBD_REP_ERR_UNKNOWN))
+                    return nullptr;
+                break;
+            }
+            // NBD_INFO_EXPORT: тип, размер, флаги
+            unsigned char info[12];
+            uint16_t type = 0;
+            uint64_t size = htobe64(source->Size());
+            uint16_t flags = htobe16(NBD_EXPORT_FLAGS);
+            memcpy(info, &type, 2);
+            memcpy(info + 2, &size, 8);
+            memcpy(info + 10, &flags, 2);
+            if (!SendOptionReply(fd, option, NBD_REP_INFO, info, sizeof(info)) ||
+                !SendOptionReply(fd, option, NBD_REP_ACK))
+                return nullptr;
+            if (option == NBD_OPT_GO)
+                return source;
+            break;
+        }
+        default:
+            if (!SendOptionReply(fd, option, NBD_REP_ERR_UNSUP))
+                return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+inline void NbdServer::Transmission(int fd, BlockSource& source)
+{
+    PooledBuffer buffer;
+    while (!stopping) {
+        NbdRequest request;
+        if (!RecvAll(fd, &request, sizeof(request)) || be32toh(request.magic) != NBD_REQUEST_MAGIC)
+            return;
+        const uint16_t type = be16toh(request.type);
+        const uint64_t offset = be64toh(request.offset);
+        const uint32_t length = be32toh(request.length);
+
+        NbdSimpleReply reply = { htobe32(NBD_SIMPLE_REPLY_MAGIC), 0, request.handle };
+
+        switch (type) {
+        case NBD_CMD_READ: {
+            if (length > NBD_MAX_REQUEST || offset + length > source.Size() || offset + length < offset) {
+                reply.error = htobe32(EINVAL);
+                if (!SendAll(fd, &reply, sizeof(reply)))
+                    return;
+                break;
+            }
+            if (buffer.Size() < length)
+                buffer = BufferPool::Shared().Acquire(length);
+            if (!source.ReadAt(buffer.Data(), length, offset)) {
+                reply.error = htobe32(EIO);
+                if (!SendAll(fd, &reply, sizeof(reply)))
+                    return;
+                break;
+            }
+            if (!SendAll(fd, &reply, sizeof(reply)) || !SendAll(fd, buffer.Data(), length))
+                return;
+            break;
+        }
+        case NBD_CMD_WRITE: {
+            // Данные записи нужно дочитать, чтобы не потерять границу следующего запроса
+            if (length > NBD_MAX_REQUEST)
+                return;
+            if (buffer.Size() < length)
+                buffer = BufferPool::Shared().Acquire(length);
+            if (!RecvAll(fd, buffer.Data(), length))
+                return;
+            reply.error = htobe32(EPERM);
+            if (!SendAll(fd, &reply, sizeof(reply)))
+                return;
+            break;
+        }
+        case NBD_CMD_DISC:
+            return;
+        case NBD_CMD_FLUSH:
+            if (!SendAll(fd, &reply, sizeof(reply)))
+                return;
+            break;
+        case NBD_CMD_TRIM:
+        case NBD_CMD_WRITE_ZEROES:
+            reply.error = htobe32(EPERM);
+            if (!SendAll(fd, &reply, sizeof(reply)))
+                return;
+            break;
+        default:
+            reply.error = htobe32(EINVAL);
+            if (!SendAll(fd, &reply, sizeof(reply)))
+                return;
+        }
+    }
+}
+
+inline bool NbdServer::SendAll(int fd, const void* data, size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    while (len != 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool NbdServer::RecvAll(int fd, void* data, size_t len)
+{
+    char* p = static_cast<char*>(data);
+    while (len != 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool NbdServer::SendOptionReply(int fd, uint32_t option, uint32_t type, const void* data, uint32_t len)
+{
+    NbdOptionReply reply = { htobe64(NBD_REPLY_MAGIC), htobe32(option), htobe32(type), htobe32(len) };
+    return SendAll(fd, &reply, sizeof(reply)) && (len == 0 || SendAll(fd, data, len));
+}
+
+#endif // __linux__
+
+#endif // NBDSERVER_H_INCLUDED
@@ -1,8 +1,24 @@
 #ifndef RAWCOPY_H_INCLUDED
 #define RAWCOPY_H_INCLUDED
 
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iomanip>
 #include "DiskInterface.h"
 #include "LogsReadWrite.h"
+#include "BlockFile.h"
+#include "SectorPolicy.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+#include "Checkpoint.h"
+#include "ResumeVerify.h"
+#include "AesXts.h"
+#include "GrainHash.h"
+#include "StreamOutput.h"
+
+constexpr unsigned RAW_STRIPE_WORKERS = 16;   ///< Количество потоков чтения полосами по умолчанию.
 
 /**
  * @class RawCopy
@@ -20,7 +36,15 @@ private:
     time_t endTime;                ///< Время завершения операции.
 
     unsigned long bufSize;         ///< Размер буфера для чтения.
-    unsigned long totalSectors;    ///< Общее количество секторов на диске.
+    uint64_t totalSectors;         ///< Общее количество секторов на диске.
+
+    std::wstring checkpointFile;                   ///< Файл контрольной точки (по умолчанию outFile + ".ckpt").
+    uint64_t checkpointBytes = CHECKPOINT_BYTES;   ///< Объем данных между контрольными точками.
+    unsigned checkpointSeconds = CHECKPOINT_SECONDS; ///< Интервал между контрольными точками.
+
+    std::shared_ptr<const AesXts> cipher;          ///< Ключ шифрования образа (nullptr — без шифрования).
+    std::shared_ptr<IoStats> stats;                ///< Статистика задержек (nullptr — не измеряется).
+    uint64_t streamHash = 0;                       ///< XXH64 последнего потокового вывода.
 
     /**
      * @brief Получает текущее системное время.
@@ -28,6 +52,26 @@ private:
      */
     time_t timeNow();
 
+    /**
+     * @brief Заполняет описание копии для контрольной точки.
+     */
+    CheckpointFields CheckpointLog() const;
+
+    /**
+     * @brief Убирает из выходного файла данные, не относящиеся к этой копии.
+     *
+     * @param writer Выходной файл.
+     * @param SectorsWritten Уже записанные секторы: 0 — файл усекается до пустого.
+     * @param total Размер копии в байтах: более длинный файл усекается до него.
+     * @return false, если усечь файл не удалось.
+     */
+    bool TruncateStale(BlockFile& writer, unsigned long long SectorsWritten, uint64_t total);
+
+    /**
+     * @brief Возвращает путь к файлу контрольной точки в кодировке платформы.
+     */
+    PathString CheckpointPath() const;
+
 public:
     /**
      * @brief Конструктор для инициализации параметров копирования.
@@ -38,7 +82,7 @@ public:
      * @param bS Размер буфера.
      * @param tS Общее количество секторов.
      */
-    RawCopy(std::wstring d, std::wstring sN, std::wstring oF, unsigned long bS, unsigned long tS)
+    RawCopy(std::wstring d, std::wstring sN, std::wstring oF, unsigned long bS, uint64_t tS)
         : disk{d}, serialNumber{sN}, outFile{oF}, bufSize{bS}, totalSectors{tS} {};
 
     /**
@@ -50,6 +94,142 @@ public:
      */
     bool CreateRawCopy(unsigned long long SectorsWritten);
 
+    /**
+     * @brief Создаёт RAW-копию диска многопоточно.
+     *
+     * Диск делится на участки размером с буфер, каждый участок читается и записывается
+     * по тому же смещению отдельной задачей общего планировщика (TaskScheduler::Shared()).
+     * Непрерывно записанная от начала часть периодически фиксируется в контрольной
+     * точке (см. SetCheckpoint, DurableCheckpoint).
+     *
+     * @param SectorsWritten Количество секторов, которые уже были записаны (в случае возобновления копирования).
+     * @return true, если копирование успешно завершено.
+     * @return false, если возникла ошибка.
+     */
+    bool CreateRawCopyThreads(unsigned long long SectorsWritten);
+
+    /**
+     * @brief Создаёт RAW-копию многопоточно, читая данные из `source`, а не с диска `disk`.
+     *
+     * Позволяет прогнать движок на имитируемом диске (SimulatedDisk) или другом источнике;
+     * в остальном совпадает с CreateRawCopyThreads(unsigned long long).
+     *
+     * @param source Источник данных размером не меньше totalSectors секторов.
+     * @param SectorsWritten Количество секторов, которые уже были записаны (в случае возобновления копирования).
+     * @return true, если копирование успешно завершено.
+     * @return false, если возникла ошибка.
+     */
+    bool CreateRawCopyThreads(BlockSource& source, unsigned long long SectorsWritten);
+
+    /**
+     * @brief Создаёт RAW-копию диска чтением полосами в несколько потоков.
+     *
+     * Диапазон секторов делится на полосы размером `stripeBytes`; поток `w` из `workers`
+     * читает полосы w, w + workers, w + 2*workers и т.д. позиционным чтением и пишет их
+     * по тем же смещениям. Так у устройства постоянно `workers` запросов в очереди
+     * независимо от числа ядер, что нужно NVMe и RAID для полной скорости. Потоки идут
+     * вровень, поэтому непрерывно записанная часть растет равномерно и фиксируется
+     * в контрольной точке так же, как в CreateRawCopyThreads.
+     *
+     * @param SectorsWritten Количество секторов, которые уже были записаны (в случае возобновления копирования).
+     * @param workers Количество потоков (глубина очереди устройства).
+     * @param stripeBytes Размер полосы (0 — размер буфера), округляется вниз до кратного 512.
+     * @return true, если копирование успешно завершено.
+     * @return false, если возникла ошибка.
+     */
+    bool CreateRawCopyStriped(unsigned long long SectorsWritten, unsigned workers = RAW_STRIPE_WORKERS,
+                              uint64_t stripeBytes = 0);
+
+    /**
+     * @brief Создаёт сжатую RAW-копию диска в формате zstd seekable.
+     *
+     * Диск делится на кадры одинакового несжатого размера, которые сжимаются
+     * параллельно (см. SeekableZstdWriter). Образ читается с любого смещения
+     * через SeekableZstdReader и распаковывается штатной утилитой zstd.
+     * Определение находится в RawCopyZstd.h: только его включение требует libzstd.
+     *
+     * @param level Уровень сжатия zstd.
+     * @param frameBytes Несжатый размер кадра (0 — ZSTD_FRAME_BYTES).
+     * @return true, если копирование успешно завершено.
+     * @return false, если возникла ошибка.
+     */
+    bool CreateCompressedCopy(int level = 3, uint64_t frameBytes = 0);
+
+    /**
+     * @brief Выводит RAW-копию диска потоком в stdout, FIFO или канал (см. StreamOutput).
+     *
+     * Промежуточный файл не создается: чтение следующего участка идет параллельно
+     * с передачей текущего, а в канал Linux страницы передаются через vmsplice без копирования.
+     * По ходу вычисляется XXH64 всего потока (GetStreamHash) и раз в секунду в stderr
+     * выводятся объем и скорость. Все сообщения идут в stderr, так как stdout может быть выходом.
+     * Контрольные точки не ведутся: поток нельзя продолжить.
+     *
+     * @param target Путь к FIFO, каналу или файлу; "-" — стандартный вывод.
+     * @return true, если весь диск передан.
+     * @return false, если возникла ошибка или читатель закрыл канал.
+     */
+    bool CreateRawCopyStream(const PathString& target);
+
+    /**
+     * @brief Возвращает XXH64 данных, переданных последним CreateRawCopyStream.
+     */
+    uint64_t GetStreamHash() const { return streamHash; };
+
+    /**
+     * @brief Проверяет частичный образ перед возобновлением копирования.
+     *
+     * Сравнивает хэши окна перед контрольной точкой и случайных участков скопированной
+     * части источника и образа (см. ResumeVerifier). Вместо повторного копирования
+     * всего диска проверка занимает секунды.
+     *
+     * @param[in] SectorsWritten Количество секторов из контрольной точки.
+     * @param[out] SectorsValid Количество секторов, с которого можно продолжать копирование.
+     * @param windowBytes Окно перед контрольной точкой в байтах.
+     * @param samples Количество случайных участков.
+     * @return false, если источник или образ не удалось прочитать.
+     */
+    bool VerifyResume(unsigned long long SectorsWritten, unsigned long long& SectorsValid,
+                      uint64_t windowBytes = 64ull * 1024 * 1024, uint32_t samples = 64);
+
+    /**
+     * @brief Настраивает контрольные точки многопоточного копирования.
+     *
+     * Контрольная точка фиксируется после сброса выходного файла на носитель,
+     * поэтому при возобновлении ее значение можно передавать в CreateRawCopyThreads.
+     *
+     * @param path Файл контрольной точки.
+     * @param everyBytes Объем данных между контрольными точками.
+     * @param everySeconds Интервал между контрольными точками в секундах.
+     */
+    void SetCheckpoint(std::wstring path, uint64_t everyBytes = CHECKPOINT_BYTES, unsigned everySeconds = CHECKPOINT_SECONDS)
+    {
+        checkpointFile = path;
+        checkpointBytes = everyBytes;
+        checkpointSeconds = everySeconds;
+    }
+
+    /**
+     * @brief Включает шифрование образа многопоточного копирования (см. AesXts).
+     *
+     * Каждый сектор шифруется с tweak, равным его номеру, поэтому образ читается
+     * с любого смещения через DecryptingSource. Сжатые копии не шифруются.
+     *
+     * @param c Ключ или nullptr, чтобы отключить шифрование.
+     */
+    void SetCipher(std::shared_ptr<const AesXts> c) { cipher = c; };
+
+    /**
+     * @brief Включает измерение задержек чтения, записи, сброса и контрольных точек (см. IoStats).
+     *
+     * @param s Статистика задания или nullptr, чтобы отключить измерение.
+     */
+    void SetStats(std::shared_ptr<IoStats> s) { stats = s; };
+
+    /**
+     * @brief Возвращает путь к файлу контрольной точки.
+     */
+    std::wstring GetCheckpointFile() const { return checkpointFile.empty() ? outFile + L".ckpt" : checkpointFile; };
+
     /**
      * @brief Возвращает время, затраченное на создание RAW-копии.
      *
@@ -81,4 +261,324 @@ public:
     std::wstring tToWcs(time_t timeToWcs);
 };
 
+inline bool RawCopy::CreateRawCopyThreads(unsigned long long SectorsWritten)
+{
+    BlockFile reader;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    reader.SetCacheHygiene();
+    reader.SetStats(stats.get());
+    return CreateRawCopyThreads(reader, SectorsWritten);
+}
+
+inline bool RawCopy::CreateRawCopyThreads(BlockSource& reader, unsigned long long SectorsWritten)
+{
+    startTime = time(nullptr);
+
+    BlockFile writer;
+    if (!writer.Open(outFile, BlockFileMode::ReadWrite)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    writer.SetCacheHygiene();
+    writer.SetStats(stats.get());
+
+    const uint64_t total = (uint64_t)totalSectors * SECTOR_SIZE;
+    if (!TruncateStale(writer, SectorsWritten, total))
+        return false;
+    const uint64_t chunk = bufSize < SECTOR_SIZE ? SECTOR_SIZE : bufSize / SECTOR_SIZE * SECTOR_SIZE;
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    // Образ размещается одним куском: запись вразнобой из задач его не фрагментирует
+    writer.Preallocate(0, total);
+
+    DurableCheckpoint checkpoint(writer, CheckpointPath(), CheckpointLog(), SectorsWritten * SECTOR_SIZE,
+                                 checkpointBytes, checkpointSeconds);
+
+    TaskGroup group(scheduler);
+    std::atomic<bool> failed(false);
+
+    for (uint64_t pos = SectorsWritten * SECTOR_SIZE; pos < total && !failed; pos += chunk) {
+        uint64_t len = total - pos < chunk ? total - pos : chunk;
+        group.WaitBelow(2 * scheduler.GetConcurrency());
+        group.Run([&, pos, len] {
+            PooledBuffer buffer = BufferPool::Shared().Acquire(len);
+            TaskScheduler::BlockingScope blocking;
+            if (!reader.ReadAt(buffer.Data(), len, pos)) {
+                std::cout << "READ error" << std::endl;
+                failed = true;
+                return;
+            }
+            if (cipher && !cipher->Encrypt(buffer.Data(), len, pos)) {
+                failed = true;
+                return;
+            }
+            if (!writer.WriteAt(buffer.Data(), len, pos)) {
+                std::cout << "Write data error" << std::endl;
+                failed = true;
+            }
+            else if (!checkpoint.Completed(pos, len)) {
+                failed = true;
+            }
+        });
+    }
+    group.Wait();
+    if (failed)
+        writer.TrimPreallocated();   // Копия оборвалась: запас за концом записанной части не нужен
+
+    // Последняя контрольная точка фиксирует всю записанную часть, в том числе при ошибке
+    if (!checkpoint.Commit())
+        failed = true;
+    // Копия завершена: контрольная точка не должна выдавать ее за незавершенную
+    if (!failed && checkpoint.GetDurableSectors() >= totalSectors && !checkpoint.Remove()) {
+        std::cout << "Checkpoint remove error" << std::endl;
+        failed = true;
+    }
+
+    endTime = time(nullptr);
+    return !failed;
+}
+
+inline bool RawCopy::CreateRawCopyStriped(unsigned long long SectorsWritten, unsigned workers, uint64_t stripeBytes)
+{
+    startTime = time(nullptr);
+
+    BlockFile reader;
+    BlockFile writer;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    if (!writer.Open(outFile, BlockFileMode::ReadWrite)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    reader.SetCacheHygiene();
+    writer.SetCacheHygiene();
+    reader.SetStats(stats.get());
+    writer.SetStats(stats.get());
+
+    const uint64_t total = (uint64_t)totalSectors * SECTOR_SIZE;
+    const uint64_t begin = SectorsWritten * SECTOR_SIZE;
+    if (!TruncateStale(writer, SectorsWritten, total))
+        return false;
+    writer.Preallocate(0, total);   // Полосы пишутся одновременно в разные места файла
+    if (stripeBytes == 0)
+        stripeBytes = bufSize;
+    const uint64_t stripe = stripeBytes < SECTOR_SIZE ? SECTOR_SIZE : stripeBytes / SECTOR_SIZE * SECTOR_SIZE;
+    const uint64_t stripes = total > begin ? (total - begin + stripe - 1) / stripe : 0;
+    if (workers == 0)
+        workers = 1;
+    if (workers > stripes)
+        workers = stripes == 0 ? 1 : static_cast<unsigned>(stripes);
+
+    DurableCheckpoint checkpoint(writer, CheckpointPath(), CheckpointLog(), begin, checkpointBytes, checkpointSeconds);
+    std::atomic<bool> failed(false);
+
+    // Потоки не берутся из общего планировщика: они только ждут устройство,
+    // а их число задает глубину очереди, а не загрузку ядер
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w != workers; w++) {
+        threads.emplace_back([&, w] {
+            PooledBuffer buffer = BufferPool::Shared().Acquire(stripe);
+            for (uint64_t k = w; k < stripes && !failed; k += workers) {
+                uint64_t pos = begin + k * stripe;
+                uint64_t len = total - pos < stripe ? total - pos : stripe;
+                if (!reader.ReadAt(buffer.Data(), len, pos)) {
+                    std::cout << "READ error" << std::endl;
+                    failed = true;
+                    return;
+                }
+                if (cipher && !cipher->Encrypt(buffer.Data(), len, pos)) {
+                    failed = true;
+                    return;
+                }
+                if (!writer.WriteAt(buffer.Data(), len, pos)) {
+                    std::cout << "Write data error" << std::endl;
+                    failed = true;
+                    return;
+                }
+                if (!checkpoint.Completed(pos, len)) {
+                    failed = true;
+                    return;
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    if (failed)
+        writer.TrimPreallocated();   // Копия оборвалась: запас за концом записанной части не нужен
+
+    // Последняя контрольная точка фиксирует всю записанную часть, в том числе при ошибке
+    if (!checkpoint.Commit())
+        failed = true;
+    // Копия завершена: контрольная точка не должна выдавать ее за незавершенную
+    if (!failed && checkpoint.GetDurableSectors() >= totalSectors && !checkpoint.Remove()) {
+        std::cout << "Checkpoint remove error" << std::endl;
+        failed = true;
+    }
+
+    endTime = time(nullptr);
+    return !failed;
+}
+
+inline bool RawCopy::CreateRawCopyStream(const PathString& target)
+{
+    startTime = time(nullptr);
+    streamHash = 0;
+
+    BlockFile reader;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cerr << "Open disk error" << std::endl;
+        return false;
+    }
+    reader.SetCacheHygiene();
+    reader.SetStats(stats.get());
+
+    // Буферы объявлены раньше выхода: при закрытии канал дочитывается до их освобождения
+    std::vector<PooledBuffer> ring;
+    StreamOutput out;
+    if (!out.Open(target)) {
+        std::cerr << "Open file error" << std::endl;
+        return false;
+    }
+
+    // В канале одновременно не больше двух участков по половине его емкости:
+    // после передачи участка k свободны участки до k-2, поэтому четырех буферов
+    // хватает, чтобы читать k+1, пока передается k
+    uint64_t chunk = bufSize < SECTOR_SIZE ? SECTOR_SIZE : bufSize / SECTOR_SIZE * SECTOR_SIZE;
+    if (out.GetPipeBytes() != 0)
+        chunk = out.GetPipeBytes() / 2;
+    for (int i = 0; i != 4; i++)
+        ring.push_back(BufferPool::Shared().Acquire(chunk));
+
+    const uint64_t total = (uint64_t)totalSectors * SECTOR_SIZE;
+    const uint64_t chunks = (total + chunk - 1) / chunk;
+    std::atomic<bool> readFailed(false);
+    auto readChunk = [&](uint64_t k) {
+        uint64_t pos = k * chunk;
+        uint64_t len = total - pos < chunk ? total - pos : chunk;
+        TaskScheduler::BlockingScope blocking;
+        if (!reader.ReadAt(ring[k % 4].Data(), len, pos)) {
+            readFailed = true;
+            return;
+        }
+        if (cipher && !cipher->Encrypt(ring[k % 4].Data(), len, pos))
+            readFailed = true;
+    };
+
+    TaskGroup group(TaskScheduler::Shared());
+    GrainHashStream hash;
+    bool failed = false;
+    auto began = std::chrono::steady_clock::now();
+    auto reported = began;
+    if (chunks != 0)
+        readChunk(0);
+
+    for (uint64_t k = 0; k != chunks && !failed; k++) {
+        if (k + 1 != chunks)
+            group.Run([&, k] { readChunk(k + 1); });
+
+        uint64_t pos = k * chunk;
+        uint64_t len = total - pos < chunk ? total - pos : chunk;
+        if (readFailed) {
+            std::cerr << "READ error" << std::endl;
+            failed = true;
+        }
+        else {
+            hash.Update(ring[k % 4].Data(), len);
+            IoTimer timer(stats.get(), IoOp::Write, len, pos);
+            if (!out.Write(ring[k % 4].Data(), len)) {
+                std::cerr << "Write data error" << std::endl;
+                failed = true;
+            }
+        }
+        group.Wait();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - reported >= std::chrono::seconds(1) || k + 1 == chunks) {
+            double seconds = std::chrono::duration<double>(now - began).count();
+            uint64_t done = pos + len;
+            std::cerr << "Streamed " << done / (1024 * 1024) << " / " << total / (1024 * 1024) << " MiB, "
+                      << static_cast<uint64_t>(seconds > 0 ? done / seconds / (1024 * 1024) : 0) << " MiB/s" << std::endl;
+            reported = now;
+        }
+    }
+    if (readFailed && !failed) {
+        std::cerr << "READ error" << std::endl;
+        failed = true;
+    }
+    out.Close();
+
+    streamHash = hash.Digest();
+    std::cerr << "XXH64 " << std::hex << std::setw(16) << std::setfill('0') << streamHash
+              << std::dec << std::setfill(' ') << std::endl;
+    endTime = time(nullptr);
+    return !failed;
+}
+
+inline bool RawCopy::TruncateStale(BlockFile& writer, unsigned long long SectorsWritten, uint64_t total)
+{
+    // Новая копия начинается с пустого файла; при возобновлении записанная часть
+    // сохраняется, но хвост более длинного прежнего файла отрезается
+    bool truncated = SectorsWritten == 0 ? writer.Truncate(0) : writer.Size() <= total || writer.Truncate(total);
+    if (!truncated)
+        std::cout << "Open file error" << std::endl;
+    return truncated;
+}
+
+inline CheckpointFields RawCopy::CheckpointLog() const
+{
+    CheckpointFields log;
+    log.type = ImageType::DD;
+    log.disk = disk;
+    log.serialNum = serialNumber;
+    size_t slash = outFile.find_last_of(L"\\/");
+    log.outFileDir = slash == std::wstring::npos ? L"" : outFile.substr(0, slash);
+    log.outFileName = slash == std::wstring::npos ? outFile : outFile.substr(slash + 1);
+    log.totalSectors = totalSectors;
+    return log;
+}
+
+inline PathString RawCopy::CheckpointPath() const
+{
+    #ifdef _WIN32
+    return GetCheckpointFile();
+    #endif // _WIN32
+    #ifdef __linux__
+    return BlockFile::WCharToString(GetCheckpointFile());
+    #endif // __linux__
+}
+
+inline bool RawCopy::VerifyResume(unsigned long long SectorsWritten, unsigned long long& SectorsValid,
+                                  uint64_t windowBytes, uint32_t samples)
+{
+    SectorsValid = 0;
+    BlockFile reader;
+    BlockFile image;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    if (!image.Open(outFile, BlockFileMode::Read)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+
+    const uint64_t chunk = bufSize < SECTOR_SIZE ? SECTOR_SIZE : bufSize / SECTOR_SIZE * SECTOR_SIZE;
+    ResumeVerifier verifier(windowBytes, samples, chunk);
+    uint64_t validBytes = 0;
+    if (cipher) {
+        DecryptingSource plain(image, *cipher);
+        if (!verifier.Verify(reader, plain, SectorsWritten * SECTOR_SIZE, validBytes))
+            return false;
+    }
+    else if (!verifier.Verify(reader, image, SectorsWritten * SECTOR_SIZE, validBytes))
+        return false;
+    SectorsValid = validBytes / SECTOR_SIZE;
+    return true;
+}
+
 #endif // RAWCOPY_H_INCLUDED
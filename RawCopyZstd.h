@@ -0,0 +1,45 @@
+/**
+ * @file RawCopyZstd.h
+ * @brief Заголовочный файл сжатой RAW-копии (RawCopy::CreateCompressedCopy).
+ *
+ * Вынесен из RawCopy.h, чтобы остальные режимы копирования собирались без libzstd.
+ * Требуется библиотека libzstd (-lzstd).
+ */
+
+#ifndef RAWCOPYZSTD_H_INCLUDED
+#define RAWCOPYZSTD_H_INCLUDED
+
+#include "RawCopy.h"
+#include "ZstdSeekable.h"
+
+inline bool RawCopy::CreateCompressedCopy(int level, uint64_t frameBytes)
+{
+    if (cipher) {
+        std::cout << "Encryption is not supported for compressed images" << std::endl;
+        return false;
+    }
+    startTime = time(nullptr);
+
+    BlockFile reader;
+    BlockFile writer;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    if (!writer.Open(outFile, BlockFileMode::Write)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    reader.SetCacheHygiene();
+    writer.SetCacheHygiene();
+    reader.SetStats(stats.get());
+    writer.SetStats(stats.get());
+
+    SeekableZstdWriter compressor(frameBytes != 0 ? frameBytes : ZSTD_FRAME_BYTES, level);
+    bool ok = compressor.Write(reader, (uint64_t)totalSectors * SECTOR_SIZE, writer) && writer.Sync();
+
+    endTime = time(nullptr);
+    return ok;
+}
+
+#endif // RAWCOPYZSTD_H_INCLUDED
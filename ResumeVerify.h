@@ -0,0 +1,137 @@
+/**
+ * @file ResumeVerify.h
+ * @brief Заголовочный файл для быстрой проверки частичного образа перед возобновлением копирования.
+ */
+
+#ifndef RESUMEVERIFY_H_INCLUDED
+#define RESUMEVERIFY_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include "BlockFile.h"
+#include "GrainHash.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+
+/**
+ * @class ResumeVerifier
+ * @brief Сравнивает уже скопированную часть образа с источником по выборке.
+ *
+ * Проверяются окно непосредственно перед контрольной точкой (там вероятнее всего
+ * оборванная запись) и случайные участки по всей скопированной части. Для каждого
+ * участка сравниваются хэши XXH64 источника и образа. Участки читаются параллельно
+ * задачами общего планировщика.
+ */
+class ResumeVerifier
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param tailBytes Размер проверяемого окна перед контрольной точкой.
+     * @param sampleCount Количество случайных участков.
+     * @param chunkBytes Размер одного сравниваемого участка.
+     * @param sampleSeed Зерно генератора смещений.
+     */
+    ResumeVerifier(uint64_t tailBytes = 64ull * 1024 * 1024, uint32_t sampleCount = 64,
+                   uint64_t chunkBytes = 1024 * 1024, uint64_t sampleSeed = 1)
+        : window(tailBytes), samples(sampleCount), chunk(chunkBytes), seed(sampleSeed) {};
+
+    /**
+     * @brief Проверяет частичный образ.
+     *
+     * @param source Источник (диск).
+     * @param image Частичный образ.
+     * @param writtenBytes Скопированная часть в байтах (значение контрольной точки).
+     * @param[out] validBytes Часть, с конца которой можно продолжать копирование:
+     *             writtenBytes, если расхождений нет, иначе начало первого несовпавшего участка.
+     * @return false, если источник или образ не удалось прочитать.
+     */
+    bool Verify(BlockSource& source, BlockSource& image, uint64_t writtenBytes, uint64_t& validBytes);
+
+    /**
+     * @brief Возвращает количество участков, сравненных при последней проверке.
+     */
+    uint64_t GetCheckedChunks() const { return checked; };
+
+private:
+    uint64_t window;         ///< Окно перед контрольной точкой.
+    uint32_t samples;        ///< Количество случайных участков.
+    uint64_t chunk;          ///< Размер участка.
+    uint64_t seed;           ///< Зерно генератора.
+    uint64_t checked = 0;    ///< Сравнено участков.
+};
+
+inline bool ResumeVerifier::Verify(BlockSource& source, BlockSource& image, uint64_t writtenBytes, uint64_t& validBytes)
+{
+    validBytes = writtenBytes;
+    checked = 0;
+    if (writtenBytes == 0 || chunk == 0)
+        return true;
+
+    // Образ короче контрольной точки: проверяется только то, что в нем есть
+    if (image.Size() < writtenBytes) {
+        writtenBytes = image.Size() / chunk * chunk;
+        validBytes = writtenBytes;
+        if (writtenBytes == 0)
+            return true;
+    }
+
+    // Участки выровнены по chunk от начала, последний может быть короче
+    const uint64_t chunks = (writtenBytes + chunk - 1) / chunk;
+    const uint64_t tailChunks = std::min(chunks, (window + chunk - 1) / chunk);
+    std::vector<uint64_t> order;
+    for (uint64_t i = chunks - tailChunks; i != chunks; i++)
+        order.push_back(i);
+
+    if (chunks > tailChunks && samples != 0) {
+        std::mt19937_64 gen(seed);
+        std::uniform_int_distribution<uint64_t> dist(0, chunks - tailChunks - 1);
+        for (uint32_t i = 0; i != samples; i++)
+            order.push_back(dist(gen));
+    }
+    std::sort(order.begin(), order.end());
+    order.erase(std::unique(order.begin(), order.end()), order.end());
+
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    TaskGroup group(scheduler);
+    std::atomic<bool> failed(false);
+    std::atomic<uint64_t> firstBad(writtenBytes);
+
+    for (uint64_t index : order) {
+        group.WaitBelow(2 * scheduler.GetConcurrency());
+        group.Run([&, index] {
+            const uint64_t pos = index * chunk;
+            const uint64_t len = std::min(chunk, writtenBytes - pos);
+            PooledBuffer src = BufferPool::Shared().Acquire(len);
+            PooledBuffer img = BufferPool::Shared().Acquire(len);
+            bool read;
+            {
+                TaskScheduler::BlockingScope blocking;
+                read = source.ReadAt(src.Data(), len, pos) && image.ReadAt(img.Data(), len, pos);
+            }
+            if (!read) {
+                failed = true;
+                return;
+            }
+            if (GrainHash64(src.Data(), len) != GrainHash64(img.Data(), len)) {
+                uint64_t bad = firstBad;
+                while (pos < bad && !firstBad.compare_exchange_weak(bad, pos)) {}
+            }
+        });
+    }
+    group.Wait();
+
+    checked = order.size();
+    if (failed) {
+        std::cout << "READ error" << std::endl;
+        return false;
+    }
+    validBytes = firstBad;
+    return true;
+}
+
+#endif // RESUMEVERIFY_H_INCLUDED
@@ -0,0 +1,84 @@
+/**
+ * @file SectorPolicy.h
+ * @brief Заголовочный файл с политиками размера сектора и общими константами геометрии.
+ */
+
+#ifndef SECTORPOLICY_H_INCLUDED
+#define SECTORPOLICY_H_INCLUDED
+
+#include <cstdint>
+
+#define SECTOR_SIZE 512               ///< Размер сектора VMDK в байтах (единица смещений в формате)
+#define FLAT_HEADS 255                ///< Количество головок для monolithicFlat (lsilogic)
+#define SPARSE_HEADS 16               ///< Количество головок для monolithicSparse (ide)
+#define SECTORS 63                    ///< Количество секторов на дорожке
+
+/**
+ * @brief Вычисляет log2 размера сектора на этапе компиляции.
+ */
+constexpr uint32_t SectorShift(uint32_t n) { return n <= 1 ? 0 : 1 + SectorShift(n >> 1); }
+
+/**
+ * @struct SectorPolicy
+ * @brief Политика размера сектора устройства.
+ *
+ * Все пересчёты смещений и выравнивание выполняются на этапе компиляции
+ * сдвигами и масками. Движки копирования параметризуются политикой и
+ * инстанцируются для 512 и 4096 байт (см. DispatchSectorSize).
+ *
+ * @tparam N Размер физического сектора в байтах (степень двойки, не меньше 512).
+ */
+template<uint32_t N>
+struct SectorPolicy
+{
+    static_assert(N >= 512 && (N & (N - 1)) == 0, "Размер сектора должен быть степенью двойки не меньше 512");
+
+    static constexpr uint32_t size = N;                                  ///< Размер сектора в байтах.
+    static constexpr uint32_t shift = SectorShift(N);                    ///< log2(N).
+    static constexpr uint64_t mask = N - 1;                              ///< Маска смещения внутри сектора.
+    static constexpr uint32_t vmdkSectorsPerSector = N / SECTOR_SIZE;    ///< Секторов VMDK в одном секторе устройства.
+
+    /// Переводит сектора устройства в байты.
+    static constexpr uint64_t ToBytes(uint64_t sectors) { return sectors << shift; }
+
+    /// Переводит байты в целые сектора устройства (с округлением вниз).
+    static constexpr uint64_t ToSectors(uint64_t bytes) { return bytes >> shift; }
+
+    /// Переводит сектора устройства в сектора VMDK (512 байт).
+    static constexpr uint64_t ToVmdkSectors(uint64_t sectors) { return sectors * vmdkSectorsPerSector; }
+
+    /// Округляет вверх до границы сектора.
+    static constexpr uint64_t AlignUp(uint64_t bytes) { return (bytes + mask) & ~mask; }
+
+    /// Округляет вниз до границы сектора.
+    static constexpr uint64_t AlignDown(uint64_t bytes) { return bytes & ~mask; }
+
+    /// Проверяет выравнивание смещения или длины по сектору.
+    static constexpr bool IsAligned(uint64_t bytes) { return (bytes & mask) == 0; }
+};
+
+typedef SectorPolicy<512> Sector512;    ///< Диски 512n и 512e.
+typedef SectorPolicy<4096> Sector4096;  ///< Диски 4Kn.
+
+static_assert(Sector512::shift == 9 && Sector4096::shift == 12, "Неверный сдвиг политики сектора");
+static_assert(Sector4096::AlignUp(4097) == 8192 && Sector4096::AlignDown(4097) == 4096, "Неверное выравнивание");
+
+/**
+ * @brief Вызывает функцию с политикой, соответствующей физическому размеру сектора.
+ *
+ * Используется движками копирования, чтобы выбрать инстанцирование во время выполнения
+ * по геометрии устройства (DiskInfoStruct::physicalSectorSize или BlockFile::SectorSize()).
+ *
+ * @param physicalSectorSize Физический размер сектора устройства в байтах.
+ * @param f Функция, принимающая объект политики (Sector512 или Sector4096).
+ * @return Результат функции.
+ */
+template<typename F>
+auto DispatchSectorSize(uint32_t physicalSectorSize, F&& f) -> decltype(f(Sector512()))
+{
+    if (physicalSectorSize >= Sector4096::size)
+        return f(Sector4096());
+    return f(Sector512());
+}
+
+#endif // SECTORPOLICY_H_INCLUDED
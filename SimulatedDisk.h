@@ -0,0 +1,263 @@
+/**
+ * @file SimulatedDisk.h
+ * @brief Заголовочный файл для имитации блочного устройства с задаваемыми задержками, пропускной способностью и ошибками.
+ */
+
+#ifndef SIMULATEDDISK_H_INCLUDED
+#define SIMULATEDDISK_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "BlockFile.h"
+
+/**
+ * @brief Содержимое имитируемого диска.
+ */
+enum class SimContent : int
+{
+    Zero = 0,      ///< Весь диск нулевой.
+    Dense,         ///< Псевдослучайные данные без нулевых блоков.
+    Sparse,        ///< Часть блоков с псевдослучайными данными, остальные нулевые (см. dataFraction).
+    Pattern,       ///< Каждое 8-байтовое слово содержит свое смещение: удобно для проверки копии.
+};
+
+/**
+ * @struct SimulatedDiskConfig
+ * @brief Параметры имитируемого диска.
+ *
+ * Все случайные величины определяются зерном, смещением и длиной запроса, а не порядком
+ * запросов, поэтому содержимое, задержки и ошибки воспроизводятся при любом числе потоков.
+ */
+struct SimulatedDiskConfig
+{
+    uint64_t sizeBytes = 0;                 ///< Размер диска в байтах.
+    uint32_t sectorBytes = 512;             ///< Размер сектора: смещение и длина запроса должны быть кратны ему.
+    SimContent content = SimContent::Dense; ///< Генератор содержимого.
+    uint64_t blockBytes = 64 * 1024;        ///< Размер блока для SimContent::Sparse.
+    double dataFraction = 0.25;             ///< Доля блоков с данными для SimContent::Sparse.
+    uint64_t seed = 1;                      ///< Зерно генераторов.
+
+    uint64_t latencyMicros = 0;             ///< Базовая задержка запроса, мкс.
+    uint64_t jitterMicros = 0;              ///< Добавка к задержке, равномерно распределенная в [0, jitterMicros].
+    double tailProbability = 0;             ///< Вероятность медленного запроса.
+    uint64_t tailMicros = 0;                ///< Задержка медленного запроса, мкс (вместо базовой).
+
+    uint64_t bytesPerSecond = 0;            ///< Пропускная способность (0 — без ограничения).
+    uint32_t queueDepth = 0;                ///< Максимум одновременных запросов, остальные ждут (0 — без ограничения).
+};
+
+/**
+ * @class SimulatedDisk
+ * @brief Источник данных, имитирующий блочное устройство.
+ *
+ * Время обслуживания запроса — максимум из его задержки и окончания передачи
+ * через общий канал с ограниченной пропускной способностью. Запросы сверх глубины
+ * очереди ждут освобождения места. Ошибки чтения задаются диапазонами секторов:
+ * постоянные или исчезающие после заданного числа неудачных попыток.
+ * Позволяет воспроизводимо проверять движки копирования, повторы и планирование
+ * без реального диска.
+ */
+class SimulatedDisk : public BlockSource
+{
+public:
+    SimulatedDisk(const SimulatedDiskConfig& c) : config(c) {};
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return config.sizeBytes; };
+
+    /**
+     * @brief Добавляет диапазон сбойных секторов.
+     * @param firstSector Первый сектор (в секторах sectorBytes).
+     * @param count Количество секторов.
+     * @param failures Сколько раз чтение диапазона завершится ошибкой (UINT32_MAX — всегда).
+     */
+    void AddBadSectors(uint64_t firstSector, uint64_t count, uint32_t failures = UINT32_MAX);
+
+    /**
+     * @brief Заполняет буфер содержимым диска без задержек и ошибок (эталон для проверки копии).
+     */
+    void Generate(unsigned char* buf, uint64_t len, uint64_t offset) const;
+
+    /**
+     * @brief Проверяет, содержит ли блок SimContent::Sparse данные.
+     * @param block Номер блока размером blockBytes.
+     */
+    bool IsDataBlock(uint64_t block) const;
+
+    /**
+     * @brief Возвращает статистику запросов.
+     */
+    uint64_t GetReads() const { return reads; };
+    uint64_t GetBytesRead() const { return bytesRead; };
+    uint64_t GetFailedReads() const { return failedReads; };
+    uint32_t GetPeakInFlight() const { return peakInFlight; };
+
+private:
+    /**
+     * @brief Диапазон сбойных секторов.
+     */
+    struct BadRange
+    {
+        uint64_t first;          ///< Первый сектор.
+        uint64_t count;          ///< Количество секторов.
+        uint32_t failuresLeft;   ///< Оставшиеся ошибки (UINT32_MAX — постоянная).
+    };
+
+    SimulatedDiskConfig config;                  ///< Параметры диска.
+    std::vector<BadRange> badRanges;             ///< Сбойные сектора.
+    std::mutex mtx;                              ///< Защищает badRanges, busyUntil и inFlight.
+    std::condition_variable queueFreed;          ///< Сигнал об освобождении места в очереди.
+    std::chrono::steady_clock::time_point busyUntil; ///< Окончание передачи последнего запроса.
+    uint32_t inFlight = 0;                       ///< Запросов в обслуживании.
+    std::atomic<uint64_t> reads{0};              ///< Количество запросов.
+    std::atomic<uint64_t> bytesRead{0};          ///< Прочитано байт.
+    std::atomic<uint64_t> failedReads{0};        ///< Запросов с ошибкой.
+    std::atomic<uint32_t> peakInFlight{0};       ///< Максимум одновременных запросов.
+
+    /**
+     * @brief Перемешивает биты (splitmix64): детерминированная замена генератора случайных чисел.
+     */
+    static uint64_t Mix(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * @brief Переводит хэш в число из [0, 1).
+     */
+    static double Unit(uint64_t h) { return (h >> 11) * (1.0 / 9007199254740992.0); }
+
+    /**
+     * @brief Задержка запроса, мкс.
+     */
+    uint64_t Latency(uint64_t offset, uint64_t len) const;
+
+    /**
+     * @brief Проверяет сбойные сектора и расходует попытку исчезающей ошибки.
+     * @return true, если запрос должен завершиться ошибкой.
+     */
+    bool HitsBadSector(uint64_t offset, uint64_t len);
+};
+
+inline void SimulatedDisk::AddBadSectors(uint64_t firstSector, uint64_t count, uint32_t failures)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    badRanges.push_back({ firstSector, count, failures });
+}
+
+inline bool SimulatedDisk::IsDataBlock(uint64_t block) const
+{
+    switch (config.content) {
+    case SimContent::Zero:
+        return false;
+    case SimContent::Sparse:
+        return Unit(Mix(config.seed ^ Mix(block))) < config.dataFraction;
+    default:
+        return true;
+    }
+}
+
+inline void SimulatedDisk::Generate(unsigned char* buf, uint64_t len, uint64_t offset) const
+{
+    if (config.content == SimContent::Zero) {
+        memset(buf, 0, len);
+        return;
+    }
+    // Слово с номером w определяется только w, поэтому любые части диска согласованы между собой
+    uint64_t end = offset + len;
+    uint64_t pos = offset;
+    while (pos < end) {
+        uint64_t word = pos / 8;
+        uint64_t value = 0;
+        if (config.content == SimContent::Pattern)
+            value = word * 8;
+        else if (config.content == SimContent::Dense || IsDataBlock(pos / config.blockBytes))
+            value = Mix(config.seed + word) | 1;   // Младший бит исключает нулевые слова
+        uint64_t in = pos % 8;
+        uint64_t part = 8 - in < end - pos ? 8 - in : end - pos;
+        memcpy(buf + (pos - offset), reinterpret_cast<unsigned char*>(&value) + in, part);
+        pos += part;
+    }
+}
+
+inline uint64_t SimulatedDisk::Latency(uint64_t offset, uint64_t len) const
+{
+    uint64_t h = Mix(config.seed ^ Mix(offset ^ Mix(len)));
+    if (config.tailProbability > 0 && Unit(h) < config.tailProbability)
+        return config.tailMicros;
+    uint64_t jitter = config.jitterMicros ? Mix(h) % (config.jitterMicros + 1) : 0;
+    return config.latencyMicros + jitter;
+}
+
+inline bool SimulatedDisk::HitsBadSector(uint64_t offset, uint64_t len)
+{
+    uint64_t first = offset / config.sectorBytes;
+    uint64_t last = (offset + len - 1) / config.sectorBytes;
+    std::lock_guard<std::mutex> lock(mtx);
+    for (BadRange& r : badRanges) {
+        if (r.failuresLeft == 0 || first >= r.first + r.count || last < r.first)
+            continue;
+        if (r.failuresLeft != UINT32_MAX)
+            r.failuresLeft--;
+        return true;
+    }
+    return false;
+}
+
+inline bool SimulatedDisk::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    // Как и устройство без буферизации, принимаем только выровненные запросы в пределах диска
+    if (len == 0 || offset % config.sectorBytes != 0 || len % config.sectorBytes != 0 ||
+        offset + len > config.sizeBytes)
+        return false;
+    reads++;
+
+    std::chrono::steady_clock::time_point done;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (config.queueDepth != 0)
+            queueFreed.wait(lock, [&] { return inFlight < config.queueDepth; });
+        inFlight++;
+        if (inFlight > peakInFlight)
+            peakInFlight = inFlight;
+
+        // Обслуживание начинается, когда запрос попал в очередь устройства
+        auto now = std::chrono::steady_clock::now();
+        done = now + std::chrono::microseconds(Latency(offset, len));
+        if (config.bytesPerSecond != 0) {
+            auto transfer = std::chrono::nanoseconds(len * 1000000000ull / config.bytesPerSecond);
+            busyUntil = (busyUntil > now ? busyUntil : now) + transfer;
+            if (busyUntil > done)
+                done = busyUntil;
+        }
+    }
+    std::this_thread::sleep_until(done);
+
+    bool failed = HitsBadSector(offset, len);
+    if (!failed)
+        Generate(buf, len, offset);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        inFlight--;
+    }
+    queueFreed.notify_one();
+
+    if (failed) {
+        failedReads++;
+        return false;
+    }
+    bytesRead += len;
+    return true;
+}
+
+#endif // SIMULATEDDISK_H_INCLUDED
@@ -0,0 +1,244 @@
+/**
+ * @file StreamOutput.h
+ * @brief Заголовочный файл для вывода образа в stdout, FIFO или канал без промежуточного файла.
+ */
+
+#ifndef STREAMOUTPUT_H_INCLUDED
+#define STREAMOUTPUT_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include "BlockFile.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#endif // __linux__
+
+constexpr uint64_t STREAM_PIPE_BYTES = 1024 * 1024;   ///< Запрашиваемая емкость канала (F_SETPIPE_SZ).
+
+/**
+ * @class StreamOutput
+ * @brief Последовательный вывод в stdout, FIFO или именованный канал.
+ *
+ * Если выход — канал Linux, данные передаются через vmsplice: страницы буфера
+ * попадают в канал без копирования. Поэтому буфер, переданный в Write, нельзя
+ * изменять, пока читатель его не забрал: после возврата из Write безопасно изменять
+ * только данные, переданные раньше последних GetPipeBytes() байт. Буферы должны быть
+ * выровнены по странице (как PooledBuffer), а читатель — забирать данные через read(),
+ * а не splice/tee. Для файлов, терминала и в Windows используется обычная запись.
+ */
+class StreamOutput
+{
+public:
+    StreamOutput() {};
+
+    ~StreamOutput() { Close(); };
+
+    StreamOutput(const StreamOutput&) = delete;
+    StreamOutput& operator=(const StreamOutput&) = delete;
+
+    /**
+     * @brief Открывает выход.
+     * @param path Путь к FIFO, каналу или файлу; "-" — стандартный вывод.
+     * @return true, если выход открыт.
+     */
+    bool Open(const PathString& path);
+
+    /**
+     * @brief Дожидается, пока читатель заберет данные из канала, и закрывает выход.
+     *
+     * Стандартный вывод не закрывается.
+     */
+    void Close();
+
+    /**
+     * @brief Передает данные целиком.
+     * @param buf Данные (см. ограничения для каналов в описании класса).
+     * @param len Длина в байтах.
+     * @return false, если читатель закрыл канал или возникла ошибка.
+     */
+    bool Write(const unsigned char* buf, uint64_t len);
+
+    /**
+     * @brief Дожидается, пока в канале не останется данных (после этого буферы можно освобождать).
+     */
+    void Drain();
+
+    /**
+     * @brief Возвращает емкость канала в байтах, если данные передаются через vmsplice, иначе 0.
+     */
+    uint64_t GetPipeBytes() const { return pipeBytes; };
+
+private:
+    #ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;  ///< Хэндл выхода.
+    #endif // _WIN32
+
+    #ifdef __linux__
+    int fd = -1;                           ///< Дескриптор выхода.
+    #endif // __linux__
+
+    bool owned = false;                    ///< Закрывать ли дескриптор (не stdout).
+    uint64_t pipeBytes = 0;                ///< Емкость канала (0 — обычная запись).
+};
+
+#ifdef __linux__
+
+inline bool StreamOutput::Open(const PathString& path)
+{
+    Close();
+    if (path == "-") {
+        fd = STDOUT_FILENO;
+        owned = false;
+    }
+    else {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        owned = true;
+    }
+
+    // Канал расширяется, чтобы за один vmsplice передавался крупный участок
+    struct stat st;
+    pipeBytes = 0;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        fcntl(fd, F_SETPIPE_SZ, static_cast<int>(STREAM_PIPE_BYTES));
+        int size = fcntl(fd, F_GETPIPE_SZ);
+        if (size > 0)
+            pipeBytes = static_cast<uint64_t>(size);
+    }
+    return true;
+}
+
+inline void StreamOutput::Close()
+{
+    if (fd < 0)
+        return;
+    Drain();
+    if (owned)
+        close(fd);
+    fd = -1;
+    pipeBytes = 0;
+}
+
+inline bool StreamOutput::Write(const unsigned char* buf, uint64_t len)
+{
+    // Закрытый читатель должен приводить к ошибке записи, а не к завершению процесса по SIGPIPE
+    sigset_t pipeSignal, oldMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+
+    bool ok = true;
+    while (len > 0) {
+        ssize_t res;
+        if (pipeBytes != 0) {
+            struct iovec iov;
+            iov.iov_base = const_cast<unsigned char*>(buf);
+            iov.iov_len = len;
+            res = vmsplice(fd, &iov, 1, 0);
+            if (res < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                pipeBytes = 0;   // vmsplice недоступен: дальше обычная запись
+                continue;
+            }
+        }
+        else {
+            res = write(fd, buf, len);
+        }
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            if (res < 0 && errno == EPIPE) {
+                struct timespec zero = {0, 0};
+                sigtimedwait(&pipeSignal, NULL, &zero);   // Сбрасываем ожидающий SIGPIPE
+            }
+            ok = false;
+            break;
+        }
+        buf += res;
+        len -= res;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    return ok;
+}
+
+inline void StreamOutput::Drain()
+{
+    if (pipeBytes == 0)
+        return;
+    // Опустошение канала писателю не сигнализируется, поэтому poll ждет только POLLERR
+    // (читатель закрыл канал и данные уже не заберет), а остаток проверяется с нарастающим интервалом
+    int queued = 0;
+    int waitMs = 1;
+    while (ioctl(fd, FIONREAD, &queued) == 0 && queued > 0) {
+        struct pollfd pfd = { fd, 0, 0 };
+        int res = poll(&pfd, 1, waitMs);
+        if (res > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+            break;
+        if (res < 0 && errno != EINTR)
+            break;
+        waitMs = waitMs < 16 ? waitMs * 2 : 16;
+    }
+}
+
+#endif // __linux__
+
+#ifdef _WIN32
+
+inline bool StreamOutput::Open(const PathString& path)
+{
+    Close();
+    pipeBytes = 0;
+    if (path == L"-") {
+        handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        owned = false;
+        return handle != INVALID_HANDLE_VALUE && handle != NULL;
+    }
+    // Именованный канал уже создан читателем, файл создается заново
+    bool pipe = path.compare(0, 9, L"\\\\.\\pipe\\") == 0;
+    handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, pipe ? OPEN_EXISTING : CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    owned = true;
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+inline void StreamOutput::Close()
+{
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+    if (owned) {
+        FlushFileBuffers(handle);
+        CloseHandle(handle);
+    }
+    handle = INVALID_HANDLE_VALUE;
+}
+
+inline bool StreamOutput::Write(const unsigned char* buf, uint64_t len)
+{
+    while (len > 0) {
+        DWORD chunk = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD written = 0;
+        if (!WriteFile(handle, buf, chunk, &written, NULL) || written == 0)
+            return false;
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+inline void StreamOutput::Drain()
+{
+}
+
+#endif // _WIN32
+
+#endif // STREAMOUTPUT_H_INCLUDED
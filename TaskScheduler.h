@@ -0,0 +1,347 @@
+/**
+ * @file TaskScheduler.h
+ * @brief Заголовочный файл общего планировщика задач с перехватом работы (work stealing).
+ */
+
+#ifndef TASKSCHEDULER_H_INCLUDED
+#define TASKSCHEDULER_H_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * @class TaskScheduler
+ * @brief Пул потоков с собственной очередью задач у каждого потока и перехватом работы.
+ *
+ * Поток кладет порожденные задачи в свою очередь и забирает их с конца (LIFO),
+ * свободные потоки перехватывают задачи с начала чужих очередей (FIFO).
+ * Задачи из внешних потоков попадают в общую очередь.
+ *
+ * Одновременно задачи выполняют не больше `concurrency` потоков: каждый держит
+ * «разрешение на выполнение». Поток, входящий в блокирующий ввод-вывод
+ * (см. BlockingScope), отдает свое разрешение запасному потоку, поэтому
+ * ядра не простаивают во время чтения с диска и не перегружаются, когда
+ * все потоки заняты вычислениями.
+ */
+class TaskScheduler
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param concurrency Количество одновременно выполняющих задачи потоков (0 — по числу ядер).
+     * @param spare Количество запасных потоков для компенсации блокировок (по умолчанию равно concurrency).
+     */
+    explicit TaskScheduler(unsigned concurrency = 0, unsigned spare = 0)
+    {
+        target = concurrency != 0 ? concurrency : std::thread::hardware_concurrency();
+        if (target == 0)
+            target = 1;
+        tokens = target;
+        unsigned total = target + (spare != 0 ? spare : target);
+        for (unsigned i = 0; i != total; i++)
+            queues.emplace_back(new Queue());
+        for (unsigned i = 0; i != total; i++)
+            threads.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+    }
+
+    ~TaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        returnCv.notify_all();
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    /**
+     * @brief Ставит задачу в очередь.
+     *
+     * Из потока планировщика задача кладется в его собственную очередь, иначе — в общую.
+     */
+    void Submit(std::function<void()> task)
+    {
+        Queue& q = (Local().scheduler == this) ? *queues[Local().index] : inject;
+        {
+            std::lock_guard<std::mutex> lock(q.mtx);
+            q.tasks.push_back(std::move(task));
+        }
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+        }
+        cv.notify_one();
+    }
+
+    /**
+     * @brief Выполняет одну задачу в вызывающем потоке, если она есть.
+     *
+     * Используется ожидающими потоками, чтобы помогать вместо простоя.
+     * @return true, если задача была выполнена.
+     */
+    bool RunOne()
+    {
+        std::function<void()> task;
+        if (!TryPop(Local().scheduler == this ? Local().index : queues.size(), task))
+            return false;
+        task();
+        return true;
+    }
+
+    /**
+     * @brief Возвращает количество одновременно выполняющих задачи потоков.
+     */
+    unsigned GetConcurrency() const { return target; };
+
+    /**
+     * @brief Общий планировщик процесса, которым пользуются все движки копирования.
+     */
+    static TaskScheduler& Shared()
+    {
+        static TaskScheduler shared;
+        return shared;
+    }
+
+    /**
+     * @class BlockingScope
+     * @brief Отмечает участок блокирующего ввода-вывода в задаче.
+     *
+     * На время участка поток планировщика отдает разрешение на выполнение,
+     * и его место занимает запасной поток. В остальных потоках ничего не делает.
+     */
+    class BlockingScope
+    {
+    public:
+        BlockingScope() : owner(Local().holdsToken ? Local().scheduler : nullptr)
+        {
+            if (owner != nullptr)
+                owner->ReleaseToken();
+        }
+
+        ~BlockingScope()
+        {
+            if (owner != nullptr)
+                owner->AcquireToken();
+        }
+
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator=(const BlockingScope&) = delete;
+
+    private:
+        TaskScheduler* owner;  ///< Планировщик, которому возвращается разрешение.
+    };
+
+private:
+    /**
+     * @brief Очередь задач с собственным мьютексом.
+     */
+    struct Queue
+    {
+        std::mutex mtx;                              ///< Защищает очередь.
+        std::deque<std::function<void()>> tasks;     ///< Задачи.
+    };
+
+    unsigned target = 1;                         ///< Количество разрешений на выполнение.
+    unsigned tokens = 0;                         ///< Свободные разрешения.
+    bool stopping = false;                       ///< Признак остановки.
+    std::atomic<size_t> pending{0};              ///< Задач в очередях.
+    std::vector<std::unique_ptr<Queue>> queues;  ///< Очереди потоков.
+    Queue inject;                                ///< Общая очередь для внешних потоков.
+    std::vector<std::thread> threads;            ///< Потоки планировщика.
+    std::mutex mtx;                              ///< Защищает tokens и stopping.
+    std::condition_variable cv;                  ///< Ожидание задач и разрешений.
+
+    std::atomic<unsigned> returning{0};          ///< Потоки, ждущие разрешение после блокировки.
+    std::condition_variable returnCv;            ///< Ожидание разрешения после блокировки.
+
+    /**
+     * @brief Состояние потока по отношению к планировщику.
+     */
+    struct ThreadState
+    {
+        TaskScheduler* scheduler = nullptr;      ///< Планировщик текущего потока.
+        size_t index = 0;                        ///< Индекс потока в планировщике.
+        bool holdsToken = false;                 ///< Держит ли поток разрешение.
+    };
+
+    static ThreadState& Local()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    /**
+     * @brief Берет задачу: своя очередь с конца, общая очередь, затем перехват у других потоков.
+     * @param self Индекс своей очереди (queues.size() для внешнего потока).
+     */
+    bool TryPop(size_t self, std::function<void()>& task)
+    {
+        if (pending == 0)
+            return false;
+
+        if (self < queues.size()) {
+            Queue& q = *queues[self];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                pending--;
+                return true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(inject.mtx);
+            if (!inject.tasks.empty()) {
+                task = std::move(inject.tasks.front());
+                inject.tasks.pop_front();
+                pending--;
+                return true;
+            }
+        }
+        for (size_t i = 1; i <= queues.size(); i++) {
+            Queue& q = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                pending--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ReleaseToken()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tokens++;
+            Local().holdsToken = false;
+        }
+        if (returning > 0)
+            returnCv.notify_one();
+        else
+            cv.notify_one();
+    }
+
+    void AcquireToken()
+    {
+        // Вернувшийся из ввода-вывода поток получает разрешение раньше простаивающих:
+        // выполняющие потоки уступают его после текущей задачи
+        returning++;
+        std::unique_lock<std::mutex> lock(mtx);
+        returnCv.wait(lock, [this] { return tokens > 0 || stopping; });
+        if (tokens > 0)
+            tokens--;
+        returning--;
+        Local().holdsToken = true;
+        if (tokens > 0)
+            cv.notify_one();
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        Local().scheduler = this;
+        Local().index = index;
+        std::function<void()> task;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return stopping || (tokens > 0 && pending > 0 && returning == 0); });
+                if (stopping)
+                    return;
+                tokens--;
+                Local().holdsToken = true;
+            }
+
+            while (TryPop(index, task)) {
+                task();
+                task = nullptr;
+                if (returning > 0)
+                    break;
+            }
+
+            ReleaseToken();
+        }
+    }
+};
+
+/**
+ * @class TaskGroup
+ * @brief Группа задач, завершения которых можно дождаться.
+ *
+ * Ожидающий поток выполняет задачи планировщика, пока группа не завершится.
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskScheduler& s = TaskScheduler::Shared()) : scheduler(s) {};
+
+    ~TaskGroup() { Wait(); };
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * @brief Запускает задачу в группе.
+     */
+    void Run(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            count++;
+        }
+        scheduler.Submit([this, task] {
+            task();
+            std::lock_guard<std::mutex> lock(mtx);
+            count--;
+            cv.notify_all();
+        });
+    }
+
+    /**
+     * @brief Ждет, пока в группе останется меньше `limit` незавершенных задач.
+     *
+     * Ограничивает количество одновременно занятых буферов в конвейере.
+     */
+    void WaitBelow(size_t limit)
+    {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (count < limit)
+                    return;
+            }
+            if (!scheduler.RunOne()) {
+                TaskScheduler::BlockingScope blocking;
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait_for(lock, std::chrono::milliseconds(1), [this, limit] { return count < limit; });
+            }
+        }
+    }
+
+    /**
+     * @brief Ждет завершения всех задач группы.
+     */
+    void Wait() { WaitBelow(1); };
+
+private:
+    TaskScheduler& scheduler;       ///< Планировщик.
+    size_t count = 0;               ///< Незавершенные задачи.
+    std::mutex mtx;                 ///< Защищает count.
+    std::condition_variable cv;     ///< Оповещение о завершении задач.
+};
+
+#endif // TASKSCHEDULER_H_INCLUDED
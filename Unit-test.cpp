@@ -1,457 +1,2140 @@
-/**
- * @brief Тест-кейсы для различных классов, с использованием библиотеки doctest.
- */
-
-#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
-#include "doctest.h"
-#include "ConsoleIO.h"
-#include "DiskInfo.h"
-#include "DiskInterface.h"
-#include "RawCopy.h"
-#include "VMDK.h"
-#include "VMDKSparce.h"
-#include "LogsReadWrite.h"
-
-using namespace std;
-/**
- * @brief Тест получения количества физических дисков.
- *
- * Проверяет, что метод **GetNumOfPhysicalDisk** возвращает неотрицательное значение.
- */
-TEST_CASE("DiskInfo: GetNumOfPhysicalDisk") {
-    DiskInfo diskInfo;
-    int num = diskInfo.GetNumOfPhysicalDisk();
-    CHECK(num >= 0);
-}
-
-/**
- * @brief Тест получения информации о диске.
- *
- * Проверяет, что метод **GetDiskInfo** возвращает true для валидного ID и заполняет
- * **diskName** и **totalSize** положительными значениями.
- */
-TEST_CASE("DiskInfo: GetDiskInfo") {
-    DiskInfo diskInfo;
-    DiskInfoStruct info;
-    CHECK(diskInfo.GetDiskInfo(0, 0, &info) == true);
-    CHECK(info.diskName.length() > 0);
-    CHECK(info.totalSize >= 0);
-}
-
-/**
- * @brief Тест для класса DiskInfo.
- *
- * Проверка работы с некорректным индексом диска
- */
-TEST_CASE("Тест DiskInfo") {
-    DiskInfo diskInfo;
-    DiskInfoStruct diskInfoStruct;
-    bool success = diskInfo.GetDiskInfo(-1, -1, &diskInfoStruct);
-    CHECK_FALSE(success);
-}
-
-/**
- * @brief Тест открытия диска для чтения.
- *
- * Проверяет, что метод **OpenDisk** возвращает true при открытии физического диска.
- */
-
-TEST_CASE("Reader: OpenDisk ph") {
-    #ifdef _WIN32
-    Reader reader;
-    CHECK(reader.OpenDisk(L"\\\\.\\PhysicalDrive2") == true);
-    #endif // _WIN32
-
-    #ifdef __linux__
-    Reader reader;
-    CHECK(reader.OpenDisk(L"/dev/sda") == true);
-    #endif // __linux__
-}
-
-/**
- * @brief Тест открытия диска для чтения.
- *
- * Проверяет, что метод **OpenDisk** возвращает true при открытии логического диска.
- */
-
-TEST_CASE("Reader: OpenDisk log") {
-    #ifdef _WIN32
-    Reader reader;
-    CHECK(reader.OpenDisk(L"\\\\.\\J:") == true);
-    #endif // _WIN32
-
-    #ifdef __linux__
-    Reader reader;
-    CHECK(reader.OpenDisk(L"/dev/sda2") == true);
-    #endif // __linux__
-}
-
-/**
- * @brief Тест операции чтения данных с диска.
- *
- * Проверяет, что метод **Read** возвращает true при чтении данных размером 512 байт.
- */
-TEST_CASE("Reader: Read") {
-    #ifdef _WIN32
-    Reader reader;
-    unsigned char buffer[512];
-    reader.OpenDisk(L"\\\\.\\J:");
-    bool readSuccess = reader.Read(buffer, 512);
-    CHECK(readSuccess == true);
-    #endif // _WIN32
-
-    #ifdef __linux__
-    Reader reader;
-    unsigned char buffer[512];
-    reader.OpenDisk(L"/dev/sda2");
-    bool readSuccess = reader.Read(buffer, 512);
-    CHECK(readSuccess == true);
-    #endif // __linux__
-}
-
- /**
- * @brief Тесты для класса Reader.
- */
-TEST_CASE("Тест Reader") {
-    Reader reader;
-
-    /** @brief Проверка открытия недопустимого пути к диску. */
-    SUBCASE("Открытие недопустимого пути к диску") {
-        bool result = reader.OpenDisk(L"/invalid/path/to/disk");
-        CHECK_FALSE(result);
-    }
-
-    /** @brief Проверка операции чтения без открытия диска. */
-      SUBCASE("Чтение без открытия диска") {
-        unsigned char buffer[10];
-        bool result = reader.Read(buffer, sizeof(buffer));
-        CHECK_FALSE(result);
-    }
-
-    /** @brief Проверка чтения пустого диска или файла. */
-    SUBCASE("Чтение пустого диска/файла") {
-        #ifdef __linux__
-        std::ofstream outFile("/tmp/empty_disk.img");
-        outFile.close();
-        reader.OpenDisk(L"/tmp/empty_disk.img");
-        unsigned char buffer[10];
-        bool result = reader.Read(buffer, sizeof(buffer));
-        CHECK_FALSE(result);
-        #endif // __linux__
-    }
-}
-
-/**
- * @brief Тест открытия файла для записи.
- *
- * Проверяет, что метод **OpenFile** успешно открывает файл для записи.
- */
-TEST_CASE("Writer: OpenFile") {
-    Writer writer;
-    CHECK(writer.OpenFile(L"output_test_file") == true);
-}
-
-/**
- * @brief Тест записи данных в файл.
- *
- * Проверяет, что метод **Write** записывает данные размером 512 байт в файл.
- */
-TEST_CASE("Writer: Write") {
-    Writer writer;
-    writer.OpenFile(L"output_test_file");
-    unsigned char buffer[512] = {0};
-    CHECK(writer.Write(buffer, 512) == true);
-}
-
-/**
- * @brief Тест для класса Writer.
- *
- * Проверка открытия файла по некорректному пути.
- */
-TEST_CASE("Тест Writer") {
-    Writer writer;
-    bool result = writer.OpenFile(L"/invalid/path/test_output.img");
-    CHECK_FALSE(result);
-}
-
-/**
- * @brief Тест создания raw-копии.
- *
- * Проверяет, что метод **CreateRawCopy** не вызывает исключений.
- */
-TEST_CASE("RawCopy: CreateRawCopy") {
-    #ifdef _WIN32
-    RawCopy rawCopy(L"\\\\.\\J:", L"226760159", L"output_test.dd", 4194304, 1961595);
-    CHECK_NOTHROW(rawCopy.CreateRawCopy(0));
-    #endif // _WIN32
-
-    #ifdef __linux__
-    RawCopy rawCopy(L"/dev/sdb1", L"07614A61715128C8", L"output_test.dd", 4194304, 1961595);
-    CHECK_NOTHROW(rawCopy.CreateRawCopy(0));
-    #endif // __linux__
-}
-
-/**
- * @brief Тест создания raw-копии многопоточно.
- *
- * Проверяет, что метод **CreateRawCopyThreads** не вызывает исключений.
- */
-TEST_CASE("RawCopy: CreateRawCopyThreads") {
-    #ifdef _WIN32
-    RawCopy rawCopy(L"\\\\.\\J:", L"226760159", L"output_test_mn.dd", 4194304, 1961595);
-    CHECK_NOTHROW(rawCopy.CreateRawCopyThreads(0));
-    #endif // _WIN32
-
-    #ifdef __linux__
-    RawCopy rawCopy(L"/dev/sdb1", L"07614A61715128C8", L"output_test_mn.dd", 4194304, 1961595);
-    CHECK_NOTHROW(rawCopy.CreateRawCopyThreads(0));
-    #endif // __linux__
-}
-
-/**
- * @brief Тест создания VMDK-файла.
- *
- * Проверяет, что метод **CreateVMDK** создает файл с заданным размером буфера и количеством секторов.
- */
-TEST_CASE("FlatVMDK: CreateVMDK") {
-    #ifdef _WIN32
-    FlatVMDK flatVMDK(L"D:\\output_dir", L"test_file", L"\\\\.\\J:", L"226760159");
-    CHECK(flatVMDK.CreateVMDK(4194304, 1961595) == true);
-    #endif // _WIN32
-
-    #ifdef __linux__
-    FlatVMDK flatVMDK(L"/home/yashuoki/test/", L"test_file_flat", L"/dev/sdb1", L"07614A61715128C8");
-    CHECK(flatVMDK.CreateVMDK(4194304, 1961595) == true);
-    #endif // __linux__
-}
-
-/**
- * @brief Тест создания Sparce VMDK-файла.
- *
- * Проверяет, что метод **CreateSparse** создает файл с заданным размером буфера и количеством секторов.
- */
-TEST_CASE("Test SparseVMDK Creation") {
-
-    DiskInfo disks;
-    DiskInfoStruct disk_info;
-
-    // Запрашиваем индекс физического диска
-    int pDisk = 2;
-    disks.GetDiskInfo(pDisk, 0, &disk_info);
-
-    // Получаем индекс диска для копирования
-    int lDisk = 1;
-    disks.GetDiskInfo(pDisk, lDisk, &disk_info);
-
-    const wchar_t* disk = (disk_info.diskName).data();
-    const wchar_t* serialNum = (disk_info.serial_id).data();
-    int64_t bufSize = 4194304;
-    wstring outFileName = L"test_file_sparce";
-    #ifdef _WIN32
-    wstring outFileDir = L"D:\\output_dir";
-    #endif // _WIN32
-    #ifdef __linux__
-    wstring outFileDir = L"/home/yashuoki/test/";
-    #endif // __linux__
-
-    SparseVMDK sparse(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, disk_info.total_sectors);
-
-    // Проверяем успешное создание sparse VMDK с корректными параметрами
-    bool result = sparse.CreateSparse();
-    CHECK(result);
-
-    // Проверяем, что создание с нулевой емкостью не проходит
-    SparseVMDK sparse2(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, 0);
-    CHECK_FALSE(sparse2.CreateSparse());
-}
-
-/**
- * @brief Тест создания Sparce VMDK-файла многопоточно.
- *
- * Проверяет, что метод **CreateSparseThread** создает файл с заданным размером буфера и количеством секторов.
- */
-TEST_CASE("Test SparseVMDK Threads Creation") {
-
-    DiskInfo disks;
-    DiskInfoStruct disk_info;
-
-    // Запрашиваем индекс физического диска
-    int pDisk = 2;
-    disks.GetDiskInfo(pDisk, 0, &disk_info);
-
-    // Получаем индекс диска для копирования
-    int lDisk = 1;
-    disks.GetDiskInfo(pDisk, lDisk, &disk_info);
-
-    const wchar_t* disk = (disk_info.diskName).data();
-    const wchar_t* serialNum = (disk_info.serial_id).data();
-    int64_t bufSize = 4194304;
-    wstring outFileName = L"test_file_sparce_mn";
-    #ifdef _WIN32
-    wstring outFileDir = L"D:\\output_dir";
-    #endif // _WIN32
-    #ifdef __linux__
-    wstring outFileDir = L"/home/yashuoki/test/";
-    #endif // __linux__
-
-    SparseVMDK sparse(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, disk_info.total_sectors);
-
-    // Проверяем успешное создание sparse VMDK с корректными параметрами
-    bool result = sparse.CreateSparseThread();
-    CHECK(result);
-}
-
-//Тест возобновления
-// Указываем путь к лог-файлу
-const string logFileName = "LogFile1";
-const string logFileName2 = "LogFile2";
-/**
- * @brief Тест создания log файла.
- *
- * Проверяет, что метод **CreateRawCopyLog** создает log файл, а также его содержмое.
- */
-TEST_CASE("LogsReadWrite - CreateRawCopyLog") {
-    LogsReadWrite<std::wstring> logManager;
-
-    // Проверка, что лог-файл был создан успешно
-    bool result = logManager.CreateRawCopyLog(L"Disk1", L"12345", L"/logs", L"log1", time(nullptr), 1024, 4096);
-    CHECK(result == true);
-
-    // Проверка, что лог-файл существует
-    std::ifstream file(logFileName);
-    CHECK(file.is_open());
-    file.close();
-
-    // Чтение и проверка содержимого файла
-    std::wifstream logFile(logFileName); // используем wifstream для работы с широкими строками
-    std::wstring line;
-
-    if (logFile.is_open()) {
-        std::getline(logFile, line);
-        CHECK(line == std::to_wstring(static_cast<int>(ImageType::DD))); // преобразуем в wstring для сравнения
-        std::getline(logFile, line);
-        CHECK(line == L"Disk1");  // Проверяем, что диск записан корректно
-        std::getline(logFile, line);
-        CHECK(line == L"12345");  // Проверяем, что серийный номер записан корректно
-        std::getline(logFile, line);
-        CHECK(line == L"/logs");  // Проверяем, что директория записана корректно
-        std::getline(logFile, line);
-        CHECK(line == L"log1");  // Проверяем, что имя файла записано корректно
-        std::getline(logFile, line);
-        CHECK(line == std::to_wstring(time(nullptr)));  // Проверяем время окончания
-        std::getline(logFile, line);
-        CHECK(line == std::to_wstring(1024));  // Проверяем количество записанных секторов
-        std::getline(logFile, line);
-        CHECK(line == std::to_wstring(4096));  // Проверяем общее количество секторов
-        logFile.close();
-    }
-}
-
-/**
- * @brief Тест чтения log файла.
- *
- * Проверяет, что метод **ReadLogFiles** считывает log файл, а также данные из него.
- */
-TEST_CASE("LogsReadWrite - ReadLogFiles") {
-    LogsReadWrite<std::wstring> logManager;
-    LogFile logFiles[10];
-    int filesRead = 0;
-
-    // Проверка, что лог-файл был прочитан
-    bool result = logManager.ReadLogFiles(logFiles, &filesRead);
-    CHECK(result == true);
-    CHECK(filesRead == 1);
-
-    // Проверка данных, считанных из файла
-    CHECK(logFiles[0].type == (ImageType::DD));
-    CHECK(logFiles[0].disk == L"Disk1");
-    CHECK(logFiles[0].outFileDir == L"/logs");
-    CHECK(logFiles[0].serialNum == L"12345");
-    CHECK(logFiles[0].outFileName == L"log1");
-    CHECK(logFiles[0].numOfSectorsWriten == 1024);
-    CHECK(logFiles[0].totalSectors == 4096);
-}
-
-/**
- * @brief Тест создания log файла для VMDK_Sparse.
- *
- * Проверяет, что метод **CreateSparseLog** создает log файл, а также его содержимое.
- * Проверяет, что метод **ReadGTEs** корректно считывеат данные с массива GTEs.
- */
-TEST_CASE("LogsReadWrite - CreateSparseLog") {
-    LogsReadWrite<wstring> logManager;
-
-    // Параметры для теста
-    uint32_t GTEs[] = {12, 14, 24};
-
-    // Проверка, что лог-файл был создан успешно
-    bool result = logManager.CreateSparseLog(L"Disk1", L"12345", L"/logs", L"log2", time(nullptr), 32, 3, 128, 12, 14, GTEs);
-    CHECK(result == true);
-
-    // Проверка, что лог-файл существует
-    ifstream file(logFileName2);
-    CHECK(file.is_open());
-    file.close();
-
-    // Чтение и проверка содержимого файла
-    wifstream logFile(logFileName2); // используем wifstream для работы с широкими строками
-    wstring line;
-
-    if (logFile.is_open()) {
-        // Проверяем тип изображения
-        getline(logFile, line);
-        CHECK(line == to_wstring(static_cast<int>(ImageType::VMDK_Sparse)));
-
-        // Проверяем остальные параметры
-        getline(logFile, line);
-        CHECK(line == L"Disk1");  // Имя диска
-        getline(logFile, line);
-        CHECK(line == L"12345");  // Серийный номер
-        getline(logFile, line);
-        CHECK(line == L"/logs");  // Директория
-        getline(logFile, line);
-        CHECK(line == L"log2");   // Имя файла
-        getline(logFile, line);
-        CHECK(line == to_wstring(time(nullptr)));  // Время окончания
-        getline(logFile, line);
-        CHECK(line == L"0");
-        getline(logFile, line);
-        CHECK(line == L"0");
-        getline(logFile, line);
-        CHECK(line == to_wstring(32));  // Количество записанных зерен
-        getline(logFile, line);
-        CHECK(line == to_wstring(3));   // Количество прочитанных зерен
-        getline(logFile, line);
-        CHECK(line == to_wstring(128)); // Общее количество зерен
-        getline(logFile, line);
-        CHECK(line == to_wstring(12));  // Смещение данных
-        getline(logFile, line);
-        CHECK(line == to_wstring(14));  // Смещение GTE
-
-        // Проверяем содержимое массива GTEs
-        for (size_t i = 0; i < 3; ++i) {
-            getline(logFile, line);
-            CHECK(line == to_wstring(GTEs[i]));
-        }
-
-        logFile.close();
-    }
-}
-
-/**
- * @brief Тест удаления log файла.
- *
- * Проверяет, что метод **DeleteLogFile** удаляет log файл.
- */
-TEST_CASE("LogsReadWrite - DeleteLogFile") {
-    LogsReadWrite<std::wstring> logManager;
-
-    // Создаем тестовый лог-файл для удаления
-    std::ofstream logFile("LogFileToDelete");
-    CHECK(logFile.is_open());
-    logFile.close();
-
-    bool deleteResult = logManager.DeleteLogFile("LogFileToDelete");
-    CHECK(deleteResult == true);
-    CHECK(!logFile.is_open());
-}
+/**
+ * @brief Тест-кейсы для различных классов, с использованием библиотеки doctest.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include "ConsoleIO.h"
+#include "DiskInfo.h"
+#include "DiskInterface.h"
+#include "RawCopy.h"
+#include "RawCopyZstd.h"
+#include "VMDK.h"
+#include "VMDKSparce.h"
+#include "LogsReadWrite.h"
+#include "GrainHash.h"
+#include "VMDKDelta.h"
+#include "GrainDedup.h"
+#include "SectorPolicy.h"
+#include "GrainSizeSelect.h"
+#include "ImagingDaemon.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+#include "Checkpoint.h"
+#include "ResumeVerify.h"
+#include "ZstdSeekable.h"
+#include "AesXts.h"
+#include "NbdServer.h"
+#include "VMDKSparseReader.h"
+#include "IoStats.h"
+#include "SimulatedDisk.h"
+#include "MappedFile.h"
+#include "ImageVerify.h"
+
+using namespace std;
+
+/**
+ * @brief Источник данных в памяти для тестов движков, работающих через BlockSource.
+ */
+struct MemorySource : BlockSource {
+    std::vector<unsigned char> data;   ///< Содержимое источника.
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override {
+        if (offset > data.size() || len > data.size() - offset)
+            return false;
+        memcpy(buf, data.data() + offset, len);
+        return true;
+    }
+
+    uint64_t Size() override { return data.size(); }
+};
+/**
+ * @brief Тест получения количества физических дисков.
+ *
+ * Проверяет, что метод **GetNumOfPhysicalDisk** возвращает неотрицательное значение.
+ */
+TEST_CASE("DiskInfo: GetNumOfPhysicalDisk") {
+    DiskInfo diskInfo;
+    int num = diskInfo.GetNumOfPhysicalDisk();
+    CHECK(num >= 0);
+}
+
+/**
+ * @brief Тест получения информации о диске.
+ *
+ * Проверяет, что метод **GetDiskInfo** возвращает true для валидного ID и заполняет
+ * **diskName** и **totalSize** положительными значениями.
+ */
+TEST_CASE("DiskInfo: GetDiskInfo") {
+    DiskInfo diskInfo;
+    DiskInfoStruct info;
+    CHECK(diskInfo.GetDiskInfo(0, 0, &info) == true);
+    CHECK(info.diskName.length() > 0);
+    CHECK(info.totalSize >= 0);
+}
+
+/**
+ * @brief Тест размеров секторов диска.
+ *
+ * Проверяет, что **GetDiskInfo** заполняет размеры логического и физического секторов.
+ */
+TEST_CASE("DiskInfo: sector sizes") {
+    DiskInfo diskInfo;
+    DiskInfoStruct info;
+    if (diskInfo.GetDiskInfo(0, 0, &info)) {
+        CHECK(info.logicalSectorSize >= 512);
+        CHECK(info.physicalSectorSize >= info.logicalSectorSize);
+        CHECK(info.total_bytes == info.total_sectors * 512);
+        CHECK(info.total_bytes == info.logicalSectors * info.logicalSectorSize);
+    }
+}
+
+/**
+ * @brief Тест для класса DiskInfo.
+ *
+ * Проверка работы с некорректным индексом диска
+ */
+TEST_CASE("Тест DiskInfo") {
+    DiskInfo diskInfo;
+    DiskInfoStruct diskInfoStruct;
+    bool success = diskInfo.GetDiskInfo(-1, -1, &diskInfoStruct);
+    CHECK_FALSE(success);
+}
+
+/**
+ * @brief Тест открытия диска для чтения.
+ *
+ * Проверяет, что метод **OpenDisk** возвращает true при открытии физического диска.
+ */
+
+TEST_CASE("Reader: OpenDisk ph") {
+    #ifdef _WIN32
+    Reader reader;
+    CHECK(reader.OpenDisk(L"\\\\.\\PhysicalDrive2") == true);
+    #endif // _WIN32
+
+    #ifdef __linux__
+    Reader reader;
+    CHECK(reader.OpenDisk(L"/dev/sda") == true);
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест открытия диска для чтения.
+ *
+ * Проверяет, что метод **OpenDisk** возвращает true при открытии логического диска.
+ */
+
+TEST_CASE("Reader: OpenDisk log") {
+    #ifdef _WIN32
+    Reader reader;
+    CHECK(reader.OpenDisk(L"\\\\.\\J:") == true);
+    #endif // _WIN32
+
+    #ifdef __linux__
+    Reader reader;
+    CHECK(reader.OpenDisk(L"/dev/sda2") == true);
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест операции чтения данных с диска.
+ *
+ * Проверяет, что метод **Read** возвращает true при чтении данных размером 512 байт.
+ */
+TEST_CASE("Reader: Read") {
+    #ifdef _WIN32
+    Reader reader;
+    unsigned char buffer[512];
+    reader.OpenDisk(L"\\\\.\\J:");
+    bool readSuccess = reader.Read(buffer, 512);
+    CHECK(readSuccess == true);
+    #endif // _WIN32
+
+    #ifdef __linux__
+    Reader reader;
+    unsigned char buffer[512];
+    reader.OpenDisk(L"/dev/sda2");
+    bool readSuccess = reader.Read(buffer, 512);
+    CHECK(readSuccess == true);
+    #endif // __linux__
+}
+
+ /**
+ * @brief Тесты для класса Reader.
+ */
+TEST_CASE("Тест Reader") {
+    Reader reader;
+
+    /** @brief Проверка открытия недопустимого пути к диску. */
+    SUBCASE("Открытие недопустимого пути к диску") {
+        bool result = reader.OpenDisk(L"/invalid/path/to/disk");
+        CHECK_FALSE(result);
+    }
+
+    /** @brief Проверка операции чтения без открытия диска. */
+      SUBCASE("Чтение без открытия диска") {
+        unsigned char buffer[10];
+        bool result = reader.Read(buffer, sizeof(buffer));
+        CHECK_FALSE(result);
+    }
+
+    /** @brief Проверка чтения пустого диска или файла. */
+    SUBCASE("Чтение пустого диска/файла") {
+        #ifdef __linux__
+        std::ofstream outFile("/tmp/empty_disk.img");
+        outFile.close();
+        reader.OpenDisk(L"/tmp/empty_disk.img");
+        unsigned char buffer[10];
+        bool result = reader.Read(buffer, sizeof(buffer));
+        CHECK_FALSE(result);
+        #endif // __linux__
+    }
+}
+
+/**
+ * @brief Тест открытия файла для записи.
+ *
+ * Проверяет, что метод **OpenFile** успешно открывает файл для записи.
+ */
+TEST_CASE("Writer: OpenFile") {
+    Writer writer;
+    CHECK(writer.OpenFile(L"output_test_file") == true);
+}
+
+/**
+ * @brief Тест записи данных в файл.
+ *
+ * Проверяет, что метод **Write** записывает данные размером 512 байт в файл.
+ */
+TEST_CASE("Writer: Write") {
+    Writer writer;
+    writer.OpenFile(L"output_test_file");
+    unsigned char buffer[512] = {0};
+    CHECK(writer.Write(buffer, 512) == true);
+}
+
+/**
+ * @brief Тест для класса Writer.
+ *
+ * Проверка открытия файла по некорректному пути.
+ */
+TEST_CASE("Тест Writer") {
+    Writer writer;
+    bool result = writer.OpenFile(L"/invalid/path/test_output.img");
+    CHECK_FALSE(result);
+}
+
+/**
+ * @brief Тест создания raw-копии.
+ *
+ * Проверяет, что метод **CreateRawCopy** не вызывает исключений.
+ */
+TEST_CASE("RawCopy: CreateRawCopy") {
+    #ifdef _WIN32
+    RawCopy rawCopy(L"\\\\.\\J:", L"226760159", L"output_test.dd", 4194304, 1961595);
+    CHECK_NOTHROW(rawCopy.CreateRawCopy(0));
+    #endif // _WIN32
+
+    #ifdef __linux__
+    RawCopy rawCopy(L"/dev/sdb1", L"07614A61715128C8", L"output_test.dd", 4194304, 1961595);
+    CHECK_NOTHROW(rawCopy.CreateRawCopy(0));
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест создания raw-копии многопоточно.
+ *
+ * Проверяет, что метод **CreateRawCopyThreads** не вызывает исключений.
+ */
+TEST_CASE("RawCopy: CreateRawCopyThreads") {
+    #ifdef _WIN32
+    RawCopy rawCopy(L"\\\\.\\J:", L"226760159", L"output_test_mn.dd", 4194304, 1961595);
+    CHECK_NOTHROW(rawCopy.CreateRawCopyThreads(0));
+    #endif // _WIN32
+
+    #ifdef __linux__
+    RawCopy rawCopy(L"/dev/sdb1", L"07614A61715128C8", L"output_test_mn.dd", 4194304, 1961595);
+    CHECK_NOTHROW(rawCopy.CreateRawCopyThreads(0));
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест создания VMDK-файла.
+ *
+ * Проверяет, что метод **CreateVMDK** создает файл с заданным размером буфера и количеством секторов.
+ */
+TEST_CASE("FlatVMDK: CreateVMDK") {
+    #ifdef _WIN32
+    FlatVMDK flatVMDK(L"D:\\output_dir", L"test_file", L"\\\\.\\J:", L"226760159");
+    CHECK(flatVMDK.CreateVMDK(4194304, 1961595) == true);
+    #endif // _WIN32
+
+    #ifdef __linux__
+    FlatVMDK flatVMDK(L"/home/yashuoki/test/", L"test_file_flat", L"/dev/sdb1", L"07614A61715128C8");
+    CHECK(flatVMDK.CreateVMDK(4194304, 1961595) == true);
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест создания Sparce VMDK-файла.
+ *
+ * Проверяет, что метод **CreateSparse** создает файл с заданным размером буфера и количеством секторов.
+ */
+TEST_CASE("Test SparseVMDK Creation") {
+
+    DiskInfo disks;
+    DiskInfoStruct disk_info;
+
+    // Запрашиваем индекс физического диска
+    int pDisk = 2;
+    disks.GetDiskInfo(pDisk, 0, &disk_info);
+
+    // Получаем индекс диска для копирования
+    int lDisk = 1;
+    disks.GetDiskInfo(pDisk, lDisk, &disk_info);
+
+    const wchar_t* disk = (disk_info.diskName).data();
+    const wchar_t* serialNum = (disk_info.serial_id).data();
+    int64_t bufSize = 4194304;
+    wstring outFileName = L"test_file_sparce";
+    #ifdef _WIN32
+    wstring outFileDir = L"D:\\output_dir";
+    #endif // _WIN32
+    #ifdef __linux__
+    wstring outFileDir = L"/home/yashuoki/test/";
+    #endif // __linux__
+
+    SparseVMDK sparse(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, disk_info.total_sectors);
+
+    // Проверяем успешное создание sparse VMDK с корректными параметрами
+    bool result = sparse.CreateSparse();
+    CHECK(result);
+
+    // Проверяем, что создание с нулевой емкостью не проходит
+    SparseVMDK sparse2(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, 0);
+    CHECK_FALSE(sparse2.CreateSparse());
+}
+
+/**
+ * @brief Тест создания Sparce VMDK-файла многопоточно.
+ *
+ * Проверяет, что метод **CreateSparseThread** создает файл с заданным размером буфера и количеством секторов.
+ */
+TEST_CASE("Test SparseVMDK Threads Creation") {
+
+    DiskInfo disks;
+    DiskInfoStruct disk_info;
+
+    // Запрашиваем индекс физического диска
+    int pDisk = 2;
+    disks.GetDiskInfo(pDisk, 0, &disk_info);
+
+    // Получаем индекс диска для копирования
+    int lDisk = 1;
+    disks.GetDiskInfo(pDisk, lDisk, &disk_info);
+
+    const wchar_t* disk = (disk_info.diskName).data();
+    const wchar_t* serialNum = (disk_info.serial_id).data();
+    int64_t bufSize = 4194304;
+    wstring outFileName = L"test_file_sparce_mn";
+    #ifdef _WIN32
+    wstring outFileDir = L"D:\\output_dir";
+    #endif // _WIN32
+    #ifdef __linux__
+    wstring outFileDir = L"/home/yashuoki/test/";
+    #endif // __linux__
+
+    SparseVMDK sparse(outFileDir, outFileName, disk, disk_info.serial_id, bufSize, disk_info.total_sectors);
+
+    // Проверяем успешное создание sparse VMDK с корректными параметрами
+    bool result = sparse.CreateSparseThread();
+    CHECK(result);
+}
+
+//Тест возобновления
+// Указываем путь к лог-файлу
+const string logFileName = "LogFile1";
+const string logFileName2 = "LogFile2";
+/**
+ * @brief Тест создания log файла.
+ *
+ * Проверяет, что метод **CreateRawCopyLog** создает log файл, а также его содержмое.
+ */
+TEST_CASE("LogsReadWrite - CreateRawCopyLog") {
+    LogsReadWrite<std::wstring> logManager;
+
+    // Проверка, что лог-файл был создан успешно
+    bool result = logManager.CreateRawCopyLog(L"Disk1", L"12345", L"/logs", L"log1", time(nullptr), 1024, 4096);
+    CHECK(result == true);
+
+    // Проверка, что лог-файл существует
+    std::ifstream file(logFileName);
+    CHECK(file.is_open());
+    file.close();
+
+    // Чтение и проверка содержимого файла
+    std::wifstream logFile(logFileName); // используем wifstream для работы с широкими строками
+    std::wstring line;
+
+    if (logFile.is_open()) {
+        std::getline(logFile, line);
+        CHECK(line == std::to_wstring(static_cast<int>(ImageType::DD))); // преобразуем в wstring для сравнения
+        std::getline(logFile, line);
+        CHECK(line == L"Disk1");  // Проверяем, что диск записан корректно
+        std::getline(logFile, line);
+        CHECK(line == L"12345");  // Проверяем, что серийный номер записан корректно
+        std::getline(logFile, line);
+        CHECK(line == L"/logs");  // Проверяем, что директория записана корректно
+        std::getline(logFile, line);
+        CHECK(line == L"log1");  // Проверяем, что имя файла записано корректно
+        std::getline(logFile, line);
+        CHECK(line == std::to_wstring(time(nullptr)));  // Проверяем время окончания
+        std::getline(logFile, line);
+        CHECK(line == std::to_wstring(1024));  // Проверяем количество записанных секторов
+        std::getline(logFile, line);
+        CHECK(line == std::to_wstring(4096));  // Проверяем общее количество секторов
+        logFile.close();
+    }
+}
+
+/**
+ * @brief Тест чтения log файла.
+ *
+ * Проверяет, что метод **ReadLogFiles** считывает log файл, а также данные из него.
+ */
+TEST_CASE("LogsReadWrite - ReadLogFiles") {
+    LogsReadWrite<std::wstring> logManager;
+    LogFile logFiles[10];
+    int filesRead = 0;
+
+    // Проверка, что лог-файл был прочитан
+    bool result = logManager.ReadLogFiles(logFiles, &filesRead);
+    CHECK(result == true);
+    CHECK(filesRead == 1);
+
+    // Проверка данных, считанных из файла
+    CHECK(logFiles[0].type == (ImageType::DD));
+    CHECK(logFiles[0].disk == L"Disk1");
+    CHECK(logFiles[0].outFileDir == L"/logs");
+    CHECK(logFiles[0].serialNum == L"12345");
+    CHECK(logFiles[0].outFileName == L"log1");
+    CHECK(logFiles[0].numOfSectorsWriten == 1024);
+    CHECK(logFiles[0].totalSectors == 4096);
+}
+
+/**
+ * @brief Тест создания log файла для VMDK_Sparse.
+ *
+ * Проверяет, что метод **CreateSparseLog** создает log файл, а также его содержимое.
+ * Проверяет, что метод **ReadGTEs** корректно считывеат данные с массива GTEs.
+ */
+TEST_CASE("LogsReadWrite - CreateSparseLog") {
+    LogsReadWrite<wstring> logManager;
+
+    // Параметры для теста
+    uint32_t GTEs[] = {12, 14, 24};
+
+    // Проверка, что лог-файл был создан успешно
+    bool result = logManager.CreateSparseLog(L"Disk1", L"12345", L"/logs", L"log2", time(nullptr), 32, 3, 128, 12, 14, GTEs);
+    CHECK(result == true);
+
+    // Проверка, что лог-файл существует
+    ifstream file(logFileName2);
+    CHECK(file.is_open());
+    file.close();
+
+    // Чтение и проверка содержимого файла
+    wifstream logFile(logFileName2); // используем wifstream для работы с широкими строками
+    wstring line;
+
+    if (logFile.is_open()) {
+        // Проверяем тип изображения
+        getline(logFile, line);
+        CHECK(line == to_wstring(static_cast<int>(ImageType::VMDK_Sparse)));
+
+        // Проверяем остальные параметры
+        getline(logFile, line);
+        CHECK(line == L"Disk1");  // Имя диска
+        getline(logFile, line);
+        CHECK(line == L"12345");  // Серийный номер
+        getline(logFile, line);
+        CHECK(line == L"/logs");  // Директория
+        getline(logFile, line);
+        CHECK(line == L"log2");   // Имя файла
+        getline(logFile, line);
+        CHECK(line == to_wstring(time(nullptr)));  // Время окончания
+        getline(logFile, line);
+        CHECK(line == L"0");
+        getline(logFile, line);
+        CHECK(line == L"0");
+        getline(logFile, line);
+        CHECK(line == to_wstring(32));  // Количество записанных зерен
+        getline(logFile, line);
+        CHECK(line == to_wstring(3));   // Количество прочитанных зерен
+        getline(logFile, line);
+        CHECK(line == to_wstring(128)); // Общее количество зерен
+        getline(logFile, line);
+        CHECK(line == to_wstring(12));  // Смещение данных
+        getline(logFile, line);
+        CHECK(line == to_wstring(14));  // Смещение GTE
+
+        // Проверяем содержимое массива GTEs
+        for (size_t i = 0; i < 3; ++i) {
+            getline(logFile, line);
+            CHECK(line == to_wstring(GTEs[i]));
+        }
+
+        logFile.close();
+    }
+}
+
+/**
+ * @brief Тест удаления log файла.
+ *
+ * Проверяет, что метод **DeleteLogFile** удаляет log файл.
+ */
+TEST_CASE("LogsReadWrite - DeleteLogFile") {
+    LogsReadWrite<std::wstring> logManager;
+
+    // Создаем тестовый лог-файл для удаления
+    std::ofstream logFile("LogFileToDelete");
+    CHECK(logFile.is_open());
+    logFile.close();
+
+    bool deleteResult = logManager.DeleteLogFile("LogFileToDelete");
+    CHECK(deleteResult == true);
+    CHECK(!logFile.is_open());
+}
+
+/**
+ * @brief Тест манифеста хэшей зерен.
+ *
+ * Проверяет, что **GrainHash64** различает зерна, а **GrainHashManifest** сохраняет и загружает хэши без искажений.
+ */
+TEST_CASE("GrainHashManifest: Save/Load") {
+    unsigned char grainA[65536] = {0};
+    unsigned char grainB[65536] = {0};
+    grainB[65535] = 1;
+    CHECK(GrainHash64(grainA, sizeof(grainA)) == GrainHash64(grainA, sizeof(grainA)));
+    CHECK(GrainHash64(grainA, sizeof(grainA)) != GrainHash64(grainB, sizeof(grainB)));
+
+    GrainHashManifest manifest;
+    manifest.Reset(128, 256, 2);
+    manifest.hashes[0] = GrainHash64(grainA, sizeof(grainA));
+    manifest.hashes[1] = GrainHash64(grainB, sizeof(grainB));
+    #ifdef _WIN32
+    CHECK(manifest.Save(L"test_manifest.ghm"));
+    #endif // _WIN32
+    #ifdef __linux__
+    CHECK(manifest.Save("/tmp/test_manifest.ghm"));
+    #endif // __linux__
+
+    GrainHashManifest loaded;
+    #ifdef _WIN32
+    CHECK(loaded.Load(L"test_manifest.ghm"));
+    #endif // _WIN32
+    #ifdef __linux__
+    CHECK(loaded.Load("/tmp/test_manifest.ghm"));
+    #endif // __linux__
+    CHECK(loaded.grainSize == 128);
+    CHECK(loaded.capacity == 256);
+    CHECK(loaded.hashes == manifest.hashes);
+}
+
+/**
+ * @brief Тест хэша XXH64.
+ *
+ * Проверяет **GrainHash64** на эталонных значениях XXH64 и то, что **GrainHashStream**
+ * дает тот же хэш при передаче данных частями произвольной длины.
+ */
+TEST_CASE("GrainHash64: XXH64 vectors and GrainHashStream") {
+    CHECK(GrainHash64(reinterpret_cast<const unsigned char*>(""), 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(GrainHash64(reinterpret_cast<const unsigned char*>("a"), 1) == 0xD24EC4F1A98C6E5BULL);
+    CHECK(GrainHash64(reinterpret_cast<const unsigned char*>("abc"), 3) == 0x44BC2CF5AD770999ULL);
+
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 17 + i / 7);
+    for (size_t len : { 0, 5, 31, 32, 33, 100, 1000 }) {
+        GrainHashStream stream(42);
+        for (size_t pos = 0, part = 1; pos < len; pos += part, part = part * 3 % 37 + 1)
+            stream.Update(data.data() + pos, std::min(part, len - pos));
+        CHECK(stream.Digest() == GrainHash64(data.data(), len, 42));
+    }
+}
+
+/**
+ * @brief Тест создания дочернего образа.
+ *
+ * Проверяет, что **CreateDelta** записывает только изменившиеся зерна, дочерний образ вместе
+ * с родителем читается как исходный диск, а совпадение хэшей без совпадения данных не теряет изменения.
+ */
+TEST_CASE("DeltaSparseVMDK: CreateDelta") {
+    #ifdef __linux__
+    const PathString base = "/tmp/test_delta_base.dd";
+    const PathString disk = "/tmp/test_delta_disk.dd";
+    const PathString parentFile = "/tmp/test_delta_base.vmdk";
+    const PathString childFile = "/tmp/test_delta_child.vmdk";
+    SparseVMDK sparse("/tmp", "test_delta_base", base);
+    DeltaSparseVMDK delta("/tmp", "test_delta_child", disk, parentFile);
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString base = L"test_delta_base.dd";
+    const PathString disk = L"test_delta_disk.dd";
+    const PathString parentFile = L".\\test_delta_base.vmdk";
+    const PathString childFile = L".\\test_delta_child.vmdk";
+    SparseVMDK sparse(L".", L"test_delta_base", base);
+    DeltaSparseVMDK delta(L".", L"test_delta_child", disk, parentFile);
+    #endif // _WIN32
+
+    // Родитель: 8 МиБ, данные в первых двух мегабайтах
+    std::vector<unsigned char> data(8 * 1024 * 1024, 0);
+    for (size_t i = 0; i != 2 * 1024 * 1024; i++)
+        data[i] = static_cast<unsigned char>(i * 7 + i / 512);
+    BlockFile file;
+    REQUIRE(file.Open(base, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+    REQUIRE(sparse.ConvertImage(1024 * 1024));
+    #ifdef __linux__
+    unlink(GrainManifestPath(parentFile).c_str());   // Хэши родителя считаются по самому образу
+    #endif // __linux__
+    #ifdef _WIN32
+    _wunlink(GrainManifestPath(parentFile).c_str());
+    #endif // _WIN32
+
+    // Диск: одно зерно изменено, одно записано поверх нулей
+    SparseVMDKReader parent;
+    REQUIRE(parent.Open(parentFile));
+    const uint64_t grainBytes = parent.GetGrainBytes();
+    data[grainBytes + 10] ^= 0xFF;
+    data[6 * 1024 * 1024 + 3] = 0x42;
+    REQUIRE(file.Open(disk, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    auto readBack = [&](std::vector<unsigned char>& out) {
+        SparseVMDKReader child, up;
+        REQUIRE(child.Open(childFile));
+        REQUIRE(up.Open(parentFile));
+        CHECK(child.GetParentCID() == up.GetCID());
+        out.assign(data.size(), 0);
+        for (uint64_t g = 0; g != child.GetTotalGrains(); g++) {
+            SparseVMDKReader& owner = child.GetGTE(g) != 0 ? child : up;
+            REQUIRE(owner.ReadGrain(g, out.data() + g * grainBytes));
+        }
+    };
+
+    REQUIRE(delta.CreateDelta(1024 * 1024, data.size() / SECTOR_SIZE));
+    CHECK(delta.GetChangedGrains() == 2);
+    std::vector<unsigned char> back;
+    readBack(back);
+    CHECK(back == data);
+
+    // Подложный манифест родителя с хэшами нового диска: изменения подтверждаются по данным
+    GrainHashManifest forged;
+    forged.Reset(grainBytes / SECTOR_SIZE, data.size() / SECTOR_SIZE, data.size() / grainBytes);
+    for (uint64_t g = 0; g != forged.hashes.size(); g++)
+        forged.hashes[g] = GrainHash64(data.data() + g * grainBytes, grainBytes);
+    REQUIRE(forged.Save(GrainManifestPath(parentFile)));
+    REQUIRE(delta.CreateDelta(1024 * 1024, data.size() / SECTOR_SIZE));
+    CHECK(delta.GetChangedGrains() == 2);
+    readBack(back);
+    CHECK(back == data);
+}
+
+/**
+ * @brief Тест индекса дедупликации зерен.
+ *
+ * Проверяет, что **FindOrInsert** возвращает ранее записанное зерно только при подтверждённом совпадении содержимого.
+ */
+TEST_CASE("GrainDedupIndex: FindOrInsert") {
+    GrainDedupIndex index;
+
+    // Первое зерно добавляется как новое
+    CHECK(index.FindOrInsert(42, 100, [](uint32_t) { return true; }) == 0);
+    // То же содержимое находит ранее записанное зерно
+    CHECK(index.FindOrInsert(42, 200, [](uint32_t gte) { return gte == 100; }) == 100);
+    // Совпадение хэша без совпадения содержимого добавляет новое зерно
+    CHECK(index.FindOrInsert(42, 300, [](uint32_t) { return false; }) == 0);
+    CHECK(index.Count() == 2);
+}
+
+/**
+ * @brief Тест создания sparse-образа с дедупликацией.
+ *
+ * Проверяет, что **CreateSparseDedup** записывает повторяющиеся зерна один раз,
+ * а образ читается обратно без искажений.
+ */
+TEST_CASE("SparseVMDK: CreateSparseDedup") {
+    #ifdef __linux__
+    const PathString disk = "/tmp/test_dedup.dd";
+    SparseVMDK sparse("/tmp", "test_dedup", disk);
+    const PathString outFile = "/tmp/test_dedup.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString disk = L"test_dedup.dd";
+    SparseVMDK sparse(L".", L"test_dedup", disk);
+    const PathString outFile = L".\\test_dedup.vmdk";
+    #endif // _WIN32
+
+    // 4 МиБ зернами по 64 КиБ: зерно A трижды, зерно B один раз, остальное нули
+    const uint64_t grainBytes = sparse.GetGrainSize() * SECTOR_SIZE;
+    std::vector<unsigned char> data(4 * 1024 * 1024, 0);
+    for (uint64_t g : { 0, 5, 9 })
+        for (uint64_t i = 0; i != grainBytes; i++)
+            data[g * grainBytes + i] = static_cast<unsigned char>(i * 13 + i / 251);
+    for (uint64_t i = 0; i != grainBytes; i++)
+        data[2 * grainBytes + i] = static_cast<unsigned char>(i % 7 + 1);
+    BlockFile file;
+    REQUIRE(file.Open(disk, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    REQUIRE(sparse.CreateSparseDedup(1024 * 1024, data.size() / SECTOR_SIZE));
+    CHECK(sparse.GetDedupGrains() == 2);
+    CHECK(sparse.GetDedupRatio() == 2.0);
+
+    SparseVMDKReader reader;
+    REQUIRE(reader.Open(outFile));
+    CHECK(reader.GetGTE(0) != 0);
+    CHECK(reader.GetGTE(5) == reader.GetGTE(0));
+    CHECK(reader.GetGTE(9) == reader.GetGTE(0));
+    CHECK(reader.GetGTE(2) != reader.GetGTE(0));
+    CHECK(reader.GetGTE(1) == 0);
+    std::vector<unsigned char> back(data.size());
+    REQUIRE(reader.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+}
+
+/**
+ * @brief Тест политик размера сектора.
+ *
+ * Проверяет пересчёт смещений и выбор политики по физическому размеру сектора в **DispatchSectorSize**.
+ */
+TEST_CASE("SectorPolicy: alignment and dispatch") {
+    CHECK(Sector4096::ToBytes(3) == 12288);
+    CHECK(Sector4096::ToVmdkSectors(1) == 8);
+    CHECK(Sector4096::AlignUp(1) == 4096);
+    CHECK(Sector512::IsAligned(1024));
+    CHECK_FALSE(Sector4096::IsAligned(1024));
+
+    auto size = [](auto policy) { return decltype(policy)::size; };
+    CHECK(DispatchSectorSize(512, size) == 512);
+    CHECK(DispatchSectorSize(4096, size) == 4096);
+}
+
+/**
+ * @brief Тест подбора размера зерна.
+ *
+ * Проверяет, что **SetGrainSize** принимает только степени двойки из допустимого диапазона,
+ * а **GrainSizeSampler** выбирает мелкое зерно для разреженного диска и крупное для плотного.
+ */
+TEST_CASE("SparseVMDK: SetGrainSize and GrainSizeSampler") {
+    #ifdef _WIN32
+    SparseVMDK sparse(L"C:\\temp", L"test", L"\\\\.\\PhysicalDrive0");
+    #endif // _WIN32
+    #ifdef __linux__
+    SparseVMDK sparse("/tmp", "test", "/dev/sda");
+    #endif // __linux__
+    CHECK(sparse.SetGrainSize(8));
+    CHECK(sparse.SetGrainSize(2048));
+    CHECK_FALSE(sparse.SetGrainSize(4));
+    CHECK_FALSE(sparse.SetGrainSize(96));
+    CHECK(sparse.GetGrainSize() == 2048);
+    CHECK_FALSE(sparse.SetGTECount(500));
+
+    MemorySource disk;
+
+    // По одному блоку 4K в каждом окне 2M
+    disk.data.assign(16 * 2 * 1024 * 1024, 0);
+    for (size_t w = 0; w != 16; w++)
+        disk.data[w * 2 * 1024 * 1024 + 100] = 1;
+    GrainSizeSampler sampler;
+    CHECK(sampler.Sample(disk, disk.data.size() / 512, 16));
+    CHECK(sampler.Best() == 8);
+
+    std::fill(disk.data.begin(), disk.data.end(), 0x5A);
+    CHECK(sampler.Sample(disk, disk.data.size() / 512, 16));
+    CHECK(sampler.Best() == 4096);
+}
+
+/**
+ * @brief Тест службы создания образов.
+ *
+ * Проверяет разбор задания в **ParseJobSpec** (в том числе размера участка проверки) и отказ **Submit**
+ * для заданий, не помещающихся в бюджет памяти.
+ */
+TEST_CASE("ImagingDaemon: ParseJobSpec and Submit") {
+    JobSpec spec;
+    std::string error;
+    CHECK(ParseJobSpec("id=nightly\nsource=/dev/sdb\ndir=/tmp\nname=img\nformat=dedup\ngrain=auto\nbuffer=1048576\n", spec, error));
+    CHECK(spec.id == "nightly");
+    CHECK(spec.format == JobFormat::SparseDedup);
+    CHECK(spec.autoGrain);
+    CHECK(spec.bufSize == 1048576);
+    CHECK(spec.verifyChunk == VERIFY_CHUNK_BYTES);
+
+    JobSpec checked;
+    CHECK(ParseJobSpec("source=/dev/sdb\ndir=/tmp\nname=img\nverify=yes\nverifyChunk=16777216\n", checked, error));
+    CHECK(checked.verify);
+    CHECK(checked.verifyChunk == 16777216);
+
+    JobSpec bad;
+    CHECK_FALSE(ParseJobSpec("source=/dev/sdb\ndir=/tmp\nname=img\nbuffer=1000\n", bad, error));
+    CHECK_FALSE(ParseJobSpec("source=/dev/sdb\ndir=/tmp\nname=img\nverifyChunk=1000\n", bad, error));
+    CHECK_FALSE(ParseJobSpec("source=/dev/sdb\ndir=/tmp\nname=img\nformat=delta\n", bad, error));
+
+    DaemonLimits limits;
+    limits.memoryBudget = 512 * 1024;
+    ImagingDaemon daemon(limits);
+    std::string id;
+    CHECK_FALSE(daemon.Submit(spec, id, error));
+    CHECK(daemon.GetState("nightly") == JobState::Unknown);
+}
+
+/**
+ * @brief Тест повторного DD-задания.
+ *
+ * Проверяет, что **ImagingDaemon** не продолжает завершенную копию: если контрольная
+ * точка всего диска осталась (сбой до ее удаления), повтор задания копирует диск заново,
+ * а после изменения источника образ обновляется, а не остается прежним.
+ */
+TEST_CASE("ImagingDaemon: re-run of a finished DD job") {
+    JobSpec spec;
+    #ifdef __linux__
+    spec.source = "/tmp/test_rerun_src.bin";
+    spec.outDir = "/tmp";
+    spec.outName = "test_rerun";
+    const PathString image = "/tmp/test_rerun.dd";
+    const PathString ckpt = "/tmp/test_rerun.dd.ckpt";
+    const std::wstring sourceName = L"/tmp/test_rerun_src.bin";
+    #endif // __linux__
+    #ifdef _WIN32
+    spec.source = L"test_rerun_src.bin";
+    spec.outDir = L".";
+    spec.outName = L"test_rerun";
+    const PathString image = L".\\test_rerun.dd";
+    const PathString ckpt = L".\\test_rerun.dd.ckpt";
+    const std::wstring sourceName = L"test_rerun_src.bin";
+    #endif // _WIN32
+    spec.bufSize = 64 * 1024;
+
+    const uint64_t bytes = 8 * 1024 * 1024;
+    std::vector<unsigned char> data(bytes, 'A');
+    BlockFile file;
+    REQUIRE(file.Open(spec.source, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    // Контрольная точка всего диска, оставшаяся после сбоя между фиксацией и удалением
+    auto leaveCheckpoint = [&]() {
+        BlockFile writer;
+        REQUIRE(writer.Open(image, BlockFileMode::ReadWrite));
+        CheckpointFields log;
+        log.type = ImageType::DD;
+        log.disk = sourceName;
+        log.totalSectors = bytes / SECTOR_SIZE;
+        DurableCheckpoint checkpoint(writer, ckpt, log, bytes);
+        REQUIRE(checkpoint.Commit());
+    };
+    ImagingDaemon daemon;
+    daemon.Start();
+    auto run = [&](const std::string& id) {
+        std::ostringstream output;
+        std::streambuf* old = std::cout.rdbuf(output.rdbuf());
+        std::string accepted, error;
+        spec.id = id;
+        bool submitted = daemon.Submit(spec, accepted, error);
+        daemon.WaitIdle();
+        std::cout.rdbuf(old);
+        REQUIRE(submitted);
+        CHECK(daemon.GetState(id) == JobState::Done);
+        return output.str();
+    };
+
+    run("rerun1");
+    // Источник не изменился: проверка возобновления проходит, но копия все равно делается заново
+    leaveCheckpoint();
+    CHECK(run("rerun2").find("resumes at sector") == std::string::npos);
+
+    // Источник изменился: образ обновляется
+    leaveCheckpoint();
+    memset(data.data(), 'B', 4096);
+    REQUIRE(file.Open(spec.source, BlockFileMode::ReadWrite));
+    REQUIRE(file.WriteAt(data.data(), 4096, 0));
+    file.Close();
+    run("rerun3");
+    daemon.Stop();
+
+    std::vector<unsigned char> head(4096);
+    REQUIRE(file.Open(image, BlockFileMode::Read));
+    CHECK(file.Size() == bytes);
+    REQUIRE(file.ReadAt(head.data(), head.size(), 0));
+    file.Close();
+    CHECK(head[0] == 'B');
+    CHECK(memcmp(head.data(), data.data(), head.size()) == 0);
+    CheckpointFields left;
+    CHECK_FALSE(DurableCheckpoint::Read(ckpt, left));
+
+    #ifdef __linux__
+    unlink(spec.source.c_str());
+    unlink(image.c_str());
+    #endif // __linux__
+    #ifdef _WIN32
+    _wunlink(spec.source.c_str());
+    _wunlink(image.c_str());
+    #endif // _WIN32
+}
+
+#ifdef __linux__
+/**
+ * @brief Тест приема заданий через Unix-сокет.
+ *
+ * Проверяет, что **ServeSocket** не удаляет чужой файл и работающий сокет, заменяет брошенный,
+ * создает сокет с правами 0600, молча закрывает соединение без запроса, отвечает клиенту,
+ * пока другой клиент молчит, и выполняет DD-задание движком RawCopy.
+ */
+TEST_CASE("ImagingDaemon: ServeSocket") {
+    const std::string path = "/tmp/test_daemon.sock";
+    const std::string source = "/tmp/test_daemon_src.bin";
+    const std::string image = "/tmp/test_daemon_dd.dd";
+    unlink(path.c_str());
+
+    std::vector<unsigned char> data(2 * 1024 * 1024);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 13 + i / 512);
+    {
+        BlockFile file;
+        REQUIRE(file.Open(source, BlockFileMode::Write));
+        REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    }
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // Обычный файл на месте сокета не удаляется
+    { std::ofstream(path) << "keep"; }
+    ImagingDaemon daemon;
+    CHECK_FALSE(daemon.ServeSocket(path));
+    struct stat st;
+    REQUIRE(lstat(path.c_str(), &st) == 0);
+    CHECK(S_ISREG(st.st_mode));
+    unlink(path.c_str());
+
+    // Брошенный сокет предыдущего запуска заменяется
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(bind(stale, (sockaddr*)&addr, sizeof(addr)) == 0);
+    close(stale);
+    daemon.Start();
+    REQUIRE(daemon.ServeSocket(path));
+    REQUIRE(lstat(path.c_str(), &st) == 0);
+    CHECK((st.st_mode & 0777) == 0600);
+
+    ImagingDaemon other;
+    CHECK_FALSE(other.ServeSocket(path));
+
+    // Соединение без запроса (как проверка занятости) закрывается без ответа
+    int empty = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(connect(empty, (sockaddr*)&addr, sizeof(addr)) == 0);
+    shutdown(empty, SHUT_WR);
+    char none[64];
+    CHECK(read(empty, none, sizeof(none)) == 0);
+    close(empty);
+
+    // Молчащий клиент не задерживает ответ следующему
+    int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(connect(idle, (sockaddr*)&addr, sizeof(addr)) == 0);
+
+    auto start = std::chrono::steady_clock::now();
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    std::string request = "id=dd1\nsource=" + source + "\ndir=/tmp\nname=test_daemon_dd\nformat=dd\nbuffer=65536\nverify=yes\n";
+    REQUIRE(write(fd, request.data(), request.size()) == (ssize_t)request.size());
+    shutdown(fd, SHUT_WR);
+    char reply[64] = {};
+    CHECK(read(fd, reply, sizeof(reply) - 1) > 0);
+    close(fd);
+    CHECK(std::string(reply) == "accepted dd1\n");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(3));
+
+    daemon.WaitIdle();
+    CHECK(daemon.GetState("dd1") == JobState::Done);
+    std::vector<unsigned char> copy(data.size());
+    BlockFile result;
+    REQUIRE(result.Open(image, BlockFileMode::Read));
+    CHECK(result.Size() == data.size());
+    CHECK(result.ReadAt(copy.data(), copy.size(), 0));
+    CHECK(copy == data);
+    result.Close();
+    CHECK(lstat((image + ".ckpt").c_str(), &st) != 0);
+
+    daemon.Stop();
+    close(idle);
+    CHECK(lstat(path.c_str(), &st) != 0);
+    unlink(source.c_str());
+    unlink(image.c_str());
+    unlink((image + ".ckpt").c_str());
+}
+#endif // __linux__
+
+/**
+ * @brief Тест планировщика задач.
+ *
+ * Проверяет, что все задачи группы, включая вложенные и помеченные **BlockingScope**, выполняются до возврата из **Wait**.
+ */
+TEST_CASE("TaskScheduler: TaskGroup") {
+    TaskScheduler scheduler(2);
+    TaskGroup group(scheduler);
+    std::atomic<int> done(0);
+
+    for (int i = 0; i != 100; i++) {
+        group.Run([&] {
+            TaskGroup inner(scheduler);
+            inner.Run([&] { done++; });
+            TaskScheduler::BlockingScope blocking;
+            inner.Wait();
+            done++;
+        });
+    }
+    group.Wait();
+    CHECK(done == 200);
+    CHECK(scheduler.GetConcurrency() == 2);
+}
+
+/**
+ * @brief Тест пула буферов.
+ *
+ * Проверяет, что **Acquire** возвращает выровненные буферы и после прогрева переиспользует блоки без новых выделений у ОС.
+ */
+TEST_CASE("BufferPool: Acquire reuses slabs") {
+    BufferPool pool(true);
+    {
+        PooledBuffer small = pool.Acquire(1000);
+        PooledBuffer large = pool.Acquire(4 * 1024 * 1024);
+        CHECK(small.Data() != nullptr);
+        CHECK(large.Data() != nullptr);
+        CHECK(reinterpret_cast<uintptr_t>(small.Data()) % 4096 == 0);
+        CHECK(reinterpret_cast<uintptr_t>(large.Data()) % (2 * 1024 * 1024) == 0);
+        CHECK(small.Size() == 1000);
+    }
+    uint64_t mapped = pool.GetMappedSlabs();
+    for (int i = 0; i != 100; i++) {
+        PooledBuffer small = pool.Acquire(4096);
+        PooledBuffer large = pool.Acquire(3 * 1024 * 1024);
+        PooledBuffer moved = std::move(large);
+        CHECK(moved.Data() != nullptr);
+    }
+    CHECK(pool.GetMappedSlabs() == mapped);
+}
+
+/**
+ * @brief Тест управления страничным кэшем.
+ *
+ * Проверяет, что при включенном **SetCacheHygiene** запись и чтение окнами сохраняют данные без искажений.
+ */
+TEST_CASE("BlockFile: SetCacheHygiene") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_cache_hygiene.bin";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_cache_hygiene.bin";
+    #endif // _WIN32
+
+    std::vector<unsigned char> data(1024 * 1024);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 7);
+
+    BlockFile writer;
+    REQUIRE(writer.Open(path, BlockFileMode::Write));
+    writer.SetCacheHygiene(64 * 1024);
+    for (size_t pos = 0; pos < data.size(); pos += 16 * 1024)
+        CHECK(writer.WriteAt(data.data() + pos, 16 * 1024, pos));
+    writer.Close();
+
+    BlockFile reader;
+    REQUIRE(reader.Open(path, BlockFileMode::Read));
+    reader.SetCacheHygiene(64 * 1024);
+    std::vector<unsigned char> back(data.size());
+    for (size_t pos = 0; pos < back.size(); pos += 16 * 1024)
+        CHECK(reader.ReadAt(back.data() + pos, 16 * 1024, pos));
+    CHECK(back == data);
+}
+
+/**
+ * @brief Тест надежной контрольной точки.
+ *
+ * Проверяет, что **DurableCheckpoint** фиксирует только непрерывно записанную часть
+ * при завершении участков не по порядку и что файл читается обратно.
+ */
+TEST_CASE("DurableCheckpoint: Commit") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_checkpoint.bin";
+    const PathString ckpt = "/tmp/test_checkpoint.ckpt";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_checkpoint.bin";
+    const PathString ckpt = L"test_checkpoint.ckpt";
+    #endif // _WIN32
+
+    BlockFile writer;
+    REQUIRE(writer.Open(path, BlockFileMode::Write));
+
+    CheckpointFields log;
+    log.type = ImageType::DD;
+    log.disk = L"disk0";
+    log.serialNum = L"SN123";
+    log.outFileDir = L"dir";
+    log.outFileName = L"image.dd";
+    log.totalSectors = 64;
+
+    DurableCheckpoint checkpoint(writer, ckpt, log, 0, 8 * SECTOR_SIZE, 3600);
+    std::vector<unsigned char> data(16 * SECTOR_SIZE, 0xAB);
+
+    // Второй участок завершился раньше первого: фиксировать нечего
+    REQUIRE(writer.WriteAt(data.data(), data.size(), data.size()));
+    CHECK(checkpoint.Completed(data.size(), data.size()));
+    CHECK(checkpoint.GetDurableSectors() == 0);
+
+    REQUIRE(writer.WriteAt(data.data(), data.size(), 0));
+    CHECK(checkpoint.Completed(0, data.size()));
+    CHECK(checkpoint.GetDurableSectors() == 32);
+
+    CheckpointFields read;
+    REQUIRE(DurableCheckpoint::Read(ckpt, read));
+    CHECK(read.type == ImageType::DD);
+    CHECK(read.disk == L"disk0");
+    CHECK(read.serialNum == L"SN123");
+    CHECK(read.outFileName == L"image.dd");
+    CHECK(read.numOfSectorsWriten == 32);
+    CHECK(read.totalSectors == 64);
+}
+
+/**
+ * @brief Тест проверки частичного образа перед возобновлением.
+ *
+ * Проверяет, что **ResumeVerifier** принимает неповрежденный образ и находит
+ * испорченный участок в окне перед контрольной точкой.
+ */
+TEST_CASE("ResumeVerifier: Verify") {
+    MemorySource disk, image;
+
+    disk.data.resize(4 * 1024 * 1024);
+    for (size_t i = 0; i != disk.data.size(); i++)
+        disk.data[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+    image.data.assign(disk.data.begin(), disk.data.begin() + 3 * 1024 * 1024);
+
+    ResumeVerifier verifier(256 * 1024, 8, 64 * 1024);
+    uint64_t valid = 0;
+    REQUIRE(verifier.Verify(disk, image, image.data.size(), valid));
+    CHECK(valid == image.data.size());
+    CHECK(verifier.GetCheckedChunks() > 4);
+
+    // Оборванная запись перед контрольной точкой
+    image.data[image.data.size() - 100 * 1024] ^= 0xFF;
+    REQUIRE(verifier.Verify(disk, image, image.data.size(), valid));
+    CHECK(valid == image.data.size() - 128 * 1024);
+
+    // Образ короче контрольной точки
+    REQUIRE(verifier.Verify(disk, image, disk.data.size(), valid));
+    CHECK(valid == image.data.size() - 128 * 1024);
+}
+
+/**
+ * @brief Тест сжатого образа zstd seekable.
+ *
+ * Проверяет, что **SeekableZstdWriter** создает образ из нескольких кадров,
+ * а **SeekableZstdReader** читает его с произвольного смещения, в том числе на границе кадров
+ * и из нескольких потоков одновременно.
+ */
+TEST_CASE("SeekableZstd: Write and ReadAt") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_seekable.dd.zst";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_seekable.dd.zst";
+    #endif // _WIN32
+
+    MemorySource disk;
+
+    // Сжимаемые данные: половина нулей, половина повторяющегося узора
+    disk.data.assign(3 * 1024 * 1024 + 4096, 0);
+    for (size_t i = disk.data.size() / 2; i != disk.data.size(); i++)
+        disk.data[i] = static_cast<unsigned char>(i % 251);
+
+    BlockFile out;
+    REQUIRE(out.Open(path, BlockFileMode::Write));
+    SeekableZstdWriter writer(1024 * 1024, 3);
+    REQUIRE(writer.Write(disk, disk.data.size(), out));
+    out.Close();
+    CHECK(writer.GetCompressedBytes() < disk.data.size() / 4);
+
+    SeekableZstdReader reader;
+    REQUIRE(reader.Open(path));
+    CHECK(reader.GetFrameCount() == 4);
+    CHECK(reader.Size() == disk.data.size());
+
+    std::vector<unsigned char> buf(8192);
+    const uint64_t offsets[] = { 0, 1024 * 1024 - 4096, 2 * 1024 * 1024 + 17, disk.data.size() - 8192 };
+    for (uint64_t offset : offsets) {
+        REQUIRE(reader.ReadAt(buf.data(), buf.size(), offset));
+        CHECK(memcmp(buf.data(), disk.data.data() + offset, buf.size()) == 0);
+    }
+    CHECK_FALSE(reader.ReadAt(buf.data(), buf.size(), disk.data.size() - 100));
+
+    // Параллельное чтение через кэш на два кадра
+    SeekableZstdReader shared(2);
+    REQUIRE(shared.Open(path));
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; t++) {
+        threads.emplace_back([&, t] {
+            std::vector<unsigned char> part(65536);
+            for (uint64_t offset = t * 4096; offset + part.size() <= disk.data.size(); offset += 300000) {
+                if (!shared.ReadAt(part.data(), part.size(), offset) ||
+                    memcmp(part.data(), disk.data.data() + offset, part.size()) != 0)
+                    errors++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    CHECK(errors == 0);
+}
+
+/**
+ * @brief Тест шифрования AES-256-XTS.
+ *
+ * Проверяет **AesXts** на векторе 10 стандарта IEEE 1619 и чтение с произвольного
+ * смещения через **DecryptingSource**, а также отказ шифровать неполную единицу XTS.
+ */
+TEST_CASE("AesXts: IEEE 1619 vector and DecryptingSource") {
+    if (!AesXts::Supported())
+        return;
+
+    const char* hex = "2718281828459045235360287471352662497757247093699959574966967627"
+                      "3141592653589793238462643383279502884197169399375105820974944592";
+    unsigned char key[XTS_KEY_BYTES];
+    for (size_t i = 0; i != XTS_KEY_BYTES; i++)
+        key[i] = static_cast<unsigned char>(std::stoi(std::string(hex + 2 * i, 2), nullptr, 16));
+
+    AesXts cipher;
+    REQUIRE(cipher.SetKey(key));
+
+    std::vector<unsigned char> sector(XTS_UNIT);
+    for (size_t i = 0; i != sector.size(); i++)
+        sector[i] = static_cast<unsigned char>(i);
+    CHECK(cipher.Encrypt(sector.data(), sector.size(), 0xFF * XTS_UNIT));
+    const unsigned char head[] = { 0x1c, 0x3b, 0x3a, 0x10, 0x2f, 0x77, 0x03, 0x86 };
+    CHECK(memcmp(sector.data(), head, sizeof(head)) == 0);
+
+    MemorySource image;
+
+    std::vector<unsigned char> plain(16 * XTS_UNIT);
+    for (size_t i = 0; i != plain.size(); i++)
+        plain[i] = static_cast<unsigned char>(i * 7 + i / 512);
+    image.data = plain;
+    CHECK(cipher.Encrypt(image.data.data(), image.data.size(), 0));
+    CHECK(image.data != plain);
+
+    // Неполная единица XTS не шифруется и не остается открытой молча
+    std::vector<unsigned char> partial(plain.begin(), plain.begin() + XTS_UNIT + 100);
+    CHECK_FALSE(cipher.Encrypt(partial.data(), partial.size(), 0));
+    CHECK_FALSE(cipher.Encrypt(partial.data(), XTS_UNIT, 100));
+    CHECK(std::equal(partial.begin(), partial.end(), plain.begin()));
+
+    DecryptingSource source(image, cipher);
+    std::vector<unsigned char> buf(1000);
+    REQUIRE(source.ReadAt(buf.data(), buf.size(), 700));
+    CHECK(memcmp(buf.data(), plain.data() + 700, buf.size()) == 0);
+
+    memset(key + 32, 0, 32);
+    memset(key, 0, 32);
+    CHECK_FALSE(cipher.SetKey(key));
+}
+
+#ifdef __linux__
+/**
+ * @brief Тест NBD-сервера.
+ *
+ * Проверяет, что **NbdServer** отдает через Unix-сокет данные опубликованного образа
+ * (согласование NBD_OPT_EXPORT_NAME и команда READ), запись отклоняется, а сокет
+ * доступен только владельцу и удаляется при остановке.
+ */
+TEST_CASE("NbdServer: export name and read") {
+    auto disk = std::make_shared<MemorySource>();
+    disk->data.resize(1024 * 1024);
+    for (size_t i = 0; i != disk->data.size(); i++)
+        disk->data[i] = static_cast<unsigned char>(i * 11 + i / 4096);
+
+    const std::string path = "/tmp/test_nbd.sock";
+    NbdServer server;
+    REQUIRE(server.AddExport("disk", std::make_shared<BlockCache>(disk, 64 * 1024, 256 * 1024)));
+    CHECK_FALSE(server.AddExport("disk", disk));
+    REQUIRE(server.ServeUnix(path));
+    struct stat st;
+    REQUIRE(lstat(path.c_str(), &st) == 0);
+    CHECK((st.st_mode & 0777) == 0600);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    REQUIRE(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+
+    NbdHello hello;
+    REQUIRE(recv(fd, &hello, sizeof(hello), MSG_WAITALL) == sizeof(hello));
+    CHECK(be64toh(hello.magic) == NBD_MAGIC);
+    uint32_t flags = htobe32(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    send(fd, &flags, 4, 0);
+    NbdOptionHeader option = { htobe64(NBD_IHAVEOPT), htobe32(NBD_OPT_EXPORT_NAME), htobe32(4) };
+    send(fd, &option, sizeof(option), 0);
+    send(fd, "disk", 4, 0);
+    unsigned char exportInfo[10];
+    REQUIRE(recv(fd, exportInfo, sizeof(exportInfo), MSG_WAITALL) == sizeof(exportInfo));
+    uint64_t size;
+    memcpy(&size, exportInfo, 8);
+    CHECK(be64toh(size) == disk->data.size());
+
+    NbdRequest read = { htobe32(NBD_REQUEST_MAGIC), 0, htobe16(NBD_CMD_READ), 7, htobe64(70000), htobe32(100000) };
+    send(fd, &read, sizeof(read), 0);
+    NbdSimpleReply reply;
+    std::vector<unsigned char> data(100000);
+    REQUIRE(recv(fd, &reply, sizeof(reply), MSG_WAITALL) == sizeof(reply));
+    CHECK(reply.error == 0);
+    CHECK(reply.handle == 7);
+    REQUIRE(recv(fd, data.data(), data.size(), MSG_WAITALL) == (ssize_t)data.size());
+    CHECK(memcmp(data.data(), disk->data.data() + 70000, data.size()) == 0);
+
+    NbdRequest write = { htobe32(NBD_REQUEST_MAGIC), 0, htobe16(NBD_CMD_WRITE), 8, 0, htobe32(512) };
+    send(fd, &write, sizeof(write), 0);
+    send(fd, data.data(), 512, 0);
+    REQUIRE(recv(fd, &reply, sizeof(reply), MSG_WAITALL) == sizeof(reply));
+    CHECK(be32toh(reply.error) == EPERM);
+
+    close(fd);
+    server.Stop();
+    CHECK(server.GetClientCount() == 0);
+    CHECK(lstat(path.c_str(), &st) != 0);
+}
+#endif // __linux__
+
+/**
+ * @brief Тест преобразования DD-образа в sparse VMDK.
+ *
+ * Проверяет, что **DataRanges** находит участки данных sparse-файла, а **ConvertImage**
+ * создает образ, в котором дыры исходного файла не заняли зерен.
+ */
+TEST_CASE("SparseVMDK: ConvertImage skips holes") {
+    #ifdef __linux__
+    const PathString image = "/tmp/test_convert.dd";
+    SparseVMDK sparse("/tmp", "test_convert", image);
+    const PathString outFile = "/tmp/test_convert.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString image = L"test_convert.dd";
+    SparseVMDK sparse(L".", L"test_convert", image);
+    const PathString outFile = L".\\test_convert.vmdk";
+    #endif // _WIN32
+
+    // 64 МиБ, данные только в начале и на 40-м мегабайте
+    const uint64_t imageBytes = 64ull * 1024 * 1024;
+    std::vector<unsigned char> block(1024 * 1024, 0x3C);
+    BlockFile dd;
+    REQUIRE(dd.Open(image, BlockFileMode::Write));
+    REQUIRE(dd.Truncate(imageBytes));
+    REQUIRE(dd.WriteAt(block.data(), block.size(), 0));
+    REQUIRE(dd.WriteAt(block.data(), block.size(), 40ull * 1024 * 1024));
+    dd.Close();
+
+    REQUIRE(dd.Open(image, BlockFileMode::Read));
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    if (dd.DataRanges(ranges)) {
+        CHECK(RangesOverlap(ranges, 0, 4096));
+        CHECK(RangesOverlap(ranges, 40ull * 1024 * 1024, 4096));
+        CHECK_FALSE(RangesOverlap(ranges, 20ull * 1024 * 1024, 4096));
+    }
+    dd.Close();
+
+    REQUIRE(sparse.ConvertImage(4 * 1024 * 1024));
+    CHECK(sparse.GetDedupRatio() == 1.0);
+
+    SparseVMDKReader reader;
+    REQUIRE(reader.Open(outFile));
+    CHECK(reader.Size() == imageBytes);
+    uint64_t allocated = 0;
+    for (uint64_t g = 0; g != reader.GetTotalGrains(); g++)
+        allocated += reader.GetGTE(g) != 0;
+    CHECK(allocated * reader.GetGrainBytes() == 2 * block.size());
+
+    std::vector<unsigned char> back(block.size());
+    REQUIRE(reader.ReadAt(back.data(), back.size(), 40ull * 1024 * 1024));
+    CHECK(back == block);
+    REQUIRE(reader.ReadAt(back.data(), back.size(), 20ull * 1024 * 1024));
+    CHECK(std::all_of(back.begin(), back.end(), [](unsigned char c) { return c == 0; }));
+}
+
+/**
+ * @brief Тест разворачивания sparse VMDK в raw-файл.
+ *
+ * Проверяет, что **Expand** переносит только выделенные зерна, а результат
+ * совпадает с исходным DD-образом.
+ */
+TEST_CASE("SparseVMDKReader: Expand") {
+    #ifdef __linux__
+    const PathString image = "/tmp/test_expand.dd";
+    const PathString raw = "/tmp/test_expand_out.dd";
+    SparseVMDK sparse("/tmp", "test_expand", image);
+    const PathString outFile = "/tmp/test_expand.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString image = L"test_expand.dd";
+    const PathString raw = L"test_expand_out.dd";
+    SparseVMDK sparse(L".", L"test_expand", image);
+    const PathString outFile = L".\\test_expand.vmdk";
+    #endif // _WIN32
+
+    // 32 МиБ: узор в начале, одно зерно в середине и неполный хвост зерна в конце
+    std::vector<unsigned char> data(32 * 1024 * 1024, 0);
+    for (size_t i = 0; i != 3 * 65536; i++)
+        data[i] = static_cast<unsigned char>(i % 249);
+    data[17 * 1024 * 1024 + 5] = 0x11;
+    data[data.size() - 1] = 0x22;
+    BlockFile dd;
+    REQUIRE(dd.Open(image, BlockFileMode::Write));
+    REQUIRE(dd.WriteAt(data.data(), data.size(), 0));
+    dd.Close();
+    REQUIRE(sparse.ConvertImage(1024 * 1024));
+
+    SparseVMDKReader reader;
+    REQUIRE(reader.Open(outFile));
+    REQUIRE(reader.Expand(raw, 1024 * 1024));
+    CHECK(reader.GetExpandedBytes() == 5 * reader.GetGrainBytes());
+
+    std::vector<unsigned char> back(data.size());
+    REQUIRE(dd.Open(raw, BlockFileMode::Read));
+    CHECK(dd.Size() == data.size());
+    REQUIRE(dd.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+}
+
+/**
+ * @brief Тест гистограмм задержек и трассировки.
+ *
+ * Проверяет точность перцентилей **LatencyHistogram** и учет операций **BlockFile**
+ * в **IoStats** с выгрузкой трассировки.
+ */
+TEST_CASE("IoStats: LatencyHistogram and trace") {
+    LatencyHistogram h;
+    for (uint64_t v = 1; v <= 1000; v++)
+        h.Record(v * 1000);     // 1..1000 мкс
+    h.Record(2000000000);       // одно зависание на 2 с
+    CHECK(h.GetCount() == 1001);
+    CHECK(h.GetMax() == 2000000000);
+    uint64_t p50 = h.Percentile(0.5);
+    CHECK(p50 >= 500000);
+    CHECK(p50 <= 500000 + 500000 / LATENCY_SUB);
+    CHECK(h.Percentile(0.99) < 1100000);
+    CHECK(h.Percentile(1.0) == 2000000000);
+    for (uint64_t v : std::vector<uint64_t>{ 0, 31, 32, 1000, 123456789, UINT64_MAX }) {
+        size_t b = LatencyHistogram::Bucket(v);
+        CHECK(b < LATENCY_BUCKETS);
+        CHECK(LatencyHistogram::BucketLow(b) <= v);
+    }
+
+    #ifdef __linux__
+    const PathString path = "/tmp/test_iostats.bin";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_iostats.bin";
+    #endif // _WIN32
+
+    IoStats stats;
+    stats.EnableTrace();
+    std::vector<unsigned char> data(64 * 1024, 0x42);
+    BlockFile file;
+    REQUIRE(file.Open(path, BlockFileMode::ReadWrite));
+    file.SetStats(&stats);
+    for (uint64_t i = 0; i != 8; i++)
+        REQUIRE(file.WriteAt(data.data(), data.size(), i * data.size()));
+    REQUIRE(file.Sync());
+    for (uint64_t i = 0; i != 4; i++)
+        REQUIRE(file.ReadAt(data.data(), data.size(), i * data.size()));
+    file.Close();
+
+    CHECK(stats.Get(IoOp::Write).GetCount() == 8);
+    CHECK(stats.Get(IoOp::Read).GetCount() == 4);
+    CHECK(stats.Get(IoOp::Sync).GetCount() == 1);
+
+    std::ostringstream report;
+    stats.Report(report);
+    CHECK(report.str().find("write: n=8") != std::string::npos);
+
+    std::ostringstream trace;
+    REQUIRE(stats.SaveTrace(trace));
+    std::string json = trace.str();
+    CHECK(json.find("\"traceEvents\"") != std::string::npos);
+    size_t events = 0;
+    for (size_t pos = json.find("\"ph\":\"X\""); pos != std::string::npos; pos = json.find("\"ph\":\"X\"", pos + 1))
+        events++;
+    CHECK(events == 13);
+}
+
+/**
+ * @brief Тест копирования полосами.
+ *
+ * Проверяет, что **CreateRawCopyStriped** дает точную копию, удаляет контрольную точку
+ * завершенной копии и корректно продолжает копирование с середины.
+ */
+TEST_CASE("RawCopy: CreateRawCopyStriped") {
+    #ifdef __linux__
+    const PathString source = "/tmp/test_striped_src.img";
+    const PathString image = "/tmp/test_striped.dd";
+    const PathString ckpt = "/tmp/test_striped.dd.ckpt";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString source = L"test_striped_src.img";
+    const PathString image = L"test_striped.dd";
+    const PathString ckpt = L"test_striped.dd.ckpt";
+    #endif // _WIN32
+
+    // Нечетное число секторов: последняя полоса неполная
+    const unsigned long sectors = 16 * 1024 + 3;
+    std::vector<unsigned char> data((uint64_t)sectors * SECTOR_SIZE);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>((i / SECTOR_SIZE) * 31 + i);
+    BlockFile file;
+    REQUIRE(file.Open(source, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+    REQUIRE(file.Open(image, BlockFileMode::Write));
+    file.Close();
+
+    #ifdef __linux__
+    RawCopy rawCopy(L"/tmp/test_striped_src.img", L"SN1", L"/tmp/test_striped.dd", 64 * 1024, sectors);
+    #endif // __linux__
+    #ifdef _WIN32
+    RawCopy rawCopy(L"test_striped_src.img", L"SN1", L"test_striped.dd", 64 * 1024, sectors);
+    #endif // _WIN32
+    REQUIRE(rawCopy.CreateRawCopyStriped(0, 8));
+
+    std::vector<unsigned char> back(data.size());
+    REQUIRE(file.Open(image, BlockFileMode::ReadWrite));
+    REQUIRE(file.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+    CheckpointFields log;
+    CHECK_FALSE(DurableCheckpoint::Read(ckpt, log));   // Завершенная копия не оставляет контрольной точки
+
+    // Портим вторую половину и продолжаем с середины
+    std::vector<unsigned char> junk((uint64_t)sectors / 2 * SECTOR_SIZE, 0xEE);
+    REQUIRE(file.WriteAt(junk.data(), junk.size(), data.size() - junk.size()));
+    file.Close();
+    const unsigned long long half = sectors - junk.size() / SECTOR_SIZE;
+    REQUIRE(rawCopy.CreateRawCopyStriped(half, 5, 12 * 1024));
+
+    REQUIRE(file.Open(image, BlockFileMode::Read));
+    REQUIRE(file.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+    CHECK_FALSE(DurableCheckpoint::Read(ckpt, log));
+}
+
+/**
+ * @brief Тест потокового вывода копии.
+ *
+ * Проверяет, что **CreateRawCopyStream** передает данные через FIFO без искажений
+ * (страницы в канале не перезаписываются до прочтения) и что XXH64 потока совпадает с хэшем данных.
+ */
+#ifdef __linux__
+TEST_CASE("RawCopy: CreateRawCopyStream to FIFO") {
+    const PathString source = "/tmp/test_stream_src.img";
+    const PathString fifo = "/tmp/test_stream.fifo";
+
+    const unsigned long sectors = 24 * 1024 + 5;
+    std::vector<unsigned char> data((uint64_t)sectors * SECTOR_SIZE);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>((i / 4096) * 13 + i);
+    BlockFile file;
+    REQUIRE(file.Open(source, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    unlink(fifo.c_str());
+    REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+
+    // Медленный читатель: канал успевает заполниться, и vmsplice ждет освобождения места
+    std::vector<unsigned char> received;
+    std::thread consumer([&] {
+        int fd = open(fifo.c_str(), O_RDONLY);
+        std::vector<unsigned char> buf(100000);
+        ssize_t got;
+        while ((got = read(fd, buf.data(), buf.size())) > 0) {
+            received.insert(received.end(), buf.begin(), buf.begin() + got);
+            usleep(100);
+        }
+        close(fd);
+    });
+
+    RawCopy rawCopy(L"/tmp/test_stream_src.img", L"SN1", L"unused.dd", 256 * 1024, sectors);
+    bool streamed = rawCopy.CreateRawCopyStream(fifo);
+    consumer.join();
+    unlink(fifo.c_str());
+
+    REQUIRE(streamed);
+    CHECK(received == data);
+    CHECK(rawCopy.GetStreamHash() == GrainHash64(data.data(), data.size()));
+}
+#endif // __linux__
+
+/**
+ * @brief Тест имитируемого диска.
+ *
+ * Проверяет воспроизводимость содержимого **SimulatedDisk**, исчезающие и постоянные
+ * сбойные сектора, ограничение глубины очереди и пропускной способности, а также
+ * сжатие имитируемого диска через **SeekableZstdWriter**.
+ */
+TEST_CASE("SimulatedDisk: content, errors, queue depth and bandwidth") {
+    SimulatedDiskConfig config;
+    config.sizeBytes = 16 * 1024 * 1024;
+    config.content = SimContent::Sparse;
+    config.dataFraction = 0.25;
+    config.seed = 7;
+    SimulatedDisk disk(config);
+
+    // Содержимое не зависит от того, какими частями его читать
+    std::vector<unsigned char> whole(1024 * 1024), part(4096);
+    REQUIRE(disk.ReadAt(whole.data(), whole.size(), 0));
+    REQUIRE(disk.ReadAt(part.data(), part.size(), 65536 + 4096));
+    CHECK(memcmp(part.data(), whole.data() + 65536 + 4096, part.size()) == 0);
+    CHECK_FALSE(disk.ReadAt(part.data(), 100, 0));
+    CHECK_FALSE(disk.ReadAt(part.data(), part.size(), config.sizeBytes - 512));
+
+    uint64_t dataBlocks = 0;
+    for (uint64_t b = 0; b != config.sizeBytes / config.blockBytes; b++)
+        dataBlocks += disk.IsDataBlock(b);
+    CHECK(dataBlocks > 30);
+    CHECK(dataBlocks < 100);
+
+    SimulatedDiskConfig patternConfig = config;
+    patternConfig.content = SimContent::Pattern;
+    SimulatedDisk pattern(patternConfig);
+    uint64_t word = 0;
+    REQUIRE(pattern.ReadAt(part.data(), part.size(), 8192));
+    memcpy(&word, part.data() + 8, 8);
+    CHECK(word == 8192 + 8);
+
+    // Исчезающая ошибка проходит после двух повторов, постоянная — никогда
+    disk.AddBadSectors(100, 8, 2);
+    disk.AddBadSectors(1000, 1);
+    CHECK_FALSE(disk.ReadAt(part.data(), part.size(), 100 * 512));
+    CHECK_FALSE(disk.ReadAt(part.data(), part.size(), 100 * 512));
+    CHECK(disk.ReadAt(part.data(), part.size(), 100 * 512));
+    CHECK_FALSE(disk.ReadAt(part.data(), 512, 1000 * 512));
+    CHECK_FALSE(disk.ReadAt(part.data(), 512, 1000 * 512));
+    CHECK(disk.GetFailedReads() == 4);
+
+    // Глубина очереди 2: восемь потоков обслуживаются не больше чем по двое
+    SimulatedDiskConfig queued = config;
+    queued.latencyMicros = 2000;
+    queued.queueDepth = 2;
+    SimulatedDisk slow(queued);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 8; t++)
+        threads.emplace_back([&slow, t] {
+            std::vector<unsigned char> buf(4096);
+            slow.ReadAt(buf.data(), buf.size(), t * 4096);
+        });
+    for (std::thread& t : threads)
+        t.join();
+    CHECK(slow.GetPeakInFlight() == 2);
+    CHECK(slow.GetReads() == 8);
+
+    // 4 МиБ при 64 МиБ/с занимают не меньше 62 мс
+    SimulatedDiskConfig capped = config;
+    capped.bytesPerSecond = 64 * 1024 * 1024;
+    SimulatedDisk limited(capped);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i != 4; i++)
+        REQUIRE(limited.ReadAt(whole.data(), whole.size(), i * whole.size()));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(62));
+
+    // Конвейер сжатия на имитируемом диске
+    #ifdef __linux__
+    const PathString path = "/tmp/test_simulated.dd.zst";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_simulated.dd.zst";
+    #endif // _WIN32
+    SimulatedDisk source(config);
+    BlockFile out;
+    REQUIRE(out.Open(path, BlockFileMode::Write));
+    SeekableZstdWriter writer(1024 * 1024, 3);
+    REQUIRE(writer.Write(source, config.sizeBytes, out));
+    out.Close();
+    CHECK(writer.GetCompressedBytes() < config.sizeBytes / 2);
+
+    SeekableZstdReader reader;
+    REQUIRE(reader.Open(path));
+    std::vector<unsigned char> expected(whole.size());
+    for (uint64_t offset = 0; offset < config.sizeBytes; offset += whole.size()) {
+        REQUIRE(reader.ReadAt(whole.data(), whole.size(), offset));
+        source.Generate(expected.data(), expected.size(), offset);
+        CHECK(whole == expected);
+    }
+}
+
+/**
+ * @brief Тест чтения образа через отображение в память.
+ *
+ * Проверяет **MappedFile::View** и **MappedFile::ReadAt**, отказ для выхода за
+ * пределы файла и для устройств, ошибку вместо SIGBUS для файла, усеченного под
+ * отображением, а также то, что **OpenImageSource** отображает DD-образ.
+ */
+TEST_CASE("MappedFile: View and ReadAt") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_mapped.dd";
+    const PathString device = "/dev/null";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_mapped.dd";
+    const PathString device = L"\\\\.\\PhysicalDrive0";
+    #endif // _WIN32
+
+    std::vector<unsigned char> data(1024 * 1024 + 512);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 7 + i / 4096);
+    BlockFile file;
+    REQUIRE(file.Open(path, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    MappedFile mapped;
+    REQUIRE(mapped.Open(path));
+    CHECK(mapped.Size() == data.size());
+    const unsigned char* view = mapped.View(4096, 65536);
+    REQUIRE(view != nullptr);
+    CHECK(memcmp(view, data.data() + 4096, 65536) == 0);
+    CHECK(mapped.View(data.size() - 100, 200) == nullptr);
+
+    std::vector<unsigned char> buf(512);
+    REQUIRE(mapped.ReadAt(buf.data(), buf.size(), data.size() - 512));
+    CHECK(memcmp(buf.data(), data.data() + data.size() - 512, 512) == 0);
+    CHECK_FALSE(mapped.ReadAt(buf.data(), buf.size(), data.size() - 100));
+
+    MappedFile notFile;
+    CHECK_FALSE(notFile.Open(device));
+
+    std::shared_ptr<BlockSource> source = OpenImageSource(path);
+    REQUIRE(source != nullptr);
+    CHECK(source->View(0, data.size()) != nullptr);
+
+    #ifdef __linux__
+    // Файл усечен под отображением: View и ReadAt сообщают об ошибке вместо SIGBUS
+    REQUIRE(truncate(path.c_str(), 65536) == 0);
+    CHECK(mapped.View(0, 4096) != nullptr);
+    CHECK(mapped.View(512 * 1024, 4096) == nullptr);
+    CHECK_FALSE(mapped.ReadAt(buf.data(), buf.size(), 512 * 1024));
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест определения формата образа.
+ *
+ * Проверяет, что **OpenImageSource** открывает DD-образ через **MappedFile**, zstd seekable —
+ * через **SeekableZstdReader**, а flat VMDK — через **FlatVMDKSource**, который склеивает
+ * экстенты с учетом смещения и отклоняет дескрипторы с путями за пределы своего каталога.
+ */
+TEST_CASE("OpenImageSource: format detection and FlatVMDKSource") {
+    #ifdef __linux__
+    const PathString dd = "/tmp/test_detect.dd";
+    const PathString zst = "/tmp/test_detect.dd.zst";
+    const PathString vmdk = "/tmp/test_detect.vmdk";
+    const PathString evil = "/tmp/test_detect_evil.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString dd = L"test_detect.dd";
+    const PathString zst = L"test_detect.dd.zst";
+    const PathString vmdk = L"test_detect.vmdk";
+    const PathString evil = L"test_detect_evil.vmdk";
+    #endif // _WIN32
+
+    MemorySource disk;
+    disk.data.resize(1024 * 1024);
+    for (size_t i = 0; i != disk.data.size(); i++)
+        disk.data[i] = static_cast<unsigned char>(i * 5 + i / 1000);
+
+    BlockFile out;
+    REQUIRE(out.Open(dd, BlockFileMode::Write));
+    REQUIRE(out.WriteAt(disk.data.data(), disk.data.size(), 0));
+    out.Close();
+    REQUIRE(out.Open(zst, BlockFileMode::Write));
+    SeekableZstdWriter writer(256 * 1024, 3);
+    REQUIRE(writer.Write(disk, disk.data.size(), out));
+    out.Close();
+
+    CHECK(std::dynamic_pointer_cast<MappedFile>(OpenImageSource(dd)) != nullptr);
+    CHECK(std::dynamic_pointer_cast<SeekableZstdReader>(OpenImageSource(zst, 0)) != nullptr);
+    CHECK(std::dynamic_pointer_cast<BlockCache>(OpenImageSource(zst)) != nullptr);
+
+    // Два экстента одного файла: второй начинается с сектора 1024
+    {
+        std::ofstream descriptor(vmdk);
+        descriptor << "# Disk DescriptorFile\nversion=1\ncreateType=\"monolithicFlat\"\n\n"
+                   << "RW 1024 FLAT \"test_detect.dd\" 0\n"
+                   << "RW 512 FLAT \"test_detect.dd\" 1024\n";
+    }
+    std::shared_ptr<BlockSource> flat = OpenImageSource(vmdk);
+    REQUIRE(std::dynamic_pointer_cast<FlatVMDKSource>(flat) != nullptr);
+    CHECK(flat->Size() == 1536 * SECTOR_SIZE);
+    std::vector<unsigned char> buf(8192);
+    REQUIRE(flat->ReadAt(buf.data(), buf.size(), 1024 * SECTOR_SIZE - 4096));
+    CHECK(memcmp(buf.data(), disk.data.data() + 1024 * SECTOR_SIZE - 4096, 4096) == 0);
+    CHECK(memcmp(buf.data() + 4096, disk.data.data() + 1024 * SECTOR_SIZE, 4096) == 0);
+    CHECK_FALSE(flat->ReadAt(buf.data(), buf.size(), flat->Size() - 100));
+
+    const char* names[] = { "../tmp/test_detect.dd", "/tmp/test_detect.dd", "sub/test_detect.dd", ".." };
+    for (const char* name : names) {
+        {
+            std::ofstream descriptor(evil);
+            descriptor << "# Disk DescriptorFile\nRW 1024 FLAT \"" << name << "\" 0\n";
+        }
+        CHECK(OpenImageSource(evil) == nullptr);
+    }
+
+    #ifdef __linux__
+    unlink(dd.c_str());
+    unlink(zst.c_str());
+    unlink(vmdk.c_str());
+    unlink(evil.c_str());
+    #endif // __linux__
+    #ifdef _WIN32
+    _wunlink(dd.c_str());
+    _wunlink(zst.c_str());
+    _wunlink(vmdk.c_str());
+    _wunlink(evil.c_str());
+    #endif // _WIN32
+}
+
+/**
+ * @brief Тест чтения незавершенного DD-образа.
+ *
+ * Проверяет, что **OpenImageSource** открывает образ с контрольной точкой через **CheckpointedSource**,
+ * данные за контрольной точкой читаются как нули, после новой фиксации становятся доступны,
+ * а после удаления контрольной точки образ доступен целиком.
+ */
+TEST_CASE("CheckpointedSource: reads up to the checkpoint") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_partial.dd";
+    const PathString ckpt = "/tmp/test_partial.dd.ckpt";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_partial.dd";
+    const PathString ckpt = L"test_partial.dd.ckpt";
+    #endif // _WIN32
+
+    std::vector<unsigned char> data(64 * SECTOR_SIZE);
+    for (size_t i = 0; i != data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 3 + 1);
+
+    BlockFile writer;
+    REQUIRE(writer.Open(path, BlockFileMode::Write));
+    CheckpointFields log;
+    log.type = ImageType::DD;
+    log.disk = L"disk0";
+    log.totalSectors = 128;
+    DurableCheckpoint checkpoint(writer, ckpt, log, 0, 16 * SECTOR_SIZE, 3600);
+
+    REQUIRE(writer.WriteAt(data.data(), 32 * SECTOR_SIZE, 0));
+    CHECK(checkpoint.Completed(0, 32 * SECTOR_SIZE));
+    REQUIRE(writer.WriteAt(data.data() + 32 * SECTOR_SIZE, 8 * SECTOR_SIZE, 32 * SECTOR_SIZE));
+
+    std::shared_ptr<BlockSource> source = OpenImageSource(path);
+    auto partial = std::dynamic_pointer_cast<CheckpointedSource>(source);
+    REQUIRE(partial != nullptr);
+    CHECK(partial->Size() == 128 * SECTOR_SIZE);
+    CHECK(partial->GetDurableBytes() == 32 * SECTOR_SIZE);
+
+    // Записанное после контрольной точки еще не считается данными образа
+    std::vector<unsigned char> buf(64 * SECTOR_SIZE);
+    REQUIRE(partial->ReadAt(buf.data(), buf.size(), 0));
+    CHECK(memcmp(buf.data(), data.data(), 32 * SECTOR_SIZE) == 0);
+    CHECK(std::all_of(buf.begin() + 32 * SECTOR_SIZE, buf.end(), [](unsigned char c) { return c == 0; }));
+    CHECK_FALSE(partial->ReadAt(buf.data(), SECTOR_SIZE, 128 * SECTOR_SIZE));
+
+    REQUIRE(writer.WriteAt(data.data() + 40 * SECTOR_SIZE, 24 * SECTOR_SIZE, 40 * SECTOR_SIZE));
+    CHECK(checkpoint.Completed(32 * SECTOR_SIZE, 32 * SECTOR_SIZE));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    CHECK(partial->GetDurableBytes() == 64 * SECTOR_SIZE);
+    REQUIRE(partial->ReadAt(buf.data(), buf.size(), 0));
+    CHECK(buf == data);
+
+    // Копия завершена: без контрольной точки образ доступен целиком и открывается как готовый
+    REQUIRE(writer.WriteAt(data.data(), data.size(), 64 * SECTOR_SIZE));
+    CHECK(checkpoint.Completed(64 * SECTOR_SIZE, 64 * SECTOR_SIZE));
+    REQUIRE(checkpoint.Commit());
+    REQUIRE(checkpoint.Remove());
+    writer.Close();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    CHECK(partial->GetDurableBytes() == 128 * SECTOR_SIZE);
+    CHECK(std::dynamic_pointer_cast<CheckpointedSource>(OpenImageSource(path)) == nullptr);
+
+    #ifdef __linux__
+    unlink(path.c_str());
+    unlink(ckpt.c_str());
+    #endif // __linux__
+    #ifdef _WIN32
+    _wunlink(path.c_str());
+    _wunlink(ckpt.c_str());
+    #endif // _WIN32
+}
+
+/**
+ * @brief Тест резервирования места под выходной файл.
+ *
+ * Проверяет, что **BlockFile::Preallocate** не меняет размер файла, а
+ * **BlockFile::TrimPreallocated** освобождает запас за концом файла.
+ */
+TEST_CASE("BlockFile: Preallocate and TrimPreallocated") {
+    #ifdef __linux__
+    const PathString path = "/tmp/test_prealloc.dd";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString path = L"test_prealloc.dd";
+    #endif // _WIN32
+
+    BlockFile file;
+    REQUIRE(file.Open(path, BlockFileMode::ReadWrite));
+    REQUIRE(file.Truncate(0));
+    REQUIRE(file.Preallocate(0, 8 * 1024 * 1024));
+    CHECK(file.Size() == 0);
+    CHECK_FALSE(file.Preallocate(0, 0));
+
+    std::vector<unsigned char> data(1024 * 1024, 0x3C);
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    CHECK(file.Size() == data.size());
+
+    #ifdef __linux__
+    struct stat st;
+    REQUIRE(stat(path.c_str(), &st) == 0);
+    CHECK((uint64_t)st.st_blocks * 512 >= 8 * 1024 * 1024);
+    #endif // __linux__
+
+    CHECK(file.TrimPreallocated());
+    CHECK(file.Size() == data.size());
+    std::vector<unsigned char> back(data.size());
+    REQUIRE(file.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+    file.Close();
+
+    #ifdef __linux__
+    REQUIRE(stat(path.c_str(), &st) == 0);
+    CHECK((uint64_t)st.st_blocks * 512 < 2 * 1024 * 1024);
+    #endif // __linux__
+}
+
+/**
+ * @brief Тест сборной записи ненулевых зерен.
+ *
+ * Проверяет, что **SparseVMDK** пишет ненулевые зерна пачками (**BlockFile::WriteGatherAt**),
+ * число операций записи падает до числа пачек, а содержимое образа не меняется.
+ */
+TEST_CASE("SparseVMDK: coalesced grain writes") {
+    #ifdef __linux__
+    const PathString image = "/tmp/test_gather.dd";
+    SparseVMDK sparse("/tmp", "test_gather", image);
+    const PathString outFile = "/tmp/test_gather.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString image = L"test_gather.dd";
+    SparseVMDK sparse(L".", L"test_gather", image);
+    const PathString outFile = L".\\test_gather.vmdk";
+    #endif // _WIN32
+
+    // 256 зерен по 64 КиБ, каждое четвертое нулевое
+    const uint64_t grainBytes = grainSize * SECTOR_SIZE;
+    std::vector<unsigned char> data(256 * grainBytes, 0);
+    for (uint64_t g = 0; g != 256; g++)
+        if (g % 4 != 3)
+            memset(data.data() + g * grainBytes, static_cast<int>(g + 1), grainBytes);
+    BlockFile dd;
+    REQUIRE(dd.Open(image, BlockFileMode::Write));
+    REQUIRE(dd.WriteAt(data.data(), data.size(), 0));
+    dd.Close();
+
+    for (uint64_t maxWrite : std::vector<uint64_t>{ 0, 1024 * 1024 }) {
+        auto stats = std::make_shared<IoStats>();
+        sparse.SetStats(stats);
+        sparse.SetMaxWriteBytes(maxWrite);
+        REQUIRE(sparse.ConvertImage(4 * 1024 * 1024));
+
+        // Заголовок, дескриптор, GD и GT — 4 записи; остальное — зерна
+        uint64_t grainWrites = stats->Get(IoOp::Write).GetCount() - 4;
+        if (maxWrite == 0)
+            CHECK(grainWrites == 192);
+        else
+            CHECK(grainWrites == 12);   // 4 задачи по 48 зерен, пачки по 16
+
+        SparseVMDKReader reader;
+        REQUIRE(reader.Open(outFile));
+        std::vector<unsigned char> back(data.size());
+        REQUIRE(reader.ReadAt(back.data(), back.size(), 0));
+        CHECK(back == data);
+    }
+}
+
+/**
+ * @brief Тест полной проверки образа по источнику.
+ *
+ * Проверяет, что **ImageVerifier** признает совпадающими DD-образ и sparse VMDK,
+ * находит испорченные секторы с точностью до сектора и считает расхождением
+ * недостающий конец образа.
+ */
+TEST_CASE("ImageVerifier: DD and sparse VMDK") {
+    #ifdef __linux__
+    const PathString source = "/tmp/test_verify_src.img";
+    const PathString image = "/tmp/test_verify.dd";
+    SparseVMDK sparse("/tmp", "test_verify", source);
+    const PathString sparseFile = "/tmp/test_verify.vmdk";
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString source = L"test_verify_src.img";
+    const PathString image = L"test_verify.dd";
+    SparseVMDK sparse(L".", L"test_verify", source);
+    const PathString sparseFile = L".\\test_verify.vmdk";
+    #endif // _WIN32
+
+    // 24 МиБ: данные через мегабайт, между ними нули
+    std::vector<unsigned char> data(24 * 1024 * 1024, 0);
+    for (size_t i = 0; i != data.size(); i++)
+        if ((i / (1024 * 1024)) % 2 == 0)
+            data[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+    BlockFile file;
+    REQUIRE(file.Open(source, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+    REQUIRE(file.Open(image, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    file.Close();
+
+    ImageVerifier verifier(1024 * 1024);
+    REQUIRE(verifier.VerifyImage(source, image));
+    CHECK(verifier.IsIdentical());
+    CHECK(verifier.GetComparedBytes() == data.size());
+
+    REQUIRE(sparse.ConvertImage(4 * 1024 * 1024));
+    REQUIRE(verifier.VerifyImage(source, sparseFile));
+    CHECK(verifier.IsIdentical());
+
+    // Два испорченных места: одно внутри сектора, другое через границу участков
+    unsigned char junk[600];
+    memset(junk, 0xEE, sizeof(junk));
+    REQUIRE(file.Open(image, BlockFileMode::ReadWrite));
+    REQUIRE(file.WriteAt(junk, 10, 5 * SECTOR_SIZE + 100));
+    REQUIRE(file.WriteAt(junk, 600, 4 * 1024 * 1024 - 300));
+    file.Close();
+    REQUIRE(verifier.VerifyImage(source, image));
+    REQUIRE(verifier.GetMismatches().size() == 2);
+    CHECK(verifier.GetMismatches()[0].first == 5 * SECTOR_SIZE);
+    CHECK(verifier.GetMismatches()[0].second == SECTOR_SIZE);
+    CHECK(verifier.GetMismatches()[1].first == 4 * 1024 * 1024 - SECTOR_SIZE);
+    CHECK(verifier.GetMismatches()[1].second == 2 * SECTOR_SIZE);
+
+    // Образ короче источника
+    REQUIRE(file.Open(image, BlockFileMode::ReadWrite));
+    REQUIRE(file.WriteAt(data.data(), data.size(), 0));
+    REQUIRE(file.Truncate(data.size() - 1024 * 1024));
+    file.Close();
+    REQUIRE(verifier.VerifyImage(source, image));
+    REQUIRE(verifier.GetMismatches().size() == 1);
+    CHECK(verifier.GetMismatches()[0].first == data.size() - 1024 * 1024);
+    CHECK(verifier.GetMismatches()[0].second == 1024 * 1024);
+    REQUIRE(verifier.VerifyImage(source, image, nullptr, data.size() - 1024 * 1024));
+    CHECK(verifier.IsIdentical());
+}
+
+/**
+ * @brief Тест движков копирования на имитируемом диске.
+ *
+ * Проверяет, что **CreateRawCopyThreads**, **CreateSparseThread**, **CreateSparseDedup**
+ * и **CreateDelta** читают данные из **SimulatedDisk** с задержками и ограниченной очередью,
+ * дают точную копию (RAW-копия — без хвоста прежнего более длинного файла) и сообщают
+ * об ошибке при постоянно сбойных секторах, а оборванная RAW-копия не удерживает
+ * зарезервированное место.
+ */
+TEST_CASE("SimulatedDisk: copy engines") {
+    SimulatedDiskConfig config;
+    config.sizeBytes = 8 * 1024 * 1024;
+    config.content = SimContent::Sparse;
+    config.seed = 11;
+    config.latencyMicros = 200;
+    config.jitterMicros = 300;
+    config.queueDepth = 4;
+    SimulatedDisk disk(config);
+    std::vector<unsigned char> data(config.sizeBytes);
+    disk.Generate(data.data(), data.size(), 0);
+    const uint64_t sectors = config.sizeBytes / SECTOR_SIZE;
+
+    #ifdef __linux__
+    const PathString ddFile = "/tmp/test_sim.dd";
+    const PathString ckpt = "/tmp/test_sim.dd.ckpt";
+    const PathString sparseFile = "/tmp/test_sim.vmdk";
+    const PathString childFile = "/tmp/test_sim_child.vmdk";
+    RawCopy rawCopy(L"/tmp/test_sim_none", L"SN1", L"/tmp/test_sim.dd", 256 * 1024, sectors);
+    SparseVMDK sparse("/tmp", "test_sim", "/tmp/test_sim_none");
+    DeltaSparseVMDK delta("/tmp", "test_sim_child", "/tmp/test_sim_none", sparseFile);
+    #endif // __linux__
+    #ifdef _WIN32
+    const PathString ddFile = L"test_sim.dd";
+    const PathString ckpt = L"test_sim.dd.ckpt";
+    const PathString sparseFile = L".\\test_sim.vmdk";
+    const PathString childFile = L".\\test_sim_child.vmdk";
+    RawCopy rawCopy(L"test_sim_none", L"SN1", L"test_sim.dd", 256 * 1024, sectors);
+    SparseVMDK sparse(L".", L"test_sim", L"test_sim_none");
+    DeltaSparseVMDK delta(L".", L"test_sim_child", L"test_sim_none", sparseFile);
+    #endif // _WIN32
+
+    // RAW-копия поверх более длинного прежнего файла: его хвост не остается в образе
+    BlockFile file;
+    std::vector<unsigned char> stale(data.size() + 1024 * 1024, 0xEE);
+    REQUIRE(file.Open(ddFile, BlockFileMode::Write));
+    REQUIRE(file.WriteAt(stale.data(), stale.size(), 0));
+    file.Close();
+    REQUIRE(rawCopy.CreateRawCopyThreads(disk, 0));
+    std::vector<unsigned char> back(data.size());
+    REQUIRE(file.Open(ddFile, BlockFileMode::Read));
+    CHECK(file.Size() == data.size());
+    REQUIRE(file.ReadAt(back.data(), back.size(), 0));
+    file.Close();
+    CHECK(back == data);
+    CHECK(disk.GetPeakInFlight() <= 4);
+
+    // Sparse VMDK: многопоточно и с дедупликацией; дочерний образ того же диска пуст
+    REQUIRE(sparse.CreateSparseDedup(disk, 1024 * 1024, sectors));
+    REQUIRE(sparse.CreateSparseThread(disk, 1024 * 1024, sectors));
+    SparseVMDKReader reader;
+    REQUIRE(reader.Open(sparseFile));
+    REQUIRE(reader.ReadAt(back.data(), back.size(), 0));
+    CHECK(back == data);
+    REQUIRE(delta.CreateDelta(disk, 1024 * 1024, sectors));
+    CHECK(delta.GetChangedGrains() == 0);
+
+    // Постоянно сбойные сектора: каждый движок сообщает об ошибке,
+    // контрольная точка RAW-копии не заходит за сбойный участок
+    disk.AddBadSectors(sectors / 2, 8);
+    REQUIRE(file.Open(ddFile, BlockFileMode::Write));
+    file.Close();
+    CHECK_FALSE(rawCopy.CreateRawCopyThreads(disk, 0));
+    CheckpointFields log;
+    REQUIRE(DurableCheckpoint::Read(ckpt, log));
+    CHECK(log.numOfSectorsWriten <= sectors / 2);
+    #ifdef __linux__
+    // Зарезервированное место за концом оборванной копии освобождено
+    struct stat st;
+    REQUIRE(stat(ddFile.c_str(), &st) == 0);
+    CHECK((uint64_t)st.st_blocks * 512 <= ((uint64_t)st.st_size + 4095) / 4096 * 4096);
+    #endif // __linux__
+    CHECK_FALSE(sparse.CreateSparseThread(disk, 1024 * 1024, sectors));
+    CHECK_FALSE(sparse.CreateSparseDedup(disk, 1024 * 1024, sectors));
+    CHECK_FALSE(delta.CreateDelta(disk, 1024 * 1024, sectors));
+}
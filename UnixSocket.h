@@ -0,0 +1,93 @@
+/**
+ * @file UnixSocket.h
+ * @brief Заголовочный файл для создания Unix-сокетов управления с ограниченным доступом (Linux).
+ *
+ * Через такие сокеты принимаются задания, читающие диски, и публикуются образы,
+ * поэтому сокет доступен только владельцу службы (или ее группе), а каждый клиент
+ * дополнительно проверяется по учетным данным процесса (SO_PEERCRED).
+ */
+
+#ifndef UNIXSOCKET_H_INCLUDED
+#define UNIXSOCKET_H_INCLUDED
+
+#ifdef __linux__
+
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * @brief Создает слушающий Unix-сокет с правами 0600 (или 0660 при доступе для группы).
+ *
+ * Права задаются chmod сразу после bind и до listen: пока сокет не слушает, подключиться
+ * к нему нельзя, а umask процесса, общая для всех потоков, не меняется. Существующий путь
+ * удаляется, только если это брошенный сокет (к нему никто не подключен); файл другого
+ * типа или работающий сокет не трогаются.
+ *
+ * @param path Путь к сокету.
+ * @param groupAccess Разрешить подключение участникам группы службы.
+ * @return Дескриптор сокета или -1.
+ */
+inline int OpenUnixListener(const std::string& path, bool groupAccess = false)
+{
+    sockaddr_un addr = {};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cout << "Socket path exists and is not a socket" << std::endl;
+            return -1;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0)
+            return -1;
+        bool live = connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0 || errno != ECONNREFUSED;
+        close(probe);
+        if (live) {
+            std::cout << "Socket is in use" << std::endl;
+            return -1;
+        }
+        unlink(path.c_str());   // Брошенный сокет предыдущего запуска
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    const mode_t mode = groupAccess ? 0660 : 0600;
+    bool bound = bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    if (!bound || chmod(path.c_str(), mode) != 0 || listen(fd, 16) != 0) {
+        if (bound)
+            unlink(path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Проверяет, что клиент Unix-сокета — root, владелец службы или (при доступе для группы) ее группа.
+ *
+ * @param fd Принятое соединение.
+ * @param groupAccess Разрешен ли доступ группе службы.
+ */
+inline bool UnixPeerAllowed(int fd, bool groupAccess = false)
+{
+    ucred cred = {};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred))
+        return false;
+    return cred.uid == 0 || cred.uid == geteuid() || (groupAccess && cred.gid == getegid());
+}
+
+#endif // __linux__
+
+#endif // UNIXSOCKET_H_INCLUDED
@@ -1,8 +1,8 @@
-/**
- * @file VMDK.h
- * @brief Заголовочный файл для создания файла формата .vmdk monolithicFlat.
- */
-
+/**
+ * @file VMDK.h
+ * @brief Заголовочный файл для создания файла формата .vmdk monolithicFlat.
+ */
+
 #ifndef HEAD_H_INCLUDED
 #define HEAD_H_INCLUDED
 
@@ -14,32 +14,28 @@
 #include <locale>
 #include <codecvt>
 #include "RawCopy.h"
-
-
-#define SECTOR_SIZE 512               /// Размер сектора в байтах
-#define HEADS 255                     /// Количество головок
-#define SECTORS 63                    /// Количество секторов
-
-/**
- * @class FlatVMDK
- * @brief Класс для работы c созданием vmdk.
- *
- * Этот класс предоставляет методы для создания vmdk, смена широких строк и ГСЧ для CID.
- */
+#include "SectorPolicy.h"
+
+/**
+ * @class FlatVMDK
+ * @brief Класс для работы c созданием vmdk.
+ *
+ * Этот класс предоставляет методы для создания vmdk, смена широких строк и ГСЧ для CID.
+ */
 
 class FlatVMDK {
 public:
 
     #ifdef _WIN32
-    /**
-     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
-     *
-     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
-     *
-     * @param[in] outDir Директория для сохранения VMDK-файла.
-     * @param[in] outName Имя создаваемого VMDK-файла.
-     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
-     */
+    /**
+     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
+     *
+     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
+     *
+     * @param[in] outDir Директория для сохранения VMDK-файла.
+     * @param[in] outName Имя создаваемого VMDK-файла.
+     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
+     */
      FlatVMDK(std::wstring outDir, std::wstring outName, std::wstring d) {
         srand(static_cast<unsigned int>(time(nullptr)));
         outFileDir = outDir;
@@ -56,50 +52,50 @@ public:
         disk = d;
     }
     #endif // __linux__
-    /**
-     * @brief Создание VMDK файла и дескриптора.
-     *
-     * @param[in] bufSize Буфер обмена данных.
-     * @param[in] capacitySectors общее кол-во секторов в выбранном пользователем диске.
-     *
-     * @return Возврашает true при успешном создании образа, false при неудачном создании
+    /**
+     * @brief Создание VMDK файла и дескриптора.
+     *
+     * @param[in] bufSize Буфер обмена данных.
+     * @param[in] capacitySectors общее кол-во секторов в выбранном пользователем диске.
+     *
+     * @return Возврашает true при успешном создании образа, false при неудачном создании
      */
     //Метод для создания flat файла и дескриптора
     bool CreateVMDK(unsigned long bufSize, uint64_t capacitySectors);
 
 private:
     #ifdef _WIN32
-    std::wstring outFileDir;  ///< Директория прописанная пользователем (Windows).
-    std::wstring outFileName; ///< Имя файла прописанная пользователем (Windows).
+    std::wstring outFileDir;  ///< Директория прописанная пользователем (Windows).
+    std::wstring outFileName; ///< Имя файла прописанная пользователем (Windows).
     std::wstring disk;        ///< Имя исходного диска или файла (Windows).
     #endif // _WIN32
 
     #ifdef __linux__
-    std::string outFileDir;   ///< Директория прописанная пользователем (Linux).
-    std::string outFileName;  ///< Имя файла прописанная пользователем (Linux).
+    std::string outFileDir;   ///< Директория прописанная пользователем (Linux).
+    std::string outFileName;  ///< Имя файла прописанная пользователем (Linux).
     std::string disk;         ///< Имя исходного диска или файла (Linux).
     #endif // __linux__
-
-    /**
-     * @brief Преобразует строку типа `std::wstring` в строку типа `std::string`.
-     *
-     * Метод, необходимый для работы со строками в различных кодировках на разных платформах.
-     *
-     * @param[in] wstr Широкая строка (`std::wstring`) для преобразования.
-     * @return Преобразованная строка типа `std::string`.
+
+    /**
+     * @brief Преобразует строку типа `std::wstring` в строку типа `std::string`.
+     *
+     * Метод, необходимый для работы со строками в различных кодировках на разных платформах.
+     *
+     * @param[in] wstr Широкая строка (`std::wstring`) для преобразования.
+     * @return Преобразованная строка типа `std::string`.
      */
     //Метод преобразования wstring в string
     std::string WCharToString(const std::wstring& wstr) {
         std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
         return converter.to_bytes(wstr); // Преобразуем
-    }
-
-    /**
-     * @brief Генерирует случайный CID (идентификатор) для VMDK-дескриптора.
-     *
-     * CID используется для уникальной идентификации диска и является частью дескриптора VMDK.
-     *
-     * @return Случайное 32-битное 8-ми значное целое число, представляющее уникальный идентификатор CID.
+    }
+
+    /**
+     * @brief Генерирует случайный CID (идентификатор) для VMDK-дескриптора.
+     *
+     * CID используется для уникальной идентификации диска и является частью дескриптора VMDK.
+     *
+     * @return Случайное 32-битное 8-ми значное целое число, представляющее уникальный идентификатор CID.
      */
     //Генерация случайного CID для дескриптора VMDK
     uint32_t generateRandomCID() {
@@ -118,7 +114,7 @@ bool FlatVMDK::CreateVMDK(unsigned long bufSize, uint64_t capacitySectors) {
     }
 
     // Расчет геометрии диска
-    uint64_t cylinders = (capacitySectors / (HEADS * SECTORS));
+    uint64_t cylinders = (capacitySectors / (FLAT_HEADS * SECTORS));
     // Случайная генерация cid
     uint32_t cid = generateRandomCID();
 
@@ -0,0 +1,476 @@
+/**
+ * @file VMDKDelta.h
+ * @brief Заголовочный файл для создания инкрементальных (дочерних) sparse-файлов формата VMDK.
+ */
+
+#ifndef VMDKDELTA_H_INCLUDED
+#define VMDKDELTA_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include "BlockFile.h"
+#include "GrainHash.h"
+#include "VMDKSparce.h"
+#include "VMDKSparseReader.h"
+
+/**
+ * @brief Возвращает путь к манифесту хэшей для sparse-образа.
+ *
+ * Расширение `.vmdk` заменяется на `.ghm`.
+ *
+ * @param imagePath Путь к .vmdk файлу.
+ * @return Путь к файлу манифеста.
+ */
+inline PathString GrainManifestPath(const PathString& imagePath)
+{
+    #ifdef _WIN32
+    const PathString ext = L".vmdk";
+    const PathString manifestExt = L".ghm";
+    #endif // _WIN32
+
+    #ifdef __linux__
+    const PathString ext = ".vmdk";
+    const PathString manifestExt = ".ghm";
+    #endif // __linux__
+
+    if (imagePath.size() >= ext.size() &&
+        imagePath.compare(imagePath.size() - ext.size(), ext.size(), ext) == 0)
+        return imagePath.substr(0, imagePath.size() - ext.size()) + manifestExt;
+    return imagePath + manifestExt;
+}
+
+/**
+ * @class DeltaSparseVMDK
+ * @brief Класс для создания дочернего sparse VMDK-файла относительно предыдущего образа.
+ *
+ * Каждое зерно диска хэшируется при чтении и сравнивается с хэшем того же зерна
+ * в родительском образе. В дочерний файл записываются только изменившиеся зерна,
+ * для остальных GTE остаётся равным 0 и данные берутся из родителя.
+ * Хэши родителя берутся из его манифеста (.ghm), а при его отсутствии
+ * вычисляются по самому родительскому образу. Совпадение хэша подтверждается
+ * побайтовым сравнением с зерном родителя (с учетом всей цепочки родителей),
+ * поэтому коллизия хэша не может потерять изменившиеся данные.
+ * Рядом с дочерним образом сохраняется его собственный полный манифест,
+ * поэтому следующий запуск может строить цепочку от него.
+ */
+class DeltaSparseVMDK {
+public:
+
+    /**
+     * @brief Конструктор для создания экземпляра класса DeltaSparseVMDK.
+     *
+     * @param[in] outDir Директория для сохранения VMDK-файла.
+     * @param[in] outName Имя создаваемого VMDK-файла.
+     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
+     * @param[in] parent Путь к родительскому sparse VMDK-файлу.
+     */
+    DeltaSparseVMDK(PathString outDir, PathString outName, PathString d, PathString parent) {
+        srand(static_cast<unsigned int>(time(nullptr)));
+        outFileDir = outDir;
+        outFileName = outName;
+        disk = d;
+        parentImage = parent;
+    }
+
+    /**
+     * @brief Создает дочерний sparse-файл VMDK, содержащий только изменившиеся зерна.
+     *
+     * @param[in] bufSize Размер буфера чтения (округляется вниз до кратного размеру зерна).
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateDelta(unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Создает дочерний sparse-файл VMDK, читая данные из `source`, а не с диска `disk`.
+     *
+     * Позволяет прогнать движок на имитируемом диске (SimulatedDisk) или другом источнике.
+     *
+     * @param[in] source Источник данных размером не меньше capacitySectors секторов.
+     * @param[in] bufSize Размер буфера чтения (округляется вниз до кратного размеру зерна).
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateDelta(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Возвращает количество зерен, записанных в дочерний образ.
+     */
+    uint64_t GetChangedGrains() const { return changedGrains; };
+
+    /**
+     * @brief Возвращает общее количество зерен диска.
+     */
+    uint64_t GetTotalGrains() const { return totalGrains; };
+
+    /**
+     * @brief Включает шифрование зерен дочернего образа (см. AesXts).
+     *
+     * Как и в SparseVMDK, шифруются только данные зерен. Цепочка родителей
+     * читается с тем же ключом.
+     *
+     * @param[in] c Ключ или nullptr, чтобы отключить шифрование.
+     */
+    void SetCipher(std::shared_ptr<const AesXts> c) { cipher = c; };
+
+    /**
+     * @brief Включает измерение задержек операций ввода-вывода (см. IoStats).
+     *
+     * @param[in] s Статистика задания или nullptr, чтобы отключить измерение.
+     */
+    void SetStats(std::shared_ptr<IoStats> s) { stats = s; };
+
+private:
+    PathString outFileDir;         ///< Директория прописанная пользователем.
+    PathString outFileName;        ///< Имя файла прописанное пользователем.
+    PathString disk;               ///< Имя исходного диска или файла.
+    PathString parentImage;        ///< Путь к родительскому образу.
+
+    uint64_t changedGrains = 0;    ///< Количество записанных (изменившихся) зерен.
+    uint64_t totalGrains = 0;      ///< Общее количество зерен.
+    uint64_t grainSectors = grainSize; ///< Размер зерна в секторах (берется из родителя).
+    uint32_t gtesPerGT = GTE_COUNT;    ///< Количество записей в GT (берется из родителя).
+    std::shared_ptr<const AesXts> cipher;  ///< Ключ шифрования зерен (nullptr — без шифрования).
+    std::shared_ptr<IoStats> stats;        ///< Статистика задержек (nullptr — не измеряется).
+    std::vector<std::unique_ptr<SparseVMDKReader>> parents; ///< Цепочка родителей: от непосредственного к базовому.
+    bool chainComplete = false;    ///< Цепочка открыта до базового образа.
+
+    /**
+     * @brief Открывает предков родителя по parentFileNameHint (в той же директории).
+     *
+     * Если предок не найден или несовместим, цепочка считается неполной:
+     * зерна, не выделенные ни в одном открытом образе, не подтверждаются.
+     */
+    void OpenAncestors();
+
+    /**
+     * @brief Читает зерно так, как его видит родительская цепочка.
+     *
+     * @param[in] grain Номер зерна.
+     * @param[out] buf Буфер размером в зерно.
+     * @return false, если содержимое неизвестно (неполная цепочка) или не прочитано.
+     */
+    bool ReadParentGrain(uint64_t grain, unsigned char* buf);
+
+    /**
+     * @brief Загружает хэши зерен и CID родительского образа.
+     *
+     * Размер зерна и GT дочернего образа принимаются равными родительским.
+     *
+     * @param[out] parentHashes Хэши зерен родителя.
+     * @param[out] parentCID CID родителя.
+     * @param[in] capacitySectors Ожидаемая емкость в секторах.
+     * @return true, если хэши получены и образ совместим с диском.
+     */
+    bool LoadParent(GrainHashManifest& parentHashes, std::string& parentCID, uint64_t capacitySectors);
+
+    /**
+     * @brief Общая часть CreateDelta: source — источник или nullptr для диска `disk`.
+     */
+    bool DeltaFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Копирует изменившиеся зерна (основной цикл CreateDelta).
+     *
+     * @tparam Sector Политика размера сектора исходного устройства.
+     * @param[in] reader Исходный диск или другой источник данных.
+     * @param[in] writer Выходной файл.
+     * @param[in] layout Расположение структур файла.
+     * @param[in] bufSize Размер буфера чтения.
+     * @param[in] diskBytes Размер диска в байтах.
+     * @param[in] parentHashes Хэши зерен родителя.
+     * @param[out] childHashes Хэши зерен диска.
+     * @param[out] GTEs Заполняемые значения GTE.
+     * @return true, если копирование успешно.
+     */
+    template<class Sector>
+    bool CopyChangedGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                           unsigned long bufSize, uint64_t diskBytes, const GrainHashManifest& parentHashes,
+                           GrainHashManifest& childHashes, std::vector<uint32_t>& GTEs);
+
+    /**
+     * @brief Генерирует случайный CID (идентификатор) для VMDK-дескриптора.
+     */
+    uint32_t generateRandomCID() {
+        return 10000000 + (rand() % 90000000);
+    }
+};
+
+inline bool DeltaSparseVMDK::LoadParent(GrainHashManifest& parentHashes, std::string& parentCID, uint64_t capacitySectors)
+{
+    parents.clear();
+    parents.emplace_back(new SparseVMDKReader());
+    SparseVMDKReader& parent = *parents.front();
+    if (!parent.Open(parentImage)) {
+        std::cout << "Parent image open error" << std::endl;
+        return false;
+    }
+    parent.SetCipher(cipher);
+    if (parent.GetHeader().capacity != capacitySectors) {
+        std::cout << "Parent image geometry mismatch" << std::endl;
+        return false;
+    }
+    grainSectors = parent.GetHeader().grainSize;
+    gtesPerGT = parent.GetHeader().numGTEsPerGT;
+    parentCID = parent.GetCID();
+    OpenAncestors();
+
+    if (parentHashes.Load(GrainManifestPath(parentImage)) &&
+        parentHashes.grainSize == grainSectors &&
+        parentHashes.capacity == capacitySectors &&
+        parentHashes.hashes.size() == parent.GetTotalGrains())
+        return true;
+
+    // Манифеста нет: хэшируем сам родительский образ.
+    // Для дочернего образа это невозможно, так как часть его зерен лежит в его родителе.
+    if (parent.HasParent()) {
+        std::cout << "Parent image has its own parent and no hash manifest" << std::endl;
+        return false;
+    }
+
+    parentHashes.Reset(grainSectors, capacitySectors, parent.GetTotalGrains());
+    std::vector<unsigned char> grain(parent.GetGrainBytes());
+    for (uint64_t i = 0; i != parent.GetTotalGrains(); i++) {
+        if (!parent.ReadGrain(i, grain.data())) {
+            std::cout << "Parent image read error" << std::endl;
+            return false;
+        }
+        parentHashes.hashes[i] = GrainHash64(grain.data(), grain.size());
+    }
+    return true;
+}
+
+inline bool DeltaSparseVMDK::CreateDelta(unsigned long bufSize, uint64_t capacitySectors)
+{
+    return DeltaFrom(nullptr, bufSize, capacitySectors);
+}
+
+inline bool DeltaSparseVMDK::CreateDelta(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    return DeltaFrom(&source, bufSize, capacitySectors);
+}
+
+inline bool DeltaSparseVMDK::DeltaFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    changedGrains = 0;
+    if (capacitySectors == 0) {
+        std::wcout << L"Не удалось определить количество секторов." << std::endl;
+        return false;
+    }
+
+    GrainHashManifest parentHashes;
+    std::string parentCID;
+    if (!LoadParent(parentHashes, parentCID, capacitySectors))
+        return false;
+
+    #ifdef _WIN32
+    PathString outFile = outFileDir + L"\\" + outFileName + L".vmdk";
+    size_t slash = parentImage.find_last_of(L"\\/");
+    #endif // _WIN32
+
+    #ifdef __linux__
+    PathString outFile = outFileDir + "/" + outFileName + ".vmdk";
+    size_t slash = parentImage.find_last_of('/');
+    #endif // __linux__
+
+    // Имя родителя для parentFileNameHint (без директории)
+    PathString parentName = slash == PathString::npos ? parentImage : parentImage.substr(slash + 1);
+
+    #ifdef _WIN32
+    std::string parentNameS = BlockFile::WCharToString(parentName);
+    std::string outFileS = BlockFile::WCharToString(outFileName + L".vmdk");
+    #endif // _WIN32
+
+    #ifdef __linux__
+    std::string parentNameS = parentName;
+    std::string outFileS = outFileName + ".vmdk";
+    #endif // __linux__
+
+    uint64_t cylinders = capacitySectors / (SPARSE_HEADS * SECTORS);
+    std::stringstream desc;
+    desc << "# Disk DescriptorFile\n"
+         << "version=1\n"
+         << "CID=" << generateRandomCID() << "\n"
+         << "parentCID=" << parentCID << "\n"
+         << "createType=\"monolithicSparse\"\n"
+         << "parentFileNameHint=\"" << parentNameS << "\"\n"
+         << "\n"
+         << "# Extent description\n"
+         << "RW " << capacitySectors << " SPARSE \"" << outFileS << "\"\n"
+         << "\n"
+         << "# The Disk Data Base\n"
+         << "#DDB\n"
+         << "ddb.adapterType = \"ide\"\n"
+         << "ddb.geometry.cylinders = \"" << cylinders << "\"\n"
+         << "ddb.geometry.heads = \"16\"\n"
+         << "ddb.geometry.sectors = \"63\"\n"
+         << "ddb.virtualHWVersion = \"10\"\n";
+    std::string descriptor = desc.str();
+
+    SparseLayout layout = ComputeSparseLayout(capacitySectors, grainSectors, gtesPerGT, descriptor.length());
+    totalGrains = layout.totalGrains;
+    const uint64_t diskBytes = capacitySectors * SECTOR_SIZE;
+
+    SparseExtentHeader header;
+    FillSparseHeader(header, capacitySectors, grainSectors, gtesPerGT, layout);
+
+    BlockFile reader;
+    BlockFile writer;
+    if (source == nullptr) {
+        if (!reader.Open(disk, BlockFileMode::Read)) {
+            std::cout << "Open disk error" << std::endl;
+            return false;
+        }
+        reader.SetCacheHygiene();
+        reader.SetStats(stats.get());
+    }
+    if (!writer.Open(outFile, BlockFileMode::Write)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    writer.SetCacheHygiene();
+    writer.SetStats(stats.get());
+    BlockSource& input = source != nullptr ? *source : reader;
+
+    std::vector<unsigned char> descBuf(layout.descriptorSize * SECTOR_SIZE, 0);
+    memcpy(descBuf.data(), descriptor.data(), descriptor.length());
+    if (!writer.WriteAt((unsigned char*)&header, sizeof(header), 0) ||
+        !writer.WriteAt(descBuf.data(), descBuf.size(), SECTOR_SIZE)) {
+        std::cout << "Header write error" << std::endl;
+        return false;
+    }
+
+    // Цикл копирования инстанцируется для физического размера сектора исходного диска
+    GrainHashManifest childHashes;
+    childHashes.Reset(grainSectors, capacitySectors, totalGrains);
+    std::vector<uint32_t> GTEs(layout.numGT * gtesPerGT, 0);
+    bool copied = DispatchSectorSize(source != nullptr ? SECTOR_SIZE : reader.SectorSize(), [&](auto policy) {
+        return CopyChangedGrains<decltype(policy)>(input, writer, layout, bufSize, diskBytes,
+                                                   parentHashes, childHashes, GTEs);
+    });
+    if (!copied)
+        return false;
+
+    // Запись GD и всех GT
+    std::vector<uint32_t> GDEs(layout.numGT);
+    for (uint64_t i = 0; i != layout.numGT; i++)
+        GDEs[i] = static_cast<uint32_t>(layout.gtOffset / SECTOR_SIZE + i * layout.gtSectors);
+
+    if (!writer.WriteAt((unsigned char*)GDEs.data(), GDEs.size() * 4, layout.gdOffset * SECTOR_SIZE) ||
+        !writer.WriteAt((unsigned char*)GTEs.data(), GTEs.size() * 4, layout.gtOffset)) {
+        std::cout << "GT write error" << std::endl;
+        return false;
+    }
+
+    if (!childHashes.Save(GrainManifestPath(outFile))) {
+        std::cout << "Hash manifest write error" << std::endl;
+        return false;
+    }
+
+    std::cout << "Changed grains: " << changedGrains << " of " << totalGrains << std::endl;
+    return true;
+}
+
+inline void DeltaSparseVMDK::OpenAncestors()
+{
+    chainComplete = false;
+    while (parents.back()->HasParent()) {
+        const SparseVMDKReader& child = *parents.back();
+        std::string hint = child.GetParentFileNameHint();
+        if (!IsPlainFileName(hint) || parents.size() >= 64)   // Защита от зацикленной цепочки
+            return;
+
+        // Предок ищется рядом с родителем
+        #ifdef _WIN32
+        size_t slash = parentImage.find_last_of(L"\\/");
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        PathString name = converter.from_bytes(hint);
+        #endif // _WIN32
+
+        #ifdef __linux__
+        size_t slash = parentImage.find_last_of('/');
+        PathString name = hint;
+        #endif // __linux__
+
+        PathString path = slash == PathString::npos ? name : parentImage.substr(0, slash + 1) + name;
+        std::unique_ptr<SparseVMDKReader> ancestor(new SparseVMDKReader());
+        if (!ancestor->Open(path) ||
+            ancestor->GetCID() != child.GetParentCID() ||
+            ancestor->GetHeader().capacity != child.GetHeader().capacity ||
+            ancestor->GetHeader().grainSize != child.GetHeader().grainSize)
+            return;
+        ancestor->SetCipher(cipher);
+        parents.push_back(std::move(ancestor));
+    }
+    chainComplete = true;
+}
+
+inline bool DeltaSparseVMDK::ReadParentGrain(uint64_t grain, unsigned char* buf)
+{
+    for (auto& image : parents) {
+        if (image->GetGTE(grain) != 0)
+            return image->ReadGrain(grain, buf);
+    }
+    if (!chainComplete)
+        return false;
+    memset(buf, 0, grainSectors * SECTOR_SIZE);
+    return true;
+}
+
+template<class Sector>
+bool DeltaSparseVMDK::CopyChangedGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                                        unsigned long bufSize, uint64_t diskBytes, const GrainHashManifest& parentHashes,
+                                        GrainHashManifest& childHashes, std::vector<uint32_t>& GTEs)
+{
+    const uint64_t grainBytes = grainSectors * SECTOR_SIZE;
+    if (grainBytes % Sector::size != 0) {
+        std::cout << "Grain size is not a multiple of the device sector" << std::endl;
+        return false;
+    }
+
+    // Буфер чтения кратен размеру зерна и выровнен по сектору
+    uint64_t grainsPerBuf = bufSize / grainBytes;
+    if (grainsPerBuf == 0)
+        grainsPerBuf = 1;
+    PooledBuffer readBuffer = BufferPool::Shared().Acquire(Sector::AlignUp(grainsPerBuf * grainBytes));
+    PooledBuffer parentGrain = BufferPool::Shared().Acquire(grainBytes);
+    uint64_t dataPos = layout.dataOffset;
+
+    for (uint64_t first = 0; first < layout.totalGrains; first += grainsPerBuf) {
+        uint64_t count = layout.totalGrains - first < grainsPerBuf ? layout.totalGrains - first : grainsPerBuf;
+        if (!ReadGrains<Sector>(reader, readBuffer.Data(), first * grainBytes, count * grainBytes, diskBytes)) {
+            std::cout << "READ error" << std::endl;
+            return false;
+        }
+
+        for (uint64_t g = 0; g != count; g++) {
+            uint64_t i = first + g;
+            unsigned char* grain = readBuffer.Data() + g * grainBytes;
+            childHashes.hashes[i] = GrainHash64(grain, grainBytes);
+            // Совпадение хэша подтверждается содержимым родителя
+            if (childHashes.hashes[i] == parentHashes.hashes[i] &&
+                ReadParentGrain(i, parentGrain.Data()) &&
+                memcmp(grain, parentGrain.Data(), grainBytes) == 0)
+                continue;   // Зерно не изменилось, читается из родителя
+
+            if (cipher && !cipher->Encrypt(grain, grainBytes, dataPos))
+                return false;
+            if (!writer.WriteAt(grain, grainBytes, dataPos)) {
+                std::cout << "Write data error" << std::endl;
+                return false;
+            }
+            GTEs[i] = static_cast<uint32_t>(dataPos / SECTOR_SIZE);
+            dataPos += grainBytes;
+            changedGrains++;
+        }
+    }
+
+    return true;
+}
+
+#endif // VMDKDELTA_H_INCLUDED
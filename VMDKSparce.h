@@ -1,422 +1,797 @@
-/**
- * @file VMDKSparse.h
- * @brief Заголовочный файл для создания sparse-файла формата VMDK.
- */
-
-#ifndef VMDKSPARCE_H_INCLUDED
-#define VMDKSPARCE_H_INCLUDED
-
-#include <fstream>
-#include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <string.h>
-#include <sstream>
-#include <cmath>
-#include <cstring>
-#include "VMDK.h"
-
-#define SECTOR_SIZE 512               ///< Размер сектора в байтах
-#define HEADS 16                      ///< Количество головок
-#define SECTORS 63                    ///< Количество секторов
-
-#define VMDK_MAGICNUMBER 0x564D444B   ///< 'VMDK' в hex (магическое число)
-#define VMDK_VERSION 1                ///< Версия VMDK
-#define GRAIN_SIZE 128                ///< Размер зерна в секторах (64K)
-#define DESCRIPTOR_SIZE 1             ///< Размер дескриптора (в секторах)
-#define VMDK_HEADER_SIZE 512          ///< Размер заголовка (512 байт)
-
-// Константы для конфигурации виртуального диска
-constexpr uint32_t grainSize = 128;                         ///< Размер блока данных (зерна) 128 секторов
-constexpr uint32_t GTE_COUNT = 512;                         ///< Количество записей в таблице зерен
-constexpr uint32_t gtCoverage = GTE_COUNT * grainSize;      ///< Покрытие одной таблицы зерен (32 MB для G = 7)
-constexpr uint32_t NUM_SECTORS = 128;                       ///< Количество секторов в буфере
-constexpr uint32_t BUFFER_SIZE = NUM_SECTORS * SECTOR_SIZE; ///< Размер буфера
-
-
-/**
- * @class SparseVMDK
- * @brief Класс для создания sparse-файлов формата VMDK.
- *
- * Класс `SparseVMDK` предоставляет функции для создания sparse VMDK-файла и его структуры,
- * включая генерацию CID и обработку строковых форматов.
- */
-class SparseVMDK {
-public:
-
-    #ifdef _WIN32
-    /**
-     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
-     *
-     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
-     *
-     * @param[in] outDir Директория для сохранения VMDK-файла.
-     * @param[in] outName Имя создаваемого VMDK-файла.
-     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
-     */
-    SparseVMDK(std::wstring outDir, std::wstring outName, std::wstring d) {
-        srand(static_cast<unsigned int>(time(nullptr)));
-        outFileDir = outDir;
-        outFileName = outName;
-        disk = d;
-    }
-    #endif // _WIN32
-
-    #ifdef __linux__
-    /**
-     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
-     *
-     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
-     *
-     * @param[in] outDir Директория для сохранения VMDK-файла.
-     * @param[in] outName Имя создаваемого VMDK-файла.
-     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
-     */
-    SparseVMDK(std::string outDir, std::string outName, std::string d) {
-        srand(static_cast<unsigned int>(time(nullptr)));
-        outFileDir = outDir;
-        outFileName = outName;
-        disk = d;
-    }
-    #endif // __linux__
-    /**
-     * @brief Создает sparse-файл VMDK формата.
-     *
-     * Основной метод для создания sparse-файла VMDK и его дескриптора,
-     * включая расчет геометрии и инициализацию данных.
-     *
-     * @param[in] bufSize Размер буфера для копирования данных.
-     * @param[in] capacitySectors Общее количество секторов на диске.
-     * @return Возвращает `true` при успешном создании файла, иначе `false`.
-     */
-    bool CreateSparse(unsigned long bufSize, uint64_t capacitySectors);
-private:
-    #ifdef _WIN32
-    std::wstring outFileDir;  ///< Директория прописанная пользователем (Windows).
-    std::wstring outFileName; ///< Имя файла прописанная пользователем (Windows).
-    std::wstring disk;        ///< Имя исходного диска или файла (Windows).
-    #endif // _WIN32
-
-    #ifdef __linux__
-    std::string outFileDir;   ///< Директория прописанная пользователем (Linux).
-    std::string outFileName;  ///< Имя файла прописанная пользователем (Linux).
-    std::string disk;         ///< Имя исходного диска или файла (Linux).
-    #endif // __linux__
-
-    /**
-     * @brief Преобразует строку типа `std::wstring` в строку типа `std::string`.
-     *
-     * Метод, необходимый для работы со строками в различных кодировках на разных платформах.
-     *
-     * @param[in] wstr Широкая строка (`std::wstring`) для преобразования.
-     * @return Преобразованная строка типа `std::string`.
-     */
-    //Метод преобразования wstring в string
-    std::string WCharToString(const std::wstring& wstr) {
-        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-        return converter.to_bytes(wstr); // Преобразуем
-    }
-
-    /**
-     * @brief Генерирует случайный CID (идентификатор) для VMDK-дескриптора.
-     *
-     * CID используется для уникальной идентификации диска и является частью дескриптора VMDK.
-     *
-     * @return Случайное 32-битное 8-ми значное целое число, представляющее уникальный идентификатор CID.
-     */
-    //Генерация случайного CID для дескриптора VMDK
-    uint32_t generateRandomCID() {
-        return 10000000 + (rand() % 90000000);
-    }
-};
-
-#pragma pack(1)  // Обеспечиваем выравнивание структуры по 1 байту
-
-/**
- * @struct SparseExtentHeader
- * @brief Структура для хранения заголовка sparse VMDK.
- *
- * Структура `SparseExtentHeader` содержит основные поля для описания
- * sparse VMDK-файла, включая магическое число, емкость, размер зерна и другие параметры.
- */
-typedef struct SparseExtentHeader
-{
-    uint32_t    magicNumber;        ///< Магическое число VMDK ('VMDK' в hex)
-    uint32_t    version;            ///< Версия VMDK
-    uint32_t    flags;              ///< Флаги конфигурации VMDK
-    uint64_t    capacity;           ///< Емкость в секторах
-    uint64_t    grainSize;          ///< Размер зерна в секторах
-    uint64_t    descriptorOffset;   ///< Смещение дескриптора в секторах
-    uint64_t    descriptorSize;     ///< Размер дескриптора в секторах
-    uint32_t    numGTEsPerGT;       ///< Количество записей в таблице зерен
-    uint64_t    rgdOffset;          ///< Смещение резервной таблицы зерен
-    uint64_t    gdOffset;           ///< Смещение основной таблицы зерен
-    uint64_t    overHead;           ///< Размер метаданных
-    bool        uncleanShutdown;    ///< Флаг завершения с ошибками
-    char        singleEndLineChar;  ///< Символ конца строки
-    char        nonEndLineChar;     ///< Символ, не являющийся концом строки
-    char        doubleEndLineChar1; ///< Первый символ двойного конца строки
-    char        doubleEndLineChar2; ///< Второй символ двойного конца строки
-    uint16_t    compressAlgorithm;  ///< Алгоритм сжатия
-    uint8_t     pad[433];           ///< Заполнение до 512 байт для выравнивания
-} SparseExtentHeader;
-#pragma pack()
-
-
-bool SparseVMDK::CreateSparse(unsigned long bufSize, uint64_t capacitySectors){
-    if (capacitySectors == 0) {
-        std::wcout << L"Не удалось определить количество секторов." << std::endl;
-        return false;
-    }
-
-    // Расчет геометрии диска
-    uint64_t cylinders = (capacitySectors / (HEADS * SECTORS));
-    // Случайная генерация cid
-    uint32_t cid = generateRandomCID();
-
-    #ifdef _WIN32
-    std::wstring outFile = outFileDir + L"\\"  + outFileName + L".vmdk";
-    std::wstring Filename = outFileName + L".vmdk";
-    #endif // _WIN32
-
-    #ifdef __linux__
-    std::string outFile = outFileDir + "//"  + outFileName + ".vmdk";
-    std::string Filename = outFileName + ".vmdk";
-    #endif // __linux__
-
-    // Записываем заголовок VMDK
-    SparseExtentHeader header;
-    memset(&header, 0, sizeof(header));
-    header.magicNumber = VMDK_MAGICNUMBER;  // Устанавливаем магическое число
-    header.version = VMDK_VERSION;          // Версия VMDK
-    header.flags = 3;                       // Устанавливаем флаги
-    header.capacity = capacitySectors;      // Ёмкость в секторах
-    header.grainSize = GRAIN_SIZE;          // Размер зерна
-    header.descriptorOffset = 1;            // Смещение дескриптора сразу после заголовка
-    header.descriptorSize = DESCRIPTOR_SIZE; // Размер дескриптора в секторах
-    header.numGTEsPerGT = 512;              // Количество записей на таблицу зерен
-    header.rgdOffset = 0;                   // Смещение резервной таблицы зерен
-    header.gdOffset = 2;                    // Смещение основной таблицы зерен
-    header.overHead = VMDK_HEADER_SIZE + SECTOR_SIZE * DESCRIPTOR_SIZE; // Метаданные
-    header.uncleanShutdown = false;         // Флаг чистого завершения
-    header.singleEndLineChar = '\n';        // Символ конца строки
-    header.nonEndLineChar = ' ';            // Символ без конца строки
-    header.doubleEndLineChar1 = '\r';       // Первый символ двойного конца строки
-    header.doubleEndLineChar2 = '\n';       // Второй символ двойного конца строки
-    header.compressAlgorithm = 0;           // Без сжатия
-
-    #ifdef _WIN32
+/**
+ * @file VMDKSparse.h
+ * @brief Заголовочный файл для создания sparse-файла формата VMDK.
+ */
+
+#ifndef VMDKSPARCE_H_INCLUDED
+#define VMDKSPARCE_H_INCLUDED
+
+#include <fstream>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "VMDK.h"
+#include "BlockFile.h"
+#include "MappedFile.h"
+#include "GrainHash.h"
+#include "GrainDedup.h"
+#include "GrainSizeSelect.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+#include "AesXts.h"
+#include "SectorPolicy.h"
+
+#define VMDK_MAGICNUMBER 0x564D444B   ///< 'VMDK' в hex (магическое число)
+#define VMDK_VERSION 1                ///< Версия VMDK
+#define GRAIN_SIZE 128                ///< Размер зерна в секторах (64K)
+#define DESCRIPTOR_SIZE 1             ///< Размер дескриптора (в секторах)
+#define VMDK_HEADER_SIZE 512          ///< Размер заголовка (512 байт)
+
+// Константы для конфигурации виртуального диска (значения по умолчанию, см. SparseVMDK::SetGrainSize)
+constexpr uint32_t grainSize = 128;                         ///< Размер блока данных (зерна) 128 секторов
+constexpr uint32_t GTE_COUNT = 512;                         ///< Количество записей в таблице зерен
+constexpr uint32_t MIN_GRAIN_SIZE = 8;                      ///< Минимальный размер зерна в секторах (4K)
+constexpr uint32_t MAX_GRAIN_SIZE = 4096;                   ///< Максимальный размер зерна в секторах (2M)
+constexpr uint32_t MIN_GTE_COUNT = 128;                     ///< Минимальное количество записей в таблице зерен
+constexpr uint32_t MAX_GTE_COUNT = 4096;                    ///< Максимальное количество записей в таблице зерен
+constexpr uint32_t gtCoverage = GTE_COUNT * grainSize;      ///< Покрытие одной таблицы зерен (32 MB для G = 7)
+constexpr uint64_t SPARSE_PREALLOC_BYTES = 64ull * 1024 * 1024; ///< Шаг резервирования места под данные sparse-файла
+constexpr uint64_t SPARSE_WRITE_BYTES = 4ull * 1024 * 1024;      ///< Наибольший объем одной сборной записи зерен
+constexpr uint32_t NUM_SECTORS = 128;                       ///< Количество секторов в буфере
+constexpr uint32_t BUFFER_SIZE = NUM_SECTORS * SECTOR_SIZE; ///< Размер буфера
+
+/**
+ * @struct SparseLayout
+ * @brief Структура с расположением метаданных и данных внутри sparse VMDK-файла.
+ */
+typedef struct
+{
+    uint64_t descriptorSize;  ///< Размер дескриптора в секторах
+    uint64_t gdOffset;        ///< Смещение каталога зерен (GD) в секторах
+    uint64_t gtOffset;        ///< Смещение первой таблицы зерен (GT) в байтах
+    uint64_t gtSectors;       ///< Размер одной таблицы зерен в секторах
+    uint64_t dataOffset;      ///< Смещение области данных в байтах (кратно размеру зерна)
+    uint64_t totalGrains;     ///< Количество зерен
+    uint64_t numGT;           ///< Количество таблиц зерен
+} SparseLayout;
+
+
+/**
+ * @class SparseVMDK
+ * @brief Класс для создания sparse-файлов формата VMDK.
+ *
+ * Класс `SparseVMDK` предоставляет функции для создания sparse VMDK-файла и его структуры,
+ * включая генерацию CID и обработку строковых форматов.
+ */
+class SparseVMDK {
+public:
+
+    #ifdef _WIN32
+    /**
+     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
+     *
+     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
+     *
+     * @param[in] outDir Директория для сохранения VMDK-файла.
+     * @param[in] outName Имя создаваемого VMDK-файла.
+     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
+     */
+    SparseVMDK(std::wstring outDir, std::wstring outName, std::wstring d) {
+        srand(static_cast<unsigned int>(time(nullptr)));
+        outFileDir = outDir;
+        outFileName = outName;
+        disk = d;
+    }
+    #endif // _WIN32
+
+    #ifdef __linux__
+    /**
+     * @brief Конструктор для создания экземпляра класса FlatVMDK на платформе Windows.
+     *
+     * Инициализирует генератор случайных чисел и устанавливает базовые параметры для VMDK-файла.
+     *
+     * @param[in] outDir Директория для сохранения VMDK-файла.
+     * @param[in] outName Имя создаваемого VMDK-файла.
+     * @param[in] d Имя исходного диска или файла, из которого будет произведено копирование данных.
+     */
+    SparseVMDK(std::string outDir, std::string outName, std::string d) {
+        srand(static_cast<unsigned int>(time(nullptr)));
+        outFileDir = outDir;
+        outFileName = outName;
+        disk = d;
+    }
+    #endif // __linux__
+    /**
+     * @brief Создает sparse-файл VMDK формата.
+     *
+     * Основной метод для создания sparse-файла VMDK и его дескриптора,
+     * включая расчет геометрии и инициализацию данных.
+     *
+     * @param[in] bufSize Размер буфера для копирования данных.
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateSparse(unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Создает sparse-файл VMDK с дедупликацией одинаковых зерен.
+     *
+     * Каждое ненулевое зерно хэшируется и ищется в индексе уже записанных зерен.
+     * Совпадение подтверждается полным сравнением с записанными данными, после чего
+     * GTE зерна указывает на уже записанное зерно и повторная запись не выполняется.
+     * Образ с общими зернами предназначен только для чтения.
+     *
+     * @param[in] bufSize Размер буфера чтения (округляется вниз до кратного размеру зерна).
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateSparseDedup(unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Создает sparse-файл VMDK с дедупликацией из произвольного источника.
+     *
+     * То же, что CreateSparseDedup, но данные читаются из `source` (образ, имитируемый
+     * диск SimulatedDisk и т. п.), а не с диска `disk`; сектор источника считается равным SECTOR_SIZE.
+     *
+     * @param[in] source Источник данных.
+     * @param[in] bufSize Размер буфера чтения.
+     * @param[in] capacitySectors Общее количество секторов источника.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateSparseDedup(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Создает sparse-файл VMDK многопоточно.
+     *
+     * Чтение, поиск нулевых зерен и запись выполняются задачами общего
+     * планировщика (TaskScheduler::Shared()). Ненулевые зерна записываются
+     * в порядке завершения задач, поэтому их порядок в файле может отличаться от порядка на диске.
+     *
+     * @param[in] bufSize Размер участка, обрабатываемого одной задачей (округляется вниз до кратного размеру зерна).
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateSparseThread(unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Создает sparse-файл VMDK многопоточно из произвольного источника.
+     *
+     * То же, что CreateSparseThread, но данные читаются из `source`, а не с диска `disk`
+     * (см. CreateSparseDedup(BlockSource&, unsigned long, uint64_t)).
+     *
+     * @param[in] source Источник данных.
+     * @param[in] bufSize Размер участка, обрабатываемого одной задачей.
+     * @param[in] capacitySectors Общее количество секторов источника.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool CreateSparseThread(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Преобразует готовый DD-образ в sparse-файл VMDK.
+     *
+     * Источником служит файл `disk` (образ .dd), диск при этом не открывается.
+     * Количество секторов берется из размера образа. Участки, которые файловая
+     * система помечает как дыры (BlockFile::DataRanges), не читаются вовсе;
+     * остальные обрабатываются так же, как в CreateSparseThread, но читаются
+     * через отображение в память (MappedFile) без промежуточного буфера.
+     *
+     * @param[in] bufSize Размер участка, обрабатываемого одной задачей (округляется вниз до кратного размеру зерна).
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    bool ConvertImage(unsigned long bufSize);
+
+    /**
+     * @brief Возвращает коэффициент дедупликации последнего запуска.
+     *
+     * @return Отношение количества ненулевых зерен к количеству записанных (1.0 — совпадений нет).
+     */
+    double GetDedupRatio() const {
+        return writtenGrains == 0 ? 1.0 : static_cast<double>(nonZeroGrains) / writtenGrains;
+    }
+
+    /**
+     * @brief Возвращает количество зерен, не записанных повторно благодаря дедупликации.
+     */
+    uint64_t GetDedupGrains() const { return nonZeroGrains - writtenGrains; };
+
+    /**
+     * @brief Устанавливает размер зерна для создаваемого образа.
+     *
+     * @param[in] sectors Размер зерна в секторах: степень двойки от MIN_GRAIN_SIZE до MAX_GRAIN_SIZE.
+     * @return Возвращает `true`, если значение допустимо и установлено.
+     */
+    bool SetGrainSize(uint64_t sectors) {
+        if (sectors < MIN_GRAIN_SIZE || sectors > MAX_GRAIN_SIZE || (sectors & (sectors - 1)) != 0)
+            return false;
+        grainSectors = sectors;
+        return true;
+    }
+
+    /**
+     * @brief Устанавливает количество записей в одной таблице зерен (GT).
+     *
+     * VMware и qemu ожидают значение 512; большие таблицы уменьшают размер GD на очень больших дисках.
+     *
+     * @param[in] count Степень двойки от MIN_GTE_COUNT до MAX_GTE_COUNT.
+     * @return Возвращает `true`, если значение допустимо и установлено.
+     */
+    bool SetGTECount(uint32_t count) {
+        if (count < MIN_GTE_COUNT || count > MAX_GTE_COUNT || (count & (count - 1)) != 0)
+            return false;
+        gtesPerGT = count;
+        return true;
+    }
+
+    /**
+     * @brief Подбирает размер зерна по выборке с диска (см. GrainSizeSampler).
+     *
+     * Выбранное значение устанавливается как текущий размер зерна.
+     *
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @param[in] samples Количество случайных участков диска для выборки.
+     * @return Выбранный размер зерна в секторах (0, если диск не удалось прочитать).
+     */
+    uint64_t SelectGrainSize(uint64_t capacitySectors, uint32_t samples = 64);
+
+    /**
+     * @brief Возвращает текущий размер зерна в секторах.
+     */
+    uint64_t GetGrainSize() const { return grainSectors; };
+
+    /**
+     * @brief Возвращает текущее количество записей в таблице зерен.
+     */
+    uint32_t GetGTECount() const { return gtesPerGT; };
+
+    /**
+     * @brief Включает шифрование зерен образа (см. AesXts).
+     *
+     * Шифруются только данные зерен, tweak — сектор зерна в файле; заголовок,
+     * дескриптор, GD и GT остаются открытыми, поэтому образ читает SparseVMDKReader с тем же ключом.
+     *
+     * @param[in] c Ключ или nullptr, чтобы отключить шифрование.
+     */
+    void SetCipher(std::shared_ptr<const AesXts> c) { cipher = c; };
+
+    /**
+     * @brief Включает измерение задержек операций ввода-вывода (см. IoStats).
+     *
+     * @param[in] s Статистика задания или nullptr, чтобы отключить измерение.
+     */
+    void SetStats(std::shared_ptr<IoStats> s) { stats = s; };
+
+    /**
+     * @brief Устанавливает наибольший объем одной записи ненулевых зерен.
+     *
+     * Ненулевые зерна участка получают места в файле подряд и пишутся сборной
+     * записью (BlockFile::WriteGatherAt) пачками не больше этого объема.
+     *
+     * @param[in] bytes Объем в байтах; меньше размера зерна — по одному зерну на запись.
+     */
+    void SetMaxWriteBytes(uint64_t bytes) { maxWriteBytes = bytes; };
+
+private:
+    uint64_t grainSectors = grainSize;   ///< Размер зерна создаваемого образа в секторах.
+    uint32_t gtesPerGT = GTE_COUNT;      ///< Количество записей в таблице зерен создаваемого образа.
+
+    uint64_t nonZeroGrains = 0;   ///< Количество ненулевых зерен последнего запуска.
+    uint64_t writtenGrains = 0;   ///< Количество фактически записанных зерен последнего запуска.
+    uint64_t maxWriteBytes = SPARSE_WRITE_BYTES;   ///< Наибольший объем одной сборной записи зерен.
+
+    std::shared_ptr<const AesXts> cipher;   ///< Ключ шифрования зерен (nullptr — без шифрования).
+    std::shared_ptr<IoStats> stats;         ///< Статистика задержек (nullptr — не измеряется).
+
+    /**
+     * @brief Копирует зерна с дедупликацией (основной цикл CreateSparseDedup).
+     *
+     * @tparam Sector Политика размера сектора исходного устройства.
+     * @param[in] reader Исходный диск.
+     * @param[in] writer Выходной файл, открытый на чтение и запись.
+     * @param[in] layout Расположение структур файла.
+     * @param[in] bufSize Размер буфера чтения.
+     * @param[in] diskBytes Размер диска в байтах.
+     * @param[out] GTEs Заполняемые значения GTE.
+     * @return Возвращает `true` при успешном копировании, иначе `false`.
+     */
+    template<class Sector>
+    bool DedupGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                     unsigned long bufSize, uint64_t diskBytes, std::vector<uint32_t>& GTEs);
+
+    /**
+     * @brief Копирует зерна задачами планировщика (основной цикл CreateSparseThread).
+     *
+     * Параметры совпадают с DedupGrains.
+     * @param[in] dataRanges Участки источника с данными (см. BlockFile::DataRanges) или nullptr.
+     *                       Участки, не пересекающиеся с ними, не читаются и остаются нулевыми.
+     */
+    template<class Sector>
+    bool ThreadedGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                        unsigned long bufSize, uint64_t diskBytes, std::vector<uint32_t>& GTEs,
+                        const std::vector<std::pair<uint64_t, uint64_t>>* dataRanges = nullptr);
+
+    /**
+     * @brief Общая часть CreateSparseDedup: source — источник или nullptr для диска `disk`.
+     */
+    bool SparseDedupFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Общая часть CreateSparseThread: source — источник или nullptr для диска `disk`.
+     */
+    bool SparseThreadFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors);
+
+    /**
+     * @brief Записывает заголовок, дескриптор, GD и GT sparse-файла вокруг цикла копирования.
+     *
+     * @param[in] capacitySectors Общее количество секторов на диске.
+     * @param[in] source Источник данных или nullptr, чтобы открыть диск `disk`.
+     * @param[in] copyLoop Цикл копирования зерен: принимает политику сектора, источник,
+     *                     выходной файл, расположение, размер диска и заполняемые GTE.
+     * @return Возвращает `true` при успешном создании файла, иначе `false`.
+     */
+    template<class CopyLoop>
+    bool WriteSparseImage(uint64_t capacitySectors, BlockSource* source, CopyLoop&& copyLoop);
+
+    #ifdef _WIN32
+    std::wstring outFileDir;  ///< Директория прописанная пользователем (Windows).
+    std::wstring outFileName; ///< Имя файла прописанная пользователем (Windows).
+    std::wstring disk;        ///< Имя исходного диска или файла (Windows).
+    #endif // _WIN32
+
+    #ifdef __linux__
+    std::string outFileDir;   ///< Директория прописанная пользователем (Linux).
+    std::string outFileName;  ///< Имя файла прописанная пользователем (Linux).
+    std::string disk;         ///< Имя исходного диска или файла (Linux).
+    #endif // __linux__
+
+    /**
+     * @brief Преобразует строку типа `std::wstring` в строку типа `std::string`.
+     *
+     * Метод, необходимый для работы со строками в различных кодировках на разных платформах.
+     *
+     * @param[in] wstr Широкая строка (`std::wstring`) для преобразования.
+     * @return Преобразованная строка типа `std::string`.
+     */
+    //Метод преобразования wstring в string
+    std::string WCharToString(const std::wstring& wstr) {
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        return converter.to_bytes(wstr); // Преобразуем
+    }
+
+    /**
+     * @brief Генерирует случайный CID (идентификатор) для VMDK-дескриптора.
+     *
+     * CID используется для уникальной идентификации диска и является частью дескриптора VMDK.
+     *
+     * @return Случайное 32-битное 8-ми значное целое число, представляющее уникальный идентификатор CID.
+     */
+    //Генерация случайного CID для дескриптора VMDK
+    uint32_t generateRandomCID() {
+        return 10000000 + (rand() % 90000000);
+    }
+};
+
+#pragma pack(1)  // Обеспечиваем выравнивание структуры по 1 байту
+
+/**
+ * @struct SparseExtentHeader
+ * @brief Структура для хранения заголовка sparse VMDK.
+ *
+ * Структура `SparseExtentHeader` содержит основные поля для описания
+ * sparse VMDK-файла, включая магическое число, емкость, размер зерна и другие параметры.
+ */
+typedef struct SparseExtentHeader
+{
+    uint32_t    magicNumber;        ///< Магическое число VMDK ('VMDK' в hex)
+    uint32_t    version;            ///< Версия VMDK
+    uint32_t    flags;              ///< Флаги конфигурации VMDK
+    uint64_t    capacity;           ///< Емкость в секторах
+    uint64_t    grainSize;          ///< Размер зерна в секторах
+    uint64_t    descriptorOffset;   ///< Смещение дескриптора в секторах
+    uint64_t    descriptorSize;     ///< Размер дескриптора в секторах
+    uint32_t    numGTEsPerGT;       ///< Количество записей в таблице зерен
+    uint64_t    rgdOffset;          ///< Смещение резервной таблицы зерен
+    uint64_t    gdOffset;           ///< Смещение основной таблицы зерен
+    uint64_t    overHead;           ///< Размер метаданных
+    bool        uncleanShutdown;    ///< Флаг завершения с ошибками
+    char        singleEndLineChar;  ///< Символ конца строки
+    char        nonEndLineChar;     ///< Символ, не являющийся концом строки
+    char        doubleEndLineChar1; ///< Первый символ двойного конца строки
+    char        doubleEndLineChar2; ///< Второй символ двойного конца строки
+    uint16_t    compressAlgorithm;  ///< Алгоритм сжатия
+    uint8_t     pad[433];           ///< Заполнение до 512 байт для выравнивания
+} SparseExtentHeader;
+#pragma pack()
+
+
+/**
+ * @brief Рассчитывает расположение структур sparse VMDK-файла.
+ *
+ * Порядок в файле: заголовок, дескриптор, GD, все GT подряд, данные.
+ *
+ * @param[in] capacitySectors Общее количество секторов на диске.
+ * @param[in] grainSectors Размер зерна в секторах.
+ * @param[in] gtesPerGT Количество записей в одной таблице зерен.
+ * @param[in] descriptorBytes Длина текстового дескриптора в байтах.
+ * @return Рассчитанное расположение.
+ */
+inline SparseLayout ComputeSparseLayout(uint64_t capacitySectors, uint64_t grainSectors,
+                                        uint64_t gtesPerGT, uint64_t descriptorBytes)
+{
+    SparseLayout layout;
+    layout.descriptorSize = (descriptorBytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (layout.descriptorSize == 0)
+        layout.descriptorSize = DESCRIPTOR_SIZE;
+    layout.totalGrains = (capacitySectors + grainSectors - 1) / grainSectors;
+    layout.numGT = (layout.totalGrains + gtesPerGT - 1) / gtesPerGT;
+    layout.gtSectors = (gtesPerGT * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    layout.gdOffset = 1 + layout.descriptorSize;
+
+    uint64_t gdBytes = layout.numGT * 4;
+    layout.gtOffset = layout.gdOffset * SECTOR_SIZE + (gdBytes + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    uint64_t grainBytes = grainSectors * SECTOR_SIZE;
+    uint64_t metaEnd = layout.gtOffset + layout.numGT * layout.gtSectors * SECTOR_SIZE;
+    layout.dataOffset = (metaEnd + grainBytes - 1) / grainBytes * grainBytes;
+    return layout;
+}
+
+/**
+ * @brief Заполняет заголовок sparse VMDK-файла по рассчитанному расположению.
+ *
+ * @param[out] header Заголовок для заполнения.
+ * @param[in] capacitySectors Общее количество секторов на диске.
+ * @param[in] grainSectors Размер зерна в секторах.
+ * @param[in] gtesPerGT Количество записей в одной таблице зерен.
+ * @param[in] layout Расположение структур файла.
+ */
+inline void FillSparseHeader(SparseExtentHeader& header, uint64_t capacitySectors, uint64_t grainSectors,
+                             uint64_t gtesPerGT, const SparseLayout& layout)
+{
+    memset(&header, 0, sizeof(header));
+    header.magicNumber = VMDK_MAGICNUMBER;
+    header.version = VMDK_VERSION;
+    header.flags = 1;                                   // Только проверка символов конца строки
+    header.capacity = capacitySectors;
+    header.grainSize = grainSectors;
+    header.descriptorOffset = 1;
+    header.descriptorSize = layout.descriptorSize;
+    header.numGTEsPerGT = static_cast<uint32_t>(gtesPerGT);
+    header.rgdOffset = 0;
+    header.gdOffset = layout.gdOffset;
+    header.overHead = layout.dataOffset / SECTOR_SIZE;  // Метаданные в секторах
+    header.uncleanShutdown = false;
+    header.singleEndLineChar = '\n';
+    header.nonEndLineChar = ' ';
+    header.doubleEndLineChar1 = '\r';
+    header.doubleEndLineChar2 = '\n';
+    header.compressAlgorithm = 0;
+}
+
+/**
+ * @brief Проверяет, пересекается ли участок с каким-либо из участков данных.
+ *
+ * @param ranges Пары (смещение, длина) в порядке возрастания смещения.
+ * @param offset Начало проверяемого участка.
+ * @param len Длина проверяемого участка.
+ */
+inline bool RangesOverlap(const std::vector<std::pair<uint64_t, uint64_t>>& ranges, uint64_t offset, uint64_t len)
+{
+    // Первый участок, заканчивающийся после offset
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), offset,
+                               [](uint64_t pos, const std::pair<uint64_t, uint64_t>& r) { return pos < r.first + r.second; });
+    return it != ranges.end() && it->first < offset + len;
+}
+
+/**
+ * @brief Читает подряд идущие зерна диска с выравниванием по сектору устройства.
+ *
+ * Смещение и длина должны быть кратны сектору политики, поэтому на дисках 4Kn
+ * запросы всегда выровнены по физическому сектору. Часть последнего зерна,
+ * выходящая за пределы диска, заполняется нулями.
+ *
+ * @tparam Sector Политика размера сектора устройства.
+ * @param reader Источник данных.
+ * @param buf Буфер размером не меньше `len`.
+ * @param offset Смещение первого зерна в байтах.
+ * @param len Длина в байтах (целое число зерен).
+ * @param diskBytes Размер диска в байтах.
+ * @return true, если чтение успешно.
+ */
+template<class Sector>
+bool ReadGrains(BlockSource& reader, unsigned char* buf, uint64_t offset, uint64_t len, uint64_t diskBytes)
+{
+    if (!Sector::IsAligned(offset) || !Sector::IsAligned(len))
+        return false;
+    if (offset + len <= diskBytes)
+        return reader.ReadAt(buf, len, offset);
+
+    uint64_t valid = diskBytes - offset;
+    uint64_t toRead = Sector::AlignUp(valid);
+    memset(buf + toRead, 0, len - toRead);
+    if (!reader.ReadAt(buf, toRead, offset))
+        return false;
+    memset(buf + valid, 0, toRead - valid);
+    return true;
+}
+
+
+bool SparseVMDK::CreateSparse(unsigned long bufSize, uint64_t capacitySectors){
+    if (capacitySectors == 0) {
+        std::wcout << L"Не удалось определить количество секторов." << std::endl;
+        return false;
+    }
+
+    // Расчет геометрии диска
+    uint64_t cylinders = (capacitySectors / (SPARSE_HEADS * SECTORS));
+    // Случайная генерация cid
+    uint32_t cid = generateRandomCID();
+
+    #ifdef _WIN32
+    std::wstring outFile = outFileDir + L"\\"  + outFileName + L".vmdk";
+    std::wstring Filename = outFileName + L".vmdk";
+    #endif // _WIN32
+
+    #ifdef __linux__
+    std::string outFile = outFileDir + "//"  + outFileName + ".vmdk";
+    std::string Filename = outFileName + ".vmdk";
+    #endif // __linux__
+
+    // Записываем заголовок VMDK
+    SparseExtentHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magicNumber = VMDK_MAGICNUMBER;  // Устанавливаем магическое число
+    header.version = VMDK_VERSION;          // Версия VMDK
+    header.flags = 3;                       // Устанавливаем флаги
+    header.capacity = capacitySectors;      // Ёмкость в секторах
+    header.grainSize = grainSectors;        // Размер зерна
+    header.descriptorOffset = 1;            // Смещение дескриптора сразу после заголовка
+    header.descriptorSize = DESCRIPTOR_SIZE; // Размер дескриптора в секторах
+    header.numGTEsPerGT = gtesPerGT;        // Количество записей на таблицу зерен
+    header.rgdOffset = 0;                   // Смещение резервной таблицы зерен
+    header.gdOffset = 2;                    // Смещение основной таблицы зерен
+    header.overHead = VMDK_HEADER_SIZE + SECTOR_SIZE * DESCRIPTOR_SIZE; // Метаданные
+    header.uncleanShutdown = false;         // Флаг чистого завершения
+    header.singleEndLineChar = '\n';        // Символ конца строки
+    header.nonEndLineChar = ' ';            // Символ без конца строки
+    header.doubleEndLineChar1 = '\r';       // Первый символ двойного конца строки
+    header.doubleEndLineChar2 = '\n';       // Второй символ двойного конца строки
+    header.compressAlgorithm = 0;           // Без сжатия
+
+    #ifdef _WIN32
     std::string outFileS = WCharToString(Filename);
     #endif // _WIN32
 
     #ifdef __linux__
     std::string outFileS = Filename;
     #endif // __linux__
-
-    //Создаем дескриптор
-    std::stringstream desc1;
-    desc1 << "# Disk DescriptorFile\n"
-                << "version=1\n"
-                //<< "encoding=\"UTF-8\"\n"
-                << "CID=" << cid << "\n"
-                << "parentCID=ffffffff\n"
-                //<< "isNativeSnapshot=\"no\"\n"
-                << "createType=\"monolithicSparse\"\n"
-                << "\n"
-                << "# Extent description\n"
-                << "RW " << capacitySectors << " SPARSE \"" << outFileS <<  "\" 0\n"
-                << "\n"
-                << "# The Disk Data Base\n"
-                << "#DDB\n"
-                << "ddb.adapterType = \"ide\"\n"
-                << "ddb.geometry.cylinders = \"" << cylinders << "\"\n"
-                << "ddb.geometry.heads = \"16\"\n"
-                << "ddb.geometry.sectors = \"63\"\n"
-                << "ddb.virtualHWVersion = \"10\"\n";
-
-    std::string descriptor = desc1.str();
-
-
-    uint64_t sizeGD = capacitySectors;
-
-    uint64_t totalGrains = (capacitySectors%grainSize)==0 ? (capacitySectors/grainSize) : (capacitySectors/grainSize)+1;     // Кол-во зерен(grains)
-    uint64_t numGT = (totalGrains%GTE_COUNT)==0 ? (totalGrains/GTE_COUNT) : (totalGrains/GTE_COUNT)+1;               // Кол-во GT
-    uint64_t totalGTEs = totalGrains;                             // Общее кол-во GTE
-    uint64_t totalGDEs = numGT;                                   // код-во одинаково
-
-    // Получение смещения из заголовка
-    uint64_t gdOffset = header.gdOffset * 512;
-
-    // Смещение для 1-й GT
-    uint64_t gtOffset = gdOffset + numGT*4;
-    // Выравнивание, чтобы было кратно 512
-    if(gtOffset%512 != 0)
-    {
-        gtOffset += 512-(gtOffset%512);
-    }
-
-    // Смещение для данных = Заголовок + Дескриптор + GD + GTs + (выравнивание до числа кратного 128 секторам)
-    uint32_t dataOffset = gtOffset + totalGrains*4;
-    // Выравнивание
-    if(dataOffset%65536 != 0)
-    {
-        dataOffset += 65536-(dataOffset%65536);
-    }
-
-    Writer writer;
-
-
-    if(writer.OpenFile(outFile.data()))
-    {
-        #ifdef _WIN32
-        std::wcout << L"Будет сделана копия типа 'Sparse' из \"" << disk << L"\" в  \"" << outFile << L"\"" << std::endl;
+
+    //Создаем дескриптор
+    std::stringstream desc1;
+    desc1 << "# Disk DescriptorFile\n"
+                << "version=1\n"
+                //<< "encoding=\"UTF-8\"\n"
+                << "CID=" << cid << "\n"
+                << "parentCID=ffffffff\n"
+                //<< "isNativeSnapshot=\"no\"\n"
+                << "createType=\"monolithicSparse\"\n"
+                << "\n"
+                << "# Extent description\n"
+                << "RW " << capacitySectors << " SPARSE \"" << outFileS <<  "\" 0\n"
+                << "\n"
+                << "# The Disk Data Base\n"
+                << "#DDB\n"
+                << "ddb.adapterType = \"ide\"\n"
+                << "ddb.geometry.cylinders = \"" << cylinders << "\"\n"
+                << "ddb.geometry.heads = \"16\"\n"
+                << "ddb.geometry.sectors = \"63\"\n"
+                << "ddb.virtualHWVersion = \"10\"\n";
+
+    std::string descriptor = desc1.str();
+
+
+    uint64_t sizeGD = capacitySectors;
+
+    uint64_t totalGrains = (capacitySectors%grainSectors)==0 ? (capacitySectors/grainSectors) : (capacitySectors/grainSectors)+1;     // Кол-во зерен(grains)
+    uint64_t numGT = (totalGrains%gtesPerGT)==0 ? (totalGrains/gtesPerGT) : (totalGrains/gtesPerGT)+1;               // Кол-во GT
+    uint64_t grainBytes = grainSectors * SECTOR_SIZE;              // Размер зерна в байтах
+    uint32_t gtSectors = (gtesPerGT * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE; // Размер одной GT в секторах
+    uint64_t totalGTEs = totalGrains;                             // Общее кол-во GTE
+    uint64_t totalGDEs = numGT;                                   // код-во одинаково
+
+    // Получение смещения из заголовка
+    uint64_t gdOffset = header.gdOffset * 512;
+
+    // Смещение для 1-й GT
+    uint64_t gtOffset = gdOffset + numGT*4;
+    // Выравнивание, чтобы было кратно 512
+    if(gtOffset%512 != 0)
+    {
+        gtOffset += 512-(gtOffset%512);
+    }
+
+    // Смещение для данных = Заголовок + Дескриптор + GD + GTs + (выравнивание до числа кратного 128 секторам)
+    uint32_t dataOffset = gtOffset + totalGrains*4;
+    // Выравнивание
+    if(dataOffset%grainBytes != 0)
+    {
+        dataOffset += grainBytes-(dataOffset%grainBytes);
+    }
+
+    Writer writer;
+
+
+    if(writer.OpenFile(outFile.data()))
+    {
+        #ifdef _WIN32
+        std::wcout << L"Будет сделана копия типа 'Sparse' из \"" << disk << L"\" в  \"" << outFile << L"\"" << std::endl;
 
         bool wresHeader = writer.Write((unsigned char*)&header, sizeof(header));
         bool wresDesc = writer.Write((unsigned char*)(descriptor.c_str()), descriptor.length());
 
         //Выравниваем до 1 Кб
-        unsigned char* bufPadding = new unsigned char[512 - descriptor.length()]{};
+        PooledBuffer padding = BufferPool::Shared().Acquire(512 - descriptor.length());
+        memset(padding.Data(), 0, 512 - descriptor.length());
+        unsigned char* bufPadding = padding.Data();
         #endif // _WIN32
-
-        #ifdef __linux__
+
+        #ifdef __linux__
         std::cout << "Будет сделана копия типа 'Sparse' из \"" << disk << "\" в  \"" << outFile << "" << std::endl;
-
+
         bool wresHeader = writer.Write((char*)&header, sizeof(header));
         bool wresDesc = writer.Write((char*)(descriptor.c_str()), descriptor.length());
 
         //Выравниваем до 1 Кб
-        char* bufPadding = new char[512 - descriptor.length()]{};
+        PooledBuffer padding = BufferPool::Shared().Acquire(512 - descriptor.length());
+        memset(padding.Data(), 0, 512 - descriptor.length());
+        char* bufPadding = (char*)padding.Data();
         #endif // __linux__
-
-        bool wresPadding = writer.Write(bufPadding, 512 - descriptor.length());
-
-        // bool wresSet = writer.SetFilePointer(1024); // утсановка позиции для записи
-        // std::string test = " HERE "; проверка
-        // bool wresTest = writer.Write((unsigned char*)(test.c_str()), test.length());
-
-        if(!wresHeader || !wresDesc)
-        {
-            std::cout << "Header write error" << std::endl;
-            delete[] bufPadding; // Освобождение памяти
-            return false;
-        }
-        else
-        {
-            //1.Сначала запишем все GDE
-            //  Заполним массив значаний GDE
-            uint32_t curGDEvalue = gtOffset/512;   // Значение первой GDE
-            uint32_t GDEs[numGT]={};               // Массив значений GDE
-            for(size_t i=0; i!= numGT; i++)
-            {
-                GDEs[i] = curGDEvalue; //Записываем в массив значение
-                curGDEvalue += 4;      //Следующая GT начинается через 4 сектора
-            }
-
-            //   Записываем GDE в файл
-            bool wresSetGD = writer.SetFilePointer(gdOffset); // установка позиции для записи
-
-            if(wresSetGD)
+
+        bool wresPadding = writer.Write(bufPadding, 512 - descriptor.length());
+
+        // bool wresSet = writer.SetFilePointer(1024); // утсановка позиции для записи
+        // std::string test = " HERE "; проверка
+        // bool wresTest = writer.Write((unsigned char*)(test.c_str()), test.length());
+
+        if(!wresHeader || !wresDesc)
+        {
+            std::cout << "Header write error" << std::endl;
+            return false;
+        }
+        else
+        {
+            //1.Сначала запишем все GDE
+            //  Заполним массив значаний GDE
+            uint32_t curGDEvalue = gtOffset/512;   // Значение первой GDE
+            uint32_t GDEs[numGT]={};               // Массив значений GDE
+            for(size_t i=0; i!= numGT; i++)
+            {
+                GDEs[i] = curGDEvalue; //Записываем в массив значение
+                curGDEvalue += gtSectors; //Следующая GT начинается через gtSectors секторов
+            }
+
+            //   Записываем GDE в файл
+            bool wresSetGD;
+            {
+                IoTimer timer(stats.get(), IoOp::Seek, 0, gdOffset);
+                wresSetGD = writer.SetFilePointer(gdOffset); // установка позиции для записи
+            }
+
+            if(wresSetGD)
             {
-                #ifdef _WIN32
+                #ifdef _WIN32
                 bool wresGD = writer.Write((unsigned char*)(&GDEs), numGT*4);
                 #endif // _WIN32
 
                 #ifdef __linux__
                 bool wresGD = writer.Write((char*)(&GDEs), numGT*4);
                 #endif // __linux__
-
-                if(!wresGD)
-                {
-                    std::cout << "GD write error" << std::endl;
-                    delete[] bufPadding; // Освобождение памяти
-                    return false;
-                }
-                else
-                {
-                    // std::cout << "GD is write" << std::endl;
-                }
-            }
-
-            //2.Заполнение области с данными
-            //Одновременно с заполнением данных будет заполняться массив GTE
-            uint32_t curGTEvalue = dataOffset/512;  //Первое значение GTE
-            uint32_t GTEs[totalGrains] = {};          //Массив значений GTE
-
-            unsigned char zeros[65536]={};          // Нулевой буфер для сравнения
-
-            //   Установим указатель на начало области с данными
-            bool wresSetData = writer.SetFilePointer(dataOffset);
-            if(!wresSetData) {
-                    std::cout << "Set Data err\n";
-                    delete[] bufPadding; // Освобождение памяти
-                    return false;
-                    }
-
-            //   Дальше идет чтение данных с диска
-            //   и запись в файл, если зерно не равно нулю
-            Reader reader;
-
-            if(!(reader.OpenDisk(disk.data())))
-            {
-                std::cout << "Open disk error" << std::endl;
-                delete[] bufPadding; // Освобождение памяти
-                return false;
-            }
-            else
+
+                if(!wresGD)
+                {
+                    std::cout << "GD write error" << std::endl;
+                    return false;
+                }
+                else
+                {
+                    // std::cout << "GD is write" << std::endl;
+                }
+            }
+
+            //2.Заполнение области с данными
+            //Одновременно с заполнением данных будет заполняться массив GTE
+            uint32_t curGTEvalue = dataOffset/512;  //Первое значение GTE
+            uint32_t GTEs[totalGrains] = {};          //Массив значений GTE
+
+            std::vector<unsigned char> zeros(grainBytes, 0); // Нулевой буфер для сравнения
+
+            //   Установим указатель на начало области с данными
+            bool wresSetData;
             {
+                IoTimer timer(stats.get(), IoOp::Seek, 0, dataOffset);
+                wresSetData = writer.SetFilePointer(dataOffset);
+            }
+            if(!wresSetData) {
+                    std::cout << "Set Data err\n";
+                    return false;
+                    }
+
+            //   Дальше идет чтение данных с диска
+            //   и запись в файл, если зерно не равно нулю
+            Reader reader;
+
+            if(!(reader.OpenDisk(disk.data())))
+            {
+                std::cout << "Open disk error" << std::endl;
+                return false;
+            }
+            else
+            {
+                PooledBuffer grainBuffer = BufferPool::Shared().Acquire(grainBytes);
+
                 #ifdef _WIN32
-                unsigned char* readBuffer = new unsigned char[BUFFER_SIZE];     // Буфер для чтения
+                unsigned char* readBuffer = grainBuffer.Data();     // Буфер для чтения
                 #endif // _WIN32
 
                 #ifdef __linux__
-                char* readBuffer = new char[BUFFER_SIZE];     // Буфер для чтения
-                #endif // __linux__
-
-                for(size_t i=0; i != totalGrains; i++)
-                {
-                    bool rres = reader.Read(readBuffer, BUFFER_SIZE);           // Чтение данных в буфер
-
-                    if(i == totalGrains-1) {
-                        std::cout << "gggg";
-                    }
-
-                    if(!rres)
-                    {
-                        std::cout << "READ error" << std::endl;
-                        delete[] readBuffer; // Освобождение памяти
-                        delete[] bufPadding;
-                        return false;
-                    }
-                    else
-                    {
-                        int zeroMemory = memcmp(readBuffer, zeros, BUFFER_SIZE);    // Сравниваем нулевой и считанный буфер
-                        if(zeroMemory) //Если не нули
-                        {
-                            //Записываем данные
-                            if(!(writer.Write(readBuffer, BUFFER_SIZE)))
-                            {
-                                std::cout << "Write data error\n";
-                                delete[] readBuffer; // Освобождение памяти
-                                delete[] bufPadding;
-                                return false;
-                            }
-                            GTEs[i] = curGTEvalue;   // Записываем значение GTE в массив
-                            curGTEvalue += 128;      // Следующий блок данных будет через 128 секторов
-                        }
-                        else   //Если нули
-                        {
-                            GTEs[i] = 0;   // Записываем значение GTE в массив
-                        }
-                    }
-                }
-                delete[] readBuffer;
-                // std::cout << "DATA is write\n";
-            }
-
-            //3.Запись массива с GTE в файл
-            bool wresSetGT = writer.SetFilePointer(gtOffset); // установка позиции для записи
-
-            if(wresSetGT)
+                char* readBuffer = (char*)grainBuffer.Data();     // Буфер для чтения
+                #endif // __linux__
+
+                for(size_t i=0; i != totalGrains; i++)
+                {
+                    bool rres;
+                    {
+                        IoTimer timer(stats.get(), IoOp::Read, grainBytes, i * grainBytes);
+                        rres = reader.Read(readBuffer, grainBytes);           // Чтение данных в буфер
+                    }
+
+                    if(i == totalGrains-1) {
+                        std::cout << "gggg";
+                    }
+
+                    if(!rres)
+                    {
+                        std::cout << "READ error" << std::endl;
+                        return false;
+                    }
+                    else
+                    {
+                        int zeroMemory = memcmp(readBuffer, zeros.data(), grainBytes);    // Сравниваем нулевой и считанный буфер
+                        if(zeroMemory) //Если не нули
+                        {
+                            //Записываем данные
+                            if (cipher && !cipher->Encrypt(grainBuffer.Data(), grainBytes, (uint64_t)curGTEvalue * SECTOR_SIZE))
+                                return false;
+                            IoTimer timer(stats.get(), IoOp::Write, grainBytes, (uint64_t)curGTEvalue * SECTOR_SIZE);
+                            if(!(writer.Write(readBuffer, grainBytes)))
+                            {
+                                std::cout << "Write data error\n";
+                                return false;
+                            }
+                            GTEs[i] = curGTEvalue;   // Записываем значение GTE в массив
+                            curGTEvalue += grainSectors; // Следующий блок данных будет через grainSectors секторов
+                        }
+                        else   //Если нули
+                        {
+                            GTEs[i] = 0;   // Записываем значение GTE в массив
+                        }
+                    }
+                }
+                // std::cout << "DATA is write\n";
+            }
+
+            //3.Запись массива с GTE в файл
+            bool wresSetGT;
+            {
+                IoTimer timer(stats.get(), IoOp::Seek, 0, gtOffset);
+                wresSetGT = writer.SetFilePointer(gtOffset); // установка позиции для записи
+            }
+
+            if(wresSetGT)
             {
                 #ifdef _WIN32
                 bool wresGT = writer.Write((unsigned char*)(&GTEs), totalGrains*4);
@@ -424,34 +799,395 @@ bool SparseVMDK::CreateSparse(unsigned long bufSize, uint64_t capacitySectors){
 
                 #ifdef __linux__
                 bool wresGT = writer.Write((char*)(&GTEs), totalGrains*4);
-                #endif // __linux__
-
-                if(!wresGT)
-                {
-                    std::cout << "GT write error" << std::endl;
-                    delete[] bufPadding; // Освобождение памяти
-                    return false;
-                }
-                else
-                {
-                    // std::cout << "GT is write" << std::endl;
-                }
-            }
-            delete[] bufPadding;
-
-        }
-        #ifdef _WIN32
-        std::wcout<< L"Конец создания копии" << std::endl;
-        #endif // _WIN32
-
-        #ifdef __linux__
-        std::cout<< "Конец создания копии" << std::endl;
-        #endif // __linux__
-        return true;
-
-    }
-    else { return false; }
-}
-
-
-#endif // VMDKSPARCE_H_INCLUDED
+                #endif // __linux__
+
+                if(!wresGT)
+                {
+                    std::cout << "GT write error" << std::endl;
+                    return false;
+                }
+                else
+                {
+                    // std::cout << "GT is write" << std::endl;
+                }
+            }
+
+        }
+        #ifdef _WIN32
+        std::wcout<< L"Конец создания копии" << std::endl;
+        #endif // _WIN32
+
+        #ifdef __linux__
+        std::cout<< "Конец создания копии" << std::endl;
+        #endif // __linux__
+        return true;
+
+    }
+    else { return false; }
+}
+
+
+bool SparseVMDK::CreateSparseDedup(unsigned long bufSize, uint64_t capacitySectors)
+{
+    return SparseDedupFrom(nullptr, bufSize, capacitySectors);
+}
+
+bool SparseVMDK::CreateSparseDedup(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    return SparseDedupFrom(&source, bufSize, capacitySectors);
+}
+
+bool SparseVMDK::SparseDedupFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    nonZeroGrains = 0;
+    writtenGrains = 0;
+    bool created = WriteSparseImage(capacitySectors, source, [&](auto policy, BlockSource& reader, BlockFile& writer,
+                                                        const SparseLayout& layout, uint64_t diskBytes,
+                                                        std::vector<uint32_t>& GTEs) {
+        return DedupGrains<decltype(policy)>(reader, writer, layout, bufSize, diskBytes, GTEs);
+    });
+    if (!created)
+        return false;
+
+    std::cout << "Dedup: " << nonZeroGrains << " non-zero grains, " << writtenGrains
+              << " written, ratio " << GetDedupRatio() << std::endl;
+    return true;
+}
+
+bool SparseVMDK::CreateSparseThread(unsigned long bufSize, uint64_t capacitySectors)
+{
+    return SparseThreadFrom(nullptr, bufSize, capacitySectors);
+}
+
+bool SparseVMDK::CreateSparseThread(BlockSource& source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    return SparseThreadFrom(&source, bufSize, capacitySectors);
+}
+
+bool SparseVMDK::SparseThreadFrom(BlockSource* source, unsigned long bufSize, uint64_t capacitySectors)
+{
+    nonZeroGrains = 0;
+    writtenGrains = 0;
+    return WriteSparseImage(capacitySectors, source, [&](auto policy, BlockSource& reader, BlockFile& writer,
+                                                 const SparseLayout& layout, uint64_t diskBytes,
+                                                 std::vector<uint32_t>& GTEs) {
+        return ThreadedGrains<decltype(policy)>(reader, writer, layout, bufSize, diskBytes, GTEs);
+    });
+}
+
+bool SparseVMDK::ConvertImage(unsigned long bufSize)
+{
+    BlockFile image;
+    if (!image.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return false;
+    }
+    const uint64_t imageBytes = image.Size();
+    if (imageBytes % SECTOR_SIZE != 0) {
+        std::cout << "Image size is not a multiple of the sector" << std::endl;
+        return false;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    image.DataRanges(ranges);
+    image.Close();
+
+    // Образ — обычный файл: зерна проверяются и пишутся прямо из отображения
+    MappedFile mapped;
+    bool useMap = mapped.Open(disk);
+
+    nonZeroGrains = 0;
+    writtenGrains = 0;
+    return WriteSparseImage(imageBytes / SECTOR_SIZE, nullptr, [&](auto policy, BlockSource& reader, BlockFile& writer,
+                                                          const SparseLayout& layout, uint64_t diskBytes,
+                                                          std::vector<uint32_t>& GTEs) {
+        BlockSource& source = useMap ? static_cast<BlockSource&>(mapped) : reader;
+        return ThreadedGrains<decltype(policy)>(source, writer, layout, bufSize, diskBytes, GTEs, &ranges);
+    });
+}
+
+template<class CopyLoop>
+bool SparseVMDK::WriteSparseImage(uint64_t capacitySectors, BlockSource* source, CopyLoop&& copyLoop)
+{
+    if (capacitySectors == 0) {
+        std::wcout << L"Не удалось определить количество секторов." << std::endl;
+        return false;
+    }
+
+    uint64_t cylinders = (capacitySectors / (SPARSE_HEADS * SECTORS));
+    uint32_t cid = generateRandomCID();
+
+    #ifdef _WIN32
+    std::wstring outFile = outFileDir + L"\\"  + outFileName + L".vmdk";
+    std::string outFileS = WCharToString(outFileName + L".vmdk");
+    #endif // _WIN32
+
+    #ifdef __linux__
+    std::string outFile = outFileDir + "/"  + outFileName + ".vmdk";
+    std::string outFileS = outFileName + ".vmdk";
+    #endif // __linux__
+
+    std::stringstream desc1;
+    desc1 << "# Disk DescriptorFile\n"
+          << "version=1\n"
+          << "CID=" << cid << "\n"
+          << "parentCID=ffffffff\n"
+          << "createType=\"monolithicSparse\"\n"
+          << "\n"
+          << "# Extent description\n"
+          << "RW " << capacitySectors << " SPARSE \"" << outFileS <<  "\"\n"
+          << "\n"
+          << "# The Disk Data Base\n"
+          << "#DDB\n"
+          << "ddb.adapterType = \"ide\"\n"
+          << "ddb.geometry.cylinders = \"" << cylinders << "\"\n"
+          << "ddb.geometry.heads = \"16\"\n"
+          << "ddb.geometry.sectors = \"63\"\n"
+          << "ddb.virtualHWVersion = \"10\"\n";
+    std::string descriptor = desc1.str();
+
+    SparseLayout layout = ComputeSparseLayout(capacitySectors, grainSectors, gtesPerGT, descriptor.length());
+    const uint64_t diskBytes = capacitySectors * SECTOR_SIZE;
+
+    SparseExtentHeader header;
+    FillSparseHeader(header, capacitySectors, grainSectors, gtesPerGT, layout);
+
+    BlockFile reader;
+    BlockFile writer;
+    if (source == nullptr) {
+        if (!reader.Open(disk, BlockFileMode::Read)) {
+            std::cout << "Open disk error" << std::endl;
+            return false;
+        }
+        reader.SetCacheHygiene();
+        reader.SetStats(stats.get());
+    }
+    // Файл открывается и на чтение: совпадения хэшей проверяются по записанным данным
+    if (!writer.Open(outFile, BlockFileMode::ReadWrite) || !writer.Truncate(0)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    // Диск и образ проходятся один раз: не засоряем страничный кэш
+    writer.SetCacheHygiene();
+    writer.SetStats(stats.get());
+    BlockSource& input = source != nullptr ? *source : reader;
+
+    std::vector<unsigned char> descBuf(layout.descriptorSize * SECTOR_SIZE, 0);
+    memcpy(descBuf.data(), descriptor.data(), descriptor.length());
+    if (!writer.WriteAt((unsigned char*)&header, sizeof(header), 0) ||
+        !writer.WriteAt(descBuf.data(), descBuf.size(), SECTOR_SIZE)) {
+        std::cout << "Header write error" << std::endl;
+        return false;
+    }
+
+    // Цикл копирования инстанцируется для физического размера сектора исходного диска
+    std::vector<uint32_t> GTEs(layout.numGT * gtesPerGT, 0);
+    bool copied = DispatchSectorSize(source != nullptr ? SECTOR_SIZE : reader.SectorSize(), [&](auto policy) {
+        return copyLoop(policy, input, writer, layout, diskBytes, GTEs);
+    });
+    if (!copied)
+        return false;
+
+    std::vector<uint32_t> GDEs(layout.numGT);
+    for (uint64_t i = 0; i != layout.numGT; i++)
+        GDEs[i] = static_cast<uint32_t>(layout.gtOffset / SECTOR_SIZE + i * layout.gtSectors);
+
+    if (!writer.WriteAt((unsigned char*)GDEs.data(), GDEs.size() * 4, layout.gdOffset * SECTOR_SIZE) ||
+        !writer.WriteAt((unsigned char*)GTEs.data(), GTEs.size() * 4, layout.gtOffset)) {
+        std::cout << "GT write error" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template<class Sector>
+bool SparseVMDK::DedupGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                             unsigned long bufSize, uint64_t diskBytes, std::vector<uint32_t>& GTEs)
+{
+    const uint64_t grainBytes = grainSectors * SECTOR_SIZE;
+    if (grainBytes % Sector::size != 0) {
+        std::cout << "Grain size is not a multiple of the device sector" << std::endl;
+        return false;
+    }
+
+    uint64_t grainsPerBuf = bufSize / grainBytes;
+    if (grainsPerBuf == 0)
+        grainsPerBuf = 1;
+    PooledBuffer readBuffer = BufferPool::Shared().Acquire(Sector::AlignUp(grainsPerBuf * grainBytes));
+    PooledBuffer candidate = BufferPool::Shared().Acquire(grainBytes);
+
+    GrainDedupIndex index;
+    uint64_t dataPos = layout.dataOffset;
+
+    for (uint64_t first = 0; first < layout.totalGrains; first += grainsPerBuf) {
+        uint64_t count = layout.totalGrains - first < grainsPerBuf ? layout.totalGrains - first : grainsPerBuf;
+        if (!ReadGrains<Sector>(reader, readBuffer.Data(), first * grainBytes, count * grainBytes, diskBytes)) {
+            std::cout << "READ error" << std::endl;
+            return false;
+        }
+
+        for (uint64_t g = 0; g != count; g++) {
+            unsigned char* grain = readBuffer.Data() + g * grainBytes;
+            if (grain[0] == 0 && memcmp(grain, grain + 1, grainBytes - 1) == 0)
+                continue;   // Нулевое зерно: GTE = 0
+            nonZeroGrains++;
+
+            uint32_t newGTE = static_cast<uint32_t>(dataPos / SECTOR_SIZE);
+            uint32_t found = index.FindOrInsert(GrainHash64(grain, grainBytes), newGTE, [&](uint32_t gte) {
+                if (!writer.ReadAt(candidate.Data(), grainBytes, (uint64_t)gte * SECTOR_SIZE))
+                    return false;
+                if (cipher && !cipher->Decrypt(candidate.Data(), grainBytes, (uint64_t)gte * SECTOR_SIZE))
+                    return false;
+                return memcmp(candidate.Data(), grain, grainBytes) == 0;
+            });
+            if (found != 0) {
+                GTEs[first + g] = found;
+                continue;
+            }
+
+            if (cipher && !cipher->Encrypt(grain, grainBytes, dataPos))
+                return false;
+            if (!writer.WriteAt(grain, grainBytes, dataPos)) {
+                std::cout << "Write data error" << std::endl;
+                return false;
+            }
+            GTEs[first + g] = newGTE;
+            dataPos += grainBytes;
+            writtenGrains++;
+        }
+    }
+
+    return true;
+}
+
+template<class Sector>
+bool SparseVMDK::ThreadedGrains(BlockSource& reader, BlockFile& writer, const SparseLayout& layout,
+                                unsigned long bufSize, uint64_t diskBytes, std::vector<uint32_t>& GTEs,
+                                const std::vector<std::pair<uint64_t, uint64_t>>* dataRanges)
+{
+    const uint64_t grainBytes = grainSectors * SECTOR_SIZE;
+    if (grainBytes % Sector::size != 0) {
+        std::cout << "Grain size is not a multiple of the device sector" << std::endl;
+        return false;
+    }
+
+    uint64_t grainsPerBuf = bufSize / grainBytes;
+    if (grainsPerBuf == 0)
+        grainsPerBuf = 1;
+
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    TaskGroup group(scheduler);
+    std::atomic<uint64_t> dataPos(layout.dataOffset);
+    std::atomic<uint64_t> nonZero(0);
+    std::atomic<bool> failed(false);
+    uint64_t preallocated = layout.dataOffset;
+    bool canPreallocate = true;
+
+    // Каждая задача читает свой участок, отбрасывает нулевые зерна и пишет остальные
+    // по месту, выделенному атомарно: порядок зерен в файле не важен, важны только GTE
+    for (uint64_t first = 0; first < layout.totalGrains && !failed; first += grainsPerBuf) {
+        uint64_t count = layout.totalGrains - first < grainsPerBuf ? layout.totalGrains - first : grainsPerBuf;
+        if (dataRanges && !RangesOverlap(*dataRanges, first * grainBytes, count * grainBytes))
+            continue;   // Участок целиком в дыре: GTE остаются нулевыми
+        group.WaitBelow(2 * scheduler.GetConcurrency());
+
+        // Место резервируется крупными кусками с запасом на задачи в работе,
+        // чтобы данные, дописываемые вразнобой, ложились на диск подряд
+        uint64_t ahead = dataPos + 2 * scheduler.GetConcurrency() * count * grainBytes;
+        while (canPreallocate && preallocated < ahead) {
+            canPreallocate = writer.Preallocate(preallocated, SPARSE_PREALLOC_BYTES);
+            preallocated += SPARSE_PREALLOC_BYTES;
+        }
+        group.Run([&, first, count] {
+            // Отображенный источник читается без копирования; шифрованию и неполному
+            // последнему зерну нужен свой буфер. Подгрузка страниц отображения ждет
+            // устройство так же, как чтение, а при ее ошибке участок читается через ReadAt
+            PooledBuffer buffer;
+            const unsigned char* data = nullptr;
+            {
+                TaskScheduler::BlockingScope blocking;
+                if (!cipher && (first + count) * grainBytes <= diskBytes)
+                    data = reader.View(first * grainBytes, count * grainBytes);
+                if (data == nullptr) {
+                    buffer = BufferPool::Shared().Acquire(Sector::AlignUp(count * grainBytes));
+                    if (!ReadGrains<Sector>(reader, buffer.Data(), first * grainBytes, count * grainBytes, diskBytes)) {
+                        std::cout << "READ error" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    data = buffer.Data();
+                }
+            }
+
+            // Ненулевые зерна собираются в пачку: место под нее выделяется одним куском,
+            // и пачка уходит одной сборной записью вместо записи на каждое зерно
+            std::vector<uint64_t> batch;
+            std::vector<std::pair<const unsigned char*, uint64_t>> parts;
+            auto flush = [&]() {
+                if (batch.empty())
+                    return true;
+                uint64_t pos = dataPos.fetch_add(batch.size() * grainBytes);
+                parts.clear();
+                for (size_t i = 0; i != batch.size(); i++) {
+                    uint64_t g = batch[i];
+                    uint64_t grainPos = pos + i * grainBytes;
+                    if (cipher && !cipher->Encrypt(buffer.Data() + g * grainBytes, grainBytes, grainPos))
+                        return false;
+                    parts.emplace_back(data + g * grainBytes, grainBytes);
+                    GTEs[first + g] = static_cast<uint32_t>(grainPos / SECTOR_SIZE);
+                }
+                batch.clear();
+                TaskScheduler::BlockingScope blocking;
+                return writer.WriteGatherAt(parts, pos);
+            };
+
+            for (uint64_t g = 0; g != count; g++) {
+                const unsigned char* grain = data + g * grainBytes;
+                if (grain[0] == 0 && memcmp(grain, grain + 1, grainBytes - 1) == 0)
+                    continue;   // Нулевое зерно: GTE = 0
+                nonZero++;
+                batch.push_back(g);
+                if (batch.size() * grainBytes >= maxWriteBytes && !flush()) {
+                    std::cout << "Write data error" << std::endl;
+                    failed = true;
+                    return;
+                }
+            }
+            if (!flush()) {
+                std::cout << "Write data error" << std::endl;
+                failed = true;
+            }
+        });
+    }
+    group.Wait();
+    writer.TrimPreallocated();   // Неиспользованный запас за последним зерном
+
+    nonZeroGrains = nonZero;
+    writtenGrains = nonZero;
+    return !failed;
+}
+
+uint64_t SparseVMDK::SelectGrainSize(uint64_t capacitySectors, uint32_t samples)
+{
+    BlockFile reader;
+    if (!reader.Open(disk, BlockFileMode::Read)) {
+        std::cout << "Open disk error" << std::endl;
+        return 0;
+    }
+
+    GrainSizeSampler sampler(MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
+    if (!sampler.Sample(reader, capacitySectors, samples)) {
+        std::cout << "READ error" << std::endl;
+        return 0;
+    }
+
+    // Зерно не может быть меньше физического сектора диска
+    uint64_t best = sampler.Best(gtesPerGT);
+    while (best * SECTOR_SIZE < reader.SectorSize() && best < MAX_GRAIN_SIZE)
+        best *= 2;
+    SetGrainSize(best);
+    std::cout << "Grain size: " << grainSectors << " sectors" << std::endl;
+    return grainSectors;
+}
+
+
+#endif // VMDKSPARCE_H_INCLUDED
@@ -0,0 +1,334 @@
+/**
+ * @file VMDKSparseReader.h
+ * @brief Заголовочный файл для чтения созданных sparse-файлов формата VMDK.
+ */
+
+#ifndef VMDKSPARSEREADER_H_INCLUDED
+#define VMDKSPARSEREADER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include "BlockFile.h"
+#include "VMDKSparce.h"
+#include "AesXts.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+
+/**
+ * @class SparseVMDKReader
+ * @brief Класс для чтения sparse VMDK-файла (monolithicSparse).
+ *
+ * Загружает заголовок, дескриптор и все таблицы зерен в память, после чего
+ * позволяет читать отдельные зерна или произвольные диапазоны виртуального диска.
+ * Чтение выполняется позиционно, поэтому методы чтения можно вызывать из нескольких потоков.
+ */
+class SparseVMDKReader : public BlockSource
+{
+public:
+
+    SparseVMDKReader() {};
+
+    /**
+     * @brief Открывает sparse VMDK-файл и загружает его метаданные.
+     * @param path Путь к .vmdk файлу.
+     * @return true, если файл открыт и его структура корректна.
+     * @return false, если возникла ошибка.
+     */
+    bool Open(const PathString& path);
+
+    /**
+     * @brief Возвращает заголовок файла.
+     */
+    const SparseExtentHeader& GetHeader() const { return header; };
+
+    /**
+     * @brief Возвращает текст дескриптора.
+     */
+    const std::string& GetDescriptor() const { return descriptor; };
+
+    /**
+     * @brief Возвращает значение CID из дескриптора (в том виде, в каком оно записано).
+     */
+    std::string GetCID() const { return DescriptorValue("CID"); };
+
+    /**
+     * @brief Возвращает значение parentCID из дескриптора.
+     */
+    std::string GetParentCID() const { return DescriptorValue("parentCID"); };
+
+    /**
+     * @brief Проверяет, является ли образ дочерним (имеет родителя).
+     */
+    bool HasParent() const { return GetParentCID() != "ffffffff"; };
+
+    /**
+     * @brief Возвращает имя родительского образа из parentFileNameHint.
+     */
+    std::string GetParentFileNameHint() const { return DescriptorValue("parentFileNameHint"); };
+
+    /**
+     * @brief Возвращает количество зерен в образе.
+     */
+    uint64_t GetTotalGrains() const { return GTEs.size(); };
+
+    /**
+     * @brief Возвращает размер зерна в байтах.
+     */
+    uint64_t GetGrainBytes() const { return header.grainSize * SECTOR_SIZE; };
+
+    /**
+     * @brief Возвращает значение GTE (смещение зерна в секторах) или 0, если зерно не выделено.
+     * @param grain Номер зерна.
+     */
+    uint32_t GetGTE(uint64_t grain) const { return GTEs[grain]; };
+
+    /**
+     * @brief Читает одно зерно. Невыделенное зерно заполняется нулями.
+     * @param grain Номер зерна.
+     * @param buf Буфер размером не меньше GetGrainBytes().
+     * @return true, если операция успешна.
+     */
+    bool ReadGrain(uint64_t grain, unsigned char* buf);
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return header.capacity * SECTOR_SIZE; };
+
+    /**
+     * @brief Задает ключ для чтения зашифрованного образа (см. SparseVMDK::SetCipher).
+     */
+    void SetCipher(std::shared_ptr<const AesXts> c) { cipher = c; };
+
+    /**
+     * @brief Разворачивает образ в raw-файл (DD) той же емкости.
+     *
+     * Выходной файл получает нужный размер без выделения места, после чего задачи
+     * общего планировщика переносят выделенные зерна позиционной записью; подряд
+     * идущие зерна пишутся одним вызовом. Невыделенные и нулевые зерна не пишутся
+     * и остаются дырами, поэтому время работы зависит от объема данных, а не от емкости.
+     * Если выход нельзя усечь (диск), дыры пробиваются через BlockFile::PunchHole.
+     *
+     * @param path Путь к выходному файлу или диску.
+     * @param batchBytes Размер участка диска, обрабатываемого одной задачей.
+     * @return true, если образ развернут.
+     */
+    bool Expand(const PathString& path, uint64_t batchBytes = 4ull * 1024 * 1024);
+
+    /**
+     * @brief Возвращает количество байт данных, записанных последним вызовом Expand.
+     */
+    uint64_t GetExpandedBytes() const { return expandedBytes; };
+
+private:
+    BlockFile file;                 ///< Открытый .vmdk файл.
+    SparseExtentHeader header;      ///< Заголовок файла.
+    std::string descriptor;         ///< Текст дескриптора.
+    std::vector<uint32_t> GTEs;     ///< Значения GTE всех зерен по порядку.
+    std::shared_ptr<const AesXts> cipher; ///< Ключ расшифрования зерен.
+    uint64_t expandedBytes = 0;     ///< Записано данных последним вызовом Expand.
+
+    /**
+     * @brief Ищет значение ключа в дескрипторе (строка вида `key=value`).
+     * @param key Имя ключа.
+     * @return Значение без кавычек или пустая строка.
+     */
+    std::string DescriptorValue(const std::string& key) const;
+};
+
+inline bool SparseVMDKReader::Open(const PathString& path)
+{
+    GTEs.clear();
+    descriptor.clear();
+    if (!file.Open(path, BlockFileMode::Read))
+        return false;
+
+    if (!file.ReadAt((unsigned char*)&header, sizeof(header), 0) ||
+        header.magicNumber != VMDK_MAGICNUMBER ||
+        header.grainSize == 0 || header.numGTEsPerGT == 0 ||
+        header.compressAlgorithm != 0)
+        return false;
+
+    if (header.descriptorSize > 0) {
+        std::vector<char> desc(header.descriptorSize * SECTOR_SIZE);
+        if (!file.ReadAt((unsigned char*)desc.data(), desc.size(), header.descriptorOffset * SECTOR_SIZE))
+            return false;
+        descriptor.assign(desc.data(), strnlen(desc.data(), desc.size()));
+    }
+
+    // Загружаем GD, а затем все GT, на которые он ссылается
+    uint64_t totalGrains = (header.capacity + header.grainSize - 1) / header.grainSize;
+    uint64_t numGT = (totalGrains + header.numGTEsPerGT - 1) / header.numGTEsPerGT;
+    std::vector<uint32_t> GDEs(numGT);
+    if (!file.ReadAt((unsigned char*)GDEs.data(), numGT * 4, header.gdOffset * SECTOR_SIZE))
+        return false;
+
+    GTEs.assign(numGT * header.numGTEsPerGT, 0);
+    for (uint64_t i = 0; i != numGT; i++) {
+        if (GDEs[i] == 0)
+            continue;
+        if (!file.ReadAt((unsigned char*)&GTEs[i * header.numGTEsPerGT],
+                         header.numGTEsPerGT * 4, (uint64_t)GDEs[i] * SECTOR_SIZE))
+            return false;
+    }
+    GTEs.resize(totalGrains);
+    return true;
+}
+
+inline bool SparseVMDKReader::ReadGrain(uint64_t grain, unsigned char* buf)
+{
+    if (grain >= GTEs.size())
+        return false;
+    if (GTEs[grain] == 0) {
+        memset(buf, 0, GetGrainBytes());
+        return true;
+    }
+    uint64_t pos = (uint64_t)GTEs[grain] * SECTOR_SIZE;
+    if (!file.ReadAt(buf, GetGrainBytes(), pos))
+        return false;
+    return !cipher || cipher->Decrypt(buf, GetGrainBytes(), pos);
+}
+
+inline bool SparseVMDKReader::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > Size())
+        return false;
+
+    uint64_t grainBytes = GetGrainBytes();
+    while (len > 0) {
+        uint64_t grain = offset / grainBytes;
+        uint64_t inGrain = offset % grainBytes;
+        uint64_t chunk = grainBytes - inGrain < len ? grainBytes - inGrain : len;
+
+        if (GTEs[grain] == 0)
+            memset(buf, 0, chunk);
+        else if (cipher) {
+            // Расшифровываются целые сектора, в которые попадает участок
+            uint64_t begin = inGrain / XTS_UNIT * XTS_UNIT;
+            uint64_t end = (inGrain + chunk + XTS_UNIT - 1) / XTS_UNIT * XTS_UNIT;
+            uint64_t pos = (uint64_t)GTEs[grain] * SECTOR_SIZE + begin;
+            std::vector<unsigned char> units(end - begin);
+            if (!file.ReadAt(units.data(), units.size(), pos) || !cipher->Decrypt(units.data(), units.size(), pos))
+                return false;
+            memcpy(buf, units.data() + (inGrain - begin), chunk);
+        }
+        else if (!file.ReadAt(buf, chunk, (uint64_t)GTEs[grain] * SECTOR_SIZE + inGrain))
+            return false;
+
+        buf += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+inline bool SparseVMDKReader::Expand(const PathString& path, uint64_t batchBytes)
+{
+    const uint64_t grainBytes = GetGrainBytes();
+    const uint64_t diskBytes = Size();
+    uint64_t grainsPerBatch = batchBytes / grainBytes;
+    if (grainsPerBatch == 0)
+        grainsPerBatch = 1;
+    expandedBytes = 0;
+
+    BlockFile out;
+    if (!out.Open(path, BlockFileMode::Write)) {
+        std::cout << "Open file error" << std::endl;
+        return false;
+    }
+    // Файл просто удлиняется (весь состоит из дыры); диск усечь нельзя, дыры пробиваются явно
+    out.SetSparse();
+    const bool punch = !out.Truncate(diskBytes);
+    if (punch && out.Size() < diskBytes) {
+        std::cout << "Output is smaller than the image" << std::endl;
+        return false;
+    }
+
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    TaskGroup group(scheduler);
+    std::atomic<uint64_t> written(0);
+    std::atomic<bool> failed(false);
+
+    for (uint64_t first = 0; first < GTEs.size() && !failed; first += grainsPerBatch) {
+        uint64_t count = std::min<uint64_t>(grainsPerBatch, GTEs.size() - first);
+        bool allocated = std::any_of(GTEs.begin() + first, GTEs.begin() + first + count,
+                                     [](uint32_t gte) { return gte != 0; });
+        if (!allocated && !punch)
+            continue;   // Участок уже является дырой
+
+        group.WaitBelow(2 * scheduler.GetConcurrency());
+        group.Run([&, first, count] {
+            PooledBuffer buffer = BufferPool::Shared().Acquire(count * grainBytes);
+            std::vector<bool> data(count, false);
+            {
+                TaskScheduler::BlockingScope blocking;
+                for (uint64_t g = 0; g != count; g++) {
+                    if (GTEs[first + g] == 0)
+                        continue;
+                    unsigned char* grain = buffer.Data() + g * grainBytes;
+                    if (!ReadGrain(first + g, grain)) {
+                        std::cout << "READ error" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    data[g] = !(grain[0] == 0 && memcmp(grain, grain + 1, grainBytes - 1) == 0);
+                }
+            }
+
+            // Серии зерен с данными пишутся одним вызовом, серии без данных остаются дырами
+            TaskScheduler::BlockingScope blocking;
+            for (uint64_t g = 0; g != count;) {
+                uint64_t end = g;
+                while (end != count && data[end] == data[g])
+                    end++;
+                uint64_t pos = (first + g) * grainBytes;
+                uint64_t len = std::min(diskBytes, (first + end) * grainBytes) - pos;
+                if (data[g]) {
+                    if (!out.WriteAt(buffer.Data() + g * grainBytes, len, pos)) {
+                        std::cout << "Write data error" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    written += len;
+                }
+                else if (punch && !out.PunchHole(pos, len)) {
+                    std::cout << "Punch hole error" << std::endl;
+                    failed = true;
+                    return;
+                }
+                g = end;
+            }
+        });
+    }
+    group.Wait();
+
+    expandedBytes = written;
+    return !failed;
+}
+
+inline std::string SparseVMDKReader::DescriptorValue(const std::string& key) const
+{
+    size_t pos = 0;
+    while (pos < descriptor.size()) {
+        size_t eol = descriptor.find('\n', pos);
+        if (eol == std::string::npos)
+            eol = descriptor.size();
+        std::string line = descriptor.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        if (line.compare(0, key.size() + 1, key + "=") != 0)
+            continue;
+        std::string value = line.substr(key.size() + 1);
+        while (!value.empty() && (value.back() == '\r' || value.back() == '"'))
+            value.pop_back();
+        if (!value.empty() && value.front() == '"')
+            value.erase(0, 1);
+        return value;
+    }
+    return "";
+}
+
+#endif // VMDKSPARSEREADER_H_INCLUDED
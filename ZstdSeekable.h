@@ -0,0 +1,371 @@
+/**
+ * @file ZstdSeekable.h
+ * @brief Заголовочный файл для сжатых DD-образов в формате zstd seekable.
+ *
+ * Образ состоит из независимо сжатых кадров zstd одинакового несжатого размера
+ * и таблицы переходов в конце файла (skippable frame формата zstd seekable),
+ * поэтому его можно распаковать штатной утилитой zstd и читать с любого смещения.
+ * Требуется библиотека libzstd (-lzstd).
+ */
+
+#ifndef ZSTDSEEKABLE_H_INCLUDED
+#define ZSTDSEEKABLE_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <zstd.h>
+#include "BlockFile.h"
+#include "GrainHash.h"
+#include "TaskScheduler.h"
+#include "BufferPool.h"
+
+constexpr uint32_t ZSTD_SKIPPABLE_MAGIC = 0x184D2A5E;     ///< Магическое число skippable frame с таблицей переходов.
+constexpr uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;      ///< Магическое число в конце таблицы переходов.
+constexpr uint8_t ZSTD_SEEKABLE_CHECKSUM = 0x80;          ///< Флаг наличия контрольных сумм кадров.
+constexpr uint32_t ZSTD_SEEKABLE_FOOTER = 9;              ///< Размер окончания таблицы переходов.
+constexpr uint32_t ZSTD_SEEKABLE_ENTRY = 12;              ///< Размер записи таблицы (с контрольной суммой).
+constexpr uint64_t ZSTD_FRAME_BYTES = 4ull * 1024 * 1024; ///< Несжатый размер кадра по умолчанию.
+constexpr size_t ZSTD_CACHE_FRAMES = 8;                   ///< Распакованных кадров в кэше читателя по умолчанию.
+
+#pragma pack(push, 1)
+
+/**
+ * @struct SeekTableEntry
+ * @brief Запись таблицы переходов: один кадр.
+ */
+typedef struct
+{
+    uint32_t compressedSize;      ///< Размер сжатого кадра.
+    uint32_t decompressedSize;    ///< Размер данных кадра.
+    uint32_t checksum;            ///< Младшие 32 бита XXH64 данных кадра.
+} SeekTableEntry;
+
+#pragma pack(pop)
+
+/**
+ * @class SeekableZstdWriter
+ * @brief Параллельно сжимает источник в образ zstd seekable.
+ *
+ * Кадры сжимаются задачами общего планировщика, в работе одновременно находится
+ * не больше 2 * concurrency кадров. Готовые кадры записываются в файл строго по порядку.
+ */
+class SeekableZstdWriter
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param frameBytes Несжатый размер кадра (кратен сектору).
+     * @param compressionLevel Уровень сжатия zstd.
+     */
+    SeekableZstdWriter(uint64_t frameBytes = ZSTD_FRAME_BYTES, int compressionLevel = 3)
+        : frame(frameBytes), level(compressionLevel) {};
+
+    /**
+     * @brief Сжимает первые `bytes` байт источника в выходной файл.
+     *
+     * @param source Источник (диск или файл).
+     * @param bytes Количество байт для сжатия.
+     * @param out Открытый на запись выходной файл.
+     * @return false при ошибке чтения, сжатия или записи.
+     */
+    bool Write(BlockSource& source, uint64_t bytes, BlockFile& out);
+
+    /**
+     * @brief Возвращает размер сжатого образа после последней записи.
+     */
+    uint64_t GetCompressedBytes() const { return written; };
+
+private:
+    /**
+     * @brief Кадр в работе.
+     */
+    struct Slot
+    {
+        TaskGroup group;              ///< Задача сжатия кадра.
+        PooledBuffer data;            ///< Сжатые данные.
+        SeekTableEntry entry;         ///< Запись таблицы переходов.
+        bool ok = false;              ///< Признак успеха.
+    };
+
+    uint64_t frame;                   ///< Несжатый размер кадра.
+    int level;                        ///< Уровень сжатия.
+    uint64_t written = 0;             ///< Записано байт.
+
+    void Compress(BlockSource& source, uint64_t offset, uint64_t len, Slot& slot);
+};
+
+/**
+ * @class SeekableZstdReader
+ * @brief Чтение образа zstd seekable с произвольного смещения.
+ *
+ * Таблица переходов читается при открытии, при чтении распаковываются только
+ * нужные кадры. Несколько последних распакованных кадров хранятся в LRU-кэше;
+ * блокировка защищает только кэш, поэтому разные кадры читаются и распаковываются
+ * параллельно, а читатели готовых кадров не ждут чужой распаковки.
+ */
+class SeekableZstdReader : public BlockSource
+{
+public:
+    /**
+     * @brief Конструктор.
+     * @param cacheFrames Максимум распакованных кадров в кэше (не меньше 1).
+     */
+    explicit SeekableZstdReader(size_t cacheFrames = ZSTD_CACHE_FRAMES)
+        : capacity(cacheFrames == 0 ? 1 : cacheFrames) {};
+
+    /**
+     * @brief Открывает образ и читает таблицу переходов.
+     * @return false, если файл не открывается или не является образом zstd seekable.
+     */
+    bool Open(const PathString& path);
+
+    bool ReadAt(unsigned char* buf, uint64_t len, uint64_t offset) override;
+
+    uint64_t Size() override { return offsets.empty() ? 0 : offsets.back(); };
+
+    /**
+     * @brief Возвращает количество кадров.
+     */
+    size_t GetFrameCount() const { return entries.size(); };
+
+private:
+    BlockFile file;                          ///< Файл образа.
+    std::vector<SeekTableEntry> entries;     ///< Таблица переходов.
+    std::vector<uint64_t> offsets;           ///< Несжатые смещения начала кадров (+ общий размер).
+    std::vector<uint64_t> positions;         ///< Смещения кадров в файле.
+    bool checksums = false;                  ///< В таблице есть контрольные суммы.
+
+    typedef std::shared_ptr<const std::vector<unsigned char>> Frame;  ///< Распакованный кадр.
+
+    size_t capacity;                         ///< Максимум кадров в кэше.
+    std::mutex mtx;                          ///< Защищает lru и index.
+    std::list<std::pair<size_t, Frame>> lru; ///< Кадры, начиная с последнего использованного.
+    std::unordered_map<size_t, std::list<std::pair<size_t, Frame>>::iterator> index; ///< Номер кадра -> элемент lru.
+
+    /**
+     * @brief Возвращает распакованный кадр из кэша или читает и распаковывает его вне блокировки.
+     * @return nullptr при ошибке чтения, распаковки или контрольной суммы.
+     */
+    Frame GetFrame(size_t number);
+};
+
+inline void SeekableZstdWriter::Compress(BlockSource& source, uint64_t offset, uint64_t len, Slot& slot)
+{
+    slot.data = BufferPool::Shared().Acquire(ZSTD_compressBound(len));
+    if (slot.data.Data() == nullptr)
+        return;
+    // Отображенный источник сжимается прямо из памяти
+    PooledBuffer raw;
+    const unsigned char* in = nullptr;
+    {
+        TaskScheduler::BlockingScope blocking;
+        in = source.View(offset, len);
+        if (in == nullptr) {
+            raw = BufferPool::Shared().Acquire(len);
+            if (raw.Data() == nullptr)
+                return;
+            if (!source.ReadAt(raw.Data(), len, offset)) {
+                std::cout << "READ error" << std::endl;
+                return;
+            }
+            in = raw.Data();
+        }
+    }
+    size_t size = ZSTD_compress(slot.data.Data(), ZSTD_compressBound(len), in, len, level);
+    if (ZSTD_isError(size)) {
+        std::cout << "Compression error: " << ZSTD_getErrorName(size) << std::endl;
+        return;
+    }
+    slot.entry.compressedSize = static_cast<uint32_t>(size);
+    slot.entry.decompressedSize = static_cast<uint32_t>(len);
+    slot.entry.checksum = static_cast<uint32_t>(GrainHash64(in, len));
+    slot.ok = true;
+}
+
+inline bool SeekableZstdWriter::Write(BlockSource& source, uint64_t bytes, BlockFile& out)
+{
+    written = 0;
+    if (frame == 0 || frame > 0xFFFFFFFFull)
+        return false;
+
+    TaskScheduler& scheduler = TaskScheduler::Shared();
+    const uint64_t frames = (bytes + frame - 1) / frame;
+    const size_t depth = 2 * scheduler.GetConcurrency();
+    std::vector<std::unique_ptr<Slot>> ring;
+    for (size_t i = 0; i != depth; i++)
+        ring.emplace_back(new Slot());
+
+    auto start = [&](uint64_t index) {
+        Slot& slot = *ring[index % depth];
+        slot.ok = false;
+        uint64_t offset = index * frame;
+        uint64_t len = std::min(frame, bytes - offset);
+        slot.group.Run([this, &source, &slot, offset, len] { Compress(source, offset, len, slot); });
+    };
+
+    for (uint64_t i = 0; i != frames && i != depth; i++)
+        start(i);
+
+    std::vector<SeekTableEntry> table;
+    bool ok = true;
+    for (uint64_t i = 0; i != frames; i++) {
+        Slot& slot = *ring[i % depth];
+        slot.group.Wait();
+        if (!ok || !slot.ok) {
+            ok = false;
+            continue;   // Дожидаемся уже запущенных кадров
+        }
+        {
+            TaskScheduler::BlockingScope blocking;
+            if (!out.WriteAt(slot.data.Data(), slot.entry.compressedSize, written)) {
+                std::cout << "Write data error" << std::endl;
+                ok = false;
+                continue;
+            }
+        }
+        written += slot.entry.compressedSize;
+        table.push_back(slot.entry);
+        slot.data.Release();
+        if (i + depth < frames)
+            start(i + depth);
+    }
+    if (!ok)
+        return false;
+
+    // Таблица переходов: skippable frame с записями кадров и окончанием
+    const uint32_t count = static_cast<uint32_t>(table.size());
+    std::vector<unsigned char> seek(8 + count * ZSTD_SEEKABLE_ENTRY + ZSTD_SEEKABLE_FOOTER);
+    uint32_t frameSize = count * ZSTD_SEEKABLE_ENTRY + ZSTD_SEEKABLE_FOOTER;
+    memcpy(seek.data(), &ZSTD_SKIPPABLE_MAGIC, 4);
+    memcpy(seek.data() + 4, &frameSize, 4);
+    if (count != 0)
+        memcpy(seek.data() + 8, table.data(), count * ZSTD_SEEKABLE_ENTRY);
+    unsigned char* footer = seek.data() + 8 + count * ZSTD_SEEKABLE_ENTRY;
+    memcpy(footer, &count, 4);
+    footer[4] = ZSTD_SEEKABLE_CHECKSUM;
+    memcpy(footer + 5, &ZSTD_SEEKABLE_MAGIC, 4);
+    if (!out.WriteAt(seek.data(), seek.size(), written)) {
+        std::cout << "Write data error" << std::endl;
+        return false;
+    }
+    written += seek.size();
+    return true;
+}
+
+inline bool SeekableZstdReader::Open(const PathString& path)
+{
+    entries.clear();
+    offsets.clear();
+    positions.clear();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        lru.clear();
+        index.clear();
+    }
+    if (!file.Open(path, BlockFileMode::Read))
+        return false;
+
+    const uint64_t fileSize = file.Size();
+    unsigned char footer[ZSTD_SEEKABLE_FOOTER];
+    if (fileSize < 8 + ZSTD_SEEKABLE_FOOTER || !file.ReadAt(footer, ZSTD_SEEKABLE_FOOTER, fileSize - ZSTD_SEEKABLE_FOOTER))
+        return false;
+    uint32_t count, magic;
+    memcpy(&count, footer, 4);
+    memcpy(&magic, footer + 5, 4);
+    if (magic != ZSTD_SEEKABLE_MAGIC || (footer[4] & 0x7F) != 0)
+        return false;
+    checksums = (footer[4] & ZSTD_SEEKABLE_CHECKSUM) != 0;
+
+    const uint64_t entrySize = checksums ? 12 : 8;
+    const uint64_t tableSize = 8 + count * entrySize + ZSTD_SEEKABLE_FOOTER;
+    if (tableSize > fileSize)
+        return false;
+    std::vector<unsigned char> table(tableSize);
+    if (!file.ReadAt(table.data(), tableSize, fileSize - tableSize))
+        return false;
+    uint32_t skippable;
+    memcpy(&skippable, table.data(), 4);
+    if (skippable != ZSTD_SKIPPABLE_MAGIC)
+        return false;
+
+    uint64_t offset = 0;
+    uint64_t position = 0;
+    for (uint32_t i = 0; i != count; i++) {
+        SeekTableEntry e = {0, 0, 0};
+        memcpy(&e, table.data() + 8 + i * entrySize, entrySize);
+        entries.push_back(e);
+        offsets.push_back(offset);
+        positions.push_back(position);
+        offset += e.decompressedSize;
+        position += e.compressedSize;
+    }
+    offsets.push_back(offset);
+    return position + tableSize == fileSize;
+}
+
+inline SeekableZstdReader::Frame SeekableZstdReader::GetFrame(size_t number)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(number);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+    }
+
+    const SeekTableEntry& e = entries[number];
+    PooledBuffer compressed = BufferPool::Shared().Acquire(e.compressedSize);
+    if (compressed.Data() == nullptr || !file.ReadAt(compressed.Data(), e.compressedSize, positions[number]))
+        return nullptr;
+    auto data = std::make_shared<std::vector<unsigned char>>(e.decompressedSize);
+    size_t size = ZSTD_decompress(data->data(), data->size(), compressed.Data(), e.compressedSize);
+    if (ZSTD_isError(size) || size != e.decompressedSize)
+        return nullptr;
+    if (checksums && static_cast<uint32_t>(GrainHash64(data->data(), size)) != e.checksum)
+        return nullptr;
+
+    // Кадр мог распаковать и другой поток: в кэше остается одна копия
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(number);
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+    lru.emplace_front(number, data);
+    index[number] = lru.begin();
+    while (lru.size() > capacity) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+    return data;
+}
+
+inline bool SeekableZstdReader::ReadAt(unsigned char* buf, uint64_t len, uint64_t offset)
+{
+    if (offset + len > Size())
+        return false;
+
+    while (len != 0) {
+        size_t number = std::upper_bound(offsets.begin(), offsets.end(), offset) - offsets.begin() - 1;
+        Frame frame = GetFrame(number);
+        if (!frame)
+            return false;
+        uint64_t inFrame = offset - offsets[number];
+        uint64_t part = std::min(len, frame->size() - inFrame);
+        memcpy(buf, frame->data() + inFrame, part);
+        buf += part;
+        offset += part;
+        len -= part;
+    }
+    return true;
+}
+
+#endif // ZSTDSEEKABLE_H_INCLUDED